@@ -0,0 +1,584 @@
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+#include <functional>
+#include <mutex>
+#include <new>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#include <fmt/core.h>
+#include <nghttp2/nghttp2.h>
+#include <boost/algorithm/string.hpp>
+#include <catch2/catch.hpp>
+
+#include "klib/exception.h"
+#include "klib/http.h"
+
+namespace {
+
+// Allocations of the current thread, counted by the replaced operator new. The
+// bench is an executable of its own, so the others are not affected
+thread_local std::uint64_t allocations = 0;
+
+}  // namespace
+
+void *operator new(std::size_t size) {
+  ++allocations;
+
+  if (auto ptr = std::malloc(std::max<std::size_t>(size, 1))) {
+    return ptr;
+  }
+  throw std::bad_alloc();
+}
+
+// GCC reports free() on memory from operator new once these are inlined
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wmismatched-new-delete"
+void operator delete(void *ptr) noexcept { std::free(ptr); }
+
+void operator delete(void *ptr, std::size_t) noexcept { std::free(ptr); }
+#pragma GCC diagnostic pop
+
+namespace {
+
+constexpr std::size_t max_payload_size = 1024 * 1024;
+
+// The same payload is sent by every response, so the server allocates little
+const std::string payload(max_payload_size, 'x');
+
+struct Reply {
+  std::string_view body;
+  std::vector<std::pair<std::string, std::string>> headers;
+};
+
+// /bytes/<n>: n bytes of body
+// /post: the size of the request body
+// /headers/<n>: n extra response headers
+Reply route(std::string_view path, std::size_t body_size,
+            std::string &storage) {
+  Reply reply;
+
+  if (path.starts_with("/bytes/")) {
+    auto size =
+        std::stoull(std::string(path.substr(std::size("/bytes/") - 1)));
+    reply.body = std::string_view(payload).substr(0, size);
+  } else if (path.starts_with("/post")) {
+    storage = std::to_string(body_size);
+    reply.body = storage;
+  } else if (path.starts_with("/headers/")) {
+    auto count =
+        std::stoull(std::string(path.substr(std::size("/headers/") - 1)));
+    for (std::size_t i = 0; i < count; ++i) {
+      reply.headers.emplace_back(fmt::format("x-header-{}", i),
+                                 fmt::format("value-{}", i));
+    }
+  }
+
+  return reply;
+}
+
+void write_all(std::int32_t fd, const char *data, std::size_t size) {
+  while (size > 0) {
+    auto n = ::write(fd, data, size);
+    if (n <= 0) {
+      throw klib::RuntimeError("write error");
+    }
+
+    data += n;
+    size -= static_cast<std::size_t>(n);
+  }
+}
+
+// https://nghttp2.org/documentation/tutorial-server.html
+class Http2Session {
+ public:
+  explicit Http2Session(std::int32_t fd) : fd_(fd) {
+    nghttp2_session_callbacks *callbacks = nullptr;
+    nghttp2_session_callbacks_new(&callbacks);
+    nghttp2_session_callbacks_set_on_begin_headers_callback(callbacks,
+                                                            on_begin_headers);
+    nghttp2_session_callbacks_set_on_header_callback(callbacks, on_header);
+    nghttp2_session_callbacks_set_on_data_chunk_recv_callback(callbacks,
+                                                              on_data_chunk);
+    nghttp2_session_callbacks_set_on_frame_recv_callback(callbacks,
+                                                         on_frame_recv);
+    nghttp2_session_callbacks_set_on_stream_close_callback(callbacks,
+                                                           on_stream_close);
+
+    auto rc = nghttp2_session_server_new(&session_, callbacks, this);
+    nghttp2_session_callbacks_del(callbacks);
+    if (rc != 0) {
+      throw klib::RuntimeError(nghttp2_strerror(rc));
+    }
+
+    nghttp2_submit_settings(session_, NGHTTP2_FLAG_NONE, nullptr, 0);
+  }
+
+  Http2Session(const Http2Session &) = delete;
+  Http2Session(Http2Session &&) = delete;
+  Http2Session &operator=(const Http2Session &) = delete;
+  Http2Session &operator=(Http2Session &&) = delete;
+
+  ~Http2Session() { nghttp2_session_del(session_); }
+
+  // The connection preface has been read into buffer
+  void run(std::string_view buffer) {
+    std::vector<char> read_buffer(64 * 1024);
+
+    while (receive(buffer) && send()) {
+      auto n = ::read(fd_, std::data(read_buffer), std::size(read_buffer));
+      if (n <= 0) {
+        return;
+      }
+      buffer = std::string_view(std::data(read_buffer),
+                                static_cast<std::size_t>(n));
+    }
+  }
+
+ private:
+  struct Stream {
+    std::string path;
+    std::size_t body_size = 0;
+    std::string storage;
+    std::string_view body;
+  };
+
+  bool receive(std::string_view buffer) {
+    return nghttp2_session_mem_recv(
+               session_, reinterpret_cast<const std::uint8_t *>(buffer.data()),
+               std::size(buffer)) >= 0;
+  }
+
+  bool send() {
+    while (true) {
+      const std::uint8_t *data = nullptr;
+      auto n = nghttp2_session_mem_send(session_, &data);
+      if (n < 0) {
+        return false;
+      }
+      if (n == 0) {
+        return true;
+      }
+
+      write_all(fd_, reinterpret_cast<const char *>(data),
+                static_cast<std::size_t>(n));
+    }
+  }
+
+  void respond(std::int32_t stream_id) {
+    auto &stream = streams_[stream_id];
+    auto reply = route(stream.path, stream.body_size, stream.storage);
+    stream.body = reply.body;
+
+    auto content_length = std::to_string(std::size(reply.body));
+    reply.headers.emplace(std::begin(reply.headers), ":status", "200");
+    reply.headers.emplace_back("content-length", content_length);
+
+    std::vector<nghttp2_nv> nva;
+    for (auto &[name, value] : reply.headers) {
+      nva.push_back({reinterpret_cast<std::uint8_t *>(std::data(name)),
+                     reinterpret_cast<std::uint8_t *>(std::data(value)),
+                     std::size(name), std::size(value), NGHTTP2_NV_FLAG_NONE});
+    }
+
+    nghttp2_data_provider provider;
+    provider.source.ptr = &stream;
+    provider.read_callback = read_body;
+    nghttp2_submit_response(session_, stream_id, std::data(nva), std::size(nva),
+                            &provider);
+  }
+
+  static int on_begin_headers(nghttp2_session *, const nghttp2_frame *frame,
+                              void *user_data) {
+    if (frame->hd.type == NGHTTP2_HEADERS &&
+        frame->headers.cat == NGHTTP2_HCAT_REQUEST) {
+      static_cast<Http2Session *>(user_data)->streams_[frame->hd.stream_id];
+    }
+    return 0;
+  }
+
+  static int on_header(nghttp2_session *, const nghttp2_frame *frame,
+                       const std::uint8_t *name, std::size_t name_length,
+                       const std::uint8_t *value, std::size_t value_length,
+                       std::uint8_t, void *user_data) {
+    if (std::string_view(reinterpret_cast<const char *>(name), name_length) ==
+        ":path") {
+      static_cast<Http2Session *>(user_data)
+          ->streams_[frame->hd.stream_id]
+          .path.assign(reinterpret_cast<const char *>(value), value_length);
+    }
+    return 0;
+  }
+
+  static int on_data_chunk(nghttp2_session *, std::uint8_t,
+                           std::int32_t stream_id, const std::uint8_t *,
+                           std::size_t length, void *user_data) {
+    static_cast<Http2Session *>(user_data)->streams_[stream_id].body_size +=
+        length;
+    return 0;
+  }
+
+  static int on_frame_recv(nghttp2_session *, const nghttp2_frame *frame,
+                           void *user_data) {
+    if ((frame->hd.type == NGHTTP2_HEADERS ||
+         frame->hd.type == NGHTTP2_DATA) &&
+        (frame->hd.flags & NGHTTP2_FLAG_END_STREAM)) {
+      static_cast<Http2Session *>(user_data)->respond(frame->hd.stream_id);
+    }
+    return 0;
+  }
+
+  static int on_stream_close(nghttp2_session *, std::int32_t stream_id,
+                             std::uint32_t, void *user_data) {
+    static_cast<Http2Session *>(user_data)->streams_.erase(stream_id);
+    return 0;
+  }
+
+  static ssize_t read_body(nghttp2_session *, std::int32_t, std::uint8_t *buf,
+                           std::size_t length, std::uint32_t *data_flags,
+                           nghttp2_data_source *source, void *) {
+    auto stream = static_cast<Stream *>(source->ptr);
+
+    auto size = std::min(length, std::size(stream->body));
+    std::copy_n(std::data(stream->body), size, buf);
+    stream->body.remove_prefix(size);
+
+    if (std::empty(stream->body)) {
+      *data_flags |= NGHTTP2_DATA_FLAG_EOF;
+    }
+    return static_cast<ssize_t>(size);
+  }
+
+  std::int32_t fd_;
+  nghttp2_session *session_ = nullptr;
+  std::unordered_map<std::int32_t, Stream> streams_;
+};
+
+// Serves HTTP/1.1 with keep-alive, and h2c with prior knowledge
+class LocalServer {
+ public:
+  LocalServer() {
+    listen_fd_ = ::socket(AF_INET, SOCK_STREAM, 0);
+    if (listen_fd_ == -1) {
+      throw klib::RuntimeError("socket error");
+    }
+
+    sockaddr_in address = {};
+    address.sin_family = AF_INET;
+    address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    address.sin_port = 0;
+    socklen_t length = sizeof(address);
+
+    if (::bind(listen_fd_, reinterpret_cast<sockaddr *>(&address), length) ==
+            -1 ||
+        ::listen(listen_fd_, SOMAXCONN) == -1 ||
+        ::getsockname(listen_fd_, reinterpret_cast<sockaddr *>(&address),
+                      &length) == -1) {
+      ::close(listen_fd_);
+      throw klib::RuntimeError("Unable to listen on the loopback address");
+    }
+    port_ = ntohs(address.sin_port);
+
+    accept_thread_ = std::thread([this] { accept_loop(); });
+  }
+
+  LocalServer(const LocalServer &) = delete;
+  LocalServer(LocalServer &&) = delete;
+  LocalServer &operator=(const LocalServer &) = delete;
+  LocalServer &operator=(LocalServer &&) = delete;
+
+  ~LocalServer() {
+    ::shutdown(listen_fd_, SHUT_RDWR);
+    accept_thread_.join();
+    ::close(listen_fd_);
+
+    std::lock_guard<std::mutex> lock(mutex_);
+    for (auto fd : connections_) {
+      ::shutdown(fd, SHUT_RDWR);
+    }
+    for (auto &thread : threads_) {
+      thread.join();
+    }
+  }
+
+  [[nodiscard]] std::string url() const {
+    return fmt::format("http://127.0.0.1:{}", port_);
+  }
+
+ private:
+  void accept_loop() {
+    while (true) {
+      auto fd = ::accept(listen_fd_, nullptr, nullptr);
+      if (fd == -1) {
+        return;
+      }
+
+      std::int32_t flag = 1;
+      ::setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &flag, sizeof(flag));
+
+      std::lock_guard<std::mutex> lock(mutex_);
+      connections_.push_back(fd);
+      threads_.emplace_back([fd] {
+        try {
+          serve(fd);
+        } catch (const std::exception &) {
+        }
+        ::close(fd);
+      });
+    }
+  }
+
+  static void serve(std::int32_t fd) {
+    constexpr std::string_view preface = "PRI * HTTP/2.0\r\n\r\nSM\r\n\r\n";
+
+    std::string buffer;
+    std::vector<char> read_buffer(64 * 1024);
+    auto fill = [&] {
+      auto n = ::read(fd, std::data(read_buffer), std::size(read_buffer));
+      if (n <= 0) {
+        return false;
+      }
+      buffer.append(std::data(read_buffer), static_cast<std::size_t>(n));
+      return true;
+    };
+
+    while (std::size(buffer) < std::size(preface) &&
+           preface.starts_with(buffer)) {
+      if (!fill()) {
+        return;
+      }
+    }
+    if (buffer.starts_with(preface)) {
+      Http2Session(fd).run(buffer);
+      return;
+    }
+
+    std::string storage;
+    std::string response;
+    while (true) {
+      std::size_t end;
+      while ((end = buffer.find("\r\n\r\n")) == std::string::npos) {
+        if (!fill()) {
+          return;
+        }
+      }
+
+      auto head = std::string_view(buffer).substr(0, end);
+      auto path = head.substr(head.find(' ') + 1);
+      path = path.substr(0, path.find(' '));
+
+      std::size_t content_length = 0;
+      bool expect_continue = false;
+      for (auto line_end = head.find("\r\n"); line_end != std::string::npos;) {
+        auto next = head.find("\r\n", line_end + 2);
+        auto line = head.substr(line_end + 2, next == std::string::npos
+                                                  ? std::string::npos
+                                                  : next - line_end - 2);
+        if (boost::istarts_with(line, "content-length:")) {
+          content_length = std::stoull(
+              std::string(line.substr(std::size("content-length:") - 1)));
+        } else if (boost::istarts_with(line, "expect: 100-continue")) {
+          expect_continue = true;
+        }
+        line_end = next;
+      }
+
+      auto reply = route(path, content_length, storage);
+      response = fmt::format(
+          "HTTP/1.1 200 OK\r\nContent-Length: {}\r\n"
+          "Content-Type: application/octet-stream\r\n",
+          std::size(reply.body));
+      for (const auto &[name, value] : reply.headers) {
+        response.append(name).append(": ").append(value).append("\r\n");
+      }
+      response.append("\r\n");
+
+      if (expect_continue) {
+        constexpr std::string_view status = "HTTP/1.1 100 Continue\r\n\r\n";
+        write_all(fd, std::data(status), std::size(status));
+      }
+
+      buffer.erase(0, end + 4);
+      while (std::size(buffer) < content_length) {
+        if (!fill()) {
+          return;
+        }
+      }
+      buffer.erase(0, content_length);
+
+      write_all(fd, std::data(response), std::size(response));
+      write_all(fd, std::data(reply.body), std::size(reply.body));
+    }
+  }
+
+  std::int32_t listen_fd_ = -1;
+  std::uint16_t port_ = 0;
+  std::thread accept_thread_;
+
+  std::mutex mutex_;
+  std::vector<std::int32_t> connections_;
+  std::vector<std::thread> threads_;
+};
+
+// Prints requests per second, latency percentiles and allocations per request
+// of the calling thread, which complements the mean reported by Catch2
+void report(const std::string &name, std::int32_t iterations,
+            const std::function<void()> &func) {
+  // Opens the connection
+  func();
+
+  std::vector<double> latencies;
+  latencies.reserve(static_cast<std::size_t>(iterations));
+
+  auto old_allocations = allocations;
+  auto start = std::chrono::steady_clock::now();
+  for (std::int32_t i = 0; i < iterations; ++i) {
+    auto begin = std::chrono::steady_clock::now();
+    func();
+    latencies.push_back(std::chrono::duration<double, std::micro>(
+                            std::chrono::steady_clock::now() - begin)
+                            .count());
+  }
+  std::chrono::duration<double> elapsed =
+      std::chrono::steady_clock::now() - start;
+  auto allocations_per_request =
+      static_cast<double>(allocations - old_allocations) / iterations;
+
+  std::sort(std::begin(latencies), std::end(latencies));
+  auto percentile = [&](std::size_t p) {
+    return latencies[(std::size(latencies) - 1) * p / 100];
+  };
+
+  fmt::print("{:<36}{:>10.0f}{:>10.1f}{:>10.1f}{:>10.1f}{:>10.1f}\n", name,
+             iterations / elapsed.count(), percentile(50), percentile(90),
+             percentile(99), allocations_per_request);
+}
+
+void print_title() {
+  fmt::print("{:<36}{:>10}{:>10}{:>10}{:>10}{:>10}\n", "name", "req/s",
+             "p50(us)", "p90(us)", "p99(us)", "allocs");
+}
+
+std::string size_name(std::size_t size) {
+  if (size >= 1024 * 1024) {
+    return fmt::format("{}MiB", size / (1024 * 1024));
+  } else if (size >= 1024) {
+    return fmt::format("{}KiB", size / 1024);
+  } else {
+    return fmt::format("{}B", size);
+  }
+}
+
+// libcurl 7.88 fails on the second request over an h2c connection
+bool reusable(klib::Request &request, const std::string &url) {
+  try {
+    static_cast<void>(request.get(url));
+    static_cast<void>(request.get(url));
+    return true;
+  } catch (const klib::RuntimeError &) {
+    return false;
+  }
+}
+
+const std::vector<std::size_t> payload_sizes = {0, 1024, 64 * 1024,
+                                                max_payload_size};
+
+const std::vector<std::pair<std::string, klib::Request::HttpVersion>>
+    http_versions = {{"http/1.1", klib::Request::HttpVersion::Http1_1},
+                     {"h2c", klib::Request::HttpVersion::Http2PriorKnowledge}};
+
+std::int32_t iterations_of(std::size_t size) {
+  return size >= max_payload_size ? 100 : 1000;
+}
+
+}  // namespace
+
+TEST_CASE("http get") {
+  LocalServer server;
+  print_title();
+
+  for (const auto &[version_name, version] : http_versions) {
+    klib::Request request;
+    request.set_http_version(version);
+    if (!reusable(request, server.url() + "/bytes/0")) {
+      WARN(version_name << " connections can not be reused, skipped");
+      continue;
+    }
+
+    for (auto size : payload_sizes) {
+      auto url = server.url() + "/bytes/" + std::to_string(size);
+      REQUIRE(std::size(request.get(url).text()) == size);
+
+      auto name = fmt::format("get {} {}", version_name, size_name(size));
+      BENCHMARK(name.c_str()) { return request.get(url); };
+      report(name, iterations_of(size), [&] { request.get(url); });
+
+      name = fmt::format("get multi {} {}", version_name, size_name(size));
+      BENCHMARK(name.c_str()) { return request.get(url, {}, {}, true); };
+      report(name, iterations_of(size),
+             [&] { request.get(url, {}, {}, true); });
+    }
+  }
+}
+
+TEST_CASE("http post") {
+  LocalServer server;
+  print_title();
+
+  for (const auto &[version_name, version] : http_versions) {
+    klib::Request request;
+    request.set_http_version(version);
+    if (!reusable(request, server.url() + "/bytes/0")) {
+      WARN(version_name << " connections can not be reused, skipped");
+      continue;
+    }
+
+    auto url = server.url() + "/post";
+
+    for (auto size : payload_sizes) {
+      auto data = payload.substr(0, size);
+      REQUIRE(request.post(url, data).text() == std::to_string(size));
+
+      auto name = fmt::format("post {} {}", version_name, size_name(size));
+      BENCHMARK(name.c_str()) { return request.post(url, data); };
+      report(name, iterations_of(size), [&] { request.post(url, data); });
+    }
+  }
+}
+
+TEST_CASE("http headers") {
+  LocalServer server;
+  print_title();
+
+  klib::Request request;
+
+  for (std::size_t count : {8, 32, 128}) {
+    const auto response =
+        request.get(server.url() + "/headers/" + std::to_string(count));
+    auto parsed = response;
+    REQUIRE(parsed.headers_map().contains("x-header-0"));
+
+    // The parsed headers are cached by Response, so a fresh copy is parsed
+    auto name = fmt::format("parse {} headers", count);
+    BENCHMARK(name.c_str()) {
+      auto copy = response;
+      return copy.headers_map().empty();
+    };
+    report(name, 10000, [&] {
+      auto copy = response;
+      static_cast<void>(copy.headers_map());
+    });
+  }
+}
@@ -0,0 +1,477 @@
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <filesystem>
+#include <fstream>
+#include <memory>
+#include <random>
+#include <span>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include <catch2/catch.hpp>
+#include <openssl/evp.h>
+
+#include "klib/util.h"
+
+namespace {
+
+std::string random_bytes(std::size_t size) {
+  std::string data(size, '\0');
+
+  std::mt19937_64 engine(42);
+  std::uniform_int_distribution<std::uint32_t> distribution(0, 255);
+  for (auto &c : data) {
+    c = static_cast<char>(distribution(engine));
+  }
+
+  return data;
+}
+
+}  // namespace
+
+TEST_CASE("sha_256_file") {
+  const std::string path = "sha-256-bench.bin";
+  klib::write_file(path, true, random_bytes(256 * 1024 * 1024));
+
+  auto expect = klib::sha_256(klib::read_file(path, true));
+  REQUIRE(klib::sha_256_file(path) == expect);
+
+  BENCHMARK_ADVANCED("sha256sum 256MiB")(Catch::Benchmark::Chronometer meter) {
+    meter.measure([&] {
+      klib::execute_command("sha256sum " + path + " > /dev/null");
+    });
+  };
+
+  BENCHMARK("klib sha_256_file 256MiB") { return klib::sha_256_file(path); };
+
+  BENCHMARK("klib read_file + sha_256 256MiB") {
+    return klib::sha_256(klib::read_file(path, true));
+  };
+
+  std::filesystem::remove(path);
+}
+
+TEST_CASE("fast hash file") {
+  const std::string path = "fast-hash-bench.bin";
+  klib::write_file(path, true, random_bytes(256 * 1024 * 1024));
+
+  BENCHMARK("klib sha_256_file 256MiB") { return klib::sha_256_file(path); };
+
+  BENCHMARK("klib xxh3_64_file 256MiB") { return klib::xxh3_64_file(path); };
+
+  BENCHMARK("klib xxh3_128_file 256MiB") {
+    return klib::xxh3_128_file(path);
+  };
+
+  BENCHMARK("klib blake3_file 256MiB") { return klib::blake3_file(path); };
+
+  BENCHMARK("klib blake3_file 256MiB, all threads") {
+    return klib::blake3_file(path, 0);
+  };
+
+  std::filesystem::remove(path);
+}
+
+TEST_CASE("sha_256_batch") {
+  std::vector<std::string> ids;
+  for (std::size_t i = 0; i < 100000; ++i) {
+    ids.push_back("user-" + std::to_string(i * 7919));
+  }
+  std::vector<std::string_view> inputs(std::begin(ids), std::end(ids));
+  std::vector<klib::Sha256Hasher::Digest> digests(std::size(inputs));
+
+  BENCHMARK("klib sha_256 100000 ids") {
+    std::size_t sum = 0;
+    for (const auto &id : ids) {
+      sum += std::size(klib::sha_256(id));
+    }
+    return sum;
+  };
+
+  BENCHMARK("klib sha_256_batch 100000 ids") {
+    klib::sha_256_batch(inputs, digests);
+    return digests.front();
+  };
+}
+
+TEST_CASE("hex_encode") {
+  auto data = random_bytes(1024 * 1024);
+  std::span<const std::uint8_t> bytes(
+      reinterpret_cast<const std::uint8_t *>(std::data(data)), std::size(data));
+  auto hex = klib::hex_encode(bytes);
+
+  klib::Sha256Hasher::Digest digest;
+  std::copy_n(std::begin(bytes), std::size(digest), std::begin(digest));
+
+  BENCHMARK("klib hex_encode SHA-256 digest") {
+    return klib::hex_encode(digest);
+  };
+
+  BENCHMARK("klib hex_encode 1MiB") { return klib::hex_encode(bytes); };
+
+  BENCHMARK("klib hex_decode 2MiB") { return klib::hex_decode(hex); };
+}
+
+TEST_CASE("base64") {
+  auto data = random_bytes(8 * 1024 * 1024);
+  auto encoded = klib::base64_encode(data);
+  REQUIRE(klib::base64_decode(encoded) == data);
+
+  std::string output(klib::base64_encoded_size(std::size(data)), '\0');
+
+  BENCHMARK("klib base64_encode 8MiB") { return klib::base64_encode(data); };
+
+  BENCHMARK("klib base64_encode 8MiB, caller buffer") {
+    return klib::base64_encode(data, output);
+  };
+
+  BENCHMARK("klib base64_decode 8MiB") {
+    return klib::base64_decode(encoded);
+  };
+
+  BENCHMARK("klib base64_decode 8MiB, caller buffer") {
+    return klib::base64_decode(encoded, output);
+  };
+}
+
+TEST_CASE("cipher") {
+  // 256 MiB per run, so 1 GB/s on one core takes about 268 ms
+  auto data = random_bytes(256 * 1024 * 1024);
+  auto key = klib::sha_256_raw("key");
+  std::vector<std::uint8_t> cbc_iv(16, 0);
+  std::vector<std::uint8_t> aead_iv(12, 0);
+
+  auto cbc = klib::aes_256_cbc_encrypt(data, key, cbc_iv);
+  auto gcm = klib::aes_256_gcm_encrypt(data, key, aead_iv);
+  auto chacha = klib::chacha20_poly1305_encrypt(data, key, aead_iv);
+
+  BENCHMARK("klib aes_256_cbc_encrypt 256MiB") {
+    return klib::aes_256_cbc_encrypt(data, key, cbc_iv);
+  };
+
+  BENCHMARK("klib aes_256_cbc_decrypt 256MiB") {
+    return klib::aes_256_cbc_decrypt(cbc, key, cbc_iv);
+  };
+
+  BENCHMARK("klib aes_256_gcm_encrypt 256MiB") {
+    return klib::aes_256_gcm_encrypt(data, key, aead_iv);
+  };
+
+  BENCHMARK("klib aes_256_gcm_decrypt 256MiB") {
+    return klib::aes_256_gcm_decrypt(gcm, key, aead_iv);
+  };
+
+  BENCHMARK("klib chacha20_poly1305_encrypt 256MiB") {
+    return klib::chacha20_poly1305_encrypt(data, key, aead_iv);
+  };
+
+  BENCHMARK("klib chacha20_poly1305_decrypt 256MiB") {
+    return klib::chacha20_poly1305_decrypt(chacha, key, aead_iv);
+  };
+}
+
+TEST_CASE("encrypt_file_chunked") {
+  const std::string path = "chunked-bench.bin";
+  const std::string encrypted = "chunked-bench.enc";
+  const std::string decrypted = "chunked-bench.dec";
+  klib::write_file(path, true, random_bytes(256 * 1024 * 1024));
+  auto key = klib::sha_256_raw("key");
+
+  BENCHMARK("klib encrypt_file_chunked 256MiB, 1 thread") {
+    klib::encrypt_file_chunked(path, encrypted, key,
+                               klib::CipherAlgorithm::Aes256Gcm, 1024 * 1024,
+                               1);
+  };
+
+  BENCHMARK("klib encrypt_file_chunked 256MiB, all threads") {
+    klib::encrypt_file_chunked(path, encrypted, key);
+  };
+
+  BENCHMARK("klib decrypt_file_chunked 256MiB, all threads") {
+    klib::decrypt_file_chunked(encrypted, decrypted, key);
+  };
+
+  for (const auto &item : {path, encrypted, decrypted}) {
+    std::filesystem::remove(item);
+  }
+}
+
+TEST_CASE("small input") {
+  const std::string data(64, 'a');
+  auto key = klib::sha_256_raw("key");
+  std::vector<std::uint8_t> iv(16, 0);
+
+  // What every call used to do: allocate a context and look the algorithm
+  // up again
+  BENCHMARK("OpenSSL new context + SHA-256 64B") {
+    std::unique_ptr<EVP_MD_CTX, decltype(&EVP_MD_CTX_free)> context(
+        EVP_MD_CTX_new(), EVP_MD_CTX_free);
+    std::uint8_t digest[EVP_MAX_MD_SIZE];
+    std::uint32_t size = 0;
+    EVP_DigestInit(context.get(), EVP_sha256());
+    EVP_DigestUpdate(context.get(), std::data(data), std::size(data));
+    EVP_DigestFinal(context.get(), digest, &size);
+    return digest[0];
+  };
+
+  BENCHMARK("klib sha_256_raw 64B") { return klib::sha_256_raw(data); };
+
+  BENCHMARK("klib md5_raw 64B") { return klib::md5_raw(data); };
+
+  BENCHMARK("klib sha3_512_raw 64B") { return klib::sha3_512_raw(data); };
+
+  BENCHMARK("OpenSSL new context + AES-256-CBC 64B") {
+    std::unique_ptr<EVP_CIPHER_CTX, decltype(&EVP_CIPHER_CTX_free)> context(
+        EVP_CIPHER_CTX_new(), EVP_CIPHER_CTX_free);
+    std::uint8_t output[64 + 16];
+    std::int32_t size = 0;
+    EVP_EncryptInit_ex(context.get(), EVP_aes_256_cbc(), nullptr,
+                       std::data(key), std::data(iv));
+    EVP_EncryptUpdate(context.get(), output, &size,
+                      reinterpret_cast<const std::uint8_t *>(std::data(data)),
+                      std::size(data));
+    EVP_EncryptFinal_ex(context.get(), output + size, &size);
+    return output[0];
+  };
+
+  BENCHMARK("klib aes_256_cbc_encrypt 64B") {
+    return klib::aes_256_cbc_encrypt(data, key, iv);
+  };
+
+  auto encrypted = klib::aes_256_cbc_encrypt(data, key, iv);
+  BENCHMARK("klib aes_256_cbc_decrypt 64B") {
+    return klib::aes_256_cbc_decrypt(encrypted, key, iv);
+  };
+}
+
+TEST_CASE("utf8") {
+  std::string ascii;
+  std::string chinese;
+  while (std::size(ascii) < 64 * 1024 * 1024) {
+    ascii += "The quick brown fox jumps over the lazy dog. ";
+    chinese += "敏捷的棕色狐狸跳过了那只懒狗。";
+  }
+
+  BENCHMARK("klib is_valid_utf8 64MiB ASCII") {
+    return klib::is_valid_utf8(ascii);
+  };
+
+  BENCHMARK("klib is_valid_utf8 64MiB Chinese") {
+    return klib::is_valid_utf8(chinese);
+  };
+
+  BENCHMARK("klib utf8_to_utf16 64MiB ASCII") {
+    return klib::utf8_to_utf16(ascii);
+  };
+
+  BENCHMARK("klib utf8_to_utf16 64MiB Chinese") {
+    return klib::utf8_to_utf16(chinese);
+  };
+
+  BENCHMARK("klib utf8_to_utf32 64MiB ASCII") {
+    return klib::utf8_to_utf32(ascii);
+  };
+
+  BENCHMARK("klib utf8_to_utf32 64MiB Chinese") {
+    return klib::utf8_to_utf32(chinese);
+  };
+}
+
+TEST_CASE("utf8 encoding") {
+  std::u32string ascii;
+  std::u32string chinese;
+  while (std::size(ascii) < 16 * 1024 * 1024) {
+    ascii += U"The quick brown fox jumps over the lazy dog. ";
+    chinese += U"敏捷的棕色狐狸跳过了那只懒狗。";
+  }
+  std::u16string ascii_16(std::begin(ascii), std::end(ascii));
+  std::u16string chinese_16(std::begin(chinese), std::end(chinese));
+  std::string output(klib::utf32_to_utf8_size(chinese), '\0');
+
+  BENCHMARK("klib utf32_to_utf8 16Mi ASCII") {
+    return klib::utf32_to_utf8(ascii);
+  };
+
+  BENCHMARK("klib utf32_to_utf8 16Mi Chinese") {
+    return klib::utf32_to_utf8(chinese);
+  };
+
+  BENCHMARK("klib utf32_to_utf8 16Mi Chinese, caller buffer") {
+    return klib::utf32_to_utf8(chinese, output);
+  };
+
+  BENCHMARK("klib utf16_to_utf8 16Mi ASCII") {
+    return klib::utf16_to_utf8(ascii_16);
+  };
+
+  BENCHMARK("klib utf16_to_utf8 16Mi Chinese") {
+    return klib::utf16_to_utf8(chinese_16);
+  };
+}
+
+TEST_CASE("text classification") {
+  std::string ascii;
+  std::string mixed;
+  while (std::size(ascii) < 64 * 1024 * 1024) {
+    ascii += "The quick brown fox jumps over the lazy dog. ";
+    mixed += "The quick brown fox 敏捷的棕色狐狸跳过了那只懒狗。";
+  }
+
+  BENCHMARK("klib is_ascii 64MiB") { return klib::is_ascii(ascii); };
+
+  BENCHMARK("klib count_chinese 64MiB") {
+    return klib::count_chinese(mixed);
+  };
+
+  BENCHMARK("klib find_chinese 64MiB ASCII") {
+    return klib::find_chinese(ascii);
+  };
+
+  BENCHMARK("klib chinese_spans 64MiB") {
+    return klib::chinese_spans(mixed);
+  };
+
+  BENCHMARK("klib utf8_to_utf32 + is_chinese 64MiB") {
+    std::size_t count = 0;
+    for (auto c : klib::utf8_to_utf32(mixed)) {
+      count += klib::is_chinese(c);
+    }
+    return count;
+  };
+}
+
+TEST_CASE("script_of") {
+  std::u32string text;
+  while (std::size(text) < 16 * 1024 * 1024) {
+    text += U"The quick brown fox 敏捷的棕色狐狸 быстрая лиса 빠른 여우 素早い狐";
+  }
+
+  BENCHMARK("klib is_chinese 16Mi") {
+    std::size_t count = 0;
+    for (auto c : text) {
+      count += klib::is_chinese(c);
+    }
+    return count;
+  };
+
+  BENCHMARK("klib script_of 16Mi") {
+    std::size_t count = 0;
+    for (auto c : text) {
+      count += static_cast<std::size_t>(klib::script_of(c));
+    }
+    return count;
+  };
+
+  BENCHMARK("klib is_script<Han, Hiragana, Katakana> 16Mi") {
+    std::size_t count = 0;
+    for (auto c : text) {
+      count += klib::is_script<klib::Script::Han, klib::Script::Hiragana,
+                               klib::Script::Katakana>(c);
+    }
+    return count;
+  };
+}
+
+TEST_CASE("MappedFile") {
+  const std::string path = "mapped-file-bench.bin";
+  klib::write_file(path, true, random_bytes(256 * 1024 * 1024));
+
+  BENCHMARK("klib read_file 256MiB") {
+    return klib::read_file(path, true);
+  };
+
+  BENCHMARK("klib MappedFile 256MiB") {
+    klib::MappedFile file(path);
+    return file.size();
+  };
+
+  BENCHMARK("klib read_file + count lines 256MiB") {
+    auto data = klib::read_file(path, true);
+    return std::count(std::begin(data), std::end(data), '\n');
+  };
+
+  BENCHMARK("klib MappedFile + count lines 256MiB") {
+    klib::MappedFile file(path, klib::MappedFileAdvice::Sequential);
+    auto view = file.view();
+    return std::count(std::begin(view), std::end(view), '\n');
+  };
+
+  std::filesystem::remove(path);
+}
+
+TEST_CASE("FileLines") {
+  const std::string path = "file-lines-bench.txt";
+  std::string text;
+  for (std::size_t i = 0; i < 4 * 1024 * 1024; ++i) {
+    text += "line ";
+    text += std::to_string(i);
+    text += " of a text file with lines of some length\n";
+  }
+  klib::write_file(path, true, text);
+
+  BENCHMARK("klib read_file_line") {
+    return std::size(klib::read_file_line(path));
+  };
+
+  BENCHMARK("klib FileLines") {
+    std::size_t count = 0;
+    for (auto line : klib::FileLines(path)) {
+      count += !std::empty(line);
+    }
+    return count;
+  };
+
+  BENCHMARK("std::getline") {
+    std::ifstream ifs(path);
+    std::size_t count = 0;
+    for (std::string line; std::getline(ifs, line);) {
+      count += !std::empty(line);
+    }
+    return count;
+  };
+
+  std::filesystem::remove(path);
+}
+
+TEST_CASE("split") {
+  std::string csv;
+  for (std::size_t i = 0; i < 100000; ++i) {
+    csv += "field ";
+    csv += std::to_string(i);
+    csv += i % 8 == 7 ? "\n" : ", ";
+  }
+
+  BENCHMARK("klib split_str") {
+    return std::size(klib::split_str(csv, ",\n"));
+  };
+
+  BENCHMARK("klib split any of") {
+    std::size_t count = 0;
+    for (auto token : klib::split(csv, ",\n")) {
+      count += std::size(token);
+    }
+    return count;
+  };
+
+  BENCHMARK("klib split any of, trim and skip empty") {
+    std::size_t count = 0;
+    for (auto token :
+         klib::split<klib::SplitOptions{.trim = true, .skip_empty = true}>(
+             csv, ",\n")) {
+      count += std::size(token);
+    }
+    return count;
+  };
+
+  BENCHMARK("klib split string") {
+    std::size_t count = 0;
+    for (auto token :
+         klib::split<klib::SplitOptions{
+             .separator = klib::SplitSeparator::String}>(csv, ", ")) {
+      count += std::size(token);
+    }
+    return count;
+  };
+}
@@ -19,6 +19,7 @@ if(KLIB_FORMAT)
     "${CMAKE_CURRENT_SOURCE_DIR}/example/*.cpp"
     "${CMAKE_CURRENT_SOURCE_DIR}/include/*.h"
     "${CMAKE_CURRENT_SOURCE_DIR}/src/*.cpp"
+    "${CMAKE_CURRENT_SOURCE_DIR}/src/*.h"
     "${CMAKE_CURRENT_SOURCE_DIR}/test/*.cpp")
 
   file(
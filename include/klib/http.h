@@ -5,23 +5,124 @@
 
 #pragma once
 
+#include <chrono>
+#include <cstddef>
 #include <cstdint>
 #include <experimental/propagate_const>
+#include <functional>
 #include <memory>
+#include <span>
 #include <string>
 #include <unordered_map>
+#include <vector>
 
 namespace klib {
 
 class Response;
+class CookieJar;
+class HttpCache;
+class RateLimiter;
+
+/**
+ * @brief Policy for retrying transient failures(connection errors, timeouts and
+ * status codes such as 503)
+ */
+struct RetryPolicy {
+  /// Maximum number of retries, 0 disables retry
+  std::int32_t max_retries = 0;
+  /// Backoff before the first retry
+  std::chrono::milliseconds initial_backoff{100};
+  /// Upper bound of the backoff, and of the honored Retry-After
+  std::chrono::milliseconds max_backoff{10000};
+  /// Backoff growth factor per retry, a random jitter is applied on top of it
+  double multiplier = 2.0;
+  /// Whether POST and PATCH requests are retried as well
+  bool retry_non_idempotent = false;
+  /// Whether to wait at least as long as the Retry-After header asks
+  bool respect_retry_after = true;
+  /// Status codes that are considered transient
+  std::vector<std::int64_t> retry_status_codes = {408, 429, 500,
+                                                  502, 503, 504};
+};
+
+/**
+ * @brief Policy for hedged requests: if no response arrives within the delay, a
+ * duplicate request is sent and the first response wins
+ */
+struct HedgePolicy {
+  /// Maximum number of hedged requests per call, 0 disables hedging
+  std::int32_t max_hedges = 0;
+  /// Delay before a hedged request is sent, 0 means the p95 of recent latencies
+  std::chrono::milliseconds delay{0};
+  /// Minimum number of latency samples before the p95 is used
+  std::size_t min_samples = 20;
+};
+
+/**
+ * @brief Counters of a Request, used to measure retries and hedged requests
+ */
+struct RequestStats {
+  /// Number of calls such as get() and post()
+  std::uint64_t requests = 0;
+  /// Number of transfers, including retries and hedged requests
+  std::uint64_t transfers = 0;
+  /// Number of retries
+  std::uint64_t retries = 0;
+  /// Number of hedged requests sent
+  std::uint64_t hedges = 0;
+  /// Number of hedged requests that returned first
+  std::uint64_t hedge_wins = 0;
+  /// The p95 of recent successful calls
+  std::chrono::microseconds latency_p95{0};
+};
+
+/**
+ * @brief Metrics of a RateLimiter
+ */
+struct RateLimiterStats {
+  /// Number of transfers allowed to start
+  std::uint64_t acquired = 0;
+  /// Number of transfers waiting now
+  std::size_t queue_depth = 0;
+  /// Maximum number of transfers waiting at the same time
+  std::size_t max_queue_depth = 0;
+  /// Total time transfers spent waiting
+  std::chrono::microseconds total_wait{0};
+  /// Longest time a transfer spent waiting
+  std::chrono::microseconds max_wait{0};
+};
 
 /**
  * @brief Constructs and sends a Request
  */
 class Request {
   friend class Response;
+  friend class CookieJar;
+  friend class HttpCache;
+  friend class RateLimiter;
 
  public:
+  /**
+   * @brief Callback used to supply the request body
+   * @param buffer: Buffer to be filled
+   * @param size: Buffer size
+   * @return Number of bytes written into buffer, return 0 at the end of data
+   */
+  using ReadCallback =
+      std::function<std::size_t(char *buffer, std::size_t size)>;
+
+  /**
+   * @brief HTTP version
+   */
+  enum class HttpVersion {
+    /// HTTP/1.1
+    Http1_1,
+    /// HTTP/2 over TLS, or upgrade from HTTP/1.1 for plain text
+    Http2,
+    /// HTTP/2 over plain text without upgrade(h2c)
+    Http2PriorKnowledge
+  };
+
   /**
    * @brief Default constructor
    */
@@ -89,11 +190,92 @@ class Request {
   void set_connect_timeout(std::int64_t seconds);
 
   /**
-   * @brief Use cookies
+   * @brief Set up HTTP version(The default is HTTP/2 over TLS and HTTP/1.1 for
+   * plain text)
+   * @param version: HTTP version
+   */
+  void set_http_version(HttpVersion version);
+
+  /**
+   * @brief Set up how long resolved host names are kept in the DNS cache(The
+   * default is 60 seconds). The DNS cache belongs to the cookie jar, so it is
+   * shared by the Request objects that share the cookie jar
+   * @param seconds: Time in seconds, 0 disables the cache and -1 keeps the
+   * entries forever
+   */
+  void set_dns_cache_timeout(std::int64_t seconds);
+
+  /**
+   * @brief Pin the address of a host instead of resolving it, the same as
+   * --resolve of curl
+   * @param host: Host name
+   * @param port: Port number
+   * @param address: IP address, or several addresses separated by comma
+   */
+  void add_resolve(const std::string &host, std::int32_t port,
+                   const std::string &address);
+
+  /**
+   * @brief Resolve the hosts and open keep-alive connections ahead of time, so
+   * that later requests to them skip DNS lookup and connection setup. The
+   * resolved hosts and TLS sessions are shared with the Request objects that
+   * share the cookie jar, the connections are kept by this one. Each
+   * connection takes a permit of the rate limiter
+   * @param urls: URLs whose hosts are to be connected
+   * @param multi: Warm up the connections used by requests with multi set,
+   * the connections are opened concurrently
+   * @return Number of connections opened successfully
+   */
+  std::size_t warm_up(const std::vector<std::string> &urls, bool multi = false);
+
+  /**
+   * @brief Use cookies(The default is true)
    * @param flag: True to use cookies
    */
   void use_cookies(bool flag);
 
+  /**
+   * @brief Share the cookie jar with other Request objects, by default each
+   * Request has its own cookie jar. The DNS cache and TLS sessions are shared
+   * too, even when cookies are not used
+   * @param cookie_jar: Cookie jar to be used
+   */
+  void set_cookie_jar(std::shared_ptr<CookieJar> cookie_jar);
+
+  /**
+   * @brief Cache the responses of GET requests, the cache can be shared with
+   * other Request objects
+   * @param cache: Cache to be used, nullptr disables the cache
+   */
+  void set_cache(std::shared_ptr<HttpCache> cache);
+
+  /**
+   * @brief Limit the request rate and the concurrent connections per host, the
+   * rate limiter can be shared with other Request objects
+   * @param rate_limiter: Rate limiter to be used, nullptr disables the limit
+   */
+  void set_rate_limiter(std::shared_ptr<RateLimiter> rate_limiter);
+
+  /**
+   * @brief Set up retry policy(The default is no retry), requests whose body is
+   * read by callback or from file descriptor are never retried
+   * @param policy: Retry policy
+   */
+  void set_retry_policy(const RetryPolicy &policy);
+
+  /**
+   * @brief Set up hedge policy(The default is no hedging), only requests that
+   * can be retried are hedged
+   * @param policy: Hedge policy
+   */
+  void set_hedge_policy(const HedgePolicy &policy);
+
+  /**
+   * @brief Get statistics
+   * @return Statistics since construction
+   */
+  [[nodiscard]] RequestStats stats() const;
+
   /**
    * @brief Sends a GET request
    * @param url: Requested url
@@ -128,11 +310,296 @@ class Request {
                 const std::unordered_map<std::string, std::string> &header = {},
                 bool multi = false);
 
+  /**
+   * @brief Sends a POST request, the data is not copied
+   * @param url: Requested url
+   * @param data: Binary data, it must remain valid until the request is
+   * completed
+   * @return Response content
+   */
+  Response post(const std::string &url, std::span<const std::byte> data,
+                const std::unordered_map<std::string, std::string> &header = {},
+                bool multi = false);
+
+  /**
+   * @brief Sends a POST request, the data is read by callback
+   * @param url: Requested url
+   * @param callback: Callback used to supply the data
+   * @param size: Data size, -1 means unknown(chunked transfer encoding)
+   * @return Response content
+   */
+  Response post(const std::string &url, const ReadCallback &callback,
+                std::int64_t size,
+                const std::unordered_map<std::string, std::string> &header = {},
+                bool multi = false);
+
+  /**
+   * @brief Sends a POST request, the data is read from file descriptor
+   * @param url: Requested url
+   * @param fd: File descriptor, read from the current offset to the end
+   * @return Response content
+   */
+  Response post(const std::string &url, std::int32_t fd,
+                const std::unordered_map<std::string, std::string> &header = {},
+                bool multi = false);
+
+  /**
+   * @brief Sends a PUT request
+   * @param url: Requested url
+   * @param data: Data string
+   * @return Response content
+   */
+  Response put(const std::string &url, const std::string &data,
+               const std::unordered_map<std::string, std::string> &header = {},
+               bool multi = false);
+
+  /**
+   * @brief Sends a PUT request, the data is not copied
+   * @param url: Requested url
+   * @param data: Binary data, it must remain valid until the request is
+   * completed
+   * @return Response content
+   */
+  Response put(const std::string &url, std::span<const std::byte> data,
+               const std::unordered_map<std::string, std::string> &header = {},
+               bool multi = false);
+
+  /**
+   * @brief Sends a PUT request, the data is read by callback
+   * @param url: Requested url
+   * @param callback: Callback used to supply the data
+   * @param size: Data size, -1 means unknown(chunked transfer encoding)
+   * @return Response content
+   */
+  Response put(const std::string &url, const ReadCallback &callback,
+               std::int64_t size,
+               const std::unordered_map<std::string, std::string> &header = {},
+               bool multi = false);
+
+  /**
+   * @brief Sends a PUT request, the data is read from file descriptor
+   * @param url: Requested url
+   * @param fd: File descriptor, read from the current offset to the end
+   * @return Response content
+   */
+  Response put(const std::string &url, std::int32_t fd,
+               const std::unordered_map<std::string, std::string> &header = {},
+               bool multi = false);
+
+  /**
+   * @brief Sends a PATCH request
+   * @param url: Requested url
+   * @param data: Data string
+   * @return Response content
+   */
+  Response patch(
+      const std::string &url, const std::string &data,
+      const std::unordered_map<std::string, std::string> &header = {},
+      bool multi = false);
+
+  /**
+   * @brief Sends a PATCH request, the data is not copied
+   * @param url: Requested url
+   * @param data: Binary data, it must remain valid until the request is
+   * completed
+   * @return Response content
+   */
+  Response patch(
+      const std::string &url, std::span<const std::byte> data,
+      const std::unordered_map<std::string, std::string> &header = {},
+      bool multi = false);
+
+  /**
+   * @brief Sends a PATCH request, the data is read by callback
+   * @param url: Requested url
+   * @param callback: Callback used to supply the data
+   * @param size: Data size, -1 means unknown(chunked transfer encoding)
+   * @return Response content
+   */
+  Response patch(
+      const std::string &url, const ReadCallback &callback, std::int64_t size,
+      const std::unordered_map<std::string, std::string> &header = {},
+      bool multi = false);
+
+  /**
+   * @brief Sends a PATCH request, the data is read from file descriptor
+   * @param url: Requested url
+   * @param fd: File descriptor, read from the current offset to the end
+   * @return Response content
+   */
+  Response patch(
+      const std::string &url, std::int32_t fd,
+      const std::unordered_map<std::string, std::string> &header = {},
+      bool multi = false);
+
+  /**
+   * @brief Sends a DELETE request
+   * @param url: Requested url
+   * @param params: URL parameters
+   * @return Response content
+   */
+  Response del(const std::string &url,
+               const std::unordered_map<std::string, std::string> &params = {},
+               const std::unordered_map<std::string, std::string> &header = {},
+               bool multi = false);
+
  private:
   class RequestImpl;
   std::experimental::propagate_const<std::unique_ptr<RequestImpl>> impl_;
 };
 
+/**
+ * @brief In-memory cookie store, together with a DNS cache and TLS session
+ * cache, which can be shared by multiple Request objects in different threads
+ */
+class CookieJar {
+  friend class Request::RequestImpl;
+
+ public:
+  /**
+   * @brief Default constructor
+   */
+  CookieJar();
+
+  CookieJar(const CookieJar &) = delete;
+  CookieJar(CookieJar &&) = delete;
+  CookieJar &operator=(const CookieJar &) = delete;
+  CookieJar &operator=(CookieJar &&) = delete;
+
+  /**
+   * @brief Destructor
+   */
+  ~CookieJar();
+
+  /**
+   * @brief Load cookies from file(Netscape format)
+   * @param path: File path
+   */
+  void load(const std::string &path);
+
+  /**
+   * @brief Save all cookies to file(Netscape format)
+   * @param path: File path
+   */
+  void save(const std::string &path);
+
+  /**
+   * @brief Remove all cookies
+   */
+  void clear();
+
+  /**
+   * @brief Get all cookies
+   * @return Cookies, one per line in Netscape format
+   */
+  [[nodiscard]] std::vector<std::string> cookies();
+
+ private:
+  class CookieJarImpl;
+  std::experimental::propagate_const<std::unique_ptr<CookieJarImpl>> impl_;
+};
+
+/**
+ * @brief HTTP response cache, which honors Cache-Control and Expires and
+ * revalidates stale responses with If-None-Match and If-Modified-Since. A
+ * response with Vary is stored for each value of the request headers it lists,
+ * and a response to a request with Authorization only if it is public. The
+ * entries are kept in a size-bounded LRU in memory, and optionally written to a
+ * directory. It can be shared by multiple Request objects in different threads
+ */
+class HttpCache {
+  friend class Request::RequestImpl;
+
+ public:
+  /**
+   * @brief Constructor
+   * @param max_memory_size: Maximum size of the entries kept in memory
+   * @param directory: Directory of the on-disk tier, empty to disable it
+   */
+  explicit HttpCache(std::size_t max_memory_size = 64 * 1024 * 1024,
+                     const std::string &directory = "");
+
+  HttpCache(const HttpCache &) = delete;
+  HttpCache(HttpCache &&) = delete;
+  HttpCache &operator=(const HttpCache &) = delete;
+  HttpCache &operator=(HttpCache &&) = delete;
+
+  /**
+   * @brief Destructor
+   */
+  ~HttpCache();
+
+  /**
+   * @brief Remove all entries, including those on disk
+   */
+  void clear();
+
+  /**
+   * @brief Get the size of the entries kept in memory
+   * @return Size in bytes
+   */
+  [[nodiscard]] std::size_t memory_size() const;
+
+  /**
+   * @brief Get the number of responses served without a transfer
+   * @return Number of hits
+   */
+  [[nodiscard]] std::uint64_t hits() const;
+
+  /**
+   * @brief Get the number of responses revalidated by 304 Not Modified
+   * @return Number of revalidations
+   */
+  [[nodiscard]] std::uint64_t revalidations() const;
+
+ private:
+  class HttpCacheImpl;
+  std::experimental::propagate_const<std::unique_ptr<HttpCacheImpl>> impl_;
+};
+
+/**
+ * @brief Token bucket rate limiter together with a limit of concurrent
+ * connections per host. Transfers wait until both allow them to start, hedged
+ * requests are skipped instead. It can be shared by multiple Request objects in
+ * different threads
+ */
+class RateLimiter {
+  friend class Request::RequestImpl;
+
+ public:
+  /**
+   * @brief Constructor
+   * @param requests_per_second: Rate at which tokens are added, 0 means no
+   * limit
+   * @param burst: Maximum number of tokens, that is, the number of transfers
+   * that can start at once
+   * @param max_connections_per_host: Maximum number of concurrent transfers to
+   * a host, 0 means no limit
+   */
+  explicit RateLimiter(double requests_per_second, std::size_t burst = 1,
+                       std::size_t max_connections_per_host = 0);
+
+  RateLimiter(const RateLimiter &) = delete;
+  RateLimiter(RateLimiter &&) = delete;
+  RateLimiter &operator=(const RateLimiter &) = delete;
+  RateLimiter &operator=(RateLimiter &&) = delete;
+
+  /**
+   * @brief Destructor
+   */
+  ~RateLimiter();
+
+  /**
+   * @brief Get metrics
+   * @return Metrics since construction
+   */
+  [[nodiscard]] RateLimiterStats stats() const;
+
+ private:
+  class RateLimiterImpl;
+  std::experimental::propagate_const<std::unique_ptr<RateLimiterImpl>> impl_;
+};
+
 class Response;
 
 /**
@@ -149,6 +616,13 @@ class Headers {
    */
   [[nodiscard]] const std::string &at(const std::string &key) const;
 
+  /**
+   * @brief Whether the key exists(not case sensitive)
+   * @param key: Key
+   * @return True if the key exists
+   */
+  [[nodiscard]] bool contains(const std::string &key) const;
+
   bool empty() const { return std::empty(map_); }
 
  private:
@@ -171,6 +645,7 @@ class Response {
   enum StatusCode : std::int64_t {
     None = 0,
     Ok = 200,
+    NotModified = 304,
     Unauthorized = 401,
     Forbidden = 403,
     NotFound = 404
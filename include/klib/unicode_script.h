@@ -0,0 +1,75 @@
+/**
+ * @file unicode_script.h
+ * @brief Unicode script property, generated by script/unicode_script.pl from
+ * Unicode 14.0.0, do not edit
+ */
+
+#pragma once
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+
+namespace klib {
+
+/**
+ * @brief Unicode script of a code point, see UAX #24
+ */
+enum class Script : std::uint8_t {
+  Unknown,
+  Common,
+  Inherited,
+  Latin,
+  Greek,
+  Cyrillic,
+  Armenian,
+  Hebrew,
+  Arabic,
+  Syriac,
+  Thaana,
+  Devanagari,
+  Bengali,
+  Gurmukhi,
+  Gujarati,
+  Oriya,
+  Tamil,
+  Telugu,
+  Kannada,
+  Malayalam,
+  Sinhala,
+  Thai,
+  Lao,
+  Tibetan,
+  Myanmar,
+  Georgian,
+  Hangul,
+  Ethiopic,
+  Cherokee,
+  Khmer,
+  Mongolian,
+  Hiragana,
+  Katakana,
+  Bopomofo,
+  Han,
+  Yi,
+};
+
+namespace detail {
+
+inline constexpr std::size_t script_count = 36;
+
+// Two stage lookup of the script of a code point. The first stage maps each
+// block of 128 code points to a block of the second stage. Blocks of a single
+// script share one block per script, the others get their own
+inline constexpr std::size_t script_block_bits = 7;
+inline constexpr std::size_t script_block_size = 1 << script_block_bits;
+
+// The second stage block of each block of script_block_size code points
+extern const std::array<std::uint8_t, 8704> script_stage_1;
+
+// The script of each code point of a block
+extern const std::array<std::uint8_t, 23040> script_stage_2;
+
+}  // namespace detail
+
+}  // namespace klib
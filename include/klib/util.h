@@ -5,14 +5,23 @@
 
 #pragma once
 
+#include <algorithm>
+#include <array>
 #include <concepts>
 #include <cstddef>
 #include <cstdint>
+#include <experimental/propagate_const>
+#include <iterator>
 #include <map>
+#include <memory>
+#include <ranges>
+#include <span>
 #include <string>
 #include <string_view>
 #include <vector>
 
+#include "klib/unicode_script.h"
+
 namespace klib {
 
 namespace detail {
@@ -37,6 +46,49 @@ using UnifiedIdeographsE = UnicodeRange<0x2B820, 0x2CEAF>;
 using CompatibilityIdeographs = UnicodeRange<0xF900, 0xFAFF>;
 using CompatibilityIdeographsSupplement = UnicodeRange<0x2F800, 0x2FA1F>;
 
+// The same characters as std::isspace() in the "C" locale
+constexpr bool is_space(char c) noexcept {
+  return c == ' ' || (c >= '\t' && c <= '\r');
+}
+
+constexpr std::string_view trim(std::string_view str) noexcept {
+  while (!std::empty(str) && is_space(str.front())) {
+    str.remove_prefix(1);
+  }
+  while (!std::empty(str) && is_space(str.back())) {
+    str.remove_suffix(1);
+  }
+  return str;
+}
+
+// A set of bytes as a bitmap, and for sets of ASCII characters as a table
+// indexed by the low nibble of a byte, with the bits of its high nibble, for
+// the SIMD search
+struct CharSet {
+  std::array<std::uint64_t, 4> bits = {};
+  std::array<std::uint8_t, 16> nibbles = {};
+  bool ascii = true;
+};
+
+constexpr CharSet make_char_set(std::string_view chars) noexcept {
+  CharSet set;
+  for (auto c : chars) {
+    auto byte = static_cast<std::uint8_t>(c);
+    set.bits[byte >> 6] |= std::uint64_t{1} << (byte & 63);
+    if (byte < 0x80) {
+      set.nibbles[byte & 0x0F] |= static_cast<std::uint8_t>(1 << (byte >> 4));
+    } else {
+      set.ascii = false;
+    }
+  }
+  return set;
+}
+
+struct NoCharSet {};
+
+// Position of the first character of str in the set, or npos
+std::size_t find_first_of(std::string_view str, const CharSet &set);
+
 }  // namespace detail
 
 /**
@@ -120,6 +172,248 @@ constexpr inline InputIt find_last(InputIt first, InputIt last,
 std::vector<std::string> split_str(const std::string &str,
                                    const std::string &separate);
 
+/**
+ * @brief Kind of separator of SplitView
+ */
+enum class SplitSeparator {
+  // A single character
+  Char,
+  // Any one of the characters
+  AnyOf,
+  // The whole string
+  String
+};
+
+/**
+ * @brief Options of SplitView, resolved at compile time
+ */
+struct SplitOptions {
+  SplitSeparator separator = SplitSeparator::AnyOf;
+  // Remove the leading and trailing whitespace of the tokens
+  bool trim = false;
+  // Skip the tokens which are empty, after trimming
+  bool skip_empty = false;
+};
+
+namespace detail {
+
+// Finds the separators of a SplitView. It is held by value, so the iterators
+// do not refer to the view. Only a string separator is kept as a view
+template <SplitSeparator separator>
+class SplitFinder {
+ public:
+  constexpr SplitFinder() = default;
+
+  constexpr explicit SplitFinder(std::string_view separate)
+      : size_(std::size(separate)) {
+    if constexpr (separator == SplitSeparator::String) {
+      separate_ = separate;
+    } else if (!std::empty(separate)) {
+      first_ = separate.front();
+    }
+    if constexpr (separator == SplitSeparator::AnyOf) {
+      set_ = make_char_set(separate);
+    }
+  }
+
+  [[nodiscard]] std::size_t find(std::string_view str) const {
+    if constexpr (separator == SplitSeparator::AnyOf) {
+      if (size_ == 1) {
+        return str.find(first_);
+      }
+      return find_first_of(str, set_);
+    } else if (size_ == 0) {
+      return std::string_view::npos;
+    } else if constexpr (separator == SplitSeparator::Char) {
+      return str.find(first_);
+    } else {
+      return str.find(separate_);
+    }
+  }
+
+  [[nodiscard]] std::size_t separator_size() const {
+    if constexpr (separator == SplitSeparator::String) {
+      return size_;
+    } else {
+      return 1;
+    }
+  }
+
+ private:
+  std::string_view separate_;
+  std::size_t size_ = 0;
+  char first_ = '\0';
+  [[no_unique_address]] std::conditional_t<separator == SplitSeparator::AnyOf,
+                                           CharSet, NoCharSet>
+      set_;
+};
+
+}  // namespace detail
+
+/**
+ * @brief Lazy view of the tokens of a string, which are views into it, so
+ * nothing is allocated or copied. There is one more token than there are
+ * separators unless empty tokens are skipped, an empty separator does not
+ * split. The string, and a separator that is a whole string, must outlive the
+ * iterators, which do not refer to the view
+ */
+template <SplitOptions options = SplitOptions{}>
+class SplitView : public std::ranges::view_interface<SplitView<options>> {
+  using Finder = detail::SplitFinder<options.separator>;
+
+ public:
+  class Iterator {
+   public:
+    using iterator_concept = std::forward_iterator_tag;
+    using iterator_category = std::input_iterator_tag;
+    using value_type = std::string_view;
+    using difference_type = std::ptrdiff_t;
+
+    Iterator() = default;
+
+    std::string_view operator*() const { return token_; }
+
+    Iterator &operator++() {
+      next();
+      return *this;
+    }
+
+    Iterator operator++(int) {
+      auto copy = *this;
+      next();
+      return copy;
+    }
+
+    // The end iterator is a default constructed one
+    friend bool operator==(const Iterator &lhs, const Iterator &rhs) {
+      return std::data(lhs.rest_) == std::data(rhs.rest_) &&
+             lhs.last_ == rhs.last_;
+    }
+
+   private:
+    friend class SplitView;
+    Iterator(std::string_view str, const Finder &finder)
+        : finder_(finder), rest_(str) {
+      next();
+    }
+
+    void next() {
+      while (true) {
+        if (last_) {
+          *this = Iterator();
+          return;
+        }
+
+        auto pos = finder_.find(rest_);
+        if (pos == std::string_view::npos) {
+          token_ = rest_;
+          last_ = true;
+        } else {
+          token_ = rest_.substr(0, pos);
+          rest_.remove_prefix(pos + finder_.separator_size());
+        }
+
+        if constexpr (options.trim) {
+          token_ = detail::trim(token_);
+        }
+        if constexpr (options.skip_empty) {
+          if (std::empty(token_)) {
+            continue;
+          }
+        }
+        return;
+      }
+    }
+
+    Finder finder_;
+    std::string_view rest_;
+    std::string_view token_;
+    // The token is the last one
+    bool last_ = false;
+  };
+
+  SplitView() = default;
+
+  /**
+   * @brief Constructor
+   * @param str: String to be split
+   * @param separate: Separator, a single character, the characters or the
+   * string, as given by the options
+   */
+  constexpr SplitView(std::string_view str, std::string_view separate)
+      : str_(str), finder_(separate) {}
+
+  Iterator begin() const { return Iterator(str_, finder_); }
+
+  Iterator end() const { return {}; }
+
+ private:
+  std::string_view str_;
+  Finder finder_;
+};
+
+/**
+ * @brief Split string lazily, see SplitView
+ * @param str: String to be split
+ * @param separate: Separator
+ * @return View of the tokens
+ */
+template <SplitOptions options = SplitOptions{}>
+constexpr SplitView<options> split(std::string_view str,
+                                   std::string_view separate) {
+  return SplitView<options>(str, separate);
+}
+
+/**
+ * @brief How a mapped file is going to be read, passed to madvise()
+ */
+enum class MappedFileAdvice { Normal, Sequential, Random, WillNeed };
+
+/**
+ * @brief Read-only view of the contents of a file, mapped into memory instead
+ * of being copied. Files that can not be mapped, such as those in /proc, are
+ * read into a buffer
+ */
+class MappedFile {
+ public:
+  /**
+   * @brief Constructor
+   * @param path: File path
+   * @param advice: How the contents are going to be read
+   */
+  explicit MappedFile(const std::string &path,
+                      MappedFileAdvice advice = MappedFileAdvice::Normal);
+
+  MappedFile(const MappedFile &) = delete;
+  MappedFile(MappedFile &&) noexcept;
+  MappedFile &operator=(const MappedFile &) = delete;
+  MappedFile &operator=(MappedFile &&) noexcept;
+
+  ~MappedFile();
+
+  /**
+   * @brief Get the contents, valid as long as the MappedFile is
+   * @return The contents of the file
+   */
+  [[nodiscard]] std::span<const std::byte> bytes() const;
+
+  /**
+   * @brief Get the contents, valid as long as the MappedFile is
+   * @return The contents of the file
+   */
+  [[nodiscard]] std::string_view view() const;
+
+  /**
+   * @brief Get the size of the file
+   * @return The size of the file
+   */
+  [[nodiscard]] std::size_t size() const;
+
+ private:
+  class MappedFileImpl;
+  std::experimental::propagate_const<std::unique_ptr<MappedFileImpl>> impl_;
+};
+
 /**
  * @brief Read a file at a time and store it in a string
  * @param path: File path
@@ -143,6 +437,64 @@ std::vector<std::string> read_file_line(std::string_view path);
 
 std::vector<std::string> read_file_line(const char *path);
 
+/**
+ * @brief Lazy input range of the lines of a file, without the '\n'. Blank
+ * lines are kept, and a last line without '\n' is a line too. The file is
+ * mapped or read one window at a time, so the memory used is bounded whatever
+ * the file size. A line is only valid until the iterator is incremented
+ */
+class FileLines {
+ public:
+  class Iterator {
+   public:
+    using value_type = std::string_view;
+    using difference_type = std::ptrdiff_t;
+
+    Iterator() = default;
+
+    std::string_view operator*() const { return line_; }
+
+    Iterator &operator++();
+    void operator++(int) { ++*this; }
+
+    friend bool operator==(const Iterator &iter, std::default_sentinel_t) {
+      return iter.lines_ == nullptr;
+    }
+
+   private:
+    friend class FileLines;
+    explicit Iterator(FileLines *lines) : lines_(lines) { ++*this; }
+
+    FileLines *lines_ = nullptr;
+    std::string_view line_;
+  };
+
+  /**
+   * @brief Constructor
+   * @param path: File path
+   */
+  explicit FileLines(const std::string &path);
+
+  FileLines(const FileLines &) = delete;
+  FileLines(FileLines &&) noexcept;
+  FileLines &operator=(const FileLines &) = delete;
+  FileLines &operator=(FileLines &&) noexcept;
+
+  ~FileLines();
+
+  /**
+   * @brief Start reading, only once as it is an input range
+   * @return Iterator at the first line
+   */
+  Iterator begin() { return Iterator(this); }
+
+  std::default_sentinel_t end() { return {}; }
+
+ private:
+  class FileLinesImpl;
+  std::experimental::propagate_const<std::unique_ptr<FileLinesImpl>> impl_;
+};
+
 /**
  * @brief Write string to file
  * @param path: File path
@@ -158,6 +510,28 @@ void write_file(std::string_view path, bool binary_mode,
 void write_file(const char *path, bool binary_mode, const char *content,
                 std::size_t length);
 
+/**
+ * @brief Determine whether a string is valid UTF-8, overlong forms, surrogates
+ * and code points above U+10FFFF are rejected
+ * @param str: A string
+ * @return If it is valid UTF-8, return true, otherwise return false
+ */
+bool is_valid_utf8(std::string_view str);
+
+/**
+ * @brief Get the number of UTF-16 code units of a valid UTF-8 string
+ * @param str: UTF-8 encoded string, which is not validated
+ * @return The size of the UTF-16 encoded string
+ */
+std::size_t utf8_to_utf16_size(std::string_view str);
+
+/**
+ * @brief Get the number of code points of a valid UTF-8 string
+ * @param str: UTF-8 encoded string, which is not validated
+ * @return The size of the UTF-32 encoded string
+ */
+std::size_t utf8_to_utf32_size(std::string_view str);
+
 /**
  * @brief Convert UTF-8 encoded string to UTF-16 encoded string
  * @param str: UTF-8 encoded string
@@ -165,6 +539,15 @@ void write_file(const char *path, bool binary_mode, const char *content,
  */
 std::u16string utf8_to_utf16(const std::string &str);
 
+/**
+ * @brief Convert UTF-8 encoded string to UTF-16 encoded string into a caller
+ * buffer
+ * @param str: UTF-8 encoded string
+ * @param output: Output, at least utf8_to_utf16_size(str)
+ * @return The number of code units written
+ */
+std::size_t utf8_to_utf16(std::string_view str, std::span<char16_t> output);
+
 /**
  * @brief Convert UTF-8 encoded string to UTF-32 encoded string
  * @param str: UTF-8 encoded string
@@ -172,6 +555,45 @@ std::u16string utf8_to_utf16(const std::string &str);
  */
 std::u32string utf8_to_utf32(const std::string &str);
 
+/**
+ * @brief Convert UTF-8 encoded string to UTF-32 encoded string into a caller
+ * buffer
+ * @param str: UTF-8 encoded string
+ * @param output: Output, at least utf8_to_utf32_size(str)
+ * @return The number of code points written
+ */
+std::size_t utf8_to_utf32(std::string_view str, std::span<char32_t> output);
+
+/**
+ * @brief Get the size of the UTF-8 encoding of a UTF-16 string
+ * @param str: UTF-16 encoded string
+ * @return The size of the UTF-8 encoded string
+ */
+std::size_t utf16_to_utf8_size(std::u16string_view str);
+
+/**
+ * @brief Get the size of the UTF-8 encoding of a UTF-32 string
+ * @param str: UTF-32 encoded string
+ * @return The size of the UTF-8 encoded string
+ */
+std::size_t utf32_to_utf8_size(std::u32string_view str);
+
+/**
+ * @brief Convert UTF-16 encoded string to UTF-8 encoded string
+ * @param str: UTF-16 encoded string
+ * @return The converted UTF-8 encoded string
+ */
+std::string utf16_to_utf8(const std::u16string &str);
+
+/**
+ * @brief Convert UTF-16 encoded string to UTF-8 encoded string into a caller
+ * buffer
+ * @param str: UTF-16 encoded string
+ * @param output: Output, at least utf16_to_utf8_size(str)
+ * @return The number of bytes written
+ */
+std::size_t utf16_to_utf8(std::u16string_view str, std::span<char> output);
+
 /**
  * @brief Convert UTF-32 encoded string to UTF-8 encoded string
  * @param c: UTF-32 encoded string
@@ -181,6 +603,15 @@ std::string utf32_to_utf8(char32_t c);
 
 std::string utf32_to_utf8(const std::u32string &str);
 
+/**
+ * @brief Convert UTF-32 encoded string to UTF-8 encoded string into a caller
+ * buffer
+ * @param str: UTF-32 encoded string
+ * @param output: Output, at least utf32_to_utf8_size(str)
+ * @return The number of bytes written
+ */
+std::size_t utf32_to_utf8(std::u32string_view str, std::span<char> output);
+
 /**
  * @brief Determine whether it is an ASCII character
  * @param c: A character
@@ -198,9 +629,9 @@ constexpr bool is_ascii(char32_t c) {
  * @return If it is a string consisting of ASCII characters , return true,
  * otherwise return false
  */
-bool is_ascii(const std::string &str);
+bool is_ascii(std::string_view str);
 
-bool is_ascii(const std::u32string &str);
+bool is_ascii(std::u32string_view str);
 
 /**
  * @brief Determine whether it is a Chinese character
@@ -216,6 +647,36 @@ constexpr bool is_chinese(char32_t c) {
          CompatibilityIdeographs{}(c) || CompatibilityIdeographsSupplement{}(c);
 }
 
+/**
+ * @brief Get the Unicode script of a character, in constant time
+ * @param c: A UTF-32 encoded character
+ * @return The script, Script::Unknown if it is not one of klib::Script or not
+ * a code point
+ */
+inline Script script_of(char32_t c) {
+  using namespace detail;
+
+  auto code_point = std::min<std::uint32_t>(c, 0x10FFFF);
+  auto block = script_stage_1[code_point >> script_block_bits];
+  return static_cast<Script>(
+      script_stage_2[block * script_block_size +
+                     (code_point & (script_block_size - 1))]);
+}
+
+/**
+ * @brief Determine whether a character is in one of the scripts, e.g.
+ * is_script<Script::Han, Script::Hiragana, Script::Katakana>(c)
+ * @param c: A UTF-32 encoded character
+ * @return If it is in one of the scripts, return true, otherwise return false
+ */
+template <Script... scripts>
+bool is_script(char32_t c) {
+  static_assert(detail::script_count <= 64);
+  constexpr std::uint64_t mask =
+      ((std::uint64_t{1} << static_cast<std::uint8_t>(scripts)) | ... | 0);
+  return (mask >> static_cast<std::uint8_t>(script_of(c))) & 1;
+}
+
 /**
  * @brief Determine whether it is a Chinese character
  * @param c: A UTF-8 encoded string representing a UTF-32 encoded character
@@ -223,19 +684,224 @@ constexpr bool is_chinese(char32_t c) {
  */
 bool is_chinese(const std::string &c);
 
+/**
+ * @brief Count the Chinese characters in a UTF-8 encoded string, without
+ * transcoding it
+ * @param str: UTF-8 encoded string, which is not validated
+ * @return The number of Chinese characters
+ */
+std::size_t count_chinese(std::string_view str);
+
+/**
+ * @brief Find the first Chinese character in a UTF-8 encoded string
+ * @param str: UTF-8 encoded string, which is not validated
+ * @param pos: Byte offset at which to start the search
+ * @return The byte offset of the first Chinese character, or
+ * std::string_view::npos if there is none
+ */
+std::size_t find_chinese(std::string_view str, std::size_t pos = 0);
+
+/**
+ * @brief A run of Chinese or non-Chinese characters
+ */
+struct ChineseSpan {
+  std::string_view text;
+  bool chinese;
+};
+
+/**
+ * @brief Split a UTF-8 encoded string into alternating runs of Chinese and
+ * non-Chinese characters
+ * @param str: UTF-8 encoded string, which is not validated
+ * @return The runs, which view into str and together cover it
+ */
+std::vector<ChineseSpan> chinese_spans(std::string_view str);
+
+/**
+ * @brief Base64 alphabet
+ */
+enum class Base64Alphabet {
+  // RFC 4648 section 4, '+' and '/', padded with '='
+  Standard,
+  // RFC 4648 section 5, '-' and '_', without padding
+  UrlSafe
+};
+
+/**
+ * @brief Get the size of the base64 encoded data
+ * @param size: Size of the data to be encoded
+ * @param alphabet: Base64 alphabet
+ * @return The number of characters
+ */
+constexpr std::size_t base64_encoded_size(
+    std::size_t size, Base64Alphabet alphabet = Base64Alphabet::Standard) {
+  if (alphabet == Base64Alphabet::Standard) {
+    return (size + 2) / 3 * 4;
+  }
+  return size / 3 * 4 + (size % 3 == 0 ? 0 : size % 3 + 1);
+}
+
+/**
+ * @brief Get the maximum size of the data decoded from base64
+ * @param size: Size of the data to be decoded
+ * @return The number of bytes
+ */
+constexpr std::size_t base64_decoded_size(std::size_t size) {
+  return (size + 3) / 4 * 3;
+}
+
+/**
+ * @brief Base64 encode into a caller buffer
+ * @param data: Data to be encoded
+ * @param output: Output, at least base64_encoded_size(std::size(data),
+ * alphabet)
+ * @param alphabet: Base64 alphabet
+ * @return The number of characters written
+ */
+std::size_t base64_encode(std::string_view data, std::span<char> output,
+                          Base64Alphabet alphabet = Base64Alphabet::Standard);
+
 /**
  * @brief Base64 encode
  * @param str: Data to be encoded
+ * @param alphabet: Base64 alphabet
  * @return Base64 result
  */
-std::string base64_encode(const std::string &str);
+std::string base64_encode(const std::string &str,
+                          Base64Alphabet alphabet = Base64Alphabet::Standard);
+
+/**
+ * @brief Base64 decode into a caller buffer, padding is optional and
+ * whitespace is skipped
+ * @param str: Data to be decoded
+ * @param output: Output, at least base64_decoded_size(std::size(str))
+ * @param alphabet: Base64 alphabet
+ * @return The number of bytes written
+ */
+std::size_t base64_decode(std::string_view str, std::span<char> output,
+                          Base64Alphabet alphabet = Base64Alphabet::Standard);
 
 /**
- * @brief Base64 decode
+ * @brief Base64 decode, padding is optional and whitespace is skipped
  * @param str: Data to be decoded
+ * @param alphabet: Base64 alphabet
+ * @return Raw data
+ */
+std::string base64_decode(const std::string &str,
+                          Base64Alphabet alphabet = Base64Alphabet::Standard);
+
+/**
+ * @brief Incremental base64 encoder, the input may be split anywhere
+ */
+class Base64Encoder {
+ public:
+  /**
+   * @brief Constructor
+   * @param alphabet: Base64 alphabet
+   */
+  explicit Base64Encoder(Base64Alphabet alphabet = Base64Alphabet::Standard)
+      : alphabet_(alphabet) {}
+
+  /**
+   * @brief Encode more data, up to 2 bytes are kept until the next call
+   * @param data: Data to be encoded
+   * @param output: Output, at least base64_encoded_size(std::size(data))
+   * @return The number of characters written
+   */
+  std::size_t update(std::string_view data, std::span<char> output);
+
+  /**
+   * @brief Encode the remaining bytes and add the padding, then reset
+   * @param output: Output, at least 4 characters
+   * @return The number of characters written
+   */
+  std::size_t finalize(std::span<char> output);
+
+ private:
+  Base64Alphabet alphabet_;
+  std::array<std::uint8_t, 3> pending_ = {};
+  std::size_t pending_size_ = 0;
+};
+
+/**
+ * @brief Incremental base64 decoder, the input may be split anywhere,
+ * padding is optional and whitespace is skipped
+ */
+class Base64Decoder {
+ public:
+  /**
+   * @brief Constructor
+   * @param alphabet: Base64 alphabet
+   */
+  explicit Base64Decoder(Base64Alphabet alphabet = Base64Alphabet::Standard)
+      : alphabet_(alphabet) {}
+
+  /**
+   * @brief Decode more data, up to 3 characters are kept until the next call
+   * @param str: Data to be decoded
+   * @param output: Output, at least base64_decoded_size(std::size(str) + 3)
+   * since the kept characters are decoded too, or
+   * base64_decoded_size(std::size(str)) when none are kept
+   * @return The number of bytes written
+   */
+  std::size_t update(std::string_view str, std::span<char> output);
+
+  /**
+   * @brief Decode the remaining characters, then reset
+   * @param output: Output, at least 2 bytes
+   * @return The number of bytes written
+   */
+  std::size_t finalize(std::span<char> output);
+
+ private:
+  Base64Alphabet alphabet_;
+  std::array<char, 4> pending_ = {};
+  std::size_t pending_size_ = 0;
+  bool padded_ = false;
+};
+
+/**
+ * @brief Hex encode into a caller buffer, in lowercase
+ * @param bytes: Data to be encoded
+ * @param hex: Output, at least twice the size of bytes
+ * @return The number of characters written
+ */
+std::size_t hex_encode(std::span<const std::uint8_t> bytes,
+                       std::span<char> hex);
+
+/**
+ * @brief Hex encode, in lowercase
+ * @param bytes: Data to be encoded
+ * @return Encoded data
+ */
+std::string hex_encode(std::span<const std::uint8_t> bytes);
+
+/**
+ * @brief Hex encode a fixed size digest without allocating
+ * @param bytes: Data to be encoded
+ * @return Encoded data, not null-terminated
+ */
+template <std::size_t N>
+std::array<char, 2 * N> hex_encode(const std::array<std::uint8_t, N> &bytes) {
+  std::array<char, 2 * N> hex;
+  hex_encode(std::span<const std::uint8_t>(bytes), std::span<char>(hex));
+  return hex;
+}
+
+/**
+ * @brief Hex decode into a caller buffer, digits may be in either case
+ * @param hex: Data to be decoded
+ * @param bytes: Output, at least half the size of hex
+ * @return The number of bytes written
+ */
+std::size_t hex_decode(std::string_view hex, std::span<std::uint8_t> bytes);
+
+/**
+ * @brief Hex decode, digits may be in either case
+ * @param hex: Data to be decoded
  * @return Raw data
  */
-std::string base64_decode(const std::string &str);
+std::vector<std::uint8_t> hex_decode(std::string_view hex);
 
 /**
  * @brief Calculate MD5
@@ -300,6 +966,318 @@ std::vector<std::uint8_t> sha3_512_raw(const std::string &str);
  */
 std::string sha3_512_file(const std::string &path);
 
+/**
+ * @brief Calculate XXH3-64, a fast non-cryptographic hash for cache keys and
+ * change detection
+ * @param str: Data to be hashed
+ * @return XXH3-64 result, in the canonical form printed by xxhsum
+ */
+std::string xxh3_64(const std::string &str);
+
+/**
+ * @brief Calculate XXH3-64
+ * @param str: Data to be hashed
+ * @return XXH3-64 result, in the canonical (big-endian) byte order
+ */
+std::vector<std::uint8_t> xxh3_64_raw(const std::string &str);
+
+/**
+ * @brief Calculate XXH3-64
+ * @param path: The path of the file to be calculated
+ * @return XXH3-64 result
+ */
+std::string xxh3_64_file(const std::string &path);
+
+/**
+ * @brief Calculate XXH3-128
+ * @param str: Data to be hashed
+ * @return XXH3-128 result, in the canonical form printed by xxhsum
+ */
+std::string xxh3_128(const std::string &str);
+
+/**
+ * @brief Calculate XXH3-128
+ * @param str: Data to be hashed
+ * @return XXH3-128 result, in the canonical (big-endian) byte order
+ */
+std::vector<std::uint8_t> xxh3_128_raw(const std::string &str);
+
+/**
+ * @brief Calculate XXH3-128
+ * @param path: The path of the file to be calculated
+ * @return XXH3-128 result
+ */
+std::string xxh3_128_file(const std::string &path);
+
+/**
+ * @brief Calculate BLAKE3
+ * @param str: Data to be hashed
+ * @param threads: Number of threads hashing the subtrees of the input, 1
+ * hashes in the calling thread, 0 means the number of hardware threads
+ * @return BLAKE3 result
+ */
+std::string blake3(const std::string &str, std::size_t threads = 1);
+
+/**
+ * @brief Calculate BLAKE3
+ * @param str: Data to be hashed
+ * @param threads: Number of threads, 0 means the number of hardware threads
+ * @return BLAKE3 result
+ */
+std::vector<std::uint8_t> blake3_raw(const std::string &str,
+                                     std::size_t threads = 1);
+
+/**
+ * @brief Calculate BLAKE3
+ * @param path: The path of the file to be calculated
+ * @param threads: Number of threads, 0 means the number of hardware threads
+ * @return BLAKE3 result
+ */
+std::string blake3_file(const std::string &path, std::size_t threads = 1);
+
+/**
+ * @brief Hash algorithm
+ */
+enum class HashAlgorithm { Md5, Sha256, Sha3_512 };
+
+/**
+ * @brief Digests of a directory tree
+ */
+struct TreeHash {
+  /// Merkle root, the digest of the top directory
+  std::string root;
+  /// Digest of each regular file, keyed by the path relative to the top
+  /// directory
+  std::map<std::string, std::string> files;
+  /// Digest of each directory, the top directory has an empty key
+  std::map<std::string, std::string> directories;
+  /// Digest of the target path of each symbolic link, which is not followed
+  std::map<std::string, std::string> links;
+};
+
+/**
+ * @brief Hash all files in the directory tree in parallel, and combine them
+ * into a Merkle tree. The digest of a file is the same as md5_file(),
+ * sha_256_file() or sha3_512_file(), the digest of a directory covers the names
+ * and digests of its entries, so an unchanged subtree keeps its digest. A
+ * symbolic link is an entry of its own, hashed by the path it points to rather
+ * than followed, other kinds of files are skipped
+ * @param path: The path of the directory to be calculated
+ * @param algorithm: Hash algorithm
+ * @param threads: Number of threads, 0 means the number of hardware threads
+ * @return Digests in hexadecimal
+ */
+TreeHash hash_tree(const std::string &path, HashAlgorithm algorithm,
+                   std::size_t threads = 0);
+
+/**
+ * @brief Get the digest size of the hash algorithm
+ * @param algorithm: Hash algorithm
+ * @return Digest size in bytes
+ */
+constexpr std::size_t digest_size(HashAlgorithm algorithm) {
+  switch (algorithm) {
+    case HashAlgorithm::Md5:
+      return 16;
+    case HashAlgorithm::Sha256:
+      return 32;
+    case HashAlgorithm::Sha3_512:
+      return 64;
+  }
+
+  return 0;
+}
+
+namespace detail {
+
+class EvpHasher {
+ public:
+  explicit EvpHasher(HashAlgorithm algorithm);
+
+  EvpHasher(const EvpHasher &) = delete;
+  EvpHasher(EvpHasher &&) noexcept;
+  EvpHasher &operator=(const EvpHasher &) = delete;
+  EvpHasher &operator=(EvpHasher &&) noexcept;
+
+  ~EvpHasher();
+
+  void update(const void *data, std::size_t size);
+  void finalize(std::uint8_t *digest);
+  void reset();
+
+ private:
+  class EvpHasherImpl;
+  std::experimental::propagate_const<std::unique_ptr<EvpHasherImpl>> impl_;
+};
+
+}  // namespace detail
+
+/**
+ * @brief Incremental hasher, the digest context is created once and reused
+ * after finalize() or reset()
+ * @tparam algorithm: Hash algorithm
+ */
+template <HashAlgorithm algorithm>
+class Hasher {
+ public:
+  /**
+   * @brief Digest in bytes
+   */
+  using Digest = std::array<std::uint8_t, digest_size(algorithm)>;
+
+  /**
+   * @brief Default constructor
+   */
+  Hasher() : hasher_(algorithm) {}
+
+  /**
+   * @brief Hash more data
+   * @param data: Data to be hashed
+   * @return *this
+   */
+  Hasher &update(std::span<const std::byte> data) {
+    hasher_.update(std::data(data), std::size(data));
+    return *this;
+  }
+
+  Hasher &update(std::string_view data) {
+    hasher_.update(std::data(data), std::size(data));
+    return *this;
+  }
+
+  /**
+   * @brief Get the digest of all data hashed since the last reset, then reset
+   * @return Digest
+   */
+  [[nodiscard]] Digest finalize() {
+    Digest digest;
+    hasher_.finalize(std::data(digest));
+    return digest;
+  }
+
+  /**
+   * @brief Discard the data hashed so far
+   */
+  void reset() { hasher_.reset(); }
+
+ private:
+  detail::EvpHasher hasher_;
+};
+
+using Md5Hasher = Hasher<HashAlgorithm::Md5>;
+using Sha256Hasher = Hasher<HashAlgorithm::Sha256>;
+using Sha3_512Hasher = Hasher<HashAlgorithm::Sha3_512>;
+
+/**
+ * @brief Calculate SHA-256 of many inputs at once, without allocating. Two
+ * inputs are hashed at a time with the SHA extensions when the CPU has them,
+ * otherwise a single digest context is reused for the whole batch
+ * @param inputs: Data to be hashed
+ * @param digests: Output, the digest of each input in the same order, its
+ * size must be the same as inputs
+ */
+void sha_256_batch(std::span<const std::string_view> inputs,
+                   std::span<Sha256Hasher::Digest> digests);
+
+/**
+ * @brief Cipher algorithm
+ */
+enum class CipherAlgorithm { Aes256Cbc, Aes256Gcm, ChaCha20Poly1305 };
+
+/**
+ * @brief Whether a cipher encrypts or decrypts
+ */
+enum class CipherOperation { Encrypt, Decrypt };
+
+/**
+ * @brief Incremental cipher, the key is set once and the context is reused
+ * for every message. AES-256-CBC uses PKCS #7 padding. AES-256-GCM and
+ * ChaCha20-Poly1305 append the authentication tag to the ciphertext, it is
+ * checked by finalize() when decrypting
+ */
+class Cipher {
+ public:
+  /**
+   * @brief The most bytes update() and finalize() write beyond their input
+   */
+  static constexpr std::size_t block_size = 16;
+
+  /**
+   * @brief Size of the authentication tag of the AEAD ciphers
+   */
+  static constexpr std::size_t tag_size = 16;
+
+  /**
+   * @brief Constructor
+   * @param algorithm: Cipher algorithm
+   * @param operation: Encrypt or decrypt
+   * @param key: Key, 256 bit
+   * @param iv: iv, 128 bit for AES-256-CBC, 96 bit for the AEAD ciphers
+   */
+  Cipher(CipherAlgorithm algorithm, CipherOperation operation,
+         std::span<const std::uint8_t> key, std::span<const std::uint8_t> iv);
+
+  Cipher(const Cipher &) = delete;
+  Cipher(Cipher &&) noexcept;
+  Cipher &operator=(const Cipher &) = delete;
+  Cipher &operator=(Cipher &&) noexcept;
+
+  ~Cipher();
+
+  /**
+   * @brief Add authenticated data that is not encrypted, only for the AEAD
+   * ciphers and before the first update() of the message
+   * @param aad: Additional authenticated data
+   */
+  void update_aad(std::string_view aad);
+
+  /**
+   * @brief Encrypt or decrypt more data. When decrypting with an AEAD cipher
+   * the last tag_size bytes seen are held back, as they may be the tag
+   * @param input: Data to be processed
+   * @param output: Output, at least std::size(input) + block_size
+   * @return The number of bytes written
+   */
+  std::size_t update(std::string_view input, std::span<char> output);
+
+  /**
+   * @brief Finish the message, then start a new one with the same key and iv.
+   * An AEAD cipher that encrypts needs reset() with a new iv before the next
+   * message, since reusing it would reveal the key stream
+   * @param output: Output, at least block_size
+   * @return The number of bytes written
+   */
+  std::size_t finalize(std::span<char> output);
+
+  /**
+   * @brief Discard the current message and start a new one with another iv.
+   * An AEAD cipher that encrypts throws if the iv is the one the last message
+   * used, or the current one that has already processed data
+   * @param iv: iv, 128 bit for AES-256-CBC, 96 bit for the AEAD ciphers
+   */
+  void reset(std::span<const std::uint8_t> iv);
+
+  /**
+   * @brief Discard the current message and start a new one with another key
+   * and iv, the cipher context is kept
+   * @param key: Key, 256 bit
+   * @param iv: iv, 128 bit for AES-256-CBC, 96 bit for the AEAD ciphers
+   */
+  void reset(std::span<const std::uint8_t> key,
+             std::span<const std::uint8_t> iv);
+
+  /**
+   * @brief Discard the current message and wipe the key schedule, so the key
+   * does not stay in memory while the cipher is idle. reset() with a key is
+   * needed before the next message
+   */
+  void clear();
+
+ private:
+  class CipherImpl;
+  std::experimental::propagate_const<std::unique_ptr<CipherImpl>> impl_;
+};
+
 /**
  * @brief AES 256-cbc encryption
  * @param str: Data to be encrypted
@@ -322,6 +1300,130 @@ std::string aes_256_cbc_decrypt(const std::string &str,
                                 const std::vector<std::uint8_t> &key,
                                 const std::vector<std::uint8_t> &iv);
 
+/**
+ * @brief AES 256-cbc encryption of a file, it is processed in chunks so the
+ * memory used does not depend on the file size
+ * @param in_path: Path of the file to be encrypted
+ * @param out_path: Path of the encrypted file, not the same file as in_path
+ * @param key: Key
+ * @param iv: iv
+ */
+void aes_256_cbc_encrypt_file(const std::string &in_path,
+                              const std::string &out_path,
+                              const std::vector<std::uint8_t> &key,
+                              const std::vector<std::uint8_t> &iv);
+
+/**
+ * @brief AES 256-cbc decryption of a file, it is processed in chunks so the
+ * memory used does not depend on the file size. The output file is removed if
+ * the decryption fails
+ * @param in_path: Path of the file to be decrypted
+ * @param out_path: Path of the decrypted file, not the same file as in_path
+ * @param key: Key
+ * @param iv: iv
+ */
+void aes_256_cbc_decrypt_file(const std::string &in_path,
+                              const std::string &out_path,
+                              const std::vector<std::uint8_t> &key,
+                              const std::vector<std::uint8_t> &iv);
+
+/**
+ * @brief AES 256-gcm encryption
+ * @param str: Data to be encrypted
+ * @param key: Key, 256 bit
+ * @param iv: iv, 96 bit, it must not be used twice with the same key
+ * @param aad: Additional authenticated data, which is not encrypted
+ * @return Encrypted data followed by the 128 bit authentication tag
+ */
+std::string aes_256_gcm_encrypt(const std::string &str,
+                                const std::vector<std::uint8_t> &key,
+                                const std::vector<std::uint8_t> &iv,
+                                std::string_view aad = {});
+
+/**
+ * @brief AES 256-gcm decryption
+ * @param str: Encrypted data followed by the authentication tag
+ * @param key: Key, 256 bit
+ * @param iv: iv, 96 bit
+ * @param aad: Additional authenticated data
+ * @return Raw data, or throw if the data has been tampered with
+ */
+std::string aes_256_gcm_decrypt(const std::string &str,
+                                const std::vector<std::uint8_t> &key,
+                                const std::vector<std::uint8_t> &iv,
+                                std::string_view aad = {});
+
+/**
+ * @brief ChaCha20-Poly1305 encryption
+ * @param str: Data to be encrypted
+ * @param key: Key, 256 bit
+ * @param iv: iv, 96 bit, it must not be used twice with the same key
+ * @param aad: Additional authenticated data, which is not encrypted
+ * @return Encrypted data followed by the 128 bit authentication tag
+ */
+std::string chacha20_poly1305_encrypt(const std::string &str,
+                                      const std::vector<std::uint8_t> &key,
+                                      const std::vector<std::uint8_t> &iv,
+                                      std::string_view aad = {});
+
+/**
+ * @brief ChaCha20-Poly1305 decryption
+ * @param str: Encrypted data followed by the authentication tag
+ * @param key: Key, 256 bit
+ * @param iv: iv, 96 bit
+ * @param aad: Additional authenticated data
+ * @return Raw data, or throw if the data has been tampered with
+ */
+std::string chacha20_poly1305_decrypt(const std::string &str,
+                                      const std::vector<std::uint8_t> &key,
+                                      const std::vector<std::uint8_t> &iv,
+                                      std::string_view aad = {});
+
+/**
+ * @brief Encrypt a file into independently sealed chunks on a pool of threads.
+ * The output starts with a header holding the algorithm, the chunk size, the
+ * plaintext size and a random base iv. Chunk i is stored at a fixed offset
+ * and is sealed with the base iv xor i and the header as authenticated data,
+ * so chunks can not be reordered, truncated or moved to another file
+ * @param in_path: Path of the file to be encrypted
+ * @param out_path: Path of the encrypted file, not the same file as in_path
+ * @param key: Key, 256 bit
+ * @param algorithm: AES-256-GCM or ChaCha20-Poly1305
+ * @param chunk_size: Plaintext bytes per chunk
+ * @param threads: Number of threads, 0 means the number of hardware threads
+ */
+void encrypt_file_chunked(
+    const std::string &in_path, const std::string &out_path,
+    const std::vector<std::uint8_t> &key,
+    CipherAlgorithm algorithm = CipherAlgorithm::Aes256Gcm,
+    std::size_t chunk_size = 1024 * 1024, std::size_t threads = 0);
+
+/**
+ * @brief Decrypt a file written by encrypt_file_chunked() on a pool of
+ * threads. The output file is removed if any chunk fails to authenticate
+ * @param in_path: Path of the encrypted file
+ * @param out_path: Path of the decrypted file, not the same file as in_path
+ * @param key: Key, 256 bit
+ * @param threads: Number of threads, 0 means the number of hardware threads
+ */
+void decrypt_file_chunked(const std::string &in_path,
+                          const std::string &out_path,
+                          const std::vector<std::uint8_t> &key,
+                          std::size_t threads = 0);
+
+/**
+ * @brief Decrypt part of a file written by encrypt_file_chunked(), only the
+ * chunks that overlap the range are read
+ * @param path: Path of the encrypted file
+ * @param key: Key, 256 bit
+ * @param offset: Offset in the plaintext
+ * @param size: Number of bytes, the result is shorter at the end of the file
+ * @return Raw data
+ */
+std::string decrypt_file_chunked_range(const std::string &path,
+                                       const std::vector<std::uint8_t> &key,
+                                       std::size_t offset, std::size_t size);
+
 /**
  * @brief Count the sum of the size of all files in the folder
  * @param path: The path of the folder to be counted
@@ -360,3 +1462,8 @@ void wait_for_child_process();
 std::string uuid();
 
 }  // namespace klib
+
+// The iterators do not refer to the view, so they may outlive it
+template <klib::SplitOptions options>
+inline constexpr bool
+    std::ranges::enable_borrowed_range<klib::SplitView<options>> = true;
@@ -0,0 +1,148 @@
+#!/usr/bin/env perl
+
+# Generate include/klib/unicode_script.h and src/unicode_script.cpp from the
+# Unicode Character Database shipped with Perl
+#
+# Usage: perl script/unicode_script.pl include/klib/unicode_script.h \
+#          src/unicode_script.cpp
+
+use strict;
+use warnings;
+
+use Unicode::UCD qw(prop_invmap);
+
+die "Usage: $0 <header> <source>\n" unless @ARGV == 2;
+my ($header_path, $source_path) = @ARGV;
+
+# Anything else is Unknown
+my @scripts = qw(
+  Common Inherited Latin Greek Cyrillic Armenian Hebrew Arabic Syriac Thaana
+  Devanagari Bengali Gurmukhi Gujarati Oriya Tamil Telugu Kannada Malayalam
+  Sinhala Thai Lao Tibetan Myanmar Georgian Hangul Ethiopic Cherokee Khmer
+  Mongolian Hiragana Katakana Bopomofo Han Yi
+);
+my %value = map { $scripts[$_] => $_ + 1 } 0 .. $#scripts;
+
+my $version = Unicode::UCD::UnicodeVersion();
+my $count = @scripts + 1;
+
+# The script of every code point
+my ($list, $map) = prop_invmap("Script");
+my @script_of = (0) x 0x110000;
+for my $i (0 .. $#$list) {
+  my $value = $value{$map->[$i]};
+  next unless $value;
+
+  my $last = $i < $#$list ? $list->[$i + 1] - 1 : 0x10FFFF;
+  @script_of[$list->[$i] .. $last] = ($value) x ($last - $list->[$i] + 1);
+}
+
+# Two stages, the first maps each block of 128 code points to a block of the
+# second. Blocks of a single script share one block per script, the others
+# get their own
+my $block_bits = 7;
+my $block_size = 1 << $block_bits;
+my @stage_1;
+my @stage_2 = map { ($_) x $block_size } 0 .. $count - 1;
+for (my $first = 0; $first < 0x110000; $first += $block_size) {
+  my @block = @script_of[$first .. $first + $block_size - 1];
+  if (!grep { $_ != $block[0] } @block) {
+    push @stage_1, $block[0];
+  } else {
+    push @stage_1, @stage_2 / $block_size;
+    push @stage_2, @block;
+  }
+}
+die "Too many blocks\n" if @stage_2 / $block_size > 256;
+
+sub print_bytes {
+  my ($fh, @bytes) = @_;
+  while (my @line = splice @bytes, 0, 12) {
+    print $fh '    ', join(', ', map { sprintf '0x%02x', $_ } @line), ",\n";
+  }
+}
+
+open my $header, '>', $header_path or die "Can not open $header_path: $!\n";
+
+my $stage_1_size = @stage_1;
+my $stage_2_size = @stage_2;
+
+print $header <<"END";
+/**
+ * \@file unicode_script.h
+ * \@brief Unicode script property, generated by script/unicode_script.pl from
+ * Unicode $version, do not edit
+ */
+
+#pragma once
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+
+namespace klib {
+
+/**
+ * \@brief Unicode script of a code point, see UAX #24
+ */
+enum class Script : std::uint8_t {
+  Unknown,
+END
+
+print $header "  $_,\n" for @scripts;
+
+print $header <<"END";
+};
+
+namespace detail {
+
+inline constexpr std::size_t script_count = $count;
+
+// Two stage lookup of the script of a code point. The first stage maps each
+// block of 128 code points to a block of the second stage. Blocks of a single
+// script share one block per script, the others get their own
+inline constexpr std::size_t script_block_bits = $block_bits;
+inline constexpr std::size_t script_block_size = 1 << script_block_bits;
+
+// The second stage block of each block of script_block_size code points
+extern const std::array<std::uint8_t, $stage_1_size> script_stage_1;
+
+// The script of each code point of a block
+extern const std::array<std::uint8_t, $stage_2_size> script_stage_2;
+
+}  // namespace detail
+
+}  // namespace klib
+END
+
+close $header;
+
+open my $source, '>', $source_path or die "Can not open $source_path: $!\n";
+
+print $source <<"END";
+// Generated by script/unicode_script.pl from Unicode $version, do not edit
+
+#include "klib/unicode_script.h"
+
+namespace klib::detail {
+
+const std::array<std::uint8_t, $stage_1_size> script_stage_1 = {
+END
+
+print_bytes($source, @stage_1);
+
+print $source <<"END";
+};
+
+const std::array<std::uint8_t, $stage_2_size> script_stage_2 = {
+END
+
+print_bytes($source, @stage_2);
+
+print $source <<"END";
+};
+
+}  // namespace klib::detail
+END
+
+close $source;
@@ -6,6 +6,8 @@
 #include <filesystem>
 #include <functional>
 #include <memory>
+#include <optional>
+#include <string_view>
 
 #include <archive.h>
 #include <archive_entry.h>
@@ -197,12 +199,14 @@ void compress(const std::vector<std::string> &paths, Algorithm algorithm,
       check_archive_correctness(
           archive_write_header(archive.get(), entry.get()), archive.get());
 
-      std::string data;
+      std::optional<MappedFile> file;
+      std::string_view data;
       const auto source_path = archive_entry_sourcepath(entry.get());
       if (std::filesystem::is_regular_file(source_path)) {
-        data = read_file(source_path, true);
+        file.emplace(source_path, MappedFileAdvice::Sequential);
+        data = file->view();
       }
-      archive_write_data(archive.get(), data.data(), std::size(data));
+      archive_write_data(archive.get(), std::data(data), std::size(data));
     }
   }
 }
@@ -0,0 +1,120 @@
+// Helpers shared by the translation units of the library, this header is not
+// installed
+
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <bit>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <exception>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace klib::detail {
+
+bool has_avx2();
+
+// Call func(data, size) with the contents of the file in order, the memory
+// used is bounded whatever the file size
+void for_each_file_chunk(
+    const std::string &path,
+    const std::function<void(const char *, std::size_t)> &func);
+
+template <typename State>
+void update_file(State &state, const std::string &path) {
+  for_each_file_chunk(path, [&](const char *data, std::size_t size) {
+    state.update(reinterpret_cast<const std::uint8_t *>(data), size);
+  });
+}
+
+inline const std::uint8_t *as_bytes(const std::string &str) {
+  return reinterpret_cast<const std::uint8_t *>(std::data(str));
+}
+
+inline std::uint32_t read_le32(const std::uint8_t *data) {
+  std::uint32_t value;
+  std::memcpy(&value, data, sizeof(value));
+  if constexpr (std::endian::native == std::endian::big) {
+    value = __builtin_bswap32(value);
+  }
+  return value;
+}
+
+inline std::uint64_t read_le64(const std::uint8_t *data) {
+  std::uint64_t value;
+  std::memcpy(&value, data, sizeof(value));
+  if constexpr (std::endian::native == std::endian::big) {
+    value = __builtin_bswap64(value);
+  }
+  return value;
+}
+
+inline void write_be64(std::uint64_t value, std::uint8_t *data) {
+  for (std::int32_t i = 7; i >= 0; --i) {
+    data[i] = static_cast<std::uint8_t>(value);
+    value >>= 8;
+  }
+}
+
+// Call func(state, index) for every index in [0, count) on a pool of threads,
+// each thread creates its own state with make_state() and reuses it for all
+// the indices it takes. The first exception thrown is rethrown in the calling
+// thread
+template <typename MakeState, typename Func>
+void parallel_for(std::size_t count, std::size_t threads, MakeState make_state,
+                  Func func) {
+  if (threads == 0) {
+    threads = std::max(std::thread::hardware_concurrency(), 1U);
+  }
+  threads = std::min(threads, count);
+
+  std::atomic<std::size_t> next = 0;
+  std::exception_ptr exception;
+  std::mutex mutex;
+
+  auto worker = [&] {
+    try {
+      auto state = make_state();
+      for (std::size_t index; (index = next++) < count;) {
+        func(state, index);
+      }
+    } catch (...) {
+      std::lock_guard<std::mutex> lock(mutex);
+      if (!exception) {
+        exception = std::current_exception();
+      }
+      next = count;
+    }
+  };
+
+  if (threads <= 1) {
+    worker();
+  } else {
+    std::vector<std::jthread> pool;
+    pool.reserve(threads - 1);
+    for (std::size_t i = 1; i < threads; ++i) {
+      pool.emplace_back(worker);
+    }
+    worker();
+  }
+
+  if (exception) {
+    std::rethrow_exception(exception);
+  }
+}
+
+// Call func(index) for every index in [0, count) on a pool of threads
+template <typename Func>
+void parallel_for(std::size_t count, std::size_t threads, Func func) {
+  parallel_for(
+      count, threads, [] { return 0; },
+      [&](std::int32_t, std::size_t index) { func(index); });
+}
+
+}  // namespace klib::detail
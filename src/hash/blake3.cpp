@@ -0,0 +1,581 @@
+#include "klib/util.h"
+
+#ifdef __x86_64__
+#include <immintrin.h>
+#endif
+
+#include <algorithm>
+#include <array>
+#include <bit>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "../detail.h"
+
+namespace klib {
+
+namespace {
+
+using detail::as_bytes;
+using detail::has_avx2;
+using detail::parallel_for;
+using detail::read_le32;
+using detail::update_file;
+
+// https://github.com/BLAKE3-team/BLAKE3-specs/blob/master/blake3.pdf
+constexpr std::size_t blake3_block_size = 64;
+constexpr std::size_t blake3_chunk_size = 1024;
+constexpr std::size_t blake3_digest_size = 32;
+
+constexpr std::uint32_t blake3_chunk_start = 1 << 0;
+constexpr std::uint32_t blake3_chunk_end = 1 << 1;
+constexpr std::uint32_t blake3_parent = 1 << 2;
+constexpr std::uint32_t blake3_root = 1 << 3;
+
+// Subtrees smaller than this are not worth a task of their own
+constexpr std::size_t blake3_parallel_grain = 256 * 1024;
+
+constexpr std::uint32_t blake3_iv[8] = {0x6A09E667, 0xBB67AE85, 0x3C6EF372,
+                                        0xA54FF53A, 0x510E527F, 0x9B05688C,
+                                        0x1F83D9AB, 0x5BE0CD19};
+
+constexpr std::uint8_t blake3_schedule[7][16] = {
+    {0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15},
+    {2, 6, 3, 10, 7, 0, 4, 13, 1, 11, 12, 5, 9, 14, 15, 8},
+    {3, 4, 10, 12, 13, 2, 7, 14, 6, 5, 9, 0, 11, 15, 8, 1},
+    {10, 7, 12, 9, 14, 3, 13, 15, 4, 0, 11, 2, 5, 8, 1, 6},
+    {12, 13, 9, 11, 15, 10, 14, 8, 7, 2, 5, 3, 0, 1, 6, 4},
+    {9, 14, 11, 5, 8, 12, 15, 1, 13, 3, 0, 10, 2, 6, 4, 7},
+    {11, 15, 5, 0, 1, 9, 8, 6, 14, 10, 2, 12, 3, 4, 7, 13},
+};
+
+using Blake3Cv = std::array<std::uint32_t, 8>;
+
+__attribute__((always_inline)) inline void blake3_g(
+    std::uint32_t *v, std::size_t a, std::size_t b, std::size_t c,
+    std::size_t d, std::uint32_t x, std::uint32_t y) {
+  v[a] += v[b] + x;
+  v[d] = std::rotr(v[d] ^ v[a], 16);
+  v[c] += v[d];
+  v[b] = std::rotr(v[b] ^ v[c], 12);
+  v[a] += v[b] + y;
+  v[d] = std::rotr(v[d] ^ v[a], 8);
+  v[c] += v[d];
+  v[b] = std::rotr(v[b] ^ v[c], 7);
+}
+
+std::array<std::uint32_t, 16> blake3_compress(const Blake3Cv &cv,
+                                              const std::uint8_t *block,
+                                              std::uint32_t block_size,
+                                              std::uint64_t counter,
+                                              std::uint32_t flags) {
+  std::uint32_t m[16];
+  for (std::size_t i = 0; i < 16; ++i) {
+    m[i] = read_le32(block + 4 * i);
+  }
+
+  std::array<std::uint32_t, 16> v = {cv[0],
+                                     cv[1],
+                                     cv[2],
+                                     cv[3],
+                                     cv[4],
+                                     cv[5],
+                                     cv[6],
+                                     cv[7],
+                                     blake3_iv[0],
+                                     blake3_iv[1],
+                                     blake3_iv[2],
+                                     blake3_iv[3],
+                                     static_cast<std::uint32_t>(counter),
+                                     static_cast<std::uint32_t>(counter >> 32),
+                                     block_size,
+                                     flags};
+
+#pragma GCC unroll 7
+  for (const auto &s : blake3_schedule) {
+    blake3_g(std::data(v), 0, 4, 8, 12, m[s[0]], m[s[1]]);
+    blake3_g(std::data(v), 1, 5, 9, 13, m[s[2]], m[s[3]]);
+    blake3_g(std::data(v), 2, 6, 10, 14, m[s[4]], m[s[5]]);
+    blake3_g(std::data(v), 3, 7, 11, 15, m[s[6]], m[s[7]]);
+    blake3_g(std::data(v), 0, 5, 10, 15, m[s[8]], m[s[9]]);
+    blake3_g(std::data(v), 1, 6, 11, 12, m[s[10]], m[s[11]]);
+    blake3_g(std::data(v), 2, 7, 8, 13, m[s[12]], m[s[13]]);
+    blake3_g(std::data(v), 3, 4, 9, 14, m[s[14]], m[s[15]]);
+  }
+
+  return v;
+}
+
+Blake3Cv blake3_truncate(const std::array<std::uint32_t, 16> &v) {
+  Blake3Cv cv;
+  for (std::size_t i = 0; i < 8; ++i) {
+    cv[i] = v[i] ^ v[i + 8];
+  }
+  return cv;
+}
+
+// The last compression of a node, it is kept unevaluated until we know
+// whether the node is the root
+struct Blake3Output {
+  [[nodiscard]] Blake3Cv chaining_value() const {
+    return blake3_truncate(
+        blake3_compress(cv, std::data(block), block_size, counter, flags));
+  }
+
+  [[nodiscard]] std::vector<std::uint8_t> root() const {
+    auto words = blake3_truncate(blake3_compress(
+        cv, std::data(block), block_size, 0, flags | blake3_root));
+
+    std::vector<std::uint8_t> digest(blake3_digest_size);
+    for (std::size_t i = 0; i < 8; ++i) {
+      for (std::size_t j = 0; j < 4; ++j) {
+        digest[4 * i + j] = static_cast<std::uint8_t>(words[i] >> (8 * j));
+      }
+    }
+    return digest;
+  }
+
+  Blake3Cv cv;
+  std::array<std::uint8_t, blake3_block_size> block;
+  std::uint32_t block_size;
+  std::uint64_t counter;
+  std::uint32_t flags;
+};
+
+Blake3Output blake3_parent_output(const Blake3Cv &left,
+                                  const Blake3Cv &right) {
+  Blake3Output output = {Blake3Cv(), {}, blake3_block_size, 0, blake3_parent};
+  std::copy(std::begin(blake3_iv), std::end(blake3_iv), std::begin(output.cv));
+  for (std::size_t i = 0; i < 8; ++i) {
+    for (std::size_t j = 0; j < 4; ++j) {
+      output.block[4 * i + j] = static_cast<std::uint8_t>(left[i] >> (8 * j));
+      output.block[32 + 4 * i + j] =
+          static_cast<std::uint8_t>(right[i] >> (8 * j));
+    }
+  }
+  return output;
+}
+
+Blake3Cv blake3_parent_cv(const Blake3Cv &left, const Blake3Cv &right) {
+  return blake3_parent_output(left, right).chaining_value();
+}
+
+Blake3Cv blake3_chunk_cv(const std::uint8_t *input, std::uint64_t counter) {
+  Blake3Cv cv;
+  std::copy(std::begin(blake3_iv), std::end(blake3_iv), std::begin(cv));
+
+  for (std::size_t i = 0; i < blake3_chunk_size / blake3_block_size; ++i) {
+    std::uint32_t flags = 0;
+    if (i == 0) {
+      flags |= blake3_chunk_start;
+    }
+    if (i == blake3_chunk_size / blake3_block_size - 1) {
+      flags |= blake3_chunk_end;
+    }
+
+    cv = blake3_truncate(blake3_compress(cv, input + i * blake3_block_size,
+                                         blake3_block_size, counter, flags));
+  }
+
+  return cv;
+}
+
+#ifdef __x86_64__
+__attribute__((target("avx2"))) __m256i blake3_rotr16(__m256i x) {
+  return _mm256_shuffle_epi8(
+      x, _mm256_setr_epi8(2, 3, 0, 1, 6, 7, 4, 5, 10, 11, 8, 9, 14, 15, 12, 13,
+                          2, 3, 0, 1, 6, 7, 4, 5, 10, 11, 8, 9, 14, 15, 12,
+                          13));
+}
+
+__attribute__((target("avx2"))) __m256i blake3_rotr8(__m256i x) {
+  return _mm256_shuffle_epi8(
+      x, _mm256_setr_epi8(1, 2, 3, 0, 5, 6, 7, 4, 9, 10, 11, 8, 13, 14, 15, 12,
+                          1, 2, 3, 0, 5, 6, 7, 4, 9, 10, 11, 8, 13, 14, 15,
+                          12));
+}
+
+__attribute__((target("avx2"))) __m256i blake3_rotr12(__m256i x) {
+  return _mm256_or_si256(_mm256_srli_epi32(x, 12), _mm256_slli_epi32(x, 20));
+}
+
+__attribute__((target("avx2"))) __m256i blake3_rotr7(__m256i x) {
+  return _mm256_or_si256(_mm256_srli_epi32(x, 7), _mm256_slli_epi32(x, 25));
+}
+
+// The 4 column or diagonal G functions are interleaved step by step, which
+// keeps the dependency chains short
+__attribute__((target("avx2"), always_inline)) inline void blake3_g4_avx2(
+    __m256i *v, const std::size_t (&index)[4][4], const __m256i *x,
+    const __m256i *y) {
+#pragma GCC unroll 4
+  for (std::size_t i = 0; i < 4; ++i) {
+    auto [a, b, c, d] = index[i];
+    v[a] = _mm256_add_epi32(_mm256_add_epi32(v[a], x[i]), v[b]);
+  }
+#pragma GCC unroll 4
+  for (std::size_t i = 0; i < 4; ++i) {
+    auto [a, b, c, d] = index[i];
+    v[d] = blake3_rotr16(_mm256_xor_si256(v[d], v[a]));
+  }
+#pragma GCC unroll 4
+  for (std::size_t i = 0; i < 4; ++i) {
+    auto [a, b, c, d] = index[i];
+    v[c] = _mm256_add_epi32(v[c], v[d]);
+  }
+#pragma GCC unroll 4
+  for (std::size_t i = 0; i < 4; ++i) {
+    auto [a, b, c, d] = index[i];
+    v[b] = blake3_rotr12(_mm256_xor_si256(v[b], v[c]));
+  }
+#pragma GCC unroll 4
+  for (std::size_t i = 0; i < 4; ++i) {
+    auto [a, b, c, d] = index[i];
+    v[a] = _mm256_add_epi32(_mm256_add_epi32(v[a], y[i]), v[b]);
+  }
+#pragma GCC unroll 4
+  for (std::size_t i = 0; i < 4; ++i) {
+    auto [a, b, c, d] = index[i];
+    v[d] = blake3_rotr8(_mm256_xor_si256(v[d], v[a]));
+  }
+#pragma GCC unroll 4
+  for (std::size_t i = 0; i < 4; ++i) {
+    auto [a, b, c, d] = index[i];
+    v[c] = _mm256_add_epi32(v[c], v[d]);
+  }
+#pragma GCC unroll 4
+  for (std::size_t i = 0; i < 4; ++i) {
+    auto [a, b, c, d] = index[i];
+    v[b] = blake3_rotr7(_mm256_xor_si256(v[b], v[c]));
+  }
+}
+
+// After the transpose, row i holds word i of each of the 8 input rows
+__attribute__((target("avx2"))) void blake3_transpose(__m256i *rows) {
+  __m256i t[8];
+  for (std::size_t i = 0; i < 8; i += 2) {
+    t[i] = _mm256_unpacklo_epi32(rows[i], rows[i + 1]);
+    t[i + 1] = _mm256_unpackhi_epi32(rows[i], rows[i + 1]);
+  }
+
+  __m256i u[8];
+  for (std::size_t i = 0; i < 8; i += 4) {
+    u[i] = _mm256_unpacklo_epi64(t[i], t[i + 2]);
+    u[i + 1] = _mm256_unpackhi_epi64(t[i], t[i + 2]);
+    u[i + 2] = _mm256_unpacklo_epi64(t[i + 1], t[i + 3]);
+    u[i + 3] = _mm256_unpackhi_epi64(t[i + 1], t[i + 3]);
+  }
+
+  for (std::size_t i = 0; i < 4; ++i) {
+    rows[i] = _mm256_permute2x128_si256(u[i], u[i + 4], 0x20);
+    rows[i + 4] = _mm256_permute2x128_si256(u[i], u[i + 4], 0x31);
+  }
+}
+
+// Hash 8 consecutive chunks at once, one chunk in each 32-bit lane
+__attribute__((target("avx2"))) void blake3_hash8_avx2(
+    const std::uint8_t *input, std::uint64_t counter, Blake3Cv *cvs) {
+  __m256i h[8];
+  for (std::size_t i = 0; i < 8; ++i) {
+    h[i] = _mm256_set1_epi32(static_cast<std::int32_t>(blake3_iv[i]));
+  }
+
+  alignas(32) std::uint32_t counter_low[8];
+  alignas(32) std::uint32_t counter_high[8];
+  for (std::size_t i = 0; i < 8; ++i) {
+    counter_low[i] = static_cast<std::uint32_t>(counter + i);
+    counter_high[i] = static_cast<std::uint32_t>((counter + i) >> 32);
+  }
+
+  for (std::size_t block = 0; block < blake3_chunk_size / blake3_block_size;
+       ++block) {
+    __m256i m[16];
+    for (std::size_t half = 0; half < 2; ++half) {
+      for (std::size_t lane = 0; lane < 8; ++lane) {
+        m[8 * half + lane] =
+            _mm256_loadu_si256(reinterpret_cast<const __m256i *>(
+                input + lane * blake3_chunk_size + block * blake3_block_size +
+                32 * half));
+      }
+      blake3_transpose(m + 8 * half);
+    }
+
+    std::uint32_t flags = 0;
+    if (block == 0) {
+      flags |= blake3_chunk_start;
+    }
+    if (block == blake3_chunk_size / blake3_block_size - 1) {
+      flags |= blake3_chunk_end;
+    }
+
+    __m256i v[16] = {
+        h[0],
+        h[1],
+        h[2],
+        h[3],
+        h[4],
+        h[5],
+        h[6],
+        h[7],
+        _mm256_set1_epi32(static_cast<std::int32_t>(blake3_iv[0])),
+        _mm256_set1_epi32(static_cast<std::int32_t>(blake3_iv[1])),
+        _mm256_set1_epi32(static_cast<std::int32_t>(blake3_iv[2])),
+        _mm256_set1_epi32(static_cast<std::int32_t>(blake3_iv[3])),
+        _mm256_load_si256(reinterpret_cast<const __m256i *>(counter_low)),
+        _mm256_load_si256(reinterpret_cast<const __m256i *>(counter_high)),
+        _mm256_set1_epi32(static_cast<std::int32_t>(blake3_block_size)),
+        _mm256_set1_epi32(static_cast<std::int32_t>(flags))};
+
+#pragma GCC unroll 7
+    for (const auto &s : blake3_schedule) {
+      constexpr std::size_t columns[4][4] = {
+          {0, 4, 8, 12}, {1, 5, 9, 13}, {2, 6, 10, 14}, {3, 7, 11, 15}};
+      constexpr std::size_t diagonals[4][4] = {
+          {0, 5, 10, 15}, {1, 6, 11, 12}, {2, 7, 8, 13}, {3, 4, 9, 14}};
+
+      __m256i x[4] = {m[s[0]], m[s[2]], m[s[4]], m[s[6]]};
+      __m256i y[4] = {m[s[1]], m[s[3]], m[s[5]], m[s[7]]};
+      blake3_g4_avx2(v, columns, x, y);
+
+      x[0] = m[s[8]], x[1] = m[s[10]], x[2] = m[s[12]], x[3] = m[s[14]];
+      y[0] = m[s[9]], y[1] = m[s[11]], y[2] = m[s[13]], y[3] = m[s[15]];
+      blake3_g4_avx2(v, diagonals, x, y);
+    }
+
+    for (std::size_t i = 0; i < 8; ++i) {
+      h[i] = _mm256_xor_si256(v[i], v[i + 8]);
+    }
+  }
+
+  blake3_transpose(h);
+  for (std::size_t i = 0; i < 8; ++i) {
+    _mm256_storeu_si256(reinterpret_cast<__m256i *>(std::data(cvs[i])), h[i]);
+  }
+}
+#endif
+
+// The chaining value of a complete subtree, chunks is a power of 2
+Blake3Cv blake3_subtree_cv(const std::uint8_t *input, std::size_t chunks,
+                           std::uint64_t counter) {
+  if (chunks == 1) {
+    return blake3_chunk_cv(input, counter);
+  }
+
+#ifdef __x86_64__
+  if (chunks == 8 && has_avx2()) {
+    Blake3Cv cvs[8];
+    blake3_hash8_avx2(input, counter, cvs);
+    for (std::size_t size = 8; size > 1; size /= 2) {
+      for (std::size_t i = 0; i < size / 2; ++i) {
+        cvs[i] = blake3_parent_cv(cvs[2 * i], cvs[2 * i + 1]);
+      }
+    }
+    return cvs[0];
+  }
+#endif
+
+  auto half = chunks / 2;
+  return blake3_parent_cv(
+      blake3_subtree_cv(input, half, counter),
+      blake3_subtree_cv(input + half * blake3_chunk_size, half,
+                        counter + half));
+}
+
+// Large subtrees are split into equal subtrees that are hashed in parallel,
+// then their chaining values are merged level by level
+Blake3Cv blake3_subtree_cv(const std::uint8_t *input, std::size_t chunks,
+                           std::uint64_t counter, std::size_t threads) {
+  if (threads == 0) {
+    threads = std::max(std::thread::hardware_concurrency(), 1U);
+  }
+
+  auto parts = std::min(std::bit_floor(chunks * blake3_chunk_size /
+                                       blake3_parallel_grain),
+                        4 * std::bit_ceil(threads));
+  if (threads == 1 || parts < 2) {
+    return blake3_subtree_cv(input, chunks, counter);
+  }
+
+  auto part_chunks = chunks / parts;
+  std::vector<Blake3Cv> cvs(parts);
+  parallel_for(parts, threads, [&](std::size_t index) {
+    cvs[index] = blake3_subtree_cv(
+        input + index * part_chunks * blake3_chunk_size, part_chunks,
+        counter + index * part_chunks);
+  });
+
+  for (auto size = parts; size > 1; size /= 2) {
+    for (std::size_t i = 0; i < size / 2; ++i) {
+      cvs[i] = blake3_parent_cv(cvs[2 * i], cvs[2 * i + 1]);
+    }
+  }
+  return cvs.front();
+}
+
+class Blake3Chunk {
+ public:
+  explicit Blake3Chunk(std::uint64_t counter) : counter_(counter) {
+    std::copy(std::begin(blake3_iv), std::end(blake3_iv), std::begin(cv_));
+  }
+
+  [[nodiscard]] std::uint64_t counter() const { return counter_; }
+
+  [[nodiscard]] std::size_t size() const {
+    return blocks_compressed_ * blake3_block_size + block_size_;
+  }
+
+  void update(const std::uint8_t *input, std::size_t size) {
+    while (size > 0) {
+      if (block_size_ == blake3_block_size) {
+        cv_ = blake3_truncate(blake3_compress(cv_, std::data(block_),
+                                              blake3_block_size, counter_,
+                                              start_flag()));
+        ++blocks_compressed_;
+        block_size_ = 0;
+      }
+
+      auto count = std::min(blake3_block_size - block_size_, size);
+      std::memcpy(std::data(block_) + block_size_, input, count);
+      block_size_ += count;
+      input += count;
+      size -= count;
+    }
+  }
+
+  [[nodiscard]] Blake3Output output() const {
+    auto block = block_;
+    std::fill(std::begin(block) + block_size_, std::end(block), 0);
+    return {cv_, block, static_cast<std::uint32_t>(block_size_), counter_,
+            start_flag() | blake3_chunk_end};
+  }
+
+ private:
+  [[nodiscard]] std::uint32_t start_flag() const {
+    return blocks_compressed_ == 0 ? blake3_chunk_start : 0;
+  }
+
+  Blake3Cv cv_;
+  std::uint64_t counter_;
+  std::array<std::uint8_t, blake3_block_size> block_ = {};
+  std::size_t block_size_ = 0;
+  std::size_t blocks_compressed_ = 0;
+};
+
+// Streaming BLAKE3, the input is split into the largest complete subtrees that
+// fit, and their chaining values are kept on a stack. Merging is delayed until
+// more input arrives, since the last node has to be finalized as the root
+class Blake3 {
+ public:
+  explicit Blake3(std::size_t threads) : threads_(threads) {}
+
+  void update(const std::uint8_t *input, std::size_t size) {
+    if (chunk_.size() > 0) {
+      auto count = std::min(blake3_chunk_size - chunk_.size(), size);
+      chunk_.update(input, count);
+      input += count;
+      size -= count;
+      if (size == 0) {
+        return;
+      }
+
+      push(chunk_.output().chaining_value(), chunk_.counter());
+      chunk_ = Blake3Chunk(chunk_.counter() + 1);
+    }
+
+    while (size > blake3_chunk_size) {
+      auto counter = chunk_.counter();
+      auto subtree_size = std::bit_floor(size);
+      while (((subtree_size - 1) & (counter * blake3_chunk_size)) != 0) {
+        subtree_size /= 2;
+      }
+
+      auto chunks = subtree_size / blake3_chunk_size;
+      if (chunks == 1) {
+        push(blake3_chunk_cv(input, counter), counter);
+      } else {
+        // Push both halves, the subtree may turn out to be the whole input
+        auto half = chunks / 2;
+        push(blake3_subtree_cv(input, half, counter, threads_), counter);
+        push(blake3_subtree_cv(input + half * blake3_chunk_size, half,
+                               counter + half, threads_),
+             counter + half);
+      }
+
+      chunk_ = Blake3Chunk(counter + chunks);
+      input += subtree_size;
+      size -= subtree_size;
+    }
+
+    if (size > 0) {
+      chunk_.update(input, size);
+      merge(chunk_.counter());
+    }
+  }
+
+  [[nodiscard]] std::vector<std::uint8_t> finalize() const {
+    if (std::empty(stack_)) {
+      return chunk_.output().root();
+    }
+
+    auto remaining = std::size(stack_);
+    Blake3Output output;
+    if (chunk_.size() > 0) {
+      output = chunk_.output();
+    } else {
+      remaining -= 2;
+      output = blake3_parent_output(stack_[remaining], stack_[remaining + 1]);
+    }
+
+    while (remaining > 0) {
+      --remaining;
+      output = blake3_parent_output(stack_[remaining], output.chaining_value());
+    }
+
+    return output.root();
+  }
+
+ private:
+  void push(const Blake3Cv &cv, std::uint64_t counter) {
+    merge(counter);
+    stack_.push_back(cv);
+  }
+
+  // A stack entry for every 1 bit of the number of chunks hashed so far
+  void merge(std::uint64_t chunks) {
+    auto size = static_cast<std::size_t>(std::popcount(chunks));
+    while (std::size(stack_) > size) {
+      auto right = stack_.back();
+      stack_.pop_back();
+      stack_.back() = blake3_parent_cv(stack_.back(), right);
+    }
+  }
+
+  std::size_t threads_;
+  Blake3Chunk chunk_ = Blake3Chunk(0);
+  std::vector<Blake3Cv> stack_;
+};
+
+}  // namespace
+
+std::string blake3(const std::string &str, std::size_t threads) {
+  return hex_encode(blake3_raw(str, threads));
+}
+
+std::vector<std::uint8_t> blake3_raw(const std::string &str,
+                                     std::size_t threads) {
+  Blake3 blake3(threads);
+  blake3.update(as_bytes(str), std::size(str));
+  return blake3.finalize();
+}
+
+std::string blake3_file(const std::string &path, std::size_t threads) {
+  Blake3 blake3(threads);
+  update_file(blake3, path);
+  return hex_encode(blake3.finalize());
+}
+
+}  // namespace klib
@@ -0,0 +1,544 @@
+#include "klib/util.h"
+
+#ifdef __x86_64__
+#include <immintrin.h>
+#endif
+
+#include <algorithm>
+#include <array>
+#include <bit>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include "../detail.h"
+
+namespace klib {
+
+namespace {
+
+using detail::as_bytes;
+using detail::has_avx2;
+using detail::read_le32;
+using detail::read_le64;
+using detail::update_file;
+using detail::write_be64;
+
+// https://github.com/Cyan4973/xxHash/blob/dev/doc/xxhash_spec.md
+constexpr std::uint64_t xxh_prime32_1 = 0x9E3779B1U;
+constexpr std::uint64_t xxh_prime32_2 = 0x85EBCA77U;
+constexpr std::uint64_t xxh_prime32_3 = 0xC2B2AE3DU;
+constexpr std::uint64_t xxh_prime64_1 = 0x9E3779B185EBCA87ULL;
+constexpr std::uint64_t xxh_prime64_2 = 0xC2B2AE3D27D4EB4FULL;
+constexpr std::uint64_t xxh_prime64_3 = 0x165667B19E3779F9ULL;
+constexpr std::uint64_t xxh_prime64_4 = 0x85EBCA77C2B2AE63ULL;
+constexpr std::uint64_t xxh_prime64_5 = 0x27D4EB2F165667C5ULL;
+constexpr std::uint64_t xxh_prime_mx1 = 0x165667919E3779F9ULL;
+constexpr std::uint64_t xxh_prime_mx2 = 0x9FB21C651E98DF25ULL;
+
+constexpr std::size_t xxh3_stripe_size = 64;
+constexpr std::size_t xxh3_secret_size = 192;
+constexpr std::size_t xxh3_stripes_per_block =
+    (xxh3_secret_size - xxh3_stripe_size) / 8;
+constexpr std::size_t xxh3_buffer_size = 4 * xxh3_stripe_size;
+constexpr std::size_t xxh3_midsize_max = 240;
+
+alignas(64) constexpr std::uint8_t xxh3_secret[xxh3_secret_size] = {
+    0xb8, 0xfe, 0x6c, 0x39, 0x23, 0xa4, 0x4b, 0xbe, 0x7c, 0x01, 0x81, 0x2c,
+    0xf7, 0x21, 0xad, 0x1c, 0xde, 0xd4, 0x6d, 0xe9, 0x83, 0x90, 0x97, 0xdb,
+    0x72, 0x40, 0xa4, 0xa4, 0xb7, 0xb3, 0x67, 0x1f, 0xcb, 0x79, 0xe6, 0x4e,
+    0xcc, 0xc0, 0xe5, 0x78, 0x82, 0x5a, 0xd0, 0x7d, 0xcc, 0xff, 0x72, 0x21,
+    0xb8, 0x08, 0x46, 0x74, 0xf7, 0x43, 0x24, 0x8e, 0xe0, 0x35, 0x90, 0xe6,
+    0x81, 0x3a, 0x26, 0x4c, 0x3c, 0x28, 0x52, 0xbb, 0x91, 0xc3, 0x00, 0xcb,
+    0x88, 0xd0, 0x65, 0x8b, 0x1b, 0x53, 0x2e, 0xa3, 0x71, 0x64, 0x48, 0x97,
+    0xa2, 0x0d, 0xf9, 0x4e, 0x38, 0x19, 0xef, 0x46, 0xa9, 0xde, 0xac, 0xd8,
+    0xa8, 0xfa, 0x76, 0x3f, 0xe3, 0x9c, 0x34, 0x3f, 0xf9, 0xdc, 0xbb, 0xc7,
+    0xc7, 0x0b, 0x4f, 0x1d, 0x8a, 0x51, 0xe0, 0x4b, 0xcd, 0xb4, 0x59, 0x31,
+    0xc8, 0x9f, 0x7e, 0xc9, 0xd9, 0x78, 0x73, 0x64, 0xea, 0xc5, 0xac, 0x83,
+    0x34, 0xd3, 0xeb, 0xc3, 0xc5, 0x81, 0xa0, 0xff, 0xfa, 0x13, 0x63, 0xeb,
+    0x17, 0x0d, 0xdd, 0x51, 0xb7, 0xf0, 0xda, 0x49, 0xd3, 0x16, 0x55, 0x26,
+    0x29, 0xd4, 0x68, 0x9e, 0x2b, 0x16, 0xbe, 0x58, 0x7d, 0x47, 0xa1, 0xfc,
+    0x8f, 0xf8, 0xb8, 0xd1, 0x7a, 0xd0, 0x31, 0xce, 0x45, 0xcb, 0x3a, 0x8f,
+    0x95, 0x16, 0x04, 0x28, 0xaf, 0xd7, 0xfb, 0xca, 0xbb, 0x4b, 0x40, 0x7e,
+};
+
+struct Xxh3Hash128 {
+  std::uint64_t low;
+  std::uint64_t high;
+};
+
+Xxh3Hash128 mult64to128(std::uint64_t lhs, std::uint64_t rhs) {
+  __extension__ using Uint128 = unsigned __int128;
+  auto product = static_cast<Uint128>(lhs) * rhs;
+  return {static_cast<std::uint64_t>(product),
+          static_cast<std::uint64_t>(product >> 64)};
+}
+
+std::uint64_t mul128_fold64(std::uint64_t lhs, std::uint64_t rhs) {
+  auto product = mult64to128(lhs, rhs);
+  return product.low ^ product.high;
+}
+
+std::uint64_t xorshift64(std::uint64_t value, std::int32_t shift) {
+  return value ^ (value >> shift);
+}
+
+std::uint64_t xxh64_avalanche(std::uint64_t hash) {
+  hash = xorshift64(hash, 33) * xxh_prime64_2;
+  hash = xorshift64(hash, 29) * xxh_prime64_3;
+  return xorshift64(hash, 32);
+}
+
+std::uint64_t xxh3_avalanche(std::uint64_t hash) {
+  hash = xorshift64(hash, 37) * xxh_prime_mx1;
+  return xorshift64(hash, 32);
+}
+
+std::uint64_t xxh3_rrmxmx(std::uint64_t hash, std::uint64_t len) {
+  hash ^= std::rotl(hash, 49) ^ std::rotl(hash, 24);
+  hash *= xxh_prime_mx2;
+  hash ^= (hash >> 35) + len;
+  hash *= xxh_prime_mx2;
+  return xorshift64(hash, 28);
+}
+
+std::uint64_t xxh3_mix16(const std::uint8_t *input,
+                         const std::uint8_t *secret) {
+  return mul128_fold64(read_le64(input) ^ read_le64(secret),
+                       read_le64(input + 8) ^ read_le64(secret + 8));
+}
+
+Xxh3Hash128 xxh3_mix32(Xxh3Hash128 acc, const std::uint8_t *input_1,
+                       const std::uint8_t *input_2,
+                       const std::uint8_t *secret) {
+  acc.low += xxh3_mix16(input_1, secret);
+  acc.low ^= read_le64(input_2) + read_le64(input_2 + 8);
+  acc.high += xxh3_mix16(input_2, secret + 16);
+  acc.high ^= read_le64(input_1) + read_le64(input_1 + 8);
+  return acc;
+}
+
+// Inputs of at most 240 bytes are hashed without the accumulators, the seed
+// is always 0
+std::uint64_t xxh3_64_short(const std::uint8_t *input, std::size_t len) {
+  const auto *secret = xxh3_secret;
+
+  if (len > 128) {
+    auto acc = len * xxh_prime64_1;
+    for (std::size_t i = 0; i < 8; ++i) {
+      acc += xxh3_mix16(input + 16 * i, secret + 16 * i);
+    }
+    acc = xxh3_avalanche(acc);
+
+    auto acc_end = xxh3_mix16(input + len - 16, secret + 136 - 17);
+    for (std::size_t i = 8; i < len / 16; ++i) {
+      acc_end += xxh3_mix16(input + 16 * i, secret + 16 * (i - 8) + 3);
+    }
+    return xxh3_avalanche(acc + acc_end);
+  }
+
+  if (len > 16) {
+    auto acc = len * xxh_prime64_1;
+    for (auto i = (len - 1) / 32 + 1; i-- > 0;) {
+      acc += xxh3_mix16(input + 16 * i, secret + 32 * i);
+      acc += xxh3_mix16(input + len - 16 * (i + 1), secret + 32 * i + 16);
+    }
+    return xxh3_avalanche(acc);
+  }
+
+  if (len > 8) {
+    auto low = read_le64(input) ^ (read_le64(secret + 24) ^
+                                   read_le64(secret + 32));
+    auto high = read_le64(input + len - 8) ^
+                (read_le64(secret + 40) ^ read_le64(secret + 48));
+    return xxh3_avalanche(len + __builtin_bswap64(low) + high +
+                          mul128_fold64(low, high));
+  }
+
+  if (len >= 4) {
+    auto input64 = read_le32(input + len - 4) +
+                   (static_cast<std::uint64_t>(read_le32(input)) << 32);
+    auto bitflip = read_le64(secret + 8) ^ read_le64(secret + 16);
+    return xxh3_rrmxmx(input64 ^ bitflip, len);
+  }
+
+  if (len > 0) {
+    auto combined = (static_cast<std::uint32_t>(input[0]) << 16) |
+                    (static_cast<std::uint32_t>(input[len >> 1]) << 24) |
+                    static_cast<std::uint32_t>(input[len - 1]) |
+                    (static_cast<std::uint32_t>(len) << 8);
+    std::uint64_t bitflip = read_le32(secret) ^ read_le32(secret + 4);
+    return xxh64_avalanche(combined ^ bitflip);
+  }
+
+  return xxh64_avalanche(read_le64(secret + 56) ^ read_le64(secret + 64));
+}
+
+Xxh3Hash128 xxh3_128_short(const std::uint8_t *input, std::size_t len) {
+  const auto *secret = xxh3_secret;
+
+  auto finish = [len](Xxh3Hash128 acc) {
+    Xxh3Hash128 hash = {acc.low + acc.high,
+                        acc.low * xxh_prime64_1 + acc.high * xxh_prime64_4 +
+                            len * xxh_prime64_2};
+    return Xxh3Hash128{xxh3_avalanche(hash.low),
+                       0 - xxh3_avalanche(hash.high)};
+  };
+
+  if (len > 128) {
+    Xxh3Hash128 acc = {len * xxh_prime64_1, 0};
+    for (std::size_t i = 32; i < 160; i += 32) {
+      acc = xxh3_mix32(acc, input + i - 32, input + i - 16, secret + i - 32);
+    }
+    acc = {xxh3_avalanche(acc.low), xxh3_avalanche(acc.high)};
+    for (std::size_t i = 160; i <= len; i += 32) {
+      acc = xxh3_mix32(acc, input + i - 32, input + i - 16,
+                       secret + 3 + i - 160);
+    }
+    acc = xxh3_mix32(acc, input + len - 16, input + len - 32,
+                     secret + 136 - 17 - 16);
+    return finish(acc);
+  }
+
+  if (len > 16) {
+    Xxh3Hash128 acc = {len * xxh_prime64_1, 0};
+    for (auto i = (len - 1) / 32 + 1; i-- > 0;) {
+      acc = xxh3_mix32(acc, input + 16 * i, input + len - 16 * (i + 1),
+                       secret + 32 * i);
+    }
+    return finish(acc);
+  }
+
+  if (len > 8) {
+    auto bitflip_low = read_le64(secret + 32) ^ read_le64(secret + 40);
+    auto bitflip_high = read_le64(secret + 48) ^ read_le64(secret + 56);
+    auto input_low = read_le64(input);
+    auto input_high = read_le64(input + len - 8);
+
+    auto m128 =
+        mult64to128(input_low ^ input_high ^ bitflip_low, xxh_prime64_1);
+    m128.low += static_cast<std::uint64_t>(len - 1) << 54;
+    input_high ^= bitflip_high;
+    m128.high += input_high + static_cast<std::uint32_t>(input_high) *
+                                  (xxh_prime32_2 - 1);
+    m128.low ^= __builtin_bswap64(m128.high);
+
+    auto hash = mult64to128(m128.low, xxh_prime64_2);
+    hash.high += m128.high * xxh_prime64_2;
+    return {xxh3_avalanche(hash.low), xxh3_avalanche(hash.high)};
+  }
+
+  if (len >= 4) {
+    auto input64 = read_le32(input) +
+                   (static_cast<std::uint64_t>(read_le32(input + len - 4))
+                    << 32);
+    auto bitflip = read_le64(secret + 16) ^ read_le64(secret + 24);
+
+    auto m128 = mult64to128(input64 ^ bitflip, xxh_prime64_1 + (len << 2));
+    m128.high += m128.low << 1;
+    m128.low ^= m128.high >> 3;
+    m128.low = xorshift64(xorshift64(m128.low, 35) * xxh_prime_mx2, 28);
+    m128.high = xxh3_avalanche(m128.high);
+    return m128;
+  }
+
+  if (len > 0) {
+    auto combined_low = (static_cast<std::uint32_t>(input[0]) << 16) |
+                        (static_cast<std::uint32_t>(input[len >> 1]) << 24) |
+                        static_cast<std::uint32_t>(input[len - 1]) |
+                        (static_cast<std::uint32_t>(len) << 8);
+    auto combined_high = std::rotl(__builtin_bswap32(combined_low), 13);
+    std::uint64_t bitflip_low = read_le32(secret) ^ read_le32(secret + 4);
+    std::uint64_t bitflip_high = read_le32(secret + 8) ^ read_le32(secret + 12);
+    return {xxh64_avalanche(combined_low ^ bitflip_low),
+            xxh64_avalanche(combined_high ^ bitflip_high)};
+  }
+
+  return {xxh64_avalanche(read_le64(secret + 64) ^ read_le64(secret + 72)),
+          xxh64_avalanche(read_le64(secret + 80) ^ read_le64(secret + 88))};
+}
+
+using Xxh3Accumulate = void (*)(std::uint64_t *acc, const std::uint8_t *input,
+                                const std::uint8_t *secret,
+                                std::size_t stripes);
+using Xxh3Scramble = void (*)(std::uint64_t *acc, const std::uint8_t *secret);
+
+void xxh3_accumulate_scalar(std::uint64_t *acc, const std::uint8_t *input,
+                            const std::uint8_t *secret, std::size_t stripes) {
+  for (std::size_t i = 0; i < stripes; ++i) {
+    const auto *stripe = input + i * xxh3_stripe_size;
+    const auto *key = secret + i * 8;
+
+    for (std::size_t lane = 0; lane < 8; ++lane) {
+      auto data = read_le64(stripe + lane * 8);
+      auto data_key = data ^ read_le64(key + lane * 8);
+      acc[lane ^ 1] += data;
+      acc[lane] += (data_key & 0xFFFFFFFF) * (data_key >> 32);
+    }
+  }
+}
+
+void xxh3_scramble_scalar(std::uint64_t *acc, const std::uint8_t *secret) {
+  for (std::size_t lane = 0; lane < 8; ++lane) {
+    acc[lane] = (xorshift64(acc[lane], 47) ^ read_le64(secret + lane * 8)) *
+                xxh_prime32_1;
+  }
+}
+
+#ifdef __x86_64__
+__attribute__((target("avx2"))) __m256i xxh3_round_avx2(
+    __m256i acc, const std::uint8_t *input, const std::uint8_t *secret) {
+  auto data = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(input));
+  auto key = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(secret));
+  auto data_key = _mm256_xor_si256(data, key);
+  auto product = _mm256_mul_epu32(data_key, _mm256_srli_epi64(data_key, 32));
+  auto swapped = _mm256_shuffle_epi32(data, _MM_SHUFFLE(1, 0, 3, 2));
+  return _mm256_add_epi64(product, _mm256_add_epi64(acc, swapped));
+}
+
+__attribute__((target("avx2"))) void xxh3_accumulate_avx2(
+    std::uint64_t *acc, const std::uint8_t *input, const std::uint8_t *secret,
+    std::size_t stripes) {
+  auto *acc_vec = reinterpret_cast<__m256i *>(acc);
+  auto acc_0 = _mm256_loadu_si256(acc_vec);
+  auto acc_1 = _mm256_loadu_si256(acc_vec + 1);
+
+  for (std::size_t i = 0; i < stripes; ++i) {
+    const auto *stripe = input + i * xxh3_stripe_size;
+    const auto *key = secret + i * 8;
+    acc_0 = xxh3_round_avx2(acc_0, stripe, key);
+    acc_1 = xxh3_round_avx2(acc_1, stripe + 32, key + 32);
+  }
+
+  _mm256_storeu_si256(acc_vec, acc_0);
+  _mm256_storeu_si256(acc_vec + 1, acc_1);
+}
+
+__attribute__((target("avx2"))) void xxh3_scramble_avx2(
+    std::uint64_t *acc, const std::uint8_t *secret) {
+  auto *acc_vec = reinterpret_cast<__m256i *>(acc);
+  const auto prime = _mm256_set1_epi32(static_cast<std::int32_t>(
+      static_cast<std::uint32_t>(xxh_prime32_1)));
+
+  for (std::size_t i = 0; i < 2; ++i) {
+    auto acc_lanes = _mm256_loadu_si256(acc_vec + i);
+    auto key = _mm256_loadu_si256(
+        reinterpret_cast<const __m256i *>(secret + 32 * i));
+    auto data = _mm256_xor_si256(
+        _mm256_xor_si256(acc_lanes, _mm256_srli_epi64(acc_lanes, 47)), key);
+
+    auto product_low = _mm256_mul_epu32(data, prime);
+    auto product_high = _mm256_mul_epu32(
+        _mm256_shuffle_epi32(data, _MM_SHUFFLE(0, 3, 0, 1)), prime);
+    _mm256_storeu_si256(
+        acc_vec + i,
+        _mm256_add_epi64(product_low, _mm256_slli_epi64(product_high, 32)));
+  }
+}
+#endif
+
+// Streaming XXH3 with the default secret and seed, for inputs of more than 240
+// bytes the 8 accumulators are updated one 64 bytes stripe at a time and
+// scrambled after every 16 stripes
+class Xxh3 {
+ public:
+  Xxh3() {
+#ifdef __x86_64__
+    if (has_avx2()) {
+      accumulate_ = xxh3_accumulate_avx2;
+      scramble_ = xxh3_scramble_avx2;
+    }
+#endif
+  }
+
+  void update(const std::uint8_t *input, std::size_t size) {
+    total_size_ += size;
+
+    if (buffered_ + size <= xxh3_buffer_size) {
+      std::memcpy(std::data(buffer_) + buffered_, input, size);
+      buffered_ += size;
+      return;
+    }
+
+    // Only stripes followed by more input are consumed, so the last stripe is
+    // always left for digest
+    if (buffered_ > 0) {
+      auto fill = xxh3_buffer_size - buffered_;
+      std::memcpy(std::data(buffer_) + buffered_, input, fill);
+      consume(std::data(acc_), stripes_, std::data(buffer_),
+              xxh3_buffer_size / xxh3_stripe_size);
+      std::memcpy(std::data(last_stripe_),
+                  std::data(buffer_) + xxh3_buffer_size - xxh3_stripe_size,
+                  xxh3_stripe_size);
+      input += fill;
+      size -= fill;
+      buffered_ = 0;
+    }
+
+    if (size > xxh3_buffer_size) {
+      auto stripes = (size - 1) / xxh3_stripe_size;
+      consume(std::data(acc_), stripes_, input, stripes);
+      input += stripes * xxh3_stripe_size;
+      size -= stripes * xxh3_stripe_size;
+      std::memcpy(std::data(last_stripe_), input - xxh3_stripe_size,
+                  xxh3_stripe_size);
+    }
+
+    std::memcpy(std::data(buffer_), input, size);
+    buffered_ = size;
+  }
+
+  [[nodiscard]] std::uint64_t digest_64() const {
+    if (total_size_ <= xxh3_midsize_max) {
+      return xxh3_64_short(std::data(buffer_), buffered_);
+    }
+
+    auto acc = digest_long();
+    return merge_accumulators(std::data(acc), xxh3_secret + 11,
+                              total_size_ * xxh_prime64_1);
+  }
+
+  [[nodiscard]] Xxh3Hash128 digest_128() const {
+    if (total_size_ <= xxh3_midsize_max) {
+      return xxh3_128_short(std::data(buffer_), buffered_);
+    }
+
+    auto acc = digest_long();
+    return {merge_accumulators(std::data(acc), xxh3_secret + 11,
+                               total_size_ * xxh_prime64_1),
+            merge_accumulators(std::data(acc),
+                               xxh3_secret + xxh3_secret_size - 64 - 11,
+                               ~(total_size_ * xxh_prime64_2))};
+  }
+
+ private:
+  void consume(std::uint64_t *acc, std::size_t &stripes_so_far,
+               const std::uint8_t *input, std::size_t stripes) const {
+    while (stripes > 0) {
+      auto count = std::min(stripes, xxh3_stripes_per_block - stripes_so_far);
+      accumulate_(acc, input, xxh3_secret + stripes_so_far * 8, count);
+      input += count * xxh3_stripe_size;
+      stripes -= count;
+      stripes_so_far += count;
+
+      if (stripes_so_far == xxh3_stripes_per_block) {
+        scramble_(acc, xxh3_secret + xxh3_secret_size - xxh3_stripe_size);
+        stripes_so_far = 0;
+      }
+    }
+  }
+
+  [[nodiscard]] std::array<std::uint64_t, 8> digest_long() const {
+    auto acc = acc_;
+    auto stripes_so_far = stripes_;
+
+    std::array<std::uint8_t, xxh3_stripe_size> last_stripe;
+    const std::uint8_t *last = nullptr;
+    if (buffered_ >= xxh3_stripe_size) {
+      consume(std::data(acc), stripes_so_far, std::data(buffer_),
+              (buffered_ - 1) / xxh3_stripe_size);
+      last = std::data(buffer_) + buffered_ - xxh3_stripe_size;
+    } else {
+      auto tail = xxh3_stripe_size - buffered_;
+      std::memcpy(std::data(last_stripe),
+                  std::data(last_stripe_) + buffered_, tail);
+      std::memcpy(std::data(last_stripe) + tail, std::data(buffer_),
+                  buffered_);
+      last = std::data(last_stripe);
+    }
+
+    accumulate_(std::data(acc), last,
+                xxh3_secret + xxh3_secret_size - xxh3_stripe_size - 7, 1);
+    return acc;
+  }
+
+  static std::uint64_t merge_accumulators(const std::uint64_t *acc,
+                                          const std::uint8_t *secret,
+                                          std::uint64_t start) {
+    for (std::size_t i = 0; i < 4; ++i) {
+      start += mul128_fold64(acc[2 * i] ^ read_le64(secret + 16 * i),
+                             acc[2 * i + 1] ^ read_le64(secret + 16 * i + 8));
+    }
+    return xxh3_avalanche(start);
+  }
+
+  Xxh3Accumulate accumulate_ = xxh3_accumulate_scalar;
+  Xxh3Scramble scramble_ = xxh3_scramble_scalar;
+
+  std::array<std::uint64_t, 8> acc_ = {
+      xxh_prime32_3, xxh_prime64_1, xxh_prime64_2, xxh_prime64_3,
+      xxh_prime64_4, xxh_prime32_2, xxh_prime64_5, xxh_prime32_1};
+  std::array<std::uint8_t, xxh3_buffer_size> buffer_;
+  std::array<std::uint8_t, xxh3_stripe_size> last_stripe_;
+  std::size_t buffered_ = 0;
+  std::size_t stripes_ = 0;
+  std::uint64_t total_size_ = 0;
+};
+
+std::uint64_t xxh3_64_hash(const std::uint8_t *input, std::size_t size) {
+  if (size <= xxh3_midsize_max) {
+    return xxh3_64_short(input, size);
+  }
+
+  Xxh3 xxh3;
+  xxh3.update(input, size);
+  return xxh3.digest_64();
+}
+
+Xxh3Hash128 xxh3_128_hash(const std::uint8_t *input, std::size_t size) {
+  if (size <= xxh3_midsize_max) {
+    return xxh3_128_short(input, size);
+  }
+
+  Xxh3 xxh3;
+  xxh3.update(input, size);
+  return xxh3.digest_128();
+}
+
+// The canonical form is big-endian, the same as xxhsum prints
+std::vector<std::uint8_t> xxh3_canonical(std::uint64_t hash) {
+  std::vector<std::uint8_t> digest(8);
+  write_be64(hash, std::data(digest));
+  return digest;
+}
+
+std::vector<std::uint8_t> xxh3_canonical(Xxh3Hash128 hash) {
+  std::vector<std::uint8_t> digest(16);
+  write_be64(hash.high, std::data(digest));
+  write_be64(hash.low, std::data(digest) + 8);
+  return digest;
+}
+
+}  // namespace
+
+std::string xxh3_64(const std::string &str) {
+  return hex_encode(xxh3_64_raw(str));
+}
+
+std::vector<std::uint8_t> xxh3_64_raw(const std::string &str) {
+  return xxh3_canonical(xxh3_64_hash(as_bytes(str), std::size(str)));
+}
+
+std::string xxh3_64_file(const std::string &path) {
+  Xxh3 xxh3;
+  update_file(xxh3, path);
+  return hex_encode(xxh3_canonical(xxh3.digest_64()));
+}
+
+std::string xxh3_128(const std::string &str) {
+  return hex_encode(xxh3_128_raw(str));
+}
+
+std::vector<std::uint8_t> xxh3_128_raw(const std::string &str) {
+  return xxh3_canonical(xxh3_128_hash(as_bytes(str), std::size(str)));
+}
+
+std::string xxh3_128_file(const std::string &path) {
+  Xxh3 xxh3;
+  update_file(xxh3, path);
+  return hex_encode(xxh3_canonical(xxh3.digest_128()));
+}
+
+}  // namespace klib
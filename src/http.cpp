@@ -1,10 +1,33 @@
 #include "klib/http.h"
 
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cctype>
+#include <cerrno>
+#include <charconv>
+#include <chrono>
+#include <cmath>
+#include <condition_variable>
 #include <cstddef>
+#include <cstring>
+#include <ctime>
+#include <exception>
 #include <filesystem>
+#include <fstream>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <random>
 #include <string_view>
+#include <thread>
+#include <utility>
+#include <vector>
 
 #include <curl/curl.h>
+#include <fmt/core.h>
 #include <boost/algorithm/string.hpp>
 
 #include "klib/error.h"
@@ -30,6 +53,12 @@ void check_curl_correct(CURLMcode code) {
   }
 }
 
+void check_curl_correct(CURLSHcode code) {
+  if (code != CURLSHcode::CURLSHE_OK) {
+    throw RuntimeError(curl_share_strerror(code));
+  }
+}
+
 std::string splicing_url(
     CURL *curl, const std::string &url,
     const std::unordered_map<std::string, std::string> &params) {
@@ -110,7 +139,7 @@ class AddForm {
       throw RuntimeError("curl is null");
     }
 
-    if (std::empty(data)) {
+    if (std::empty(data) && std::empty(file)) {
       return;
     }
 
@@ -163,294 +192,1973 @@ class AddForm {
   curl_mime *form_ = nullptr;
 };
 
-class Multi {
+class CustomRequest {
  public:
-  explicit Multi(CURL *curl) : curl_(curl), multi_(curl_multi_init()) {
+  explicit CustomRequest(CURL *curl, const char *method) : curl_(curl) {
     if (!curl_) {
       throw RuntimeError("curl is null");
     }
 
-    if (!multi_) {
-      throw RuntimeError("create multi_handle error");
-    }
+    check_curl_correct(curl_easy_setopt(curl_, CURLOPT_CUSTOMREQUEST, method));
+  }
 
+  ~CustomRequest() {
     try {
-      check_curl_correct(curl_multi_add_handle(multi_, curl_));
+      check_curl_correct(
+          curl_easy_setopt(curl_, CURLOPT_CUSTOMREQUEST, nullptr));
     } catch (...) {
-      if (curl_multi_cleanup(multi_) != CURLMcode::CURLM_OK) {
-        error("curl_multi_cleanup error");
-      } else {
-        throw;
-      }
+      error("Error restoring the default request method");
     }
   }
 
-  ~Multi() {
+ private:
+  CURL *curl_ = nullptr;
+};
+
+// Sends HEAD requests, which open connections without transferring the body
+class NoBody {
+ public:
+  explicit NoBody(CURL *curl) : curl_(curl) {
+    if (!curl_) {
+      throw RuntimeError("curl is null");
+    }
+
+    check_curl_correct(curl_easy_setopt(curl_, CURLOPT_NOBODY, 1L));
+  }
+
+  ~NoBody() {
     try {
-      check_curl_correct(curl_multi_remove_handle(multi_, curl_));
-      check_curl_correct(curl_multi_cleanup(multi_));
+      check_curl_correct(curl_easy_setopt(curl_, CURLOPT_NOBODY, 0L));
+      check_curl_correct(curl_easy_setopt(curl_, CURLOPT_HTTPGET, 1L));
     } catch (...) {
-      error("Error destroying multi");
+      error("Error restoring the default request method");
     }
   }
 
-  [[nodiscard]] CURLM *get() const { return multi_; }
-
  private:
   CURL *curl_ = nullptr;
-  CURLM *multi_ = nullptr;
 };
 
-}  // namespace
-
-class Request::RequestImpl {
+// https://curl.se/libcurl/c/CURLOPT_READFUNCTION.html
+class AddBody {
  public:
-  RequestImpl();
+  explicit AddBody(CURL *curl, std::span<const std::byte> data) : curl_(curl) {
+    if (!curl_) {
+      throw RuntimeError("curl is null");
+    }
 
-  RequestImpl(const RequestImpl &) = delete;
-  RequestImpl(RequestImpl &&) = delete;
-  RequestImpl &operator=(const RequestImpl &) = delete;
-  RequestImpl &operator=(RequestImpl &&) = delete;
-  ~RequestImpl();
+    // CURLOPT_POSTFIELDS does not copy the data, and the size makes it binary
+    // safe
+    check_curl_correct(curl_easy_setopt(curl_, CURLOPT_POST, 1L));
+    check_curl_correct(curl_easy_setopt(
+        curl_, CURLOPT_POSTFIELDSIZE_LARGE,
+        static_cast<curl_off_t>(std::size(data))));
+    const char *fields =
+        std::empty(data) ? "" : reinterpret_cast<const char *>(std::data(data));
+    check_curl_correct(curl_easy_setopt(curl_, CURLOPT_POSTFIELDS, fields));
+  }
 
-  void verbose(bool flag);
-  void allow_redirects(bool flag);
-  void set_proxy(const std::string &proxy);
-  void set_no_proxy();
-  void set_user_agent(const std::string &user_agent);
-  void set_browser_user_agent();
-  void set_curl_user_agent();
-  void set_timeout(std::int64_t seconds);
-  void set_connect_timeout(std::int64_t seconds);
-  void use_cookies(bool flag);
+  explicit AddBody(CURL *curl, const Request::ReadCallback &callback,
+                   std::int64_t size)
+      : curl_(curl), callback_(&callback) {
+    if (!curl_) {
+      throw RuntimeError("curl is null");
+    }
 
-  Response get(const std::string &url,
-               const std::unordered_map<std::string, std::string> &params,
-               const std::unordered_map<std::string, std::string> &header,
-               bool multi);
-  Response post(const std::string &url,
-                const std::unordered_map<std::string, std::string> &data,
-                const std::unordered_map<std::string, std::string> &file,
-                const std::unordered_map<std::string, std::string> &header,
-                bool multi);
-  Response post(const std::string &url, const std::string &data,
-                const std::unordered_map<std::string, std::string> &header,
-                bool multi);
+    if (!callback) {
+      throw RuntimeError("The read callback can not be empty");
+    }
 
- private:
-  constexpr static std::string_view cookies_path = "/tmp/cookies.txt";
-  bool use_cookies_ = true;
+    check_curl_correct(curl_easy_setopt(curl_, CURLOPT_POST, 1L));
+    check_curl_correct(curl_easy_setopt(curl_, CURLOPT_POSTFIELDS, nullptr));
+    check_curl_correct(curl_easy_setopt(
+        curl_, CURLOPT_POSTFIELDSIZE_LARGE, static_cast<curl_off_t>(size)));
+    check_curl_correct(
+        curl_easy_setopt(curl_, CURLOPT_READFUNCTION, AddBody::read_callback));
+    check_curl_correct(curl_easy_setopt(curl_, CURLOPT_READDATA, this));
+  }
 
-  void set_cookies();
+  ~AddBody() {
+    try {
+      check_curl_correct(curl_easy_setopt(curl_, CURLOPT_POSTFIELDS, nullptr));
+      check_curl_correct(curl_easy_setopt(curl_, CURLOPT_POSTFIELDSIZE_LARGE,
+                                          static_cast<curl_off_t>(-1)));
+      check_curl_correct(
+          curl_easy_setopt(curl_, CURLOPT_READFUNCTION, nullptr));
+      check_curl_correct(curl_easy_setopt(curl_, CURLOPT_READDATA, nullptr));
+    } catch (...) {
+      error("Error restoring the default body");
+    }
+  }
 
-  Response do_post(bool multi);
+  // The exception thrown by the callback can not pass through libcurl, so it
+  // is saved and rethrown here
+  void rethrow_exception() const {
+    if (exception_) {
+      std::rethrow_exception(exception_);
+    }
+  }
 
-  static std::size_t callback_func_std_string(void *contents, std::size_t size,
-                                              std::size_t nmemb,
-                                              std::string *s);
+ private:
+  static std::size_t read_callback(char *buffer, std::size_t size,
+                                   std::size_t nitems, AddBody *self) {
+    try {
+      return (*self->callback_)(buffer, size * nitems);
+    } catch (...) {
+      self->exception_ = std::current_exception();
+      return CURL_READFUNC_ABORT;
+    }
+  }
 
-  CURL *http_handle_;
+  CURL *curl_ = nullptr;
+  const Request::ReadCallback *callback_ = nullptr;
+  std::exception_ptr exception_;
 };
 
-Request::RequestImpl::RequestImpl() {
-  check_curl_correct(curl_global_init(CURL_GLOBAL_DEFAULT));
+Request::ReadCallback fd_read_callback(std::int32_t fd) {
+  return [fd](char *buffer, std::size_t size) -> std::size_t {
+    ssize_t rc = 0;
+    do {
+      rc = read(fd, buffer, size);
+    } while (rc == -1 && errno == EINTR);
 
-  http_handle_ = curl_easy_init();
-  if (!http_handle_) {
-    throw RuntimeError("curl_easy_init() error");
+    if (rc == -1) {
+      throw RuntimeError(std::strerror(errno));
+    }
+
+    return static_cast<std::size_t>(rc);
+  };
+}
+
+std::int64_t fd_remaining_size(std::int32_t fd) {
+  struct stat st = {};
+  if (fstat(fd, &st) == -1) {
+    throw RuntimeError(std::strerror(errno));
   }
 
-  try {
-    check_curl_correct(
-        curl_easy_setopt(http_handle_, CURLOPT_SSL_VERIFYPEER, 1L));
-    check_curl_correct(
-        curl_easy_setopt(http_handle_, CURLOPT_SSL_VERIFYHOST, 2L));
-    check_curl_correct(
-        curl_easy_setopt(http_handle_, CURLOPT_CAPATH, "/etc/ssl/certs"));
-    check_curl_correct(curl_easy_setopt(http_handle_, CURLOPT_CAINFO,
-                                        "/etc/ssl/certs/ca-certificates.crt"));
-    check_curl_correct(curl_easy_setopt(http_handle_, CURLOPT_HTTP_VERSION,
-                                        CURL_HTTP_VERSION_2_0));
-    check_curl_correct(
-        curl_easy_setopt(http_handle_, CURLOPT_FOLLOWLOCATION, 1L));
-    check_curl_correct(curl_easy_setopt(http_handle_, CURLOPT_WRITEFUNCTION,
-                                        RequestImpl::callback_func_std_string));
-    check_curl_correct(curl_easy_setopt(http_handle_, CURLOPT_HEADERFUNCTION,
-                                        callback_func_std_string));
-  } catch (...) {
-    curl_easy_cleanup(http_handle_);
-    curl_global_cleanup();
-    throw;
+  if (!S_ISREG(st.st_mode)) {
+    return -1;
   }
-}
 
-Request::RequestImpl::~RequestImpl() {
-  curl_easy_cleanup(http_handle_);
-  curl_global_cleanup();
-}
+  auto offset = lseek(fd, 0, SEEK_CUR);
+  if (offset == -1) {
+    return -1;
+  }
 
-void Request::RequestImpl::verbose(bool flag) {
-  check_curl_correct(curl_easy_setopt(http_handle_, CURLOPT_VERBOSE, flag));
+  return std::max<std::int64_t>(st.st_size - offset, 0);
 }
 
-void Request::RequestImpl::allow_redirects(bool flag) {
-  check_curl_correct(
-      curl_easy_setopt(http_handle_, CURLOPT_FOLLOWLOCATION, flag));
-}
+// Adds the easy handle to the multi handle for the lifetime of the object
+class Multi {
+ public:
+  explicit Multi(CURLM *multi, CURL *curl) : multi_(multi), curl_(curl) {
+    if (!multi_ || !curl_) {
+      throw RuntimeError("curl is null");
+    }
 
-void Request::RequestImpl::set_proxy(const std::string &proxy) {
-  check_curl_correct(
-      curl_easy_setopt(http_handle_, CURLOPT_PROXY, proxy.c_str()));
-}
+    check_curl_correct(curl_multi_add_handle(multi_, curl_));
+  }
 
-void Request::RequestImpl::set_no_proxy() {
-  check_curl_correct(curl_easy_setopt(http_handle_, CURLOPT_NOPROXY, "*"));
-}
+  Multi(const Multi &) = delete;
+  Multi(Multi &&) = delete;
+  Multi &operator=(const Multi &) = delete;
+  Multi &operator=(Multi &&) = delete;
 
-void Request::RequestImpl::set_user_agent(const std::string &user_agent) {
-  check_curl_correct(
-      curl_easy_setopt(http_handle_, CURLOPT_USERAGENT, user_agent.c_str()));
-}
+  ~Multi() {
+    try {
+      check_curl_correct(curl_multi_remove_handle(multi_, curl_));
+    } catch (...) {
+      error("Error destroying multi");
+    }
+  }
 
-void Request::RequestImpl::set_browser_user_agent() {
-  // navigator.userAgent
-  set_user_agent(
-      "Mozilla/5.0 (X11; Linux x86_64) AppleWebKit/537.36 (KHTML, like Gecko) "
-      "Chrome/94.0.4606.61 Safari/537.36 Edg/94.0.992.31");
-}
+ private:
+  CURLM *multi_ = nullptr;
+  CURL *curl_ = nullptr;
+};
 
-void Request::RequestImpl::set_curl_user_agent() {
-  set_user_agent("curl/7.79.1");
+bool is_transient_error(CURLcode code) {
+  switch (code) {
+    case CURLcode::CURLE_COULDNT_RESOLVE_HOST:
+    case CURLcode::CURLE_COULDNT_CONNECT:
+    case CURLcode::CURLE_OPERATION_TIMEDOUT:
+    case CURLcode::CURLE_SSL_CONNECT_ERROR:
+    case CURLcode::CURLE_GOT_NOTHING:
+    case CURLcode::CURLE_SEND_ERROR:
+    case CURLcode::CURLE_RECV_ERROR:
+    case CURLcode::CURLE_PARTIAL_FILE:
+    case CURLcode::CURLE_HTTP2:
+    case CURLcode::CURLE_HTTP2_STREAM:
+      return true;
+    default:
+      return false;
+  }
 }
 
-void Request::RequestImpl::set_timeout(std::int64_t seconds) {
-  check_curl_correct(curl_easy_setopt(http_handle_, CURLOPT_TIMEOUT, seconds));
+bool is_idempotent(std::string_view method) {
+  return method != "POST" && method != "PATCH";
 }
 
-void Request::RequestImpl::set_connect_timeout(std::int64_t seconds) {
-  check_curl_correct(
-      curl_easy_setopt(http_handle_, CURLOPT_CONNECTTIMEOUT, seconds));
+// The whole string as an integer, empty if it is not one or is out of range
+template <typename T>
+std::optional<T> parse_integer(std::string_view str) {
+  T value;
+  auto last = std::data(str) + std::size(str);
+  auto [ptr, ec] = std::from_chars(std::data(str), last, value);
+  if (ec != std::errc() || ptr != last) {
+    return {};
+  }
+  return value;
 }
 
-void Request::RequestImpl::use_cookies(bool flag) { use_cookies_ = flag; }
-
-Response Request::RequestImpl::get(
-    const std::string &url,
-    const std::unordered_map<std::string, std::string> &params,
-    const std::unordered_map<std::string, std::string> &header, bool multi) {
-  set_cookies();
-  check_curl_correct(curl_easy_setopt(http_handle_, CURLOPT_HTTPGET, 1L));
+// https://developer.mozilla.org/en-US/docs/Web/HTTP/Headers/Retry-After
+std::optional<std::chrono::milliseconds> parse_retry_after(
+    const std::string &value) {
+  if (std::empty(value)) {
+    return {};
+  }
 
-  AddHeader add_header(http_handle_, header);
+  if (std::all_of(std::begin(value), std::end(value), [](char c) {
+        return std::isdigit(static_cast<unsigned char>(c));
+      })) {
+    // Too many digits is longer than any wait that can be honored
+    constexpr auto max_seconds =
+        std::chrono::milliseconds::max().count() / 1000;
+    auto seconds = parse_integer<std::int64_t>(value);
+    if (!seconds || *seconds > max_seconds) {
+      return std::chrono::milliseconds::max();
+    }
+    return std::chrono::seconds(*seconds);
+  }
 
-  auto complete_url = splicing_url(http_handle_, url, params);
-  check_curl_correct(
-      curl_easy_setopt(http_handle_, CURLOPT_URL, complete_url.c_str()));
+  auto date = curl_getdate(value.c_str(), nullptr);
+  if (date == -1) {
+    return {};
+  }
 
-  Response response;
-  check_curl_correct(
-      curl_easy_setopt(http_handle_, CURLOPT_WRITEDATA, &response.text_));
-  check_curl_correct(
-      curl_easy_setopt(http_handle_, CURLOPT_HEADERDATA, &response.headers_));
+  auto now = std::time(nullptr);
+  return std::chrono::seconds(std::max<std::int64_t>(date - now, 0));
+}
 
-  if (multi) {
-    Multi multi_handle(http_handle_);
-    std::int32_t still_running = 1;
-    do {
-      check_curl_correct(
-          curl_multi_perform(multi_handle.get(), &still_running));
-      check_curl_correct(
-          curl_multi_poll(multi_handle.get(), nullptr, 0, 1000, nullptr));
-    } while (still_running);
-  } else {
-    check_curl_correct(curl_easy_perform(http_handle_));
+std::string host_of(const std::string &url) {
+  std::unique_ptr<CURLU, decltype(curl_url_cleanup) *> handle(
+      curl_url(), curl_url_cleanup);
+  if (!handle) {
+    throw RuntimeError("curl_url() error");
   }
 
-  check_curl_correct(curl_easy_getinfo(http_handle_, CURLINFO_RESPONSE_CODE,
-                                       &response.status_code_));
+  char *host = nullptr;
+  if (curl_url_set(handle.get(), CURLUPART_URL, url.c_str(), 0) !=
+          CURLUcode::CURLUE_OK ||
+      curl_url_get(handle.get(), CURLUPART_HOST, &host, 0) !=
+          CURLUcode::CURLUE_OK) {
+    return url;
+  }
 
-  return response;
+  std::string result = host;
+  curl_free(host);
+  return result;
 }
 
-Response Request::RequestImpl::post(
-    const std::string &url,
-    const std::unordered_map<std::string, std::string> &data,
-    const std::unordered_map<std::string, std::string> &file,
-    const std::unordered_map<std::string, std::string> &header, bool multi) {
-  set_cookies();
-  check_curl_correct(curl_easy_setopt(http_handle_, CURLOPT_HTTPPOST, 1L));
-
-  AddForm add_form(http_handle_, data, file);
-  AddHeader add_header(http_handle_, header);
-  check_curl_correct(curl_easy_setopt(http_handle_, CURLOPT_URL, url.c_str()));
+struct CacheEntry {
+  std::int64_t status_code = 0;
+  std::string headers;
+  std::string text;
+  // Seconds since the epoch, the entry must be revalidated after it
+  std::int64_t expires = 0;
+  std::string etag;
+  std::string last_modified;
+};
 
-  return do_post(multi);
+std::int64_t now_seconds() {
+  return std::chrono::duration_cast<std::chrono::seconds>(
+             std::chrono::system_clock::now().time_since_epoch())
+      .count();
 }
 
-Response Request::RequestImpl::post(
-    const std::string &url, const std::string &data,
-    const std::unordered_map<std::string, std::string> &header, bool multi) {
-  set_cookies();
-  check_curl_correct(curl_easy_setopt(http_handle_, CURLOPT_HTTPPOST, 1L));
+// Get the value in the last header block, the key is not case sensitive
+std::optional<std::string> find_header(const std::string &headers,
+                                       std::string_view key) {
+  // A header block starts with a status line, header values may contain
+  // "HTTP/" too
+  auto begin = headers.rfind("\r\nHTTP/");
+  begin = begin == std::string::npos ? 0 : begin + 2;
 
-  AddHeader add_header(http_handle_, header);
-  check_curl_correct(curl_easy_setopt(http_handle_, CURLOPT_URL, url.c_str()));
-  check_curl_correct(
-      curl_easy_setopt(http_handle_, CURLOPT_POSTFIELDS, data.c_str()));
+  std::optional<std::string> result;
+  std::string_view view = headers;
+  view.remove_prefix(begin);
 
-  return do_post(multi);
-}
+  while (!std::empty(view)) {
+    auto end = view.find("\r\n");
+    auto line = view.substr(0, end);
+    view.remove_prefix(end == std::string_view::npos ? std::size(view)
+                                                     : end + 2);
 
-void Request::RequestImpl::set_cookies() {
-  if (use_cookies_) {
-    check_curl_correct(curl_easy_setopt(http_handle_, CURLOPT_COOKIEJAR,
-                                        RequestImpl::cookies_path.data()));
-    check_curl_correct(curl_easy_setopt(http_handle_, CURLOPT_COOKIEFILE,
-                                        RequestImpl::cookies_path.data()));
-  } else {
-    check_curl_correct(curl_easy_setopt(http_handle_, CURLOPT_COOKIEJAR, ""));
-    check_curl_correct(curl_easy_setopt(http_handle_, CURLOPT_COOKIEFILE, ""));
+    auto index = line.find(':');
+    if (index == std::string_view::npos ||
+        !boost::iequals(line.substr(0, index), key)) {
+      continue;
+    }
+
+    auto value = std::string(line.substr(index + 1));
+    boost::trim(value);
+    if (result) {
+      result->append(", ").append(value);
+    } else {
+      result = value;
+    }
   }
+
+  return result;
 }
 
-Response Request::RequestImpl::do_post(bool multi) {
-  Response response;
+// https://developer.mozilla.org/en-US/docs/Web/HTTP/Headers/Cache-Control
+// Return empty if the response must not be stored
+std::optional<std::int64_t> cache_expires(const std::string &headers) {
+  auto now = now_seconds();
+
+  if (auto cache_control = find_header(headers, "Cache-Control")) {
+    // no-store wins wherever it is, so all the directives are read first
+    bool no_store = false;
+    bool no_cache = false;
+    bool has_max_age = false;
+    std::optional<std::int64_t> max_age;
+
+    for (auto directive : split_str(*cache_control, ",")) {
+      boost::to_lower(directive);
+      if (directive == "no-store") {
+        no_store = true;
+      } else if (directive == "no-cache") {
+        no_cache = true;
+      } else if (directive.starts_with("max-age=")) {
+        has_max_age = true;
+        max_age = parse_integer<std::int64_t>(
+            std::string_view(directive).substr(std::size("max-age=") - 1));
+      }
+    }
 
-  check_curl_correct(
-      curl_easy_setopt(http_handle_, CURLOPT_WRITEDATA, &response.text_));
-  check_curl_correct(
-      curl_easy_setopt(http_handle_, CURLOPT_HEADERDATA, &response.headers_));
+    if (no_store) {
+      return {};
+    }
+    if (no_cache || (has_max_age && !max_age)) {
+      return 0;
+    }
 
-  if (multi) {
-    Multi multi_handle(http_handle_);
-    std::int32_t still_running = 0;
-    do {
-      auto mc = curl_multi_perform(multi_handle.get(), &still_running);
-      if (still_running) {
-        mc = curl_multi_poll(multi_handle.get(), nullptr, 0, 1000, nullptr);
+    if (max_age) {
+      std::int64_t age = 0;
+      if (auto value = find_header(headers, "Age")) {
+        age = parse_integer<std::int64_t>(*value).value_or(0);
       }
 
-      if (mc) {
-        break;
-      }
-    } while (still_running);
-  } else {
-    check_curl_correct(curl_easy_perform(http_handle_));
+      return now + *max_age - age;
+    }
   }
 
-  check_curl_correct(curl_easy_getinfo(http_handle_, CURLINFO_RESPONSE_CODE,
-                                       &response.status_code_));
+  if (auto expires = find_header(headers, "Expires")) {
+    return std::max<std::int64_t>(curl_getdate(expires->c_str(), nullptr), 0);
+  }
 
-  return response;
+  return 0;
 }
 
-std::size_t Request::RequestImpl::callback_func_std_string(void *contents,
-                                                           std::size_t size,
-                                                           std::size_t nmemb,
-                                                           std::string *s) {
-  s->append(static_cast<const char *>(contents), size * nmemb);
-  return size * nmemb;
-}
+// The value of a request header, the key is not case sensitive
+const std::string *find_request_header(
+    const std::unordered_map<std::string, std::string> &header,
+    std::string_view key) {
+  for (const auto &[name, value] : header) {
+    if (boost::iequals(name, key)) {
+      return &value;
+    }
+  }
+  return nullptr;
+}
+
+// Whether a Cache-Control value has the directive, such as "no-cache"
+bool has_directive(std::string_view cache_control, std::string_view directive) {
+  constexpr SplitOptions options{.trim = true, .skip_empty = true};
+  return std::ranges::any_of(
+      split<options>(cache_control, ","),
+      [directive](std::string_view item) {
+        return boost::iequals(item, directive);
+      });
+}
+
+// Responses with Vary are stored under the URL together with the values of
+// the request headers it lists
+std::string variant_key(
+    const std::string &url, std::string_view vary,
+    const std::unordered_map<std::string, std::string> &header) {
+  auto key = url;
+  constexpr SplitOptions options{.trim = true, .skip_empty = true};
+  for (auto name : split<options>(vary, ",")) {
+    key.append("\n").append(boost::to_lower_copy(std::string(name)));
+    key.append(": ");
+    if (auto value = find_request_header(header, name)) {
+      key.append(*value);
+    }
+  }
+  return key;
+}
+
+std::optional<CacheEntry> make_cache_entry(std::int64_t status_code,
+                                           const std::string &headers,
+                                           const std::string &text) {
+  // Varies with something else than request headers
+  auto vary = find_header(headers, "Vary");
+  if (status_code != Response::StatusCode::Ok ||
+      (vary && vary->find('*') != std::string::npos)) {
+    return {};
+  }
+
+  auto expires = cache_expires(headers);
+  if (!expires) {
+    return {};
+  }
+
+  CacheEntry entry;
+  entry.status_code = status_code;
+  entry.expires = *expires;
+  entry.etag = find_header(headers, "ETag").value_or("");
+  entry.last_modified = find_header(headers, "Last-Modified").value_or("");
+
+  // Useless if it can neither be reused nor be revalidated
+  if (entry.expires <= now_seconds() && std::empty(entry.etag) &&
+      std::empty(entry.last_modified)) {
+    return {};
+  }
+
+  entry.headers = headers;
+  entry.text = text;
+  return entry;
+}
+
+}  // namespace
+
+// https://curl.se/libcurl/c/libcurl-share.html
+class CookieJar::CookieJarImpl {
+ public:
+  CookieJarImpl();
+
+  CookieJarImpl(const CookieJarImpl &) = delete;
+  CookieJarImpl(CookieJarImpl &&) = delete;
+  CookieJarImpl &operator=(const CookieJarImpl &) = delete;
+  CookieJarImpl &operator=(CookieJarImpl &&) = delete;
+  ~CookieJarImpl();
+
+  void load(const std::string &path);
+  void save(const std::string &path);
+  void clear();
+  std::vector<std::string> cookies();
+
+  [[nodiscard]] CURLSH *get() const { return share_handle_; }
+
+ private:
+  static void lock(CURL *, curl_lock_data data, curl_lock_access,
+                   CookieJarImpl *self);
+  static void unlock(CURL *, curl_lock_data data, CookieJarImpl *self);
+
+  std::mutex mutex_[CURL_LOCK_DATA_LAST];
+
+  CURLSH *share_handle_;
+  // Used to load, save and list cookies, an easy handle is not thread-safe
+  std::mutex http_handle_mutex_;
+  CURL *http_handle_ = nullptr;
+};
+
+CookieJar::CookieJarImpl::CookieJarImpl() {
+  check_curl_correct(curl_global_init(CURL_GLOBAL_DEFAULT));
+
+  share_handle_ = curl_share_init();
+  if (!share_handle_) {
+    curl_global_cleanup();
+    throw RuntimeError("curl_share_init() error");
+  }
+
+  try {
+    check_curl_correct(curl_share_setopt(share_handle_, CURLSHOPT_LOCKFUNC,
+                                         CookieJarImpl::lock));
+    check_curl_correct(curl_share_setopt(share_handle_, CURLSHOPT_UNLOCKFUNC,
+                                         CookieJarImpl::unlock));
+    check_curl_correct(
+        curl_share_setopt(share_handle_, CURLSHOPT_USERDATA, this));
+    // The connection cache is not shared, libcurl does not support sharing it
+    // between concurrent threads
+    for (auto data : {CURL_LOCK_DATA_COOKIE, CURL_LOCK_DATA_DNS,
+                      CURL_LOCK_DATA_SSL_SESSION}) {
+      check_curl_correct(
+          curl_share_setopt(share_handle_, CURLSHOPT_SHARE, data));
+    }
+
+    http_handle_ = curl_easy_init();
+    if (!http_handle_) {
+      throw RuntimeError("curl_easy_init() error");
+    }
+    check_curl_correct(
+        curl_easy_setopt(http_handle_, CURLOPT_SHARE, share_handle_));
+  } catch (...) {
+    curl_easy_cleanup(http_handle_);
+    curl_share_cleanup(share_handle_);
+    curl_global_cleanup();
+    throw;
+  }
+}
+
+CookieJar::CookieJarImpl::~CookieJarImpl() {
+  curl_easy_cleanup(http_handle_);
+
+  if (curl_share_cleanup(share_handle_) != CURLSHcode::CURLSHE_OK) {
+    error("curl_share_cleanup error");
+  }
+  curl_global_cleanup();
+}
+
+void CookieJar::CookieJarImpl::load(const std::string &path) {
+  if (!std::filesystem::is_regular_file(path)) {
+    throw RuntimeError("'{}' is not a file", path);
+  }
+
+  // CURLOPT_COOKIEFILE would add the file to a list that is read again by
+  // every later load, so only the lines of this file are added
+  std::lock_guard lock(http_handle_mutex_);
+  for (auto line : FileLines(path)) {
+    if (line.ends_with('\r')) {
+      line.remove_suffix(1);
+    }
+    if (std::empty(line) ||
+        (line.starts_with('#') && !line.starts_with("#HttpOnly_"))) {
+      continue;
+    }
+
+    check_curl_correct(curl_easy_setopt(http_handle_, CURLOPT_COOKIELIST,
+                                        std::string(line).c_str()));
+  }
+}
+
+void CookieJar::CookieJarImpl::save(const std::string &path) {
+  // CURLOPT_COOKIELIST "FLUSH" does not report a failed write, so the file is
+  // written here from the same lines
+  std::string content = "# Netscape HTTP Cookie File\n\n";
+  for (const auto &line : cookies()) {
+    content.append(line).append("\n");
+  }
+
+  // A failed write leaves the previous file as it was
+  auto temp_path = path + ".tmp";
+  std::ofstream ofs(temp_path, std::ofstream::binary);
+  if (!ofs) {
+    throw RuntimeError("can not open file: '{}'", temp_path);
+  }
+  ofs.write(std::data(content), std::ssize(content));
+  ofs.close();
+  if (!ofs) {
+    std::filesystem::remove(temp_path);
+    throw RuntimeError("can not write file: '{}'", temp_path);
+  }
+
+  std::filesystem::rename(temp_path, path);
+}
+
+void CookieJar::CookieJarImpl::clear() {
+  std::lock_guard lock(http_handle_mutex_);
+  check_curl_correct(curl_easy_setopt(http_handle_, CURLOPT_COOKIELIST, "ALL"));
+}
+
+std::vector<std::string> CookieJar::CookieJarImpl::cookies() {
+  std::lock_guard lock(http_handle_mutex_);
+  curl_slist *list = nullptr;
+  check_curl_correct(
+      curl_easy_getinfo(http_handle_, CURLINFO_COOKIELIST, &list));
+
+  std::vector<std::string> result;
+  for (auto item = list; item; item = item->next) {
+    result.emplace_back(item->data);
+  }
+  curl_slist_free_all(list);
+
+  return result;
+}
+
+void CookieJar::CookieJarImpl::lock(CURL *, curl_lock_data data,
+                                    curl_lock_access, CookieJarImpl *self) {
+  self->mutex_[data].lock();
+}
+
+void CookieJar::CookieJarImpl::unlock(CURL *, curl_lock_data data,
+                                      CookieJarImpl *self) {
+  self->mutex_[data].unlock();
+}
+
+class HttpCache::HttpCacheImpl {
+ public:
+  HttpCacheImpl(std::size_t max_memory_size, const std::string &directory);
+
+  void clear();
+  [[nodiscard]] std::size_t memory_size() const;
+  [[nodiscard]] std::uint64_t hits() const;
+  [[nodiscard]] std::uint64_t revalidations() const;
+
+  std::optional<CacheEntry> find(const std::string &key);
+  void store(const std::string &key, CacheEntry entry);
+  void remove(const std::string &key);
+
+  void hit();
+  void revalidated();
+
+ private:
+  using List = std::list<std::pair<std::string, CacheEntry>>;
+
+  void store_memory(const std::string &key, CacheEntry entry);
+  void remove_memory(const std::string &key);
+
+  [[nodiscard]] std::string file_path(const std::string &key) const;
+  std::optional<CacheEntry> read_entry(const std::string &key) const;
+  void write_entry(const std::string &key, const CacheEntry &entry) const;
+
+  static std::size_t entry_size(const std::string &key,
+                                const CacheEntry &entry);
+
+  std::size_t max_memory_size_;
+  std::size_t memory_size_ = 0;
+  std::string directory_;
+
+  // The most recently used entry is at the front
+  List lru_;
+  std::unordered_map<std::string, List::iterator> index_;
+
+  std::uint64_t hits_ = 0;
+  std::uint64_t revalidations_ = 0;
+
+  mutable std::mutex mutex_;
+};
+
+HttpCache::HttpCacheImpl::HttpCacheImpl(std::size_t max_memory_size,
+                                        const std::string &directory)
+    : max_memory_size_(max_memory_size), directory_(directory) {
+  if (!std::empty(directory_)) {
+    std::filesystem::create_directories(directory_);
+  }
+}
+
+void HttpCache::HttpCacheImpl::clear() {
+  std::lock_guard<std::mutex> lock(mutex_);
+
+  lru_.clear();
+  index_.clear();
+  memory_size_ = 0;
+
+  if (!std::empty(directory_)) {
+    for (const auto &item : std::filesystem::directory_iterator(directory_)) {
+      if (item.is_regular_file() && item.path().extension() == ".cache") {
+        std::filesystem::remove(item.path());
+      }
+    }
+  }
+}
+
+std::size_t HttpCache::HttpCacheImpl::memory_size() const {
+  std::lock_guard<std::mutex> lock(mutex_);
+  return memory_size_;
+}
+
+std::uint64_t HttpCache::HttpCacheImpl::hits() const {
+  std::lock_guard<std::mutex> lock(mutex_);
+  return hits_;
+}
+
+std::uint64_t HttpCache::HttpCacheImpl::revalidations() const {
+  std::lock_guard<std::mutex> lock(mutex_);
+  return revalidations_;
+}
+
+std::optional<CacheEntry> HttpCache::HttpCacheImpl::find(
+    const std::string &key) {
+  std::lock_guard<std::mutex> lock(mutex_);
+
+  if (auto iter = index_.find(key); iter != std::end(index_)) {
+    lru_.splice(std::begin(lru_), lru_, iter->second);
+    return iter->second->second;
+  }
+
+  if (std::empty(directory_)) {
+    return {};
+  }
+
+  auto entry = read_entry(key);
+  if (entry) {
+    store_memory(key, *entry);
+  }
+
+  return entry;
+}
+
+void HttpCache::HttpCacheImpl::store(const std::string &key,
+                                     CacheEntry entry) {
+  std::lock_guard<std::mutex> lock(mutex_);
+
+  if (!std::empty(directory_)) {
+    write_entry(key, entry);
+  }
+  store_memory(key, std::move(entry));
+}
+
+void HttpCache::HttpCacheImpl::remove(const std::string &key) {
+  std::lock_guard<std::mutex> lock(mutex_);
+
+  remove_memory(key);
+  if (!std::empty(directory_)) {
+    std::filesystem::remove(file_path(key));
+  }
+}
+
+void HttpCache::HttpCacheImpl::hit() {
+  std::lock_guard<std::mutex> lock(mutex_);
+  ++hits_;
+}
+
+void HttpCache::HttpCacheImpl::revalidated() {
+  std::lock_guard<std::mutex> lock(mutex_);
+  ++revalidations_;
+}
+
+void HttpCache::HttpCacheImpl::store_memory(const std::string &key,
+                                            CacheEntry entry) {
+  remove_memory(key);
+
+  // Too large to be kept in memory, it is still in the on-disk tier
+  auto size = entry_size(key, entry);
+  if (size > max_memory_size_) {
+    return;
+  }
+
+  while (memory_size_ + size > max_memory_size_) {
+    const auto &[last_key, last_entry] = lru_.back();
+    memory_size_ -= entry_size(last_key, last_entry);
+    index_.erase(last_key);
+    lru_.pop_back();
+  }
+
+  lru_.emplace_front(key, std::move(entry));
+  index_.emplace(key, std::begin(lru_));
+  memory_size_ += size;
+}
+
+void HttpCache::HttpCacheImpl::remove_memory(const std::string &key) {
+  auto iter = index_.find(key);
+  if (iter == std::end(index_)) {
+    return;
+  }
+
+  memory_size_ -= entry_size(key, iter->second->second);
+  lru_.erase(iter->second);
+  index_.erase(iter);
+}
+
+std::string HttpCache::HttpCacheImpl::file_path(const std::string &key) const {
+  return (std::filesystem::path(directory_) / (sha_256(key) + ".cache"))
+      .string();
+}
+
+// The file consists of the key, status code, expires, ETag, Last-Modified,
+// header size and text size, one per line, followed by headers and text
+std::optional<CacheEntry> HttpCache::HttpCacheImpl::read_entry(
+    const std::string &key) const {
+  auto path = file_path(key);
+  if (!std::filesystem::is_regular_file(path)) {
+    return {};
+  }
+
+  auto content = read_file(path, true);
+  std::string_view view = content;
+
+  auto next_line = [&view]() {
+    auto end = view.find('\n');
+    if (end == std::string_view::npos) {
+      throw RuntimeError("Invalid cache file");
+    }
+
+    auto line = std::string(view.substr(0, end));
+    view.remove_prefix(end + 1);
+    return line;
+  };
+
+  try {
+    // Different keys with the same hash
+    if (next_line() != key) {
+      return {};
+    }
+
+    auto next_integer = [&next_line]<typename T>(T &value) {
+      auto integer = parse_integer<T>(next_line());
+      if (!integer) {
+        throw RuntimeError("Invalid cache file");
+      }
+      value = *integer;
+    };
+
+    CacheEntry entry;
+    next_integer(entry.status_code);
+    next_integer(entry.expires);
+    entry.etag = next_line();
+    entry.last_modified = next_line();
+    std::size_t headers_size;
+    std::size_t text_size;
+    next_integer(headers_size);
+    next_integer(text_size);
+
+    if (headers_size > std::size(view) ||
+        std::size(view) - headers_size != text_size) {
+      throw RuntimeError("Invalid cache file");
+    }
+    entry.headers = view.substr(0, headers_size);
+    entry.text = view.substr(headers_size);
+
+    return entry;
+  } catch (const std::exception &) {
+    warn("Invalid cache file: {}", path);
+    std::filesystem::remove(path);
+    return {};
+  }
+}
+
+void HttpCache::HttpCacheImpl::write_entry(const std::string &key,
+                                           const CacheEntry &entry) const {
+  std::string content;
+  content.reserve(std::size(key) + std::size(entry.headers) +
+                  std::size(entry.text) + 128);
+
+  for (const auto &line :
+       {key, std::to_string(entry.status_code), std::to_string(entry.expires),
+        entry.etag, entry.last_modified,
+        std::to_string(std::size(entry.headers)),
+        std::to_string(std::size(entry.text))}) {
+    content.append(line).append("\n");
+  }
+  content.append(entry.headers).append(entry.text);
+
+  // Readers never see a partially written file
+  auto path = file_path(key);
+  auto temp_path = path + ".tmp";
+  write_file(temp_path, true, content);
+  std::filesystem::rename(temp_path, path);
+}
+
+std::size_t HttpCache::HttpCacheImpl::entry_size(const std::string &key,
+                                                 const CacheEntry &entry) {
+  return std::size(key) + std::size(entry.headers) + std::size(entry.text) +
+         std::size(entry.etag) + std::size(entry.last_modified);
+}
+
+// https://en.wikipedia.org/wiki/Token_bucket
+class RateLimiter::RateLimiterImpl {
+ public:
+  // Holds a connection slot of the host until destroyed
+  class Permit {
+   public:
+    Permit(RateLimiterImpl *limiter, const std::string &host)
+        : limiter_(limiter), host_(host) {}
+
+    Permit(const Permit &) = delete;
+    Permit(Permit &&other) noexcept
+        : limiter_(std::exchange(other.limiter_, nullptr)),
+          host_(std::move(other.host_)) {}
+    Permit &operator=(const Permit &) = delete;
+    Permit &operator=(Permit &&) = delete;
+
+    ~Permit() {
+      if (limiter_) {
+        limiter_->release(host_);
+      }
+    }
+
+   private:
+    RateLimiterImpl *limiter_ = nullptr;
+    std::string host_;
+  };
+
+  RateLimiterImpl(double requests_per_second, std::size_t burst,
+                  std::size_t max_connections_per_host);
+
+  Permit acquire(const std::string &host);
+  std::optional<Permit> try_acquire(const std::string &host);
+
+  [[nodiscard]] std::size_t max_connections_per_host() const {
+    return max_connections_per_host_;
+  }
+  [[nodiscard]] RateLimiterStats stats() const;
+
+ private:
+  void release(const std::string &host);
+  void refill();
+
+  double requests_per_second_;
+  double burst_;
+  std::size_t max_connections_per_host_;
+
+  // Negative when transfers have reserved tokens that are not added yet
+  double tokens_;
+  std::chrono::steady_clock::time_point last_refill_;
+  std::unordered_map<std::string, std::size_t> connections_;
+
+  RateLimiterStats stats_;
+
+  mutable std::mutex mutex_;
+  std::condition_variable condition_;
+};
+
+RateLimiter::RateLimiterImpl::RateLimiterImpl(
+    double requests_per_second, std::size_t burst,
+    std::size_t max_connections_per_host)
+    : requests_per_second_(requests_per_second),
+      burst_(static_cast<double>(burst)),
+      max_connections_per_host_(max_connections_per_host),
+      tokens_(burst_),
+      last_refill_(std::chrono::steady_clock::now()) {
+  if (requests_per_second_ < 0) {
+    throw RuntimeError("The requests_per_second can not be negative");
+  }
+  if (burst == 0) {
+    throw RuntimeError("The burst can not be 0");
+  }
+}
+
+RateLimiter::RateLimiterImpl::Permit RateLimiter::RateLimiterImpl::acquire(
+    const std::string &host) {
+  auto start = std::chrono::steady_clock::now();
+
+  std::unique_lock<std::mutex> lock(mutex_);
+  ++stats_.queue_depth;
+  stats_.max_queue_depth =
+      std::max(stats_.max_queue_depth, stats_.queue_depth);
+
+  if (max_connections_per_host_ != 0) {
+    condition_.wait(lock, [&] {
+      return connections_[host] < max_connections_per_host_;
+    });
+    ++connections_[host];
+  }
+  Permit permit(this, host);
+
+  // Reserve a token, and wait outside the lock until it is added
+  std::chrono::duration<double> delay(0);
+  if (requests_per_second_ > 0) {
+    refill();
+    tokens_ -= 1;
+    if (tokens_ < 0) {
+      delay = std::chrono::duration<double>(-tokens_ / requests_per_second_);
+    }
+  }
+
+  lock.unlock();
+  std::this_thread::sleep_for(delay);
+  lock.lock();
+
+  auto wait = std::chrono::duration_cast<std::chrono::microseconds>(
+      std::chrono::steady_clock::now() - start);
+  --stats_.queue_depth;
+  ++stats_.acquired;
+  stats_.total_wait += wait;
+  stats_.max_wait = std::max(stats_.max_wait, wait);
+
+  return permit;
+}
+
+std::optional<RateLimiter::RateLimiterImpl::Permit>
+RateLimiter::RateLimiterImpl::try_acquire(const std::string &host) {
+  std::lock_guard<std::mutex> lock(mutex_);
+
+  if (max_connections_per_host_ != 0 &&
+      connections_[host] >= max_connections_per_host_) {
+    return {};
+  }
+
+  if (requests_per_second_ > 0) {
+    refill();
+    if (tokens_ < 1) {
+      return {};
+    }
+    tokens_ -= 1;
+  }
+
+  if (max_connections_per_host_ != 0) {
+    ++connections_[host];
+  }
+  ++stats_.acquired;
+
+  return std::optional<Permit>(std::in_place, this, host);
+}
+
+RateLimiterStats RateLimiter::RateLimiterImpl::stats() const {
+  std::lock_guard<std::mutex> lock(mutex_);
+  return stats_;
+}
+
+void RateLimiter::RateLimiterImpl::release(const std::string &host) {
+  if (max_connections_per_host_ == 0) {
+    return;
+  }
+
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (--connections_[host] == 0) {
+      connections_.erase(host);
+    }
+  }
+  condition_.notify_all();
+}
+
+void RateLimiter::RateLimiterImpl::refill() {
+  auto now = std::chrono::steady_clock::now();
+  std::chrono::duration<double> elapsed = now - last_refill_;
+  last_refill_ = now;
+
+  tokens_ = std::min(burst_, tokens_ + elapsed.count() * requests_per_second_);
+}
+
+class Request::RequestImpl {
+ public:
+  RequestImpl();
+
+  RequestImpl(const RequestImpl &) = delete;
+  RequestImpl(RequestImpl &&) = delete;
+  RequestImpl &operator=(const RequestImpl &) = delete;
+  RequestImpl &operator=(RequestImpl &&) = delete;
+  ~RequestImpl();
+
+  void verbose(bool flag);
+  void allow_redirects(bool flag);
+  void set_proxy(const std::string &proxy);
+  void set_no_proxy();
+  void set_user_agent(const std::string &user_agent);
+  void set_browser_user_agent();
+  void set_curl_user_agent();
+  void set_timeout(std::int64_t seconds);
+  void set_connect_timeout(std::int64_t seconds);
+  void set_http_version(HttpVersion version);
+  void set_dns_cache_timeout(std::int64_t seconds);
+  void add_resolve(const std::string &host, std::int32_t port,
+                   const std::string &address);
+  std::size_t warm_up(const std::vector<std::string> &urls, bool multi);
+  void use_cookies(bool flag);
+  void set_cookie_jar(std::shared_ptr<CookieJar> cookie_jar);
+  void set_cache(std::shared_ptr<HttpCache> cache);
+  void set_rate_limiter(std::shared_ptr<RateLimiter> rate_limiter);
+  void set_retry_policy(const RetryPolicy &policy);
+  void set_hedge_policy(const HedgePolicy &policy);
+  [[nodiscard]] RequestStats stats() const;
+
+  Response get(const std::string &url,
+               const std::unordered_map<std::string, std::string> &params,
+               const std::unordered_map<std::string, std::string> &header,
+               bool multi);
+  Response post(const std::string &url,
+                const std::unordered_map<std::string, std::string> &data,
+                const std::unordered_map<std::string, std::string> &file,
+                const std::unordered_map<std::string, std::string> &header,
+                bool multi);
+  Response post(const std::string &url, const std::string &data,
+                const std::unordered_map<std::string, std::string> &header,
+                bool multi);
+
+  Response upload(const char *method, const std::string &url,
+                  std::span<const std::byte> data,
+                  const std::unordered_map<std::string, std::string> &header,
+                  bool multi);
+  Response upload(const char *method, const std::string &url,
+                  const ReadCallback &callback, std::int64_t size,
+                  const std::unordered_map<std::string, std::string> &header,
+                  bool multi);
+  Response upload(const char *method, const std::string &url, std::int32_t fd,
+                  const std::unordered_map<std::string, std::string> &header,
+                  bool multi);
+
+  Response del(const std::string &url,
+               const std::unordered_map<std::string, std::string> &params,
+               const std::unordered_map<std::string, std::string> &header,
+               bool multi);
+
+ private:
+  bool use_cookies_ = true;
+  std::shared_ptr<CookieJar> cookie_jar_;
+
+  std::shared_ptr<HttpCache> cache_;
+  std::shared_ptr<RateLimiter> rate_limiter_;
+  // Host of the current request, used by the rate limiter
+  std::string host_;
+
+  RetryPolicy retry_policy_;
+  HedgePolicy hedge_policy_;
+  RequestStats stats_;
+
+  // Ring buffer of the latency of recent successful calls
+  constexpr static std::size_t max_latency_samples = 128;
+  std::vector<std::chrono::microseconds> latencies_;
+  std::size_t latency_index_ = 0;
+
+  std::mt19937_64 random_engine_{std::random_device{}()};
+
+  void set_cookies();
+  void set_url(const std::string &url);
+
+  Response cached_get(
+      const std::string &url,
+      const std::unordered_map<std::string, std::string> &header, bool multi);
+
+  Response perform(bool multi, bool retryable);
+  CURLcode transfer(Response &response, bool multi);
+  CURLcode hedged_transfer(Response &response,
+                           std::chrono::milliseconds delay);
+  CURLcode transfer_result(CURL *handle);
+
+  std::optional<std::chrono::milliseconds> retry_delay(std::int32_t retry,
+                                                       CURLcode code,
+                                                       Response &response);
+  [[nodiscard]] std::chrono::milliseconds hedge_delay() const;
+  void record_latency(std::chrono::microseconds latency);
+  [[nodiscard]] std::chrono::microseconds latency_p95() const;
+
+  static std::size_t callback_func_std_string(void *contents, std::size_t size,
+                                              std::size_t nmemb,
+                                              std::string *s);
+
+  CURL *http_handle_;
+  // Multi handle shared by all transfers of this Request, it keeps the
+  // connection cache alive between calls
+  CURLM *multi_handle_ = nullptr;
+  curl_slist *resolve_ = nullptr;
+};
+
+Request::RequestImpl::RequestImpl() {
+  check_curl_correct(curl_global_init(CURL_GLOBAL_DEFAULT));
+
+  http_handle_ = curl_easy_init();
+  if (!http_handle_) {
+    throw RuntimeError("curl_easy_init() error");
+  }
+
+  try {
+    check_curl_correct(
+        curl_easy_setopt(http_handle_, CURLOPT_SSL_VERIFYPEER, 1L));
+    check_curl_correct(
+        curl_easy_setopt(http_handle_, CURLOPT_SSL_VERIFYHOST, 2L));
+    check_curl_correct(
+        curl_easy_setopt(http_handle_, CURLOPT_CAPATH, "/etc/ssl/certs"));
+    check_curl_correct(curl_easy_setopt(http_handle_, CURLOPT_CAINFO,
+                                        "/etc/ssl/certs/ca-certificates.crt"));
+    check_curl_correct(curl_easy_setopt(http_handle_, CURLOPT_HTTP_VERSION,
+                                        CURL_HTTP_VERSION_2_0));
+    check_curl_correct(
+        curl_easy_setopt(http_handle_, CURLOPT_FOLLOWLOCATION, 1L));
+    check_curl_correct(curl_easy_setopt(http_handle_, CURLOPT_WRITEFUNCTION,
+                                        RequestImpl::callback_func_std_string));
+    check_curl_correct(curl_easy_setopt(http_handle_, CURLOPT_HEADERFUNCTION,
+                                        callback_func_std_string));
+
+    cookie_jar_ = std::make_shared<CookieJar>();
+    set_cookies();
+
+    multi_handle_ = curl_multi_init();
+    if (!multi_handle_) {
+      throw RuntimeError("create multi_handle error");
+    }
+  } catch (...) {
+    curl_easy_cleanup(http_handle_);
+    curl_global_cleanup();
+    throw;
+  }
+}
+
+Request::RequestImpl::~RequestImpl() {
+  if (curl_multi_cleanup(multi_handle_) != CURLMcode::CURLM_OK) {
+    error("curl_multi_cleanup error");
+  }
+  curl_easy_cleanup(http_handle_);
+  curl_slist_free_all(resolve_);
+  curl_global_cleanup();
+}
+
+void Request::RequestImpl::verbose(bool flag) {
+  check_curl_correct(curl_easy_setopt(http_handle_, CURLOPT_VERBOSE, flag));
+}
+
+void Request::RequestImpl::allow_redirects(bool flag) {
+  check_curl_correct(
+      curl_easy_setopt(http_handle_, CURLOPT_FOLLOWLOCATION, flag));
+}
+
+void Request::RequestImpl::set_proxy(const std::string &proxy) {
+  check_curl_correct(
+      curl_easy_setopt(http_handle_, CURLOPT_PROXY, proxy.c_str()));
+}
+
+void Request::RequestImpl::set_no_proxy() {
+  check_curl_correct(curl_easy_setopt(http_handle_, CURLOPT_NOPROXY, "*"));
+}
+
+void Request::RequestImpl::set_user_agent(const std::string &user_agent) {
+  check_curl_correct(
+      curl_easy_setopt(http_handle_, CURLOPT_USERAGENT, user_agent.c_str()));
+}
+
+void Request::RequestImpl::set_browser_user_agent() {
+  // navigator.userAgent
+  set_user_agent(
+      "Mozilla/5.0 (X11; Linux x86_64) AppleWebKit/537.36 (KHTML, like Gecko) "
+      "Chrome/94.0.4606.61 Safari/537.36 Edg/94.0.992.31");
+}
+
+void Request::RequestImpl::set_curl_user_agent() {
+  set_user_agent("curl/7.79.1");
+}
+
+void Request::RequestImpl::set_timeout(std::int64_t seconds) {
+  check_curl_correct(curl_easy_setopt(http_handle_, CURLOPT_TIMEOUT, seconds));
+}
+
+void Request::RequestImpl::set_connect_timeout(std::int64_t seconds) {
+  check_curl_correct(
+      curl_easy_setopt(http_handle_, CURLOPT_CONNECTTIMEOUT, seconds));
+}
+
+void Request::RequestImpl::set_http_version(HttpVersion version) {
+  long value = CURL_HTTP_VERSION_NONE;
+  switch (version) {
+    case HttpVersion::Http1_1:
+      value = CURL_HTTP_VERSION_1_1;
+      break;
+    case HttpVersion::Http2:
+      value = CURL_HTTP_VERSION_2_0;
+      break;
+    case HttpVersion::Http2PriorKnowledge:
+      value = CURL_HTTP_VERSION_2_PRIOR_KNOWLEDGE;
+      break;
+  }
+
+  check_curl_correct(
+      curl_easy_setopt(http_handle_, CURLOPT_HTTP_VERSION, value));
+}
+
+void Request::RequestImpl::set_dns_cache_timeout(std::int64_t seconds) {
+  check_curl_correct(
+      curl_easy_setopt(http_handle_, CURLOPT_DNS_CACHE_TIMEOUT, seconds));
+}
+
+// https://curl.se/libcurl/c/CURLOPT_RESOLVE.html
+void Request::RequestImpl::add_resolve(const std::string &host,
+                                       std::int32_t port,
+                                       const std::string &address) {
+  if (std::empty(host) || std::empty(address)) {
+    throw RuntimeError("The host and address can not be empty");
+  }
+
+  auto item = fmt::format("{}:{}:{}", host, port, address);
+  auto list = curl_slist_append(resolve_, item.c_str());
+  if (!list) {
+    throw RuntimeError("curl_slist_append() error");
+  }
+  resolve_ = list;
+
+  check_curl_correct(curl_easy_setopt(http_handle_, CURLOPT_RESOLVE, resolve_));
+}
+
+// Each transfer leaves its connection in the connection cache of the handle
+// that runs it, the easy handle itself or the multi handle. The DNS cache is
+// that of the cookie jar
+std::size_t Request::RequestImpl::warm_up(const std::vector<std::string> &urls,
+                                          bool multi) {
+  using Permit = RateLimiter::RateLimiterImpl::Permit;
+
+  std::string discard;
+  check_curl_correct(
+      curl_easy_setopt(http_handle_, CURLOPT_WRITEDATA, &discard));
+  check_curl_correct(
+      curl_easy_setopt(http_handle_, CURLOPT_HEADERDATA, &discard));
+  NoBody no_body(http_handle_);
+
+  std::size_t count = 0;
+  if (!multi) {
+    for (const auto &url : urls) {
+      std::optional<Permit> permit;
+      if (rate_limiter_) {
+        permit.emplace(rate_limiter_->impl_->acquire(host_of(url)));
+      }
+
+      check_curl_correct(
+          curl_easy_setopt(http_handle_, CURLOPT_URL, url.c_str()));
+      if (curl_easy_perform(http_handle_) == CURLcode::CURLE_OK) {
+        ++count;
+      }
+    }
+
+    return count;
+  }
+
+  struct WarmUp {
+    std::unique_ptr<CURL, decltype(curl_easy_cleanup) *> handle{
+        nullptr, curl_easy_cleanup};
+    std::string host;
+    std::optional<Permit> permit;
+    std::optional<Multi> add_handle;
+  };
+  std::vector<WarmUp> items(std::size(urls));
+  for (std::size_t i = 0; i < std::size(urls); ++i) {
+    check_curl_correct(
+        curl_easy_setopt(http_handle_, CURLOPT_URL, urls[i].c_str()));
+
+    items[i].handle.reset(curl_easy_duphandle(http_handle_));
+    if (!items[i].handle) {
+      throw RuntimeError("curl_easy_duphandle() error");
+    }
+    if (rate_limiter_) {
+      items[i].host = host_of(urls[i]);
+    }
+  }
+
+  // A transfer starts once it has a permit. The wait is only blocking when
+  // nothing runs, so the permits held here never block it
+  std::size_t next = 0;
+  std::size_t running = 0;
+  while (next < std::size(items) || running > 0) {
+    for (; next < std::size(items); ++next) {
+      auto &item = items[next];
+      if (rate_limiter_) {
+        if (running == 0) {
+          item.permit.emplace(rate_limiter_->impl_->acquire(item.host));
+        } else if (auto permit =
+                       rate_limiter_->impl_->try_acquire(item.host)) {
+          item.permit.emplace(std::move(*permit));
+        } else {
+          break;
+        }
+      }
+
+      item.add_handle.emplace(multi_handle_, item.handle.get());
+      ++running;
+    }
+
+    std::int32_t still_running = 0;
+    check_curl_correct(curl_multi_perform(multi_handle_, &still_running));
+
+    std::int32_t msgs_in_queue = 0;
+    while (auto msg = curl_multi_info_read(multi_handle_, &msgs_in_queue)) {
+      if (msg->msg != CURLMSG_DONE) {
+        continue;
+      }
+      if (msg->data.result == CURLcode::CURLE_OK) {
+        ++count;
+      }
+
+      auto iter = std::find_if(std::begin(items), std::end(items),
+                               [msg](const WarmUp &item) {
+                                 return item.handle.get() == msg->easy_handle;
+                               });
+      iter->add_handle.reset();
+      iter->permit.reset();
+      --running;
+    }
+
+    if (still_running) {
+      // Check for permits again soon while transfers are waiting for them
+      auto timeout = next < std::size(items) ? 10 : 1000;
+      check_curl_correct(
+          curl_multi_poll(multi_handle_, nullptr, 0, timeout, nullptr));
+    }
+  }
+
+  return count;
+}
+
+void Request::RequestImpl::use_cookies(bool flag) {
+  use_cookies_ = flag;
+  set_cookies();
+}
+
+void Request::RequestImpl::set_cookie_jar(
+    std::shared_ptr<CookieJar> cookie_jar) {
+  if (!cookie_jar) {
+    throw RuntimeError("The cookie jar can not be null");
+  }
+
+  // Detach from the old share handle before it is destroyed
+  std::swap(cookie_jar_, cookie_jar);
+  set_cookies();
+}
+
+void Request::RequestImpl::set_cache(std::shared_ptr<HttpCache> cache) {
+  cache_ = std::move(cache);
+}
+
+void Request::RequestImpl::set_rate_limiter(
+    std::shared_ptr<RateLimiter> rate_limiter) {
+  // Also bounds the connections opened by hedged requests
+  auto max_connections =
+      rate_limiter ? rate_limiter->impl_->max_connections_per_host() : 0;
+  check_curl_correct(curl_multi_setopt(multi_handle_,
+                                       CURLMOPT_MAX_HOST_CONNECTIONS,
+                                       static_cast<long>(max_connections)));
+
+  rate_limiter_ = std::move(rate_limiter);
+}
+
+void Request::RequestImpl::set_retry_policy(const RetryPolicy &policy) {
+  if (policy.max_retries < 0) {
+    throw RuntimeError("The max_retries can not be negative");
+  }
+
+  retry_policy_ = policy;
+}
+
+void Request::RequestImpl::set_hedge_policy(const HedgePolicy &policy) {
+  if (policy.max_hedges < 0) {
+    throw RuntimeError("The max_hedges can not be negative");
+  }
+
+  hedge_policy_ = policy;
+}
+
+RequestStats Request::RequestImpl::stats() const {
+  auto result = stats_;
+  result.latency_p95 = latency_p95();
+  return result;
+}
+
+Response Request::RequestImpl::get(
+    const std::string &url,
+    const std::unordered_map<std::string, std::string> &params,
+    const std::unordered_map<std::string, std::string> &header, bool multi) {
+  check_curl_correct(curl_easy_setopt(http_handle_, CURLOPT_HTTPGET, 1L));
+
+  auto complete_url = splicing_url(http_handle_, url, params);
+  set_url(complete_url);
+
+  if (cache_) {
+    return cached_get(complete_url, header, multi);
+  }
+
+  AddHeader add_header(http_handle_, header);
+  return perform(multi, true);
+}
+
+Response Request::RequestImpl::post(
+    const std::string &url,
+    const std::unordered_map<std::string, std::string> &data,
+    const std::unordered_map<std::string, std::string> &file,
+    const std::unordered_map<std::string, std::string> &header, bool multi) {
+  if (std::empty(data) && std::empty(file)) {
+    return upload("POST", url, std::span<const std::byte>(), header, multi);
+  }
+
+  AddForm add_form(http_handle_, data, file);
+  AddHeader add_header(http_handle_, header);
+  set_url(url);
+
+  return perform(multi, retry_policy_.retry_non_idempotent);
+}
+
+Response Request::RequestImpl::post(
+    const std::string &url, const std::string &data,
+    const std::unordered_map<std::string, std::string> &header, bool multi) {
+  return upload("POST", url, std::as_bytes(std::span(data)), header, multi);
+}
+
+Response Request::RequestImpl::upload(
+    const char *method, const std::string &url, std::span<const std::byte> data,
+    const std::unordered_map<std::string, std::string> &header, bool multi) {
+  AddBody add_body(http_handle_, data);
+  // POST is the default method when there is a body
+  CustomRequest custom_request(
+      http_handle_, std::string_view(method) == "POST" ? nullptr : method);
+  AddHeader add_header(http_handle_, header);
+  set_url(url);
+
+  return perform(multi, is_idempotent(method) ||
+                            retry_policy_.retry_non_idempotent);
+}
+
+Response Request::RequestImpl::upload(
+    const char *method, const std::string &url, const ReadCallback &callback,
+    std::int64_t size,
+    const std::unordered_map<std::string, std::string> &header, bool multi) {
+  AddBody add_body(http_handle_, callback, size);
+  CustomRequest custom_request(
+      http_handle_, std::string_view(method) == "POST" ? nullptr : method);
+  AddHeader add_header(http_handle_, header);
+  set_url(url);
+
+  // The callback can not be rewound, so the request is never retried
+  try {
+    return perform(multi, false);
+  } catch (...) {
+    add_body.rethrow_exception();
+    throw;
+  }
+}
+
+Response Request::RequestImpl::upload(
+    const char *method, const std::string &url, std::int32_t fd,
+    const std::unordered_map<std::string, std::string> &header, bool multi) {
+  return upload(method, url, fd_read_callback(fd), fd_remaining_size(fd),
+                header, multi);
+}
+
+Response Request::RequestImpl::del(
+    const std::string &url,
+    const std::unordered_map<std::string, std::string> &params,
+    const std::unordered_map<std::string, std::string> &header, bool multi) {
+  check_curl_correct(curl_easy_setopt(http_handle_, CURLOPT_HTTPGET, 1L));
+
+  CustomRequest custom_request(http_handle_, "DELETE");
+  AddHeader add_header(http_handle_, header);
+
+  auto complete_url = splicing_url(http_handle_, url, params);
+  set_url(complete_url);
+
+  return perform(multi, true);
+}
+
+void Request::RequestImpl::set_url(const std::string &url) {
+  check_curl_correct(curl_easy_setopt(http_handle_, CURLOPT_URL, url.c_str()));
+  if (rate_limiter_) {
+    host_ = host_of(url);
+  }
+}
+
+// The cookies are kept in the share handle of the cookie jar, the empty cookie
+// file only turns on the cookie engine and no file is read or written. The
+// share handle stays attached without cookies for its DNS cache
+void Request::RequestImpl::set_cookies() {
+  check_curl_correct(curl_easy_setopt(http_handle_, CURLOPT_SHARE,
+                                      cookie_jar_->impl_->get()));
+  check_curl_correct(curl_easy_setopt(http_handle_, CURLOPT_COOKIEFILE,
+                                      use_cookies_ ? "" : nullptr));
+  // The pinned hosts are loaded into the DNS cache once they are set
+  if (resolve_) {
+    check_curl_correct(
+        curl_easy_setopt(http_handle_, CURLOPT_RESOLVE, resolve_));
+  }
+}
+
+// https://developer.mozilla.org/en-US/docs/Web/HTTP/Caching
+Response Request::RequestImpl::cached_get(
+    const std::string &url,
+    const std::unordered_map<std::string, std::string> &header, bool multi) {
+  auto &cache = cache_->impl_;
+
+  std::string_view cache_control;
+  if (auto value = find_request_header(header, "Cache-Control")) {
+    cache_control = *value;
+  }
+  if (has_directive(cache_control, "no-store")) {
+    AddHeader add_header(http_handle_, header);
+    return perform(multi, true);
+  }
+
+  // The entry under the URL of a response with Vary only holds the header
+  auto key = url;
+  auto entry = cache->find(key);
+  if (entry) {
+    if (auto vary = find_header(entry->headers, "Vary")) {
+      key = variant_key(url, *vary, header);
+      entry = cache->find(key);
+    }
+  }
+
+  auto conditional_header = header;
+  if (entry) {
+    if (entry->expires > now_seconds() &&
+        !has_directive(cache_control, "no-cache") &&
+        !has_directive(cache_control, "max-age=0")) {
+      cache->hit();
+
+      Response response;
+      response.status_code_ = entry->status_code;
+      response.headers_ = std::move(entry->headers);
+      response.text_ = std::move(entry->text);
+      return response;
+    }
+
+    // Those of the caller are kept
+    if (!std::empty(entry->etag) &&
+        !find_request_header(header, "If-None-Match")) {
+      conditional_header.emplace("If-None-Match", entry->etag);
+    }
+    if (!std::empty(entry->last_modified) &&
+        !find_request_header(header, "If-Modified-Since")) {
+      conditional_header.emplace("If-Modified-Since", entry->last_modified);
+    }
+  }
+
+  AddHeader add_header(http_handle_, conditional_header);
+  auto response = perform(multi, true);
+
+  if (entry && response.status_code_ == Response::StatusCode::NotModified) {
+    // The freshness in the 304 response takes precedence over the stored one
+    auto expires = cache_expires(response.headers_);
+    if (!find_header(response.headers_, "Cache-Control") &&
+        !find_header(response.headers_, "Expires")) {
+      expires = cache_expires(entry->headers);
+    }
+    if (auto etag = find_header(response.headers_, "ETag")) {
+      entry->etag = *etag;
+    }
+
+    response.status_code_ = entry->status_code;
+    response.headers_ = entry->headers;
+    response.text_ = entry->text;
+
+    if (expires) {
+      entry->expires = *expires;
+      cache->store(key, std::move(*entry));
+    } else {
+      cache->remove(key);
+    }
+    cache->revalidated();
+    return response;
+  }
+
+  auto new_entry = make_cache_entry(response.status_code_, response.headers_,
+                                    response.text_);
+  // A response to a request with credentials is private unless it says not
+  if (new_entry && find_request_header(header, "Authorization") &&
+      !has_directive(
+          find_header(response.headers_, "Cache-Control").value_or(""),
+          "public")) {
+    new_entry.reset();
+  }
+
+  if (!new_entry) {
+    if (entry) {
+      cache->remove(key);
+    }
+    return response;
+  }
+
+  if (auto vary = find_header(response.headers_, "Vary")) {
+    CacheEntry vary_entry;
+    vary_entry.headers = "Vary: " + *vary + "\r\n";
+    cache->store(url, std::move(vary_entry));
+    key = variant_key(url, *vary, header);
+  } else {
+    key = url;
+  }
+  cache->store(key, std::move(*new_entry));
+
+  return response;
+}
+
+Response Request::RequestImpl::perform(bool multi, bool retryable) {
+  ++stats_.requests;
+
+  for (std::int32_t retry = 0;; ++retry) {
+    auto start = std::chrono::steady_clock::now();
+
+    Response response;
+    auto delay = retryable ? hedge_delay() : std::chrono::milliseconds(0);
+    auto code = delay > std::chrono::milliseconds(0)
+                    ? hedged_transfer(response, delay)
+                    : transfer(response, multi);
+
+    if (code == CURLcode::CURLE_OK) {
+      record_latency(std::chrono::duration_cast<std::chrono::microseconds>(
+          std::chrono::steady_clock::now() - start));
+    }
+
+    std::optional<std::chrono::milliseconds> backoff;
+    if (retryable) {
+      backoff = retry_delay(retry, code, response);
+    }
+    if (!backoff) {
+      check_curl_correct(code);
+      return response;
+    }
+
+    ++stats_.retries;
+    std::this_thread::sleep_for(*backoff);
+  }
+}
+
+CURLcode Request::RequestImpl::transfer(Response &response, bool multi) {
+  std::optional<RateLimiter::RateLimiterImpl::Permit> permit;
+  if (rate_limiter_) {
+    permit.emplace(rate_limiter_->impl_->acquire(host_));
+  }
+
+  ++stats_.transfers;
+
+  check_curl_correct(
+      curl_easy_setopt(http_handle_, CURLOPT_WRITEDATA, &response.text_));
+  check_curl_correct(
+      curl_easy_setopt(http_handle_, CURLOPT_HEADERDATA, &response.headers_));
+
+  CURLcode code = CURLcode::CURLE_OK;
+  if (multi) {
+    Multi add_handle(multi_handle_, http_handle_);
+
+    std::int32_t still_running = 0;
+    do {
+      check_curl_correct(curl_multi_perform(multi_handle_, &still_running));
+      if (still_running) {
+        check_curl_correct(
+            curl_multi_poll(multi_handle_, nullptr, 0, 1000, nullptr));
+      }
+    } while (still_running);
+
+    code = transfer_result(http_handle_);
+  } else {
+    code = curl_easy_perform(http_handle_);
+  }
+
+  if (code == CURLcode::CURLE_OK) {
+    check_curl_correct(curl_easy_getinfo(http_handle_, CURLINFO_RESPONSE_CODE,
+                                         &response.status_code_));
+  }
+
+  return code;
+}
+
+// https://research.google/pubs/pub40801/
+CURLcode Request::RequestImpl::hedged_transfer(
+    Response &response, std::chrono::milliseconds delay) {
+  struct Hedge {
+    std::unique_ptr<CURL, decltype(curl_easy_cleanup) *> handle{
+        nullptr, curl_easy_cleanup};
+    Response response;
+    std::optional<RateLimiter::RateLimiterImpl::Permit> permit;
+    std::optional<Multi> add_handle;
+    bool done = false;
+    CURLcode code = CURLcode::CURLE_OK;
+  };
+  // Destroyed last, after all handles are removed from the multi handle
+  std::vector<std::unique_ptr<Hedge>> hedges;
+
+  std::optional<RateLimiter::RateLimiterImpl::Permit> permit;
+  if (rate_limiter_) {
+    permit.emplace(rate_limiter_->impl_->acquire(host_));
+  }
+
+  ++stats_.transfers;
+  check_curl_correct(
+      curl_easy_setopt(http_handle_, CURLOPT_WRITEDATA, &response.text_));
+  check_curl_correct(
+      curl_easy_setopt(http_handle_, CURLOPT_HEADERDATA, &response.headers_));
+
+  std::optional<Multi> add_handle;
+  add_handle.emplace(multi_handle_, http_handle_);
+
+  bool done = false;
+  auto code = CURLcode::CURLE_OK;
+  CURL *winner = nullptr;
+  auto next_hedge = std::chrono::steady_clock::now() + delay;
+
+  while (!winner) {
+    std::int32_t still_running = 0;
+    check_curl_correct(curl_multi_perform(multi_handle_, &still_running));
+
+    std::int32_t msgs_in_queue = 0;
+    while (auto msg = curl_multi_info_read(multi_handle_, &msgs_in_queue)) {
+      if (msg->msg != CURLMSG_DONE) {
+        continue;
+      }
+
+      if (msg->easy_handle == http_handle_) {
+        done = true;
+        code = msg->data.result;
+      } else {
+        for (auto &hedge : hedges) {
+          if (hedge->handle.get() == msg->easy_handle) {
+            hedge->done = true;
+            hedge->code = msg->data.result;
+          }
+        }
+      }
+
+      // The first successful transfer wins, a failed one waits for the others
+      if (msg->data.result == CURLcode::CURLE_OK) {
+        winner = msg->easy_handle;
+        break;
+      }
+    }
+
+    if (winner) {
+      break;
+    }
+
+    auto running = !done || std::any_of(std::begin(hedges), std::end(hedges),
+                                        [](const auto &hedge) {
+                                          return !hedge->done;
+                                        });
+    if (!running) {
+      return code;
+    }
+
+    auto now = std::chrono::steady_clock::now();
+    if (!done && std::ssize(hedges) < hedge_policy_.max_hedges &&
+        now >= next_hedge) {
+      auto hedge = std::make_unique<Hedge>();
+      next_hedge = now + delay;
+
+      // A hedge never waits for the rate limiter, it is skipped instead
+      if (rate_limiter_) {
+        auto permit = rate_limiter_->impl_->try_acquire(host_);
+        if (!permit) {
+          continue;
+        }
+        hedge->permit.emplace(std::move(*permit));
+      }
+
+      hedge->handle.reset(curl_easy_duphandle(http_handle_));
+      if (!hedge->handle) {
+        throw RuntimeError("curl_easy_duphandle() error");
+      }
+
+      check_curl_correct(curl_easy_setopt(hedge->handle.get(),
+                                          CURLOPT_WRITEDATA,
+                                          &hedge->response.text_));
+      check_curl_correct(curl_easy_setopt(hedge->handle.get(),
+                                          CURLOPT_HEADERDATA,
+                                          &hedge->response.headers_));
+      hedge->add_handle.emplace(multi_handle_, hedge->handle.get());
+      hedges.push_back(std::move(hedge));
+
+      ++stats_.hedges;
+      ++stats_.transfers;
+      continue;
+    }
+
+    std::int32_t timeout = 1000;
+    if (!done && std::ssize(hedges) < hedge_policy_.max_hedges) {
+      auto remaining = std::chrono::duration_cast<std::chrono::milliseconds>(
+          next_hedge - now);
+      timeout = std::clamp<std::int32_t>(remaining.count(), 1, 1000);
+    }
+    check_curl_correct(
+        curl_multi_poll(multi_handle_, nullptr, 0, timeout, nullptr));
+  }
+
+  // The losers are cancelled, no callback writes to the buffers after this
+  add_handle.reset();
+  for (auto &hedge : hedges) {
+    hedge->add_handle.reset();
+  }
+
+  if (winner != http_handle_) {
+    ++stats_.hedge_wins;
+    for (auto &hedge : hedges) {
+      if (hedge->handle.get() == winner) {
+        response = std::move(hedge->response);
+      }
+    }
+  }
+
+  check_curl_correct(curl_easy_getinfo(winner, CURLINFO_RESPONSE_CODE,
+                                       &response.status_code_));
+  return CURLcode::CURLE_OK;
+}
+
+CURLcode Request::RequestImpl::transfer_result(CURL *handle) {
+  auto code = CURLcode::CURLE_OK;
+
+  std::int32_t msgs_in_queue = 0;
+  while (auto msg = curl_multi_info_read(multi_handle_, &msgs_in_queue)) {
+    if (msg->msg == CURLMSG_DONE && msg->easy_handle == handle) {
+      code = msg->data.result;
+    }
+  }
+
+  return code;
+}
+
+// Exponential backoff with full jitter
+// https://aws.amazon.com/blogs/architecture/exponential-backoff-and-jitter/
+std::optional<std::chrono::milliseconds> Request::RequestImpl::retry_delay(
+    std::int32_t retry, CURLcode code, Response &response) {
+  if (retry >= retry_policy_.max_retries) {
+    return {};
+  }
+
+  if (code != CURLcode::CURLE_OK) {
+    if (!is_transient_error(code)) {
+      return {};
+    }
+  } else if (std::find(std::begin(retry_policy_.retry_status_codes),
+                       std::end(retry_policy_.retry_status_codes),
+                       response.status_code_) ==
+             std::end(retry_policy_.retry_status_codes)) {
+    return {};
+  }
+
+  auto max_backoff = static_cast<double>(retry_policy_.max_backoff.count());
+  auto backoff = std::min(
+      max_backoff, static_cast<double>(retry_policy_.initial_backoff.count()) *
+                       std::pow(retry_policy_.multiplier, retry));
+  std::uniform_int_distribution<std::int64_t> distribution(
+      0, static_cast<std::int64_t>(backoff));
+  std::chrono::milliseconds delay(distribution(random_engine_));
+
+  if (code == CURLcode::CURLE_OK && retry_policy_.respect_retry_after) {
+    const auto &headers = response.headers_map();
+
+    if (headers.contains("retry-after")) {
+      if (auto retry_after = parse_retry_after(headers.at("retry-after"))) {
+        // The server asks for a longer wait than the caller can accept
+        if (*retry_after > retry_policy_.max_backoff) {
+          return {};
+        }
+
+        delay = std::max(delay, *retry_after);
+      }
+    }
+  }
+
+  return delay;
+}
+
+std::chrono::milliseconds Request::RequestImpl::hedge_delay() const {
+  if (hedge_policy_.max_hedges == 0) {
+    return std::chrono::milliseconds(0);
+  }
+
+  if (hedge_policy_.delay > std::chrono::milliseconds(0)) {
+    return hedge_policy_.delay;
+  }
+
+  auto min_samples = std::max<std::size_t>(hedge_policy_.min_samples, 1);
+  if (std::size(latencies_) < min_samples) {
+    return std::chrono::milliseconds(0);
+  }
+
+  return std::max(
+      std::chrono::duration_cast<std::chrono::milliseconds>(latency_p95()),
+      std::chrono::milliseconds(1));
+}
+
+void Request::RequestImpl::record_latency(std::chrono::microseconds latency) {
+  if (std::size(latencies_) < max_latency_samples) {
+    latencies_.push_back(latency);
+  } else {
+    latencies_[latency_index_] = latency;
+    latency_index_ = (latency_index_ + 1) % max_latency_samples;
+  }
+}
+
+std::chrono::microseconds Request::RequestImpl::latency_p95() const {
+  if (std::empty(latencies_)) {
+    return std::chrono::microseconds(0);
+  }
+
+  auto samples = latencies_;
+  auto index = (std::size(samples) * 95 + 99) / 100 - 1;
+  std::nth_element(std::begin(samples), std::begin(samples) + index,
+                   std::end(samples));
+  return samples[index];
+}
+
+std::size_t Request::RequestImpl::callback_func_std_string(void *contents,
+                                                           std::size_t size,
+                                                           std::size_t nmemb,
+                                                           std::string *s) {
+  s->append(static_cast<const char *>(contents), size * nmemb);
+  return size * nmemb;
+}
 
 Request::Request() : impl_(std::make_unique<RequestImpl>()) {}
 
@@ -478,8 +2186,48 @@ void Request::set_connect_timeout(std::int64_t seconds) {
   impl_->set_connect_timeout(seconds);
 }
 
+void Request::set_http_version(HttpVersion version) {
+  impl_->set_http_version(version);
+}
+
+void Request::set_dns_cache_timeout(std::int64_t seconds) {
+  impl_->set_dns_cache_timeout(seconds);
+}
+
+void Request::add_resolve(const std::string &host, std::int32_t port,
+                          const std::string &address) {
+  impl_->add_resolve(host, port, address);
+}
+
+std::size_t Request::warm_up(const std::vector<std::string> &urls,
+                             bool multi) {
+  return impl_->warm_up(urls, multi);
+}
+
 void Request::use_cookies(bool flag) { impl_->use_cookies(flag); }
 
+void Request::set_cookie_jar(std::shared_ptr<CookieJar> cookie_jar) {
+  impl_->set_cookie_jar(std::move(cookie_jar));
+}
+
+void Request::set_cache(std::shared_ptr<HttpCache> cache) {
+  impl_->set_cache(std::move(cache));
+}
+
+void Request::set_rate_limiter(std::shared_ptr<RateLimiter> rate_limiter) {
+  impl_->set_rate_limiter(std::move(rate_limiter));
+}
+
+void Request::set_retry_policy(const RetryPolicy &policy) {
+  impl_->set_retry_policy(policy);
+}
+
+void Request::set_hedge_policy(const HedgePolicy &policy) {
+  impl_->set_hedge_policy(policy);
+}
+
+RequestStats Request::stats() const { return impl_->stats(); }
+
 Response Request::get(
     const std::string &url,
     const std::unordered_map<std::string, std::string> &params,
@@ -501,6 +2249,117 @@ Response Request::post(
   return impl_->post(url, data, header, multi);
 }
 
+Response Request::post(
+    const std::string &url, std::span<const std::byte> data,
+    const std::unordered_map<std::string, std::string> &header, bool multi) {
+  return impl_->upload("POST", url, data, header, multi);
+}
+
+Response Request::post(
+    const std::string &url, const ReadCallback &callback, std::int64_t size,
+    const std::unordered_map<std::string, std::string> &header, bool multi) {
+  return impl_->upload("POST", url, callback, size, header, multi);
+}
+
+Response Request::post(
+    const std::string &url, std::int32_t fd,
+    const std::unordered_map<std::string, std::string> &header, bool multi) {
+  return impl_->upload("POST", url, fd, header, multi);
+}
+
+Response Request::put(
+    const std::string &url, const std::string &data,
+    const std::unordered_map<std::string, std::string> &header, bool multi) {
+  return impl_->upload("PUT", url, std::as_bytes(std::span(data)), header,
+                       multi);
+}
+
+Response Request::put(
+    const std::string &url, std::span<const std::byte> data,
+    const std::unordered_map<std::string, std::string> &header, bool multi) {
+  return impl_->upload("PUT", url, data, header, multi);
+}
+
+Response Request::put(
+    const std::string &url, const ReadCallback &callback, std::int64_t size,
+    const std::unordered_map<std::string, std::string> &header, bool multi) {
+  return impl_->upload("PUT", url, callback, size, header, multi);
+}
+
+Response Request::put(
+    const std::string &url, std::int32_t fd,
+    const std::unordered_map<std::string, std::string> &header, bool multi) {
+  return impl_->upload("PUT", url, fd, header, multi);
+}
+
+Response Request::patch(
+    const std::string &url, const std::string &data,
+    const std::unordered_map<std::string, std::string> &header, bool multi) {
+  return impl_->upload("PATCH", url, std::as_bytes(std::span(data)), header,
+                       multi);
+}
+
+Response Request::patch(
+    const std::string &url, std::span<const std::byte> data,
+    const std::unordered_map<std::string, std::string> &header, bool multi) {
+  return impl_->upload("PATCH", url, data, header, multi);
+}
+
+Response Request::patch(
+    const std::string &url, const ReadCallback &callback, std::int64_t size,
+    const std::unordered_map<std::string, std::string> &header, bool multi) {
+  return impl_->upload("PATCH", url, callback, size, header, multi);
+}
+
+Response Request::patch(
+    const std::string &url, std::int32_t fd,
+    const std::unordered_map<std::string, std::string> &header, bool multi) {
+  return impl_->upload("PATCH", url, fd, header, multi);
+}
+
+Response Request::del(
+    const std::string &url,
+    const std::unordered_map<std::string, std::string> &params,
+    const std::unordered_map<std::string, std::string> &header, bool multi) {
+  return impl_->del(url, params, header, multi);
+}
+
+CookieJar::CookieJar() : impl_(std::make_unique<CookieJarImpl>()) {}
+
+CookieJar::~CookieJar() = default;
+
+void CookieJar::load(const std::string &path) { impl_->load(path); }
+
+void CookieJar::save(const std::string &path) { impl_->save(path); }
+
+void CookieJar::clear() { impl_->clear(); }
+
+std::vector<std::string> CookieJar::cookies() { return impl_->cookies(); }
+
+HttpCache::HttpCache(std::size_t max_memory_size, const std::string &directory)
+    : impl_(std::make_unique<HttpCacheImpl>(max_memory_size, directory)) {}
+
+HttpCache::~HttpCache() = default;
+
+void HttpCache::clear() { impl_->clear(); }
+
+std::size_t HttpCache::memory_size() const { return impl_->memory_size(); }
+
+std::uint64_t HttpCache::hits() const { return impl_->hits(); }
+
+std::uint64_t HttpCache::revalidations() const {
+  return impl_->revalidations();
+}
+
+RateLimiter::RateLimiter(double requests_per_second, std::size_t burst,
+                         std::size_t max_connections_per_host)
+    : impl_(std::make_unique<RateLimiterImpl>(
+          requests_per_second, burst, max_connections_per_host)) {}
+
+RateLimiter::~RateLimiter() = default;
+
+RateLimiterStats RateLimiter::stats() const { return impl_->stats(); }
+
 const std::string &Headers::at(const std::string &key) const {
   auto lower_key = boost::to_lower_copy(key);
   if (!map_.contains(lower_key)) {
@@ -510,6 +2369,10 @@ const std::string &Headers::at(const std::string &key) const {
   return map_.at(lower_key);
 }
 
+bool Headers::contains(const std::string &key) const {
+  return map_.contains(boost::to_lower_copy(key));
+}
+
 void Headers::add(const std::string &key, const std::string &value) {
   auto lower_key = boost::to_lower_copy(key);
   auto lower_value = boost::to_lower_copy(value);
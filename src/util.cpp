@@ -1,60 +1,65 @@
 #include "klib/util.h"
 
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 #include <unistd.h>
 #include <wait.h>
 
+#ifdef __x86_64__
+#include <immintrin.h>
+#endif
+
 #include <algorithm>
+#include <atomic>
+#include <bit>
+#include <cctype>
 #include <cerrno>
-#include <clocale>
 #include <cstdlib>
 #include <cstring>
-#include <cuchar>
+#include <exception>
 #include <filesystem>
+#include <functional>
 #include <fstream>
 #include <limits>
 #include <map>
 #include <memory>
+#include <mutex>
+#include <optional>
+#include <span>
 #include <string_view>
+#include <thread>
 #include <utility>
 #include <vector>
 
-#include <fmt/compile.h>
 #include <fmt/format.h>
-#include <openssl/aes.h>
 #include <openssl/err.h>
 #include <openssl/evp.h>
-#include <openssl/md5.h>
-#include <openssl/sha.h>
-#include <boost/algorithm/string.hpp>
+#include <openssl/rand.h>
 #include <boost/uuid/uuid_generators.hpp>
 #include <boost/uuid/uuid_io.hpp>
 
 #include "klib/error.h"
 #include "klib/exception.h"
 
+#include "detail.h"
+
 namespace klib {
 
 namespace {
 
+using detail::has_avx2;
+using detail::parallel_for;
+using detail::read_le32;
+using detail::read_le64;
+using detail::write_be64;
+
 void check_openssl(std::int32_t rc) {
   if (rc != 1) {
     throw RuntimeError(ERR_error_string(ERR_get_error(), nullptr));
   }
 }
 
-std::string bytes_to_hex_string(const std::vector<std::uint8_t> &bytes) {
-  std::string str;
-
-  // https://zh.wikipedia.org/wiki/SHA-3#SHA_%E5%AE%B6%E6%97%8F%E5%87%BD%E6%95%B0%E7%9A%84%E6%AF%94%E8%BE%83
-  str.reserve(128);
-
-  for (auto byte : bytes) {
-    str += fmt::format(FMT_COMPILE("{:02x}"), byte);
-  }
-
-  return str;
-}
-
 std::map<std::string, std::string> read_folder(const std::string &path) {
   if (!std::filesystem::is_directory(path)) {
     throw RuntimeError("'{}' is not a directory", path);
@@ -75,431 +80,3637 @@ std::map<std::string, std::string> read_folder(const std::string &path) {
   return folder;
 }
 
-std::vector<std::uint8_t> do_evp(const std::string &str,
-                                 std::uint32_t digest_length,
-                                 const EVP_MD *algorithm) {
-  std::unique_ptr<EVP_MD_CTX, decltype(EVP_MD_CTX_free) *> context(
-      EVP_MD_CTX_new(), EVP_MD_CTX_free);
-  if (!context) {
-    throw RuntimeError(ERR_error_string(ERR_get_error(), nullptr));
+// One hasher per algorithm and thread, so the digest is fetched and its
+// context allocated once instead of on every call
+detail::EvpHasher &cached_hasher(HashAlgorithm algorithm) {
+  thread_local std::array<std::unique_ptr<detail::EvpHasher>, 3> hashers;
+
+  auto &hasher = hashers[static_cast<std::size_t>(algorithm)];
+  if (!hasher) {
+    hasher = std::make_unique<detail::EvpHasher>(algorithm);
+  }
+  return *hasher;
+}
+
+std::vector<std::uint8_t> evp_digest(std::string_view data,
+                                     HashAlgorithm algorithm) {
+  auto &hasher = cached_hasher(algorithm);
+
+  std::vector<std::uint8_t> digest(digest_size(algorithm));
+  try {
+    hasher.update(std::data(data), std::size(data));
+    hasher.finalize(std::data(digest));
+  } catch (...) {
+    hasher.reset();
+    throw;
   }
 
-  check_openssl(EVP_DigestInit(context.get(), algorithm));
-  check_openssl(EVP_DigestUpdate(context.get(), str.c_str(), std::size(str)));
+  return digest;
+}
 
-  auto digest = std::make_unique<std::uint8_t[]>(digest_length);
-  check_openssl(EVP_DigestFinal(context.get(), digest.get(), &digest_length));
+const EVP_MD *evp_md(HashAlgorithm algorithm) {
+  switch (algorithm) {
+    case HashAlgorithm::Md5:
+      return EVP_md5();
+    case HashAlgorithm::Sha256:
+      return EVP_sha256();
+    case HashAlgorithm::Sha3_512:
+      return EVP_sha3_512();
+  }
 
-  return std::vector<std::uint8_t>(digest.get(), digest.get() + digest_length);
+  throw RuntimeError("Unknown hash algorithm");
 }
 
 }  // namespace
 
-ChangeWorkingDir::ChangeWorkingDir(const std::string &path) {
-  if (!std::empty(path)) {
-    backup_ = std::filesystem::current_path();
+namespace detail {
 
-    if (!std::filesystem::is_directory(path)) {
-      if (!std::filesystem::create_directory(path)) {
-        throw RuntimeError("can not create directory: '{}'", path);
-      }
-    }
+class EvpHasher::EvpHasherImpl {
+ public:
+  explicit EvpHasherImpl(HashAlgorithm algorithm);
 
-    if (chdir(path.c_str())) {
-      throw RuntimeError("chdir error");
-    }
-  }
-}
+  EvpHasherImpl(const EvpHasherImpl &) = delete;
+  EvpHasherImpl(EvpHasherImpl &&) = delete;
+  EvpHasherImpl &operator=(const EvpHasherImpl &) = delete;
+  EvpHasherImpl &operator=(EvpHasherImpl &&) = delete;
 
-ChangeWorkingDir::~ChangeWorkingDir() {
-  if (!std::empty(backup_) && chdir(backup_.c_str())) {
-    error("chdir error");
-  }
-}
+  ~EvpHasherImpl();
 
-std::vector<std::string> split_str(const std::string &str,
-                                   const std::string &separate) {
-  std::vector<std::string> result;
-  result.reserve(128);
+  void update(const void *data, std::size_t size);
+  void finalize(std::uint8_t *digest);
+  void reset();
+
+ private:
+  // Explicitly fetched, so the lookup is not repeated by every init
+  EVP_MD *md_ = nullptr;
+  EVP_MD_CTX *context_ = nullptr;
+};
 
-  boost::split(result, str, boost::is_any_of(separate),
-               boost::token_compress_on);
-  for (auto &line : result) {
-    boost::trim(line);
+EvpHasher::EvpHasherImpl::EvpHasherImpl(HashAlgorithm algorithm) {
+  md_ = EVP_MD_fetch(nullptr, EVP_MD_get0_name(evp_md(algorithm)), nullptr);
+  if (!md_) {
+    throw RuntimeError(ERR_error_string(ERR_get_error(), nullptr));
   }
 
-  std::erase_if(result,
-                [](const std::string &line) { return std::empty(line); });
+  context_ = EVP_MD_CTX_new();
+  if (!context_) {
+    EVP_MD_free(md_);
+    throw RuntimeError(ERR_error_string(ERR_get_error(), nullptr));
+  }
 
-  return result;
+  try {
+    reset();
+  } catch (...) {
+    EVP_MD_CTX_free(context_);
+    EVP_MD_free(md_);
+    throw;
+  }
 }
 
-std::string read_file(const std::string &path, bool binary_mode) {
-  return read_file(path.c_str(), binary_mode);
+EvpHasher::EvpHasherImpl::~EvpHasherImpl() {
+  EVP_MD_CTX_free(context_);
+  EVP_MD_free(md_);
 }
 
-std::string read_file(std::string_view path, bool binary_mode) {
-  return read_file(path.data(), binary_mode);
+void EvpHasher::EvpHasherImpl::update(const void *data, std::size_t size) {
+  check_openssl(EVP_DigestUpdate(context_, data, size));
 }
 
-std::string read_file(const char *path, bool binary_mode) {
-  if (!std::filesystem::is_regular_file(path)) {
-    throw RuntimeError("'{}' is not a file", path);
-  }
-
-  std::ifstream ifs;
-  if (binary_mode) {
-    ifs.open(path, std::ifstream::binary);
-  } else {
-    ifs.open(path);
-  }
+void EvpHasher::EvpHasherImpl::finalize(std::uint8_t *digest) {
+  check_openssl(EVP_DigestFinal_ex(context_, digest, nullptr));
+  reset();
+}
 
-  if (!ifs) {
-    throw RuntimeError("can not open file: '{}'", path);
-  }
+void EvpHasher::EvpHasherImpl::reset() {
+  check_openssl(EVP_DigestInit_ex(context_, md_, nullptr));
+}
 
-  std::string data;
+EvpHasher::EvpHasher(HashAlgorithm algorithm)
+    : impl_(std::make_unique<EvpHasherImpl>(algorithm)) {}
 
-  auto size = ifs.seekg(0, std::ifstream::end).tellg();
-  data.resize(size);
-  ifs.seekg(0, std::ifstream::beg).read(data.data(), size);
+EvpHasher::EvpHasher(EvpHasher &&) noexcept = default;
 
-  return data;
-}
+EvpHasher &EvpHasher::operator=(EvpHasher &&) noexcept = default;
 
-std::vector<std::string> read_file_line(const std::string &path) {
-  return read_file_line(path.c_str());
-}
+EvpHasher::~EvpHasher() = default;
 
-std::vector<std::string> read_file_line(std::string_view path) {
-  return read_file_line(path.data());
+void EvpHasher::update(const void *data, std::size_t size) {
+  impl_->update(data, size);
 }
 
-std::vector<std::string> read_file_line(const char *path) {
-  auto str = read_file(path, false);
-  return split_str(str, "\n");
-}
+void EvpHasher::finalize(std::uint8_t *digest) { impl_->finalize(digest); }
 
-void write_file(const std::string &path, bool binary_mode,
-                const std::string &content) {
-  write_file(path.c_str(), binary_mode, content.c_str(), std::size(content));
-}
+void EvpHasher::reset() { impl_->reset(); }
 
-void write_file(std::string_view path, bool binary_mode,
-                std::string_view content) {
-  write_file(path.data(), binary_mode, content.data(), std::size(content));
-}
+}  // namespace detail
 
-void write_file(const char *path, bool binary_mode, const char *content,
-                std::size_t length) {
-  std::ofstream ofs;
-  if (binary_mode) {
-    ofs.open(path, std::ofstream::binary);
-  } else {
-    ofs.open(path);
-  }
+namespace {
 
-  if (!ofs) {
-    throw RuntimeError("can not open file: '{}'", path);
+class FileDescriptor {
+ public:
+  explicit FileDescriptor(const std::string &path,
+                          std::int32_t flags = O_RDONLY)
+      : fd_(::open(path.c_str(), flags | O_CLOEXEC, 0644)) {
+    if (fd_ == -1) {
+      throw RuntimeError("can not open file: '{}'", path);
+    }
   }
 
-  ofs.write(content, length);
-}
+  FileDescriptor(const FileDescriptor &) = delete;
+  FileDescriptor(FileDescriptor &&) = delete;
+  FileDescriptor &operator=(const FileDescriptor &) = delete;
+  FileDescriptor &operator=(FileDescriptor &&) = delete;
 
-// https://zh.cppreference.com/w/c/string/multibyte/mbrtoc16
-std::u16string utf8_to_utf16(const std::string &str) {
-  if (std::empty(str)) {
-    return {};
-  }
+  ~FileDescriptor() { ::close(fd_); }
 
-  std::setlocale(LC_ALL, "en_US.utf8");
+  [[nodiscard]] std::int32_t get() const { return fd_; }
 
-  std::u16string result;
+ private:
+  std::int32_t fd_ = -1;
+};
 
-  char16_t out = 0;
-  auto begin = str.c_str();
-  auto size = std::size(str);
-  mbstate_t state = {};
+std::size_t file_size(const FileDescriptor &fd) {
+  struct stat status = {};
+  if (::fstat(fd.get(), &status) == -1) {
+    throw RuntimeError(std::strerror(errno));
+  }
+  return static_cast<std::size_t>(status.st_size);
+}
 
-  while (auto rc = std::mbrtoc16(&out, begin, size, &state)) {
-    if (rc == static_cast<std::size_t>(-1)) {
-      throw RuntimeError(std::strerror(errno));
+// A read-only mapping of part of a file, data() is nullptr if it can not be
+// mapped
+class Mapping {
+ public:
+  Mapping(const FileDescriptor &fd, std::size_t offset, std::size_t size) {
+    auto addr = ::mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd.get(),
+                       static_cast<off_t>(offset));
+    if (addr != MAP_FAILED) {
+      data_ = addr;
+      size_ = size;
     }
+  }
 
-    if (rc == static_cast<std::size_t>(-3)) {
-      result.push_back(out);
-    } else if (rc <= std::numeric_limits<std::size_t>::max() / 2) {
-      begin += rc;
-      result.push_back(out);
-    } else {
-      break;
+  Mapping(const Mapping &) = delete;
+  Mapping(Mapping &&) = delete;
+  Mapping &operator=(const Mapping &) = delete;
+  Mapping &operator=(Mapping &&) = delete;
+
+  ~Mapping() {
+    if (data_ != nullptr) {
+      ::munmap(data_, size_);
     }
   }
 
-  return result;
-}
+  void advise(std::int32_t advice) const { ::madvise(data_, size_, advice); }
 
-// https://zh.cppreference.com/w/c/string/multibyte/mbrtoc32
-std::u32string utf8_to_utf32(const std::string &str) {
-  if (std::empty(str)) {
-    return {};
+  [[nodiscard]] const char *data() const {
+    return static_cast<const char *>(data_);
   }
 
-  std::setlocale(LC_ALL, "en_US.utf8");
+  [[nodiscard]] std::size_t size() const { return size_; }
+
+ private:
+  void *data_ = nullptr;
+  std::size_t size_ = 0;
+};
+
+// Call func(data, size) with the contents of the file from offset to the end,
+// read by pread()
+template <typename Func>
+void pread_chunks(const FileDescriptor &fd, const std::string &path,
+                  std::size_t offset, Func func) {
+  std::vector<char> buffer(1024 * 1024);
+  while (true) {
+    auto n = ::pread(fd.get(), std::data(buffer), std::size(buffer),
+                     static_cast<off_t>(offset));
+    if (n == -1) {
+      if (errno == EINTR) {
+        continue;
+      }
+      throw RuntimeError("can not read file: '{}'", path);
+    }
+    if (n == 0) {
+      return;
+    }
 
-  std::u32string result;
+    func(std::data(buffer), static_cast<std::size_t>(n));
+    offset += static_cast<std::size_t>(n);
+  }
+}
 
-  char32_t out = 0;
-  auto begin = str.c_str();
-  auto size = std::size(str);
-  mbstate_t state = {};
+// Call func(data, size) with the contents of the file in order. The file is
+// mapped one window at a time, so the memory used is bounded whatever the file
+// size. Files that can not be mapped, or that report no size such as those in
+// /proc, are read by pread() instead
+template <typename Func>
+void for_each_file_chunk(const std::string &path, Func func) {
+  if (!std::filesystem::is_regular_file(path)) {
+    throw RuntimeError("'{}' is not a file", path);
+  }
 
-  while (auto rc = std::mbrtoc32(&out, begin, size, &state)) {
-    if (rc == static_cast<std::size_t>(-1)) {
-      throw RuntimeError(std::strerror(errno));
-    }
+  FileDescriptor fd(path);
 
-    if (rc > static_cast<std::size_t>(-1) / 2) {
+  constexpr std::size_t window_size = 64 * 1024 * 1024;
+  auto size = file_size(fd);
+
+  std::size_t offset = 0;
+  while (offset < size) {
+    Mapping mapping(fd, offset, std::min(window_size, size - offset));
+    if (mapping.data() == nullptr) {
       break;
     }
 
-    begin += rc;
-    result.push_back(out);
+    mapping.advise(MADV_SEQUENTIAL);
+    func(mapping.data(), mapping.size());
+    offset += mapping.size();
   }
 
-  return result;
+  if (offset == size && size != 0) {
+    return;
+  }
+  pread_chunks(fd, path, offset, func);
 }
 
-// https://zh.cppreference.com/w/c/string/multibyte/c32rtomb
-std::string utf32_to_utf8(char32_t c) {
-  std::setlocale(LC_ALL, "en_US.utf8");
-
-  std::string result;
-  result.resize(MB_CUR_MAX);
-
-  mbstate_t state = {};
-  auto rc = std::c32rtomb(std::data(result), c, &state);
-
-  if (rc == static_cast<std::size_t>(-1)) {
-    throw RuntimeError(std::strerror(errno));
-  } else if (rc == 0) {
-    throw RuntimeError("utf32_to_utf8 error");
+std::vector<std::uint8_t> digest_file(const std::string &path,
+                                      HashAlgorithm algorithm) {
+  auto &hasher = cached_hasher(algorithm);
+
+  std::vector<std::uint8_t> digest(digest_size(algorithm));
+  try {
+    for_each_file_chunk(path, [&](const char *data, std::size_t size) {
+      hasher.update(data, size);
+    });
+    hasher.finalize(std::data(digest));
+  } catch (...) {
+    hasher.reset();
+    throw;
   }
 
-  result.resize(rc);
+  return digest;
+}
+
+bool has_ssse3() {
+#ifdef __x86_64__
+  static const bool result = __builtin_cpu_supports("ssse3");
   return result;
+#else
+  return false;
+#endif
 }
 
-std::string utf32_to_utf8(const std::u32string &str) {
-  std::string result;
+constexpr char hex_digits[] = "0123456789abcdef";
 
-  for (auto c : str) {
-    result.append(utf32_to_utf8(c));
+// The two characters of every byte value
+constexpr auto hex_table = [] {
+  std::array<std::array<char, 2>, 256> table = {};
+  for (std::size_t i = 0; i < 256; ++i) {
+    table[i] = {hex_digits[i >> 4], hex_digits[i & 0xF]};
+  }
+  return table;
+}();
+
+// The value of every hexadecimal digit, 0xFF for the other characters
+constexpr auto hex_values = [] {
+  std::array<std::uint8_t, 256> table = {};
+  std::fill(std::begin(table), std::end(table), 0xFF);
+  for (std::uint8_t i = 0; i < 10; ++i) {
+    table['0' + i] = i;
+  }
+  for (std::uint8_t i = 0; i < 6; ++i) {
+    table['a' + i] = 10 + i;
+    table['A' + i] = 10 + i;
   }
+  return table;
+}();
 
-  return result;
+void hex_encode_scalar(const std::uint8_t *bytes, std::size_t size,
+                       char *hex) {
+  for (std::size_t i = 0; i < size; ++i) {
+    std::memcpy(hex + 2 * i, std::data(hex_table[bytes[i]]), 2);
+  }
 }
 
-bool is_ascii(const std::string &str) {
-  return std::all_of(std::begin(str), std::end(str),
-                     [](char c) { return is_ascii(c); });
+// Return false if there is a character that is not a hexadecimal digit
+bool hex_decode_scalar(const char *hex, std::size_t size,
+                       std::uint8_t *bytes) {
+  for (std::size_t i = 0; i < size; ++i) {
+    auto high = hex_values[static_cast<std::uint8_t>(hex[2 * i])];
+    auto low = hex_values[static_cast<std::uint8_t>(hex[2 * i + 1])];
+    if ((high | low) == 0xFF) {
+      return false;
+    }
+    bytes[i] = static_cast<std::uint8_t>(high << 4 | low);
+  }
+  return true;
 }
 
-bool is_ascii(const std::u32string &str) {
-  return std::all_of(std::begin(str), std::end(str),
-                     [](char32_t c) { return is_ascii(c); });
+#ifdef __x86_64__
+// Each 16 bytes are split into nibbles, which index the digits with a byte
+// shuffle
+__attribute__((target("ssse3"))) std::size_t hex_encode_ssse3(
+    const std::uint8_t *bytes, std::size_t size, char *hex) {
+  const auto digits =
+      _mm_loadu_si128(reinterpret_cast<const __m128i *>(hex_digits));
+  const auto mask = _mm_set1_epi8(0xF);
+
+  std::size_t i = 0;
+  for (; i + 16 <= size; i += 16) {
+    auto input = _mm_loadu_si128(reinterpret_cast<const __m128i *>(bytes + i));
+    auto high = _mm_and_si128(_mm_srli_epi16(input, 4), mask);
+    auto low = _mm_and_si128(input, mask);
+
+    auto *output = reinterpret_cast<__m128i *>(hex + 2 * i);
+    _mm_storeu_si128(output,
+                     _mm_shuffle_epi8(digits, _mm_unpacklo_epi8(high, low)));
+    _mm_storeu_si128(output + 1,
+                     _mm_shuffle_epi8(digits, _mm_unpackhi_epi8(high, low)));
+  }
+  return i;
 }
 
-bool is_chinese(const std::string &c) {
-  if (std::empty(c)) {
-    return false;
+__attribute__((target("avx2"))) std::size_t hex_encode_avx2(
+    const std::uint8_t *bytes, std::size_t size, char *hex) {
+  const auto digits = _mm256_broadcastsi128_si256(
+      _mm_loadu_si128(reinterpret_cast<const __m128i *>(hex_digits)));
+  const auto mask = _mm256_set1_epi8(0xF);
+
+  std::size_t i = 0;
+  for (; i + 32 <= size; i += 32) {
+    auto input =
+        _mm256_loadu_si256(reinterpret_cast<const __m256i *>(bytes + i));
+    auto high = _mm256_and_si256(_mm256_srli_epi16(input, 4), mask);
+    auto low = _mm256_and_si256(input, mask);
+
+    // The unpacks work within 128-bit lanes, bytes 0-7 and 16-23 are in the
+    // first one
+    auto first = _mm256_unpacklo_epi8(high, low);
+    auto second = _mm256_unpackhi_epi8(high, low);
+
+    auto *output = reinterpret_cast<__m256i *>(hex + 2 * i);
+    _mm256_storeu_si256(
+        output, _mm256_shuffle_epi8(
+                    digits, _mm256_permute2x128_si256(first, second, 0x20)));
+    _mm256_storeu_si256(
+        output + 1,
+        _mm256_shuffle_epi8(digits,
+                            _mm256_permute2x128_si256(first, second, 0x31)));
+  }
+  return i;
+}
+
+// Return the number of bytes decoded, stop before the first block with a
+// character that is not a hexadecimal digit
+__attribute__((target("ssse3"))) std::size_t hex_decode_ssse3(
+    const char *hex, std::size_t size, std::uint8_t *bytes) {
+  std::size_t i = 0;
+  for (; i + 8 <= size; i += 8) {
+    auto input =
+        _mm_loadu_si128(reinterpret_cast<const __m128i *>(hex + 2 * i));
+
+    auto digit = _mm_sub_epi8(input, _mm_set1_epi8('0'));
+    auto is_digit =
+        _mm_cmpeq_epi8(_mm_min_epu8(digit, _mm_set1_epi8(9)), digit);
+    auto letter = _mm_sub_epi8(_mm_or_si128(input, _mm_set1_epi8(0x20)),
+                               _mm_set1_epi8('a'));
+    auto is_letter =
+        _mm_cmpeq_epi8(_mm_min_epu8(letter, _mm_set1_epi8(5)), letter);
+    if (_mm_movemask_epi8(_mm_or_si128(is_digit, is_letter)) != 0xFFFF) {
+      break;
+    }
+
+    auto value = _mm_or_si128(
+        _mm_and_si128(is_digit, digit),
+        _mm_and_si128(is_letter, _mm_add_epi8(letter, _mm_set1_epi8(10))));
+    auto words = _mm_maddubs_epi16(value, _mm_set1_epi16(0x0110));
+    _mm_storel_epi64(reinterpret_cast<__m128i *>(bytes + i),
+                     _mm_packus_epi16(words, words));
   }
+  return i;
+}
 
-  auto utf32 = utf8_to_utf32(c);
+__attribute__((target("avx2"))) std::size_t hex_decode_avx2(
+    const char *hex, std::size_t size, std::uint8_t *bytes) {
+  std::size_t i = 0;
+  for (; i + 16 <= size; i += 16) {
+    auto input =
+        _mm256_loadu_si256(reinterpret_cast<const __m256i *>(hex + 2 * i));
+
+    auto digit = _mm256_sub_epi8(input, _mm256_set1_epi8('0'));
+    auto is_digit = _mm256_cmpeq_epi8(
+        _mm256_min_epu8(digit, _mm256_set1_epi8(9)), digit);
+    auto letter = _mm256_sub_epi8(
+        _mm256_or_si256(input, _mm256_set1_epi8(0x20)), _mm256_set1_epi8('a'));
+    auto is_letter = _mm256_cmpeq_epi8(
+        _mm256_min_epu8(letter, _mm256_set1_epi8(5)), letter);
+    if (_mm256_movemask_epi8(_mm256_or_si256(is_digit, is_letter)) != -1) {
+      break;
+    }
 
-  if (std::size(utf32) != 1) {
-    throw RuntimeError("not a UTF-32 encoded character: '{}'", c);
+    auto value = _mm256_or_si256(
+        _mm256_and_si256(is_digit, digit),
+        _mm256_and_si256(is_letter,
+                         _mm256_add_epi8(letter, _mm256_set1_epi8(10))));
+    auto words = _mm256_maddubs_epi16(value, _mm256_set1_epi16(0x0110));
+    auto packed = _mm256_permute4x64_epi64(_mm256_packus_epi16(words, words),
+                                           _MM_SHUFFLE(3, 1, 2, 0));
+    _mm_storeu_si128(reinterpret_cast<__m128i *>(bytes + i),
+                     _mm256_castsi256_si128(packed));
   }
+  return i;
+}
+#endif
 
-  return is_chinese(utf32.front());
+bool has_sha_ni() {
+#ifdef __x86_64__
+  static const bool result =
+      __builtin_cpu_supports("sha") && __builtin_cpu_supports("sse4.1");
+  return result;
+#else
+  return false;
+#endif
 }
 
-// https://github.com/gspark/cryptool/blob/main/src/crypto/digest/base64.cpp
-std::string base64_encode(const std::string &str) {
-  std::unique_ptr<EVP_ENCODE_CTX, decltype(EVP_ENCODE_CTX_free) *> context(
-      EVP_ENCODE_CTX_new(), EVP_ENCODE_CTX_free);
-  if (!context) {
-    throw RuntimeError(ERR_error_string(ERR_get_error(), nullptr));
+// The message of a SHA-256 computation as a sequence of 64 bytes blocks, the
+// full blocks are read in place and only the padded tail is copied
+class Sha256Blocks {
+ public:
+  explicit Sha256Blocks(std::string_view input)
+      : data_(reinterpret_cast<const std::uint8_t *>(std::data(input))),
+        full_blocks_(std::size(input) / 64) {
+    auto rest = std::size(input) % 64;
+    std::memcpy(std::data(tail_), data_ + full_blocks_ * 64, rest);
+    tail_[rest] = 0x80;
+    tail_blocks_ = rest + 1 + 8 > 64 ? 2 : 1;
+
+    auto bits = static_cast<std::uint64_t>(std::size(input)) * 8;
+    write_be64(bits, std::data(tail_) + tail_blocks_ * 64 - 8);
   }
 
-  EVP_EncodeInit(context.get());
+  [[nodiscard]] std::size_t size() const { return full_blocks_ + tail_blocks_; }
 
-  std::int32_t chunk_len = 0;
-  auto size = std::size(str);
-  auto digest = std::make_unique<std::uint8_t[]>(EVP_ENCODE_LENGTH(size));
-  if (auto code = EVP_EncodeUpdate(
-          context.get(), digest.get(), &chunk_len,
-          reinterpret_cast<const unsigned char *>(std::data(str)), size);
-      code != 0 && code != 1) {
-    throw RuntimeError(ERR_error_string(ERR_get_error(), nullptr));
+  [[nodiscard]] const std::uint8_t *operator[](std::size_t index) const {
+    if (index < full_blocks_) {
+      return data_ + index * 64;
+    }
+    return std::data(tail_) + (index - full_blocks_) * 64;
   }
 
-  std::int32_t output_len = chunk_len;
-  EVP_EncodeFinal(context.get(), digest.get() + chunk_len, &chunk_len);
-  output_len += chunk_len;
+ private:
+  const std::uint8_t *data_;
+  std::size_t full_blocks_;
+  std::size_t tail_blocks_;
+  std::array<std::uint8_t, 128> tail_ = {};
+};
+
+#ifdef __x86_64__
+alignas(16) constexpr std::uint32_t sha_256_k[64] = {
+    0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1,
+    0x923f82a4, 0xab1c5ed5, 0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3,
+    0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174, 0xe49b69c1, 0xefbe4786,
+    0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+    0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147,
+    0x06ca6351, 0x14292967, 0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13,
+    0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85, 0xa2bfe8a1, 0xa81a664b,
+    0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+    0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a,
+    0x5b9cca4f, 0x682e6ff3, 0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208,
+    0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2};
+
+// The state as the ABEF and CDGH halves used by the SHA extensions
+struct Sha256NiState {
+  __m128i abef;
+  __m128i cdgh;
+};
+
+__attribute__((target("sha,sse4.1,ssse3"))) __m128i sha_256_byte_swap(
+    __m128i x) {
+  return _mm_shuffle_epi8(
+      x, _mm_set_epi64x(0x0c0d0e0f08090a0bULL, 0x0405060700010203ULL));
+}
+
+__attribute__((target("sha,sse4.1,ssse3"))) Sha256NiState sha_256_ni_init() {
+  constexpr std::uint32_t h[8] = {0x6a09e667, 0xbb67ae85, 0x3c6ef372,
+                                  0xa54ff53a, 0x510e527f, 0x9b05688c,
+                                  0x1f83d9ab, 0x5be0cd19};
 
-  auto output =
-      std::string(reinterpret_cast<const char *>(digest.get()), output_len);
+  auto cdab = _mm_shuffle_epi32(
+      _mm_loadu_si128(reinterpret_cast<const __m128i *>(h)), 0xB1);
+  auto efgh = _mm_shuffle_epi32(
+      _mm_loadu_si128(reinterpret_cast<const __m128i *>(h + 4)), 0x1B);
+  return {_mm_alignr_epi8(cdab, efgh, 8), _mm_blend_epi16(efgh, cdab, 0xF0)};
+}
 
-  boost::replace_all(output, "\n", "");
-  return output;
+__attribute__((target("sha,sse4.1,ssse3"))) void sha_256_ni_digest(
+    const Sha256NiState &state, std::uint8_t *digest) {
+  auto feba = _mm_shuffle_epi32(state.abef, 0x1B);
+  auto dchg = _mm_shuffle_epi32(state.cdgh, 0xB1);
+  _mm_storeu_si128(reinterpret_cast<__m128i *>(digest),
+                   sha_256_byte_swap(_mm_blend_epi16(feba, dchg, 0xF0)));
+  _mm_storeu_si128(reinterpret_cast<__m128i *>(digest + 16),
+                   sha_256_byte_swap(_mm_alignr_epi8(dchg, feba, 8)));
 }
 
-std::string base64_decode(const std::string &str) {
-  std::unique_ptr<EVP_ENCODE_CTX, decltype(EVP_ENCODE_CTX_free) *> context(
-      EVP_ENCODE_CTX_new(), EVP_ENCODE_CTX_free);
-  if (!context) {
-    throw RuntimeError(ERR_error_string(ERR_get_error(), nullptr));
+// 4 of the 64 rounds, the message schedule is computed on the fly in w
+__attribute__((target("sha,sse4.1,ssse3"), always_inline)) inline void
+sha_256_ni_rounds(Sha256NiState &state, __m128i *w, const std::uint8_t *block,
+                  std::size_t group) {
+  auto &current = w[group % 4];
+  if (group < 4) {
+    current = sha_256_byte_swap(_mm_loadu_si128(
+        reinterpret_cast<const __m128i *>(block + 16 * group)));
+  } else {
+    const auto &previous = w[(group + 3) % 4];
+    current = _mm_sha256msg2_epu32(
+        _mm_add_epi32(_mm_sha256msg1_epu32(current, w[(group + 1) % 4]),
+                      _mm_alignr_epi8(previous, w[(group + 2) % 4], 4)),
+        previous);
   }
 
-  EVP_DecodeInit(context.get());
+  auto message = _mm_add_epi32(
+      current,
+      _mm_load_si128(reinterpret_cast<const __m128i *>(sha_256_k + 4 * group)));
+  state.cdgh = _mm_sha256rnds2_epu32(state.cdgh, state.abef, message);
+  state.abef = _mm_sha256rnds2_epu32(state.abef, state.cdgh,
+                                     _mm_shuffle_epi32(message, 0x0E));
+}
 
-  std::int32_t chunk_len = 0;
-  auto size = std::size(str);
-  auto digest = std::make_unique<std::uint8_t[]>(EVP_DECODE_LENGTH(size));
-  if (auto code = EVP_DecodeUpdate(
-          context.get(), digest.get(), &chunk_len,
-          reinterpret_cast<const unsigned char *>(std::data(str)), size);
-      code != 0 && code != 1) {
-    throw RuntimeError(ERR_error_string(ERR_get_error(), nullptr));
-  }
+__attribute__((target("sha,sse4.1,ssse3"))) void sha_256_ni_compress(
+    Sha256NiState &state, const std::uint8_t *block) {
+  auto saved = state;
 
-  std::int32_t output_len = chunk_len;
-  check_openssl(
-      EVP_DecodeFinal(context.get(), digest.get() + chunk_len, &chunk_len));
-  output_len += chunk_len;
+  __m128i w[4];
+#pragma GCC unroll 16
+  for (std::size_t group = 0; group < 16; ++group) {
+    sha_256_ni_rounds(state, w, block, group);
+  }
 
-  return std::string(reinterpret_cast<const char *>(digest.get()), output_len);
+  state.abef = _mm_add_epi32(state.abef, saved.abef);
+  state.cdgh = _mm_add_epi32(state.cdgh, saved.cdgh);
 }
 
-std::string md5(const std::string &str) {
-  return bytes_to_hex_string(md5_raw(str));
-}
+// Two independent messages are interleaved, so one hides the latency of the
+// other's rounds
+__attribute__((target("sha,sse4.1,ssse3"))) void sha_256_ni_compress_x2(
+    Sha256NiState &state_0, const std::uint8_t *block_0,
+    Sha256NiState &state_1, const std::uint8_t *block_1) {
+  auto saved_0 = state_0;
+  auto saved_1 = state_1;
+
+  __m128i w_0[4];
+  __m128i w_1[4];
+#pragma GCC unroll 16
+  for (std::size_t group = 0; group < 16; ++group) {
+    sha_256_ni_rounds(state_0, w_0, block_0, group);
+    sha_256_ni_rounds(state_1, w_1, block_1, group);
+  }
 
-std::vector<std::uint8_t> md5_raw(const std::string &str) {
-  return do_evp(str, MD5_DIGEST_LENGTH, EVP_md5());
+  state_0.abef = _mm_add_epi32(state_0.abef, saved_0.abef);
+  state_0.cdgh = _mm_add_epi32(state_0.cdgh, saved_0.cdgh);
+  state_1.abef = _mm_add_epi32(state_1.abef, saved_1.abef);
+  state_1.cdgh = _mm_add_epi32(state_1.cdgh, saved_1.cdgh);
 }
 
-std::string md5_file(const std::string &path) {
-  return md5(read_file(path, true));
-}
+void sha_256_ni_batch(std::span<const std::string_view> inputs,
+                      std::span<Sha256Hasher::Digest> digests) {
+  std::size_t i = 0;
+  for (; i + 1 < std::size(inputs); i += 2) {
+    Sha256Blocks blocks_0(inputs[i]);
+    Sha256Blocks blocks_1(inputs[i + 1]);
+    auto state_0 = sha_256_ni_init();
+    auto state_1 = sha_256_ni_init();
+
+    auto common = std::min(std::size(blocks_0), std::size(blocks_1));
+    for (std::size_t j = 0; j < common; ++j) {
+      sha_256_ni_compress_x2(state_0, blocks_0[j], state_1, blocks_1[j]);
+    }
+    for (auto j = common; j < std::size(blocks_0); ++j) {
+      sha_256_ni_compress(state_0, blocks_0[j]);
+    }
+    for (auto j = common; j < std::size(blocks_1); ++j) {
+      sha_256_ni_compress(state_1, blocks_1[j]);
+    }
 
-std::string sha_256(const std::string &str) {
-  return bytes_to_hex_string(sha_256_raw(str));
+    sha_256_ni_digest(state_0, std::data(digests[i]));
+    sha_256_ni_digest(state_1, std::data(digests[i + 1]));
+  }
+
+  if (i < std::size(inputs)) {
+    Sha256Blocks blocks(inputs[i]);
+    auto state = sha_256_ni_init();
+    for (std::size_t j = 0; j < std::size(blocks); ++j) {
+      sha_256_ni_compress(state, blocks[j]);
+    }
+    sha_256_ni_digest(state, std::data(digests[i]));
+  }
 }
+#endif
+
+// https://datatracker.ietf.org/doc/html/rfc4648#section-4
+struct Base64Codec {
+  std::array<char, 64> chars;
+  // The value of every character of the alphabet, 0xFF for the others
+  std::array<std::uint8_t, 256> values;
+  bool padding;
+};
+
+constexpr Base64Codec make_base64_codec(char c62, char c63, bool padding) {
+  Base64Codec codec = {};
+  for (std::size_t i = 0; i < 26; ++i) {
+    codec.chars[i] = static_cast<char>('A' + i);
+    codec.chars[26 + i] = static_cast<char>('a' + i);
+  }
+  for (std::size_t i = 0; i < 10; ++i) {
+    codec.chars[52 + i] = static_cast<char>('0' + i);
+  }
+  codec.chars[62] = c62;
+  codec.chars[63] = c63;
 
-std::vector<std::uint8_t> sha_256_raw(const std::string &str) {
-  return do_evp(str, SHA256_DIGEST_LENGTH, EVP_sha256());
+  std::fill(std::begin(codec.values), std::end(codec.values), 0xFF);
+  for (std::size_t i = 0; i < 64; ++i) {
+    codec.values[static_cast<std::uint8_t>(codec.chars[i])] =
+        static_cast<std::uint8_t>(i);
+  }
+  codec.padding = padding;
+
+  return codec;
 }
 
-std::string sha_256_file(const std::string &path) {
-  return sha_256(read_file(path, true));
+constexpr auto base64_standard = make_base64_codec('+', '/', true);
+constexpr auto base64_url_safe = make_base64_codec('-', '_', false);
+
+const Base64Codec &base64_codec(Base64Alphabet alphabet) {
+  return alphabet == Base64Alphabet::UrlSafe ? base64_url_safe
+                                             : base64_standard;
 }
 
-std::string sha3_512(const std::string &str) {
-  return bytes_to_hex_string(sha3_512_raw(str));
+// Encode the bytes up to the last complete group of 3, return the number of
+// bytes consumed
+std::size_t base64_encode_scalar(const std::uint8_t *bytes, std::size_t size,
+                                 char *output, const Base64Codec &codec) {
+  std::size_t i = 0;
+  for (; i + 3 <= size; i += 3) {
+    std::uint32_t group = bytes[i] << 16 | bytes[i + 1] << 8 | bytes[i + 2];
+    *output++ = codec.chars[group >> 18];
+    *output++ = codec.chars[(group >> 12) & 0x3F];
+    *output++ = codec.chars[(group >> 6) & 0x3F];
+    *output++ = codec.chars[group & 0x3F];
+  }
+  return i;
 }
 
-std::vector<std::uint8_t> sha3_512_raw(const std::string &str) {
-  return do_evp(str, SHA512_DIGEST_LENGTH, EVP_sha3_512());
+// Encode the last 1 or 2 bytes, return the number of characters written
+std::size_t base64_encode_tail(const std::uint8_t *bytes, std::size_t size,
+                               char *output, const Base64Codec &codec) {
+  if (size == 0) {
+    return 0;
+  }
+
+  std::uint32_t group = bytes[0] << 16 | (size == 2 ? bytes[1] << 8 : 0);
+  output[0] = codec.chars[group >> 18];
+  output[1] = codec.chars[(group >> 12) & 0x3F];
+  if (size == 2) {
+    output[2] = codec.chars[(group >> 6) & 0x3F];
+  }
+
+  if (!codec.padding) {
+    return size + 1;
+  }
+  if (size == 1) {
+    output[2] = '=';
+  }
+  output[3] = '=';
+  return 4;
 }
 
-std::string sha3_512_file(const std::string &path) {
-  return sha3_512(read_file(path, true));
+// Decode the characters up to the last complete group of 4, return the number
+// of characters consumed, it stops before a character that is not in the
+// alphabet
+std::size_t base64_decode_scalar(const char *str, std::size_t size,
+                                 std::uint8_t *output,
+                                 const Base64Codec &codec) {
+  std::size_t i = 0;
+  for (; i + 4 <= size; i += 4) {
+    auto a = codec.values[static_cast<std::uint8_t>(str[i])];
+    auto b = codec.values[static_cast<std::uint8_t>(str[i + 1])];
+    auto c = codec.values[static_cast<std::uint8_t>(str[i + 2])];
+    auto d = codec.values[static_cast<std::uint8_t>(str[i + 3])];
+    if ((a | b | c | d) == 0xFF) {
+      break;
+    }
+
+    std::uint32_t group = a << 18 | b << 12 | c << 6 | d;
+    *output++ = static_cast<std::uint8_t>(group >> 16);
+    *output++ = static_cast<std::uint8_t>(group >> 8);
+    *output++ = static_cast<std::uint8_t>(group);
+  }
+  return i;
 }
 
-// https://wiki.openssl.org/index.php/EVP_Symmetric_Encryption_and_Decryption#C.2B.2B_Programs
-std::string aes_256_cbc_encrypt(const std::string &str,
-                                const std::vector<std::uint8_t> &key,
-                                const std::vector<std::uint8_t> &iv) {
-  if (std::size(key) != 32) {
-    throw RuntimeError("The key is not 256 bit");
+// Decode the last 2 or 3 characters of unpadded data, return the number of
+// bytes written, or throw if they are not valid
+std::size_t base64_decode_tail(const char *str, std::size_t size,
+                               std::uint8_t *output,
+                               const Base64Codec &codec) {
+  if (size == 0) {
+    return 0;
   }
-  if (std::size(iv) != AES_BLOCK_SIZE) {
-    throw RuntimeError("The iv is not 16 bit");
+  if (size == 1) {
+    throw RuntimeError("Truncated base64 data");
   }
 
-  check_openssl(EVP_add_cipher(EVP_aes_256_cbc()));
-  std::unique_ptr<EVP_CIPHER_CTX, decltype(&EVP_CIPHER_CTX_free)> ctx(
-      EVP_CIPHER_CTX_new(), EVP_CIPHER_CTX_free);
-  if (!ctx) {
-    throw RuntimeError(ERR_error_string(ERR_get_error(), nullptr));
+  std::uint32_t group = 0;
+  for (std::size_t i = 0; i < size; ++i) {
+    auto value = codec.values[static_cast<std::uint8_t>(str[i])];
+    if (value == 0xFF) {
+      throw RuntimeError("Invalid base64 character: '{}'", str[i]);
+    }
+    group |= static_cast<std::uint32_t>(value) << (18 - 6 * i);
   }
 
-  check_openssl(EVP_EncryptInit_ex(
-      ctx.get(), EVP_aes_256_cbc(), nullptr,
-      reinterpret_cast<const unsigned char *>(std::data(key)),
-      reinterpret_cast<const unsigned char *>(std::data(iv))));
+  output[0] = static_cast<std::uint8_t>(group >> 16);
+  if (size == 3) {
+    output[1] = static_cast<std::uint8_t>(group >> 8);
+  }
+  return size - 1;
+}
 
-  check_openssl(EVP_CIPHER_CTX_set_padding(ctx.get(), EVP_PADDING_PKCS7));
+#ifdef __x86_64__
+// http://0x80.pl/notesen/2016-01-12-sse-base64-encoding.html
+// Each 3 bytes are spread over 4 bytes with a shuffle, the 6-bit indices are
+// moved into place with multiplies, then mapped to the alphabet by adding an
+// offset looked up by range
+__attribute__((target("ssse3"))) std::size_t base64_encode_ssse3(
+    const std::uint8_t *bytes, std::size_t size, char *output,
+    const Base64Codec &codec) {
+  const auto spread =
+      _mm_setr_epi8(1, 0, 2, 1, 4, 3, 5, 4, 7, 6, 8, 7, 10, 9, 11, 10);
+  const auto offsets = _mm_setr_epi8(
+      'a' - 26, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52,
+      '0' - 52, '0' - 52, '0' - 52, '0' - 52,
+      static_cast<char>(codec.chars[62] - 62),
+      static_cast<char>(codec.chars[63] - 63), 'A', 0, 0);
+
+  std::size_t i = 0;
+  for (; i + 16 <= size; i += 12) {
+    auto input = _mm_shuffle_epi8(
+        _mm_loadu_si128(reinterpret_cast<const __m128i *>(bytes + i)), spread);
+
+    auto high =
+        _mm_mulhi_epu16(_mm_and_si128(input, _mm_set1_epi32(0x0FC0FC00)),
+                        _mm_set1_epi32(0x04000040));
+    auto low =
+        _mm_mullo_epi16(_mm_and_si128(input, _mm_set1_epi32(0x003F03F0)),
+                        _mm_set1_epi32(0x01000010));
+    auto indices = _mm_or_si128(high, low);
+
+    auto range = _mm_or_si128(
+        _mm_subs_epu8(indices, _mm_set1_epi8(51)),
+        _mm_and_si128(_mm_cmpgt_epi8(_mm_set1_epi8(26), indices),
+                      _mm_set1_epi8(13)));
+    _mm_storeu_si128(
+        reinterpret_cast<__m128i *>(output + i / 3 * 4),
+        _mm_add_epi8(indices, _mm_shuffle_epi8(offsets, range)));
+  }
+  return i;
+}
 
-  std::string result;
-  auto input_size = std::size(str);
-  result.resize(input_size + AES_BLOCK_SIZE);
-  std::int32_t len;
+__attribute__((target("avx2"))) std::size_t base64_encode_avx2(
+    const std::uint8_t *bytes, std::size_t size, char *output,
+    const Base64Codec &codec) {
+  const auto spread = _mm256_setr_epi8(1, 0, 2, 1, 4, 3, 5, 4, 7, 6, 8, 7, 10,
+                                       9, 11, 10, 1, 0, 2, 1, 4, 3, 5, 4, 7, 6,
+                                       8, 7, 10, 9, 11, 10);
+  const auto offsets = _mm256_broadcastsi128_si256(_mm_setr_epi8(
+      'a' - 26, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52,
+      '0' - 52, '0' - 52, '0' - 52, '0' - 52,
+      static_cast<char>(codec.chars[62] - 62),
+      static_cast<char>(codec.chars[63] - 63), 'A', 0, 0));
+
+  // Each 128-bit lane takes 12 bytes, the loads read 4 bytes more
+  std::size_t i = 0;
+  for (; i + 28 <= size; i += 24) {
+    auto input = _mm256_inserti128_si256(
+        _mm256_castsi128_si256(
+            _mm_loadu_si128(reinterpret_cast<const __m128i *>(bytes + i))),
+        _mm_loadu_si128(reinterpret_cast<const __m128i *>(bytes + i + 12)), 1);
+    input = _mm256_shuffle_epi8(input, spread);
+
+    auto high = _mm256_mulhi_epu16(
+        _mm256_and_si256(input, _mm256_set1_epi32(0x0FC0FC00)),
+        _mm256_set1_epi32(0x04000040));
+    auto low = _mm256_mullo_epi16(
+        _mm256_and_si256(input, _mm256_set1_epi32(0x003F03F0)),
+        _mm256_set1_epi32(0x01000010));
+    auto indices = _mm256_or_si256(high, low);
+
+    auto range = _mm256_or_si256(
+        _mm256_subs_epu8(indices, _mm256_set1_epi8(51)),
+        _mm256_and_si256(_mm256_cmpgt_epi8(_mm256_set1_epi8(26), indices),
+                         _mm256_set1_epi8(13)));
+    _mm256_storeu_si256(
+        reinterpret_cast<__m256i *>(output + i / 3 * 4),
+        _mm256_add_epi8(indices, _mm256_shuffle_epi8(offsets, range)));
+  }
+  return i;
+}
 
-  check_openssl(EVP_EncryptUpdate(
-      ctx.get(), reinterpret_cast<unsigned char *>(std::data(result)), &len,
-      reinterpret_cast<const unsigned char *>(std::data(str)), input_size));
+// Characters are classified by range, so both alphabets share the code. A
+// block with a character out of the alphabet is left to the scalar code
+__attribute__((target("ssse3"))) std::size_t base64_decode_ssse3(
+    const char *str, std::size_t size, std::uint8_t *output,
+    const Base64Codec &codec) {
+  std::size_t i = 0;
+  for (; i + 16 <= size; i += 16) {
+    auto input = _mm_loadu_si128(reinterpret_cast<const __m128i *>(str + i));
+
+    auto upper = _mm_sub_epi8(input, _mm_set1_epi8('A'));
+    auto lower = _mm_sub_epi8(input, _mm_set1_epi8('a'));
+    auto digit = _mm_sub_epi8(input, _mm_set1_epi8('0'));
+    auto is_upper =
+        _mm_cmpeq_epi8(_mm_min_epu8(upper, _mm_set1_epi8(25)), upper);
+    auto is_lower =
+        _mm_cmpeq_epi8(_mm_min_epu8(lower, _mm_set1_epi8(25)), lower);
+    auto is_digit =
+        _mm_cmpeq_epi8(_mm_min_epu8(digit, _mm_set1_epi8(9)), digit);
+    auto is_62 = _mm_cmpeq_epi8(input, _mm_set1_epi8(codec.chars[62]));
+    auto is_63 = _mm_cmpeq_epi8(input, _mm_set1_epi8(codec.chars[63]));
+
+    auto valid =
+        _mm_or_si128(_mm_or_si128(is_upper, is_lower),
+                     _mm_or_si128(is_digit, _mm_or_si128(is_62, is_63)));
+    if (_mm_movemask_epi8(valid) != 0xFFFF) {
+      break;
+    }
 
-  std::int32_t len2;
-  check_openssl(EVP_EncryptFinal_ex(
-      ctx.get(), reinterpret_cast<unsigned char *>(std::data(result)) + len,
-      &len2));
+    auto values = _mm_or_si128(
+        _mm_or_si128(
+            _mm_and_si128(is_upper, upper),
+            _mm_and_si128(is_lower, _mm_add_epi8(lower, _mm_set1_epi8(26)))),
+        _mm_or_si128(
+            _mm_and_si128(is_digit, _mm_add_epi8(digit, _mm_set1_epi8(52))),
+            _mm_or_si128(_mm_and_si128(is_62, _mm_set1_epi8(62)),
+                         _mm_and_si128(is_63, _mm_set1_epi8(63)))));
+
+    // Merge 4 6-bit values into 3 bytes, then drop the 4th byte of each group
+    auto pairs = _mm_maddubs_epi16(values, _mm_set1_epi32(0x01400140));
+    auto groups = _mm_madd_epi16(pairs, _mm_set1_epi32(0x00011000));
+    auto packed = _mm_shuffle_epi8(
+        groups,
+        _mm_setr_epi8(2, 1, 0, 6, 5, 4, 10, 9, 8, 14, 13, 12, -1, -1, -1, -1));
+
+    auto *dest = output + i / 4 * 3;
+    _mm_storel_epi64(reinterpret_cast<__m128i *>(dest), packed);
+    auto rest = _mm_cvtsi128_si32(_mm_srli_si128(packed, 8));
+    std::memcpy(dest + 8, &rest, 4);
+  }
+  return i;
+}
 
-  result.resize(len + len2);
-  return result;
+__attribute__((target("avx2"))) std::size_t base64_decode_avx2(
+    const char *str, std::size_t size, std::uint8_t *output,
+    const Base64Codec &codec) {
+  std::size_t i = 0;
+  for (; i + 32 <= size; i += 32) {
+    auto input =
+        _mm256_loadu_si256(reinterpret_cast<const __m256i *>(str + i));
+
+    auto upper = _mm256_sub_epi8(input, _mm256_set1_epi8('A'));
+    auto lower = _mm256_sub_epi8(input, _mm256_set1_epi8('a'));
+    auto digit = _mm256_sub_epi8(input, _mm256_set1_epi8('0'));
+    auto is_upper = _mm256_cmpeq_epi8(
+        _mm256_min_epu8(upper, _mm256_set1_epi8(25)), upper);
+    auto is_lower = _mm256_cmpeq_epi8(
+        _mm256_min_epu8(lower, _mm256_set1_epi8(25)), lower);
+    auto is_digit = _mm256_cmpeq_epi8(
+        _mm256_min_epu8(digit, _mm256_set1_epi8(9)), digit);
+    auto is_62 = _mm256_cmpeq_epi8(input, _mm256_set1_epi8(codec.chars[62]));
+    auto is_63 = _mm256_cmpeq_epi8(input, _mm256_set1_epi8(codec.chars[63]));
+
+    auto valid = _mm256_or_si256(
+        _mm256_or_si256(is_upper, is_lower),
+        _mm256_or_si256(is_digit, _mm256_or_si256(is_62, is_63)));
+    if (_mm256_movemask_epi8(valid) != -1) {
+      break;
+    }
+
+    auto values = _mm256_or_si256(
+        _mm256_or_si256(_mm256_and_si256(is_upper, upper),
+                        _mm256_and_si256(is_lower,
+                                         _mm256_add_epi8(
+                                             lower, _mm256_set1_epi8(26)))),
+        _mm256_or_si256(
+            _mm256_and_si256(is_digit,
+                             _mm256_add_epi8(digit, _mm256_set1_epi8(52))),
+            _mm256_or_si256(_mm256_and_si256(is_62, _mm256_set1_epi8(62)),
+                            _mm256_and_si256(is_63, _mm256_set1_epi8(63)))));
+
+    auto pairs = _mm256_maddubs_epi16(values, _mm256_set1_epi32(0x01400140));
+    auto groups = _mm256_madd_epi16(pairs, _mm256_set1_epi32(0x00011000));
+    auto packed = _mm256_shuffle_epi8(
+        groups, _mm256_setr_epi8(2, 1, 0, 6, 5, 4, 10, 9, 8, 14, 13, 12, -1, -1,
+                                 -1, -1, 2, 1, 0, 6, 5, 4, 10, 9, 8, 14, 13,
+                                 12, -1, -1, -1, -1));
+    packed = _mm256_permutevar8x32_epi32(
+        packed, _mm256_setr_epi32(0, 1, 2, 4, 5, 6, 7, 7));
+
+    auto *dest = output + i / 4 * 3;
+    _mm_storeu_si128(reinterpret_cast<__m128i *>(dest),
+                     _mm256_castsi256_si128(packed));
+    _mm_storel_epi64(reinterpret_cast<__m128i *>(dest + 16),
+                     _mm256_extracti128_si256(packed, 1));
+  }
+  return i;
+}
+#endif
+
+std::size_t base64_encode_blocks(const std::uint8_t *bytes, std::size_t size,
+                                 char *output, const Base64Codec &codec) {
+  std::size_t done = 0;
+#ifdef __x86_64__
+  if (has_avx2()) {
+    done = base64_encode_avx2(bytes, size, output, codec);
+  }
+  if (has_ssse3()) {
+    done += base64_encode_ssse3(bytes + done, size - done,
+                                output + done / 3 * 4, codec);
+  }
+#endif
+  return done + base64_encode_scalar(bytes + done, size - done,
+                                     output + done / 3 * 4, codec);
 }
 
-std::string aes_256_cbc_decrypt(const std::string &str,
-                                const std::vector<std::uint8_t> &key,
-                                const std::vector<std::uint8_t> &iv) {
-  if (std::size(key) != 32) {
-    throw RuntimeError("The key is not 256 bit");
+std::size_t base64_decode_blocks(const char *str, std::size_t size,
+                                 std::uint8_t *output,
+                                 const Base64Codec &codec) {
+  std::size_t done = 0;
+#ifdef __x86_64__
+  if (has_avx2()) {
+    done = base64_decode_avx2(str, size, output, codec);
   }
-  if (std::size(iv) != AES_BLOCK_SIZE) {
-    throw RuntimeError("The iv is not 16 bit");
+  if (has_ssse3()) {
+    done += base64_decode_ssse3(str + done, size - done,
+                                output + done / 4 * 3, codec);
   }
+#endif
+  return done + base64_decode_scalar(str + done, size - done,
+                                     output + done / 4 * 3, codec);
+}
 
-  check_openssl(EVP_add_cipher(EVP_aes_256_cbc()));
-  std::unique_ptr<EVP_CIPHER_CTX, decltype(&EVP_CIPHER_CTX_free)> ctx(
-      EVP_CIPHER_CTX_new(), EVP_CIPHER_CTX_free);
-  if (!ctx) {
-    throw RuntimeError(ERR_error_string(ERR_get_error(), nullptr));
+// https://www.unicode.org/versions/Unicode15.0.0/ch03.pdf, table 3-7
+bool validate_utf8_scalar(const std::uint8_t *data, std::size_t size) {
+  std::size_t i = 0;
+  while (i < size) {
+    auto byte = data[i];
+    if (byte < 0x80) {
+      ++i;
+      continue;
+    }
+
+    std::size_t length = 0;
+    std::uint8_t min = 0x80;
+    std::uint8_t max = 0xBF;
+    if (byte >= 0xC2 && byte <= 0xDF) {
+      length = 2;
+    } else if (byte >= 0xE0 && byte <= 0xEF) {
+      length = 3;
+      if (byte == 0xE0) {
+        min = 0xA0;
+      } else if (byte == 0xED) {
+        max = 0x9F;
+      }
+    } else if (byte >= 0xF0 && byte <= 0xF4) {
+      length = 4;
+      if (byte == 0xF0) {
+        min = 0x90;
+      } else if (byte == 0xF4) {
+        max = 0x8F;
+      }
+    } else {
+      return false;
+    }
+
+    if (size - i < length || data[i + 1] < min || data[i + 1] > max) {
+      return false;
+    }
+    for (std::size_t j = 2; j < length; ++j) {
+      if ((data[i + j] & 0xC0) != 0x80) {
+        return false;
+      }
+    }
+    i += length;
   }
 
-  check_openssl(EVP_DecryptInit_ex(
-      ctx.get(), EVP_aes_256_cbc(), nullptr,
-      reinterpret_cast<const unsigned char *>(std::data(key)),
-      reinterpret_cast<const unsigned char *>(std::data(iv))));
+  return true;
+}
 
-  check_openssl(EVP_CIPHER_CTX_set_padding(ctx.get(), EVP_PADDING_PKCS7));
+// Decode the code points that start before end, the input must be valid
+template <typename Char>
+Char *utf8_decode_scalar(const std::uint8_t *&data, const std::uint8_t *end,
+                         Char *output) {
+  while (data < end) {
+    std::uint32_t byte = data[0];
+    if (byte < 0x80) {
+      *output++ = static_cast<Char>(byte);
+      ++data;
+      continue;
+    }
 
-  std::string result;
-  auto input_size = std::size(str);
-  result.resize(input_size + AES_BLOCK_SIZE);
-  std::int32_t len;
+    std::uint32_t code_point;
+    if (byte < 0xE0) {
+      code_point = (byte & 0x1F) << 6 | (data[1] & 0x3F);
+      data += 2;
+    } else if (byte < 0xF0) {
+      code_point =
+          (byte & 0x0F) << 12 | (data[1] & 0x3F) << 6 | (data[2] & 0x3F);
+      data += 3;
+    } else {
+      code_point = (byte & 0x07) << 18 | (data[1] & 0x3F) << 12 |
+                   (data[2] & 0x3F) << 6 | (data[3] & 0x3F);
+      data += 4;
+    }
+
+    if constexpr (sizeof(Char) == 2) {
+      if (code_point >= 0x10000) {
+        code_point -= 0x10000;
+        *output++ = static_cast<Char>(0xD800 + (code_point >> 10));
+        *output++ = static_cast<Char>(0xDC00 + (code_point & 0x3FF));
+        continue;
+      }
+    }
+    *output++ = static_cast<Char>(code_point);
+  }
 
-  check_openssl(EVP_DecryptUpdate(
-      ctx.get(), reinterpret_cast<unsigned char *>(std::data(result)), &len,
-      reinterpret_cast<const unsigned char *>(std::data(str)), input_size));
+  return output;
+}
 
-  std::int32_t len2;
-  check_openssl(EVP_DecryptFinal_ex(
-      ctx.get(), reinterpret_cast<unsigned char *>(std::data(result)) + len,
-      &len2));
+struct Utf8Counts {
+  // Bytes 10xxxxxx, which do not start a code point
+  std::size_t continuations = 0;
+  // Bytes 11110xxx, which start a code point above U+FFFF
+  std::size_t four_byte_leads = 0;
+};
+
+void utf8_count_scalar(const std::uint8_t *data, std::size_t size,
+                       Utf8Counts &counts) {
+  for (std::size_t i = 0; i < size; ++i) {
+    counts.continuations += (data[i] & 0xC0) == 0x80;
+    counts.four_byte_leads += data[i] >= 0xF0;
+  }
+}
+
+#ifdef __x86_64__
+// https://arxiv.org/abs/2010.03090
+// Every pair of consecutive bytes is classified by three 16-entry lookups, on
+// the high nibble of the first byte, its low nibble and the high nibble of the
+// second byte. A bit survives the AND only for an invalid pair, except
+// TWO_CONTINUATIONS which is expected for the 3rd and 4th byte of a sequence
+constexpr std::uint8_t utf8_too_short = 1 << 0;
+constexpr std::uint8_t utf8_too_long = 1 << 1;
+constexpr std::uint8_t utf8_overlong_3 = 1 << 2;
+constexpr std::uint8_t utf8_too_large = 1 << 3;
+constexpr std::uint8_t utf8_surrogate = 1 << 4;
+constexpr std::uint8_t utf8_overlong_2 = 1 << 5;
+constexpr std::uint8_t utf8_too_large_1000 = 1 << 6;
+constexpr std::uint8_t utf8_overlong_4 = 1 << 6;
+constexpr std::uint8_t utf8_two_continuations = 1 << 7;
+constexpr std::uint8_t utf8_carry =
+    utf8_too_short | utf8_too_long | utf8_two_continuations;
+
+constexpr std::array<std::uint8_t, 16> utf8_byte_1_high = {
+    // 0_______ ________, ASCII
+    utf8_too_long, utf8_too_long, utf8_too_long, utf8_too_long, utf8_too_long,
+    utf8_too_long, utf8_too_long, utf8_too_long,
+    // 10______ ________, continuation
+    utf8_two_continuations, utf8_two_continuations, utf8_two_continuations,
+    utf8_two_continuations,
+    // 1100____ ________, 2 bytes lead
+    utf8_too_short | utf8_overlong_2,
+    // 1101____ ________, 2 bytes lead
+    utf8_too_short,
+    // 1110____ ________, 3 bytes lead
+    utf8_too_short | utf8_overlong_3 | utf8_surrogate,
+    // 1111____ ________, 4 bytes lead
+    utf8_too_short | utf8_too_large | utf8_too_large_1000 | utf8_overlong_4};
+
+constexpr std::array<std::uint8_t, 16> utf8_byte_1_low = {
+    // ____0000 ________
+    utf8_carry | utf8_overlong_3 | utf8_overlong_2 | utf8_overlong_4,
+    // ____0001 ________
+    utf8_carry | utf8_overlong_2,
+    // ____001_ ________
+    utf8_carry, utf8_carry,
+    // ____0100 ________
+    utf8_carry | utf8_too_large,
+    // ____0101 ________ to ____1100 ________
+    utf8_carry | utf8_too_large | utf8_too_large_1000,
+    utf8_carry | utf8_too_large | utf8_too_large_1000,
+    utf8_carry | utf8_too_large | utf8_too_large_1000,
+    utf8_carry | utf8_too_large | utf8_too_large_1000,
+    utf8_carry | utf8_too_large | utf8_too_large_1000,
+    utf8_carry | utf8_too_large | utf8_too_large_1000,
+    utf8_carry | utf8_too_large | utf8_too_large_1000,
+    utf8_carry | utf8_too_large | utf8_too_large_1000,
+    // ____1101 ________
+    utf8_carry | utf8_too_large | utf8_too_large_1000 | utf8_surrogate,
+    // ____111_ ________
+    utf8_carry | utf8_too_large | utf8_too_large_1000,
+    utf8_carry | utf8_too_large | utf8_too_large_1000};
+
+constexpr std::array<std::uint8_t, 16> utf8_byte_2_high = {
+    // ________ 0_______
+    utf8_too_short, utf8_too_short, utf8_too_short, utf8_too_short,
+    utf8_too_short, utf8_too_short, utf8_too_short, utf8_too_short,
+    // ________ 1000____
+    utf8_too_long | utf8_overlong_2 | utf8_two_continuations | utf8_overlong_3 |
+        utf8_too_large_1000 | utf8_overlong_4,
+    // ________ 1001____
+    utf8_too_long | utf8_overlong_2 | utf8_two_continuations | utf8_overlong_3 |
+        utf8_too_large,
+    // ________ 101_____
+    utf8_too_long | utf8_overlong_2 | utf8_two_continuations | utf8_surrogate |
+        utf8_too_large,
+    utf8_too_long | utf8_overlong_2 | utf8_two_continuations | utf8_surrogate |
+        utf8_too_large,
+    // ________ 11______
+    utf8_too_short, utf8_too_short, utf8_too_short, utf8_too_short};
+
+__attribute__((target("avx2"))) __m256i utf8_table(
+    const std::array<std::uint8_t, 16> &table) {
+  return _mm256_broadcastsi128_si256(
+      _mm_loadu_si128(reinterpret_cast<const __m128i *>(std::data(table))));
+}
+
+// The input shifted right by N bytes, with the last N bytes of the previous
+// input shifted in
+template <std::int32_t N>
+__attribute__((target("avx2"), always_inline)) inline __m256i utf8_prev(
+    __m256i input, __m256i prev_input) {
+  return _mm256_alignr_epi8(
+      input, _mm256_permute2x128_si256(prev_input, input, 0x21), 16 - N);
+}
+
+__attribute__((target("avx2"), always_inline)) inline __m256i utf8_high_nibble(
+    __m256i input) {
+  return _mm256_and_si256(_mm256_srli_epi16(input, 4), _mm256_set1_epi8(0x0F));
+}
+
+class Utf8ValidatorAvx2 {
+ public:
+  __attribute__((target("avx2"))) Utf8ValidatorAvx2()
+      : byte_1_high_(utf8_table(utf8_byte_1_high)),
+        byte_1_low_(utf8_table(utf8_byte_1_low)),
+        byte_2_high_(utf8_table(utf8_byte_2_high)),
+        // A lead byte among the last 3 needs bytes from the next block
+        max_(_mm256_setr_epi8(-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+                              -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+                              -1, -1, -1, -1, -1, static_cast<char>(0xF0 - 1),
+                              static_cast<char>(0xE0 - 1),
+                              static_cast<char>(0xC0 - 1))),
+        error_(_mm256_setzero_si256()),
+        prev_input_(_mm256_setzero_si256()),
+        prev_incomplete_(_mm256_setzero_si256()) {}
+
+  __attribute__((target("avx2"))) void check(__m256i input) {
+    if (_mm256_movemask_epi8(input) == 0) {
+      error_ = _mm256_or_si256(error_, prev_incomplete_);
+      prev_incomplete_ = _mm256_setzero_si256();
+    } else {
+      auto prev1 = utf8_prev<1>(input, prev_input_);
+      auto special = _mm256_and_si256(
+          _mm256_and_si256(
+              _mm256_shuffle_epi8(byte_1_high_, utf8_high_nibble(prev1)),
+              _mm256_shuffle_epi8(
+                  byte_1_low_,
+                  _mm256_and_si256(prev1, _mm256_set1_epi8(0x0F)))),
+          _mm256_shuffle_epi8(byte_2_high_, utf8_high_nibble(input)));
+
+      // Only 111_____ and 1111____ are at least 0x80 after the subtraction
+      auto is_third = _mm256_subs_epu8(utf8_prev<2>(input, prev_input_),
+                                       _mm256_set1_epi8(0xE0 - 0x80));
+      auto is_fourth = _mm256_subs_epu8(utf8_prev<3>(input, prev_input_),
+                                        _mm256_set1_epi8(0xF0 - 0x80));
+      auto must_be_continuation =
+          _mm256_and_si256(_mm256_or_si256(is_third, is_fourth),
+                           _mm256_set1_epi8(static_cast<char>(0x80)));
+
+      error_ = _mm256_or_si256(error_,
+                               _mm256_xor_si256(must_be_continuation, special));
+      prev_incomplete_ = _mm256_subs_epu8(input, max_);
+    }
+    prev_input_ = input;
+  }
+
+  __attribute__((target("avx2"))) bool finish() {
+    error_ = _mm256_or_si256(error_, prev_incomplete_);
+    return _mm256_testz_si256(error_, error_);
+  }
+
+ private:
+  __m256i byte_1_high_;
+  __m256i byte_1_low_;
+  __m256i byte_2_high_;
+  __m256i max_;
+  __m256i error_;
+  __m256i prev_input_;
+  __m256i prev_incomplete_;
+};
+
+__attribute__((target("avx2"))) bool validate_utf8_avx2(
+    const std::uint8_t *data, std::size_t size) {
+  Utf8ValidatorAvx2 validator;
+
+  std::size_t i = 0;
+  for (; i + 32 <= size; i += 32) {
+    validator.check(
+        _mm256_loadu_si256(reinterpret_cast<const __m256i *>(data + i)));
+  }
+
+  // The padding is ASCII, so a truncated sequence in the tail is an error
+  if (i < size) {
+    std::uint8_t tail[32] = {};
+    std::copy(data + i, data + size, tail);
+    validator.check(
+        _mm256_loadu_si256(reinterpret_cast<const __m256i *>(tail)));
+  }
+
+  return validator.finish();
+}
+
+__attribute__((target("avx2"))) std::size_t utf8_count_avx2(
+    const std::uint8_t *data, std::size_t size, Utf8Counts &counts) {
+  std::size_t i = 0;
+  for (; i + 32 <= size; i += 32) {
+    auto input =
+        _mm256_loadu_si256(reinterpret_cast<const __m256i *>(data + i));
+    // Signed, continuations are -128 to -65 and 4 bytes leads -16 to -1
+    auto continuations = _mm256_cmpgt_epi8(_mm256_set1_epi8(-64), input);
+    auto four_byte_leads = _mm256_cmpgt_epi8(input, _mm256_set1_epi8(-17));
+    counts.continuations += std::popcount(
+        static_cast<std::uint32_t>(_mm256_movemask_epi8(continuations)));
+    counts.four_byte_leads += std::popcount(static_cast<std::uint32_t>(
+        _mm256_movemask_epi8(_mm256_and_si256(four_byte_leads, input))));
+  }
+  return i;
+}
+
+// Store 8 code points of at most 16 bits
+template <typename Char>
+__attribute__((target("avx2"), always_inline)) inline void utf8_store_8(
+    Char *output, __m256i code_points) {
+  if constexpr (sizeof(Char) == 2) {
+    auto packed = _mm256_permute4x64_epi64(
+        _mm256_packus_epi32(code_points, code_points), 0b1000);
+    _mm_storeu_si128(reinterpret_cast<__m128i *>(output),
+                     _mm256_castsi256_si128(packed));
+  } else {
+    _mm256_storeu_si256(reinterpret_cast<__m256i *>(output), code_points);
+  }
+}
+
+// Blocks of 32 ASCII bytes are widened at once, runs of 3 bytes sequences,
+// which is most CJK text, are decoded 8 at a time. The others are decoded one
+// code point at a time
+template <typename Char>
+__attribute__((target("avx2"))) Char *utf8_transcode_avx2(
+    const std::uint8_t *&data, const std::uint8_t *end, Char *output) {
+  // Each lane holds 4 sequences of 3 bytes, reordered as 0, b2, b1, b0
+  const auto spread = _mm256_setr_epi8(2, 1, 0, -1, 5, 4, 3, -1, 8, 7, 6, -1,
+                                       11, 10, 9, -1, 2, 1, 0, -1, 5, 4, 3, -1,
+                                       8, 7, 6, -1, 11, 10, 9, -1);
+
+  while (end - data >= 32) {
+    auto input = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(data));
+    auto non_ascii = _mm256_movemask_epi8(input);
+    if (non_ascii == 0) {
+      auto low = _mm256_castsi256_si128(input);
+      auto high = _mm256_extracti128_si256(input, 1);
+      if constexpr (sizeof(Char) == 2) {
+        auto out = reinterpret_cast<__m256i *>(output);
+        _mm256_storeu_si256(out, _mm256_cvtepu8_epi16(low));
+        _mm256_storeu_si256(out + 1, _mm256_cvtepu8_epi16(high));
+      } else {
+        utf8_store_8(output, _mm256_cvtepu8_epi32(low));
+        utf8_store_8(output + 8, _mm256_cvtepu8_epi32(_mm_srli_si128(low, 8)));
+        utf8_store_8(output + 16, _mm256_cvtepu8_epi32(high));
+        utf8_store_8(output + 24,
+                     _mm256_cvtepu8_epi32(_mm_srli_si128(high, 8)));
+      }
+      data += 32;
+      output += 32;
+      continue;
+    }
+
+    // The input is valid, so 3 bytes leads at 0, 3, 6 and 9 of both halves
+    // mean 8 complete sequences of 3 bytes
+    input = _mm256_inserti128_si256(
+        input, _mm_loadu_si128(reinterpret_cast<const __m128i *>(data + 12)),
+        1);
+    auto leads = _mm256_movemask_epi8(_mm256_cmpeq_epi8(
+        _mm256_and_si256(input, _mm256_set1_epi8(static_cast<char>(0xF0))),
+        _mm256_set1_epi8(static_cast<char>(0xE0))));
+    if ((leads & 0x0FFF0FFF) == 0x02490249) {
+      auto v = _mm256_shuffle_epi8(input, spread);
+      auto code_points = _mm256_or_si256(
+          _mm256_or_si256(
+              _mm256_and_si256(v, _mm256_set1_epi32(0x3F)),
+              _mm256_and_si256(_mm256_srli_epi32(v, 2),
+                               _mm256_set1_epi32(0xFC0))),
+          _mm256_and_si256(_mm256_srli_epi32(v, 4),
+                           _mm256_set1_epi32(0xF000)));
+      utf8_store_8(output, code_points);
+      data += 24;
+      output += 8;
+      continue;
+    }
+
+    // Up to the first non-ASCII byte, then a few code points
+    auto next = data + std::countr_zero(static_cast<std::uint32_t>(non_ascii));
+    output = utf8_decode_scalar(data, std::min(next + 4, end), output);
+  }
+  return output;
+}
+#endif
+
+bool validate_utf8(std::string_view str) {
+  auto data = reinterpret_cast<const std::uint8_t *>(std::data(str));
+#ifdef __x86_64__
+  if (has_avx2()) {
+    return validate_utf8_avx2(data, std::size(str));
+  }
+#endif
+  return validate_utf8_scalar(data, std::size(str));
+}
+
+Utf8Counts utf8_count(std::string_view str) {
+  auto data = reinterpret_cast<const std::uint8_t *>(std::data(str));
+  Utf8Counts counts;
+
+  std::size_t done = 0;
+#ifdef __x86_64__
+  if (has_avx2()) {
+    done = utf8_count_avx2(data, std::size(str), counts);
+  }
+#endif
+  utf8_count_scalar(data + done, std::size(str) - done, counts);
+
+  return counts;
+}
+
+template <typename Char>
+std::size_t utf8_transcode(std::string_view str, std::span<Char> output,
+                           std::size_t size) {
+  if (std::size(output) < size) {
+    throw RuntimeError("The output is too small");
+  }
+
+  auto data = reinterpret_cast<const std::uint8_t *>(std::data(str));
+  auto end = data + std::size(str);
+  auto out = std::data(output);
+#ifdef __x86_64__
+  if (has_avx2()) {
+    out = utf8_transcode_avx2(data, end, out);
+  }
+#endif
+  out = utf8_decode_scalar(data, end, out);
+
+  return out - std::data(output);
+}
+
+struct Utf8Size {
+  std::size_t size = 0;
+  bool valid = true;
+  // The last UTF-16 code unit seen was a high surrogate
+  bool high_surrogate = false;
+};
+
+void utf8_size_scalar(const char32_t *data, std::size_t size,
+                      Utf8Size &result) {
+  for (std::size_t i = 0; i < size; ++i) {
+    auto c = static_cast<std::uint32_t>(data[i]);
+    result.valid &= c < 0xD800 || (c > 0xDFFF && c <= 0x10FFFF);
+    result.size += 1 + (c >= 0x80) + (c >= 0x800) + (c >= 0x10000);
+  }
+}
+
+void utf8_size_scalar(const char16_t *data, std::size_t size,
+                      Utf8Size &result) {
+  for (std::size_t i = 0; i < size; ++i) {
+    auto c = static_cast<std::uint16_t>(data[i]);
+    bool low = (c & 0xFC00) == 0xDC00;
+    result.valid &= low == result.high_surrogate;
+    result.high_surrogate = (c & 0xFC00) == 0xD800;
+    // A surrogate pair is 4 bytes, 2 for each half
+    result.size += 1 + (c >= 0x80) + (c >= 0x800) -
+                   (low || result.high_surrogate);
+  }
+}
+
+template <typename Char>
+char *utf8_encode_scalar(const Char *&data, const Char *end, char *output) {
+  while (data < end) {
+    auto c = static_cast<std::uint32_t>(*data++);
+    if constexpr (sizeof(Char) == 2) {
+      if ((c & 0xFC00) == 0xD800) {
+        c = 0x10000 + ((c - 0xD800) << 10) +
+            (static_cast<std::uint32_t>(*data++) - 0xDC00);
+      }
+    }
+
+    if (c < 0x80) {
+      *output++ = static_cast<char>(c);
+    } else if (c < 0x800) {
+      *output++ = static_cast<char>(0xC0 | (c >> 6));
+      *output++ = static_cast<char>(0x80 | (c & 0x3F));
+    } else if (c < 0x10000) {
+      *output++ = static_cast<char>(0xE0 | (c >> 12));
+      *output++ = static_cast<char>(0x80 | ((c >> 6) & 0x3F));
+      *output++ = static_cast<char>(0x80 | (c & 0x3F));
+    } else {
+      *output++ = static_cast<char>(0xF0 | (c >> 18));
+      *output++ = static_cast<char>(0x80 | ((c >> 12) & 0x3F));
+      *output++ = static_cast<char>(0x80 | ((c >> 6) & 0x3F));
+      *output++ = static_cast<char>(0x80 | (c & 0x3F));
+    }
+  }
+  return output;
+}
+
+#ifdef __x86_64__
+__attribute__((target("avx2"), always_inline)) inline std::int32_t
+utf8_sum_epi32(__m256i v) {
+  auto sum = _mm_add_epi32(_mm256_castsi256_si128(v),
+                           _mm256_extracti128_si256(v, 1));
+  sum = _mm_add_epi32(sum, _mm_shuffle_epi32(sum, 0b01001110));
+  sum = _mm_add_epi32(sum, _mm_shuffle_epi32(sum, 0b10110001));
+  return _mm_cvtsi128_si32(sum);
+}
+
+__attribute__((target("avx2"))) std::size_t utf8_size_avx2(
+    const char32_t *data, std::size_t size, Utf8Size &result) {
+  auto invalid = _mm256_setzero_si256();
+
+  std::size_t i = 0;
+  while (size - i >= 8) {
+    // Each lane counts down once for every extra byte, summed before it could
+    // overflow
+    auto extra = _mm256_setzero_si256();
+    auto stop = i + std::min<std::size_t>((size - i) / 8 * 8, 8 * 65536);
+    for (; i < stop; i += 8) {
+      auto input =
+          _mm256_loadu_si256(reinterpret_cast<const __m256i *>(data + i));
+      auto too_large = _mm256_cmpeq_epi32(
+          _mm256_max_epu32(input, _mm256_set1_epi32(0x110000)), input);
+      auto surrogate = _mm256_cmpeq_epi32(
+          _mm256_and_si256(input, _mm256_set1_epi32(0xFFFFF800)),
+          _mm256_set1_epi32(0xD800));
+      invalid = _mm256_or_si256(invalid, _mm256_or_si256(too_large, surrogate));
+
+      // Signed, but anything negative is already invalid
+      extra = _mm256_add_epi32(
+          extra, _mm256_cmpgt_epi32(input, _mm256_set1_epi32(0x7F)));
+      extra = _mm256_add_epi32(
+          extra, _mm256_cmpgt_epi32(input, _mm256_set1_epi32(0x7FF)));
+      extra = _mm256_add_epi32(
+          extra, _mm256_cmpgt_epi32(input, _mm256_set1_epi32(0xFFFF)));
+    }
+    result.size += static_cast<std::size_t>(-utf8_sum_epi32(extra));
+  }
+
+  result.size += i;
+  result.valid &= _mm256_testz_si256(invalid, invalid);
+  return i;
+}
+
+__attribute__((target("avx2"))) std::size_t utf8_size_avx2(
+    const char16_t *data, std::size_t size, Utf8Size &result) {
+  std::size_t i = 0;
+  for (; i + 16 <= size; i += 16) {
+    auto input =
+        _mm256_loadu_si256(reinterpret_cast<const __m256i *>(data + i));
+    auto zero = _mm256_setzero_si256();
+    auto surrogates = _mm256_and_si256(
+        input, _mm256_set1_epi16(static_cast<short>(0xFC00)));
+    // 2 bits for each code unit
+    auto high = static_cast<std::uint32_t>(_mm256_movemask_epi8(
+        _mm256_cmpeq_epi16(surrogates,
+                           _mm256_set1_epi16(static_cast<short>(0xD800)))));
+    auto low = static_cast<std::uint32_t>(_mm256_movemask_epi8(
+        _mm256_cmpeq_epi16(surrogates,
+                           _mm256_set1_epi16(static_cast<short>(0xDC00)))));
+    // Every low surrogate follows a high surrogate and nothing else does
+    result.valid &= ((high << 2) | (result.high_surrogate ? 0b11 : 0)) == low;
+    result.high_surrogate = high >> 31;
+
+    auto not_ascii = _mm256_set1_epi16(static_cast<short>(0xFF80));
+    auto not_two_bytes = _mm256_set1_epi16(static_cast<short>(0xF800));
+    auto one_byte = static_cast<std::uint32_t>(_mm256_movemask_epi8(
+        _mm256_cmpeq_epi16(_mm256_and_si256(input, not_ascii), zero)));
+    auto two_bytes = static_cast<std::uint32_t>(_mm256_movemask_epi8(
+        _mm256_cmpeq_epi16(_mm256_and_si256(input, not_two_bytes), zero)));
+    result.size += 16 + (std::popcount(~one_byte) + std::popcount(~two_bytes) -
+                         std::popcount(high | low)) /
+                            2;
+  }
+  return i;
+}
+
+// 8 code points of 2 bytes, that is U+0080 to U+07FF
+__attribute__((target("avx2"), always_inline)) inline void utf8_encode_2(
+    char *output, __m256i code_points) {
+  auto bytes = _mm256_or_si256(
+      _mm256_or_si256(_mm256_set1_epi32(0x80C0),
+                      _mm256_srli_epi32(code_points, 6)),
+      _mm256_slli_epi32(
+          _mm256_and_si256(code_points, _mm256_set1_epi32(0x3F)), 8));
+  auto packed =
+      _mm256_permute4x64_epi64(_mm256_packus_epi32(bytes, bytes), 0b1000);
+  _mm_storeu_si128(reinterpret_cast<__m128i *>(output),
+                   _mm256_castsi256_si128(packed));
+}
+
+// 8 code points of 3 bytes, that is U+0800 to U+FFFF
+__attribute__((target("avx2"), always_inline)) inline void utf8_encode_3(
+    char *output, __m256i code_points) {
+  // Each lane is 0xE0 | c >> 12, 0x80 | (c >> 6 & 0x3F), 0x80 | (c & 0x3F)
+  auto bytes = _mm256_or_si256(
+      _mm256_or_si256(_mm256_set1_epi32(0x8080E0),
+                      _mm256_srli_epi32(code_points, 12)),
+      _mm256_or_si256(
+          _mm256_slli_epi32(
+              _mm256_and_si256(code_points, _mm256_set1_epi32(0xFC0)), 2),
+          _mm256_slli_epi32(
+              _mm256_and_si256(code_points, _mm256_set1_epi32(0x3F)), 16)));
+  auto packed = _mm256_shuffle_epi8(
+      bytes, _mm256_setr_epi8(0, 1, 2, 4, 5, 6, 8, 9, 10, 12, 13, 14, -1, -1,
+                              -1, -1, 0, 1, 2, 4, 5, 6, 8, 9, 10, 12, 13, 14,
+                              -1, -1, -1, -1));
+
+  // 12 bytes from each half, without writing past the 24 bytes
+  auto high = _mm256_extracti128_si256(packed, 1);
+  _mm_storeu_si128(reinterpret_cast<__m128i *>(output),
+                   _mm256_castsi256_si128(packed));
+  _mm_storel_epi64(reinterpret_cast<__m128i *>(output + 12), high);
+  auto rest = _mm_cvtsi128_si32(_mm_srli_si128(high, 8));
+  std::memcpy(output + 20, &rest, 4);
+}
+
+// Blocks of 32 ASCII code points are narrowed at once, blocks of 8 code points
+// of the same length are encoded together if it is 1, 2 or 3 bytes. The others
+// are encoded one code point at a time
+template <typename Char>
+__attribute__((target("avx2"))) char *utf8_encode_avx2(const Char *&data,
+                                                      const Char *end,
+                                                      char *output) {
+  while (end - data >= 8) {
+    if (end - data >= 32) {
+      auto input = reinterpret_cast<const __m256i *>(data);
+      __m256i packed;
+      bool ascii = false;
+      if constexpr (sizeof(Char) == 2) {
+        auto a = _mm256_loadu_si256(input);
+        auto b = _mm256_loadu_si256(input + 1);
+        ascii = _mm256_testz_si256(
+            _mm256_or_si256(a, b),
+            _mm256_set1_epi16(static_cast<short>(0xFF80)));
+        packed = _mm256_permute4x64_epi64(_mm256_packus_epi16(a, b),
+                                          0b11011000);
+      } else {
+        auto a = _mm256_loadu_si256(input);
+        auto b = _mm256_loadu_si256(input + 1);
+        auto c = _mm256_loadu_si256(input + 2);
+        auto d = _mm256_loadu_si256(input + 3);
+        ascii = _mm256_testz_si256(
+            _mm256_or_si256(_mm256_or_si256(a, b), _mm256_or_si256(c, d)),
+            _mm256_set1_epi32(0xFFFFFF80));
+        packed = _mm256_permutevar8x32_epi32(
+            _mm256_packus_epi16(_mm256_packus_epi32(a, b),
+                                _mm256_packus_epi32(c, d)),
+            _mm256_setr_epi32(0, 4, 1, 5, 2, 6, 3, 7));
+      }
+      if (ascii) {
+        _mm256_storeu_si256(reinterpret_cast<__m256i *>(output), packed);
+        data += 32;
+        output += 32;
+        continue;
+      }
+    }
+
+    __m256i code_points;
+    if constexpr (sizeof(Char) == 2) {
+      code_points = _mm256_cvtepu16_epi32(
+          _mm_loadu_si128(reinterpret_cast<const __m128i *>(data)));
+    } else {
+      code_points =
+          _mm256_loadu_si256(reinterpret_cast<const __m256i *>(data));
+    }
+
+    auto zero = _mm256_setzero_si256();
+    auto high_bits = _mm256_and_si256(code_points, _mm256_set1_epi32(0xF800));
+    if (_mm256_testz_si256(code_points, _mm256_set1_epi32(0xFFFFFF80))) {
+      auto packed = _mm256_packus_epi32(code_points, code_points);
+      packed = _mm256_permutevar8x32_epi32(_mm256_packus_epi16(packed, packed),
+                                           _mm256_setr_epi32(0, 4, 0, 4, 0, 4,
+                                                             0, 4));
+      _mm_storel_epi64(reinterpret_cast<__m128i *>(output),
+                       _mm256_castsi256_si128(packed));
+      output += 8;
+    } else if (_mm256_testz_si256(code_points, _mm256_set1_epi32(0xFFFFF800)) &&
+               _mm256_movemask_epi8(_mm256_cmpeq_epi32(
+                   _mm256_and_si256(code_points, _mm256_set1_epi32(0x780)),
+                   zero)) == 0) {
+      utf8_encode_2(output, code_points);
+      output += 16;
+    } else if (_mm256_testz_si256(code_points,
+                                  _mm256_set1_epi32(0xFFFF0000)) &&
+               _mm256_movemask_epi8(_mm256_or_si256(
+                   _mm256_cmpeq_epi32(high_bits, zero),
+                   _mm256_cmpeq_epi32(high_bits,
+                                      _mm256_set1_epi32(0xD800)))) == 0) {
+      utf8_encode_3(output, code_points);
+      output += 24;
+    } else {
+      // A surrogate pair at the end goes one past, which the input has
+      output = utf8_encode_scalar(data, data + 8, output);
+      continue;
+    }
+    data += 8;
+  }
+  return output;
+}
+#endif
+
+template <typename Char>
+std::size_t utf8_size(std::basic_string_view<Char> str) {
+  Utf8Size result;
+
+  std::size_t done = 0;
+#ifdef __x86_64__
+  if (has_avx2()) {
+    done = utf8_size_avx2(std::data(str), std::size(str), result);
+  }
+#endif
+  utf8_size_scalar(std::data(str) + done, std::size(str) - done, result);
+
+  if (!result.valid || result.high_surrogate) {
+    throw RuntimeError("Invalid UTF-{} string", sizeof(Char) * 8);
+  }
+  return result.size;
+}
+
+template <typename Char>
+std::size_t utf8_encode(std::basic_string_view<Char> str,
+                        std::span<char> output, std::size_t size) {
+  if (std::size(output) < size) {
+    throw RuntimeError("The output is too small");
+  }
+
+  auto data = std::data(str);
+  auto end = data + std::size(str);
+  auto out = std::data(output);
+#ifdef __x86_64__
+  if (has_avx2()) {
+    out = utf8_encode_avx2(data, end, out);
+  }
+#endif
+  out = utf8_encode_scalar(data, end, out);
+
+  return out - std::data(output);
+}
+
+bool is_ascii_scalar(const std::uint8_t *data, std::size_t size) {
+  std::size_t i = 0;
+  std::uint64_t bits = 0;
+  for (; i + 8 <= size; i += 8) {
+    std::uint64_t word;
+    std::memcpy(&word, data + i, 8);
+    bits |= word;
+  }
+  for (; i < size; ++i) {
+    bits |= data[i];
+  }
+  return (bits & 0x8080808080808080) == 0;
+}
+
+// Whether a Chinese character, see is_chinese(char32_t), starts here. Only the
+// lead bytes E3 to EF and F0 can start one
+bool chinese_at(const std::uint8_t *data, const std::uint8_t *end) {
+  auto lead = *data;
+  if (lead < 0xE3 || lead > 0xF0) {
+    return false;
+  }
+
+  std::uint32_t c;
+  if (lead < 0xF0) {
+    if (end - data < 3) {
+      return false;
+    }
+    c = ((lead & 0x0F) << 12) | ((data[1] & 0x3F) << 6) | (data[2] & 0x3F);
+  } else {
+    if (end - data < 4) {
+      return false;
+    }
+    c = ((data[1] & 0x3F) << 12) | ((data[2] & 0x3F) << 6) | (data[3] & 0x3F);
+  }
+  return is_chinese(static_cast<char32_t>(c));
+}
+
+#ifdef __x86_64__
+__attribute__((target("avx2"))) bool is_ascii_avx2(const std::uint8_t *data,
+                                                   std::size_t size) {
+  const auto high = _mm256_set1_epi8(static_cast<char>(0x80));
+
+  std::size_t i = 0;
+  for (; i + 128 <= size; i += 128) {
+    auto input = reinterpret_cast<const __m256i *>(data + i);
+    auto bits = _mm256_or_si256(
+        _mm256_or_si256(_mm256_loadu_si256(input),
+                        _mm256_loadu_si256(input + 1)),
+        _mm256_or_si256(_mm256_loadu_si256(input + 2),
+                        _mm256_loadu_si256(input + 3)));
+    if (!_mm256_testz_si256(bits, high)) {
+      return false;
+    }
+  }
+  for (; i + 32 <= size; i += 32) {
+    auto input =
+        _mm256_loadu_si256(reinterpret_cast<const __m256i *>(data + i));
+    if (!_mm256_testz_si256(input, high)) {
+      return false;
+    }
+  }
+  return is_ascii_scalar(data + i, size - i);
+}
+
+__attribute__((target("avx2"))) bool is_ascii_avx2(const char32_t *data,
+                                                   std::size_t size) {
+  const auto high = _mm256_set1_epi32(0xFFFFFF80);
+
+  std::size_t i = 0;
+  for (; i + 32 <= size; i += 32) {
+    auto input = reinterpret_cast<const __m256i *>(data + i);
+    auto bits = _mm256_or_si256(
+        _mm256_or_si256(_mm256_loadu_si256(input),
+                        _mm256_loadu_si256(input + 1)),
+        _mm256_or_si256(_mm256_loadu_si256(input + 2),
+                        _mm256_loadu_si256(input + 3)));
+    if (!_mm256_testz_si256(bits, high)) {
+      return false;
+    }
+  }
+  for (; i < size; ++i) {
+    if (!is_ascii(data[i])) {
+      return false;
+    }
+  }
+  return true;
+}
+
+// A bit for each of the 32 bytes which starts a Chinese character of 3 bytes,
+// reads 33 bytes. The blocks of U+3400 to U+FAFF are told apart by the lead
+// byte and the byte after it
+__attribute__((target("avx2"), always_inline)) inline std::uint32_t
+chinese_leads_3_avx2(const std::uint8_t *data) {
+  auto lead = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(data));
+  auto next = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(data + 1));
+
+  // U+3400 to U+3FFF
+  auto e3 = _mm256_and_si256(
+      _mm256_cmpeq_epi8(lead, _mm256_set1_epi8(static_cast<char>(0xE3))),
+      _mm256_cmpeq_epi8(
+          _mm256_max_epu8(next, _mm256_set1_epi8(static_cast<char>(0x90))),
+          next));
+  // U+4000 to U+4FFF, except the Yijing hexagrams at U+4DC0 to U+4DFF
+  auto e4 = _mm256_andnot_si256(
+      _mm256_cmpeq_epi8(next, _mm256_set1_epi8(static_cast<char>(0xB7))),
+      _mm256_cmpeq_epi8(lead, _mm256_set1_epi8(static_cast<char>(0xE4))));
+  // U+5000 to U+9FFF
+  auto offset =
+      _mm256_sub_epi8(lead, _mm256_set1_epi8(static_cast<char>(0xE5)));
+  auto e5_e9 = _mm256_cmpeq_epi8(
+      _mm256_min_epu8(offset, _mm256_set1_epi8(4)), offset);
+  // U+F900 to U+FAFF
+  offset = _mm256_sub_epi8(next, _mm256_set1_epi8(static_cast<char>(0xA4)));
+  auto ef = _mm256_and_si256(
+      _mm256_cmpeq_epi8(lead, _mm256_set1_epi8(static_cast<char>(0xEF))),
+      _mm256_cmpeq_epi8(_mm256_min_epu8(offset, _mm256_set1_epi8(7)),
+                        offset));
+
+  return static_cast<std::uint32_t>(_mm256_movemask_epi8(
+      _mm256_or_si256(_mm256_or_si256(e3, e4), _mm256_or_si256(e5_e9, ef))));
+}
+
+// A bit for each of the 32 bytes which starts a Chinese character, reads 35
+// bytes
+__attribute__((target("avx2"))) std::uint32_t chinese_leads_avx2(
+    const std::uint8_t *data) {
+  auto mask = chinese_leads_3_avx2(data);
+
+  auto lead = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(data));
+  auto four_bytes = static_cast<std::uint32_t>(_mm256_movemask_epi8(
+      _mm256_cmpeq_epi8(lead, _mm256_set1_epi8(static_cast<char>(0xF0)))));
+  while (four_bytes != 0) {
+    auto i = std::countr_zero(four_bytes);
+    if (chinese_at(data + i, data + i + 4)) {
+      mask |= 1U << i;
+    }
+    four_bytes &= four_bytes - 1;
+  }
+  return mask;
+}
+
+__attribute__((target("avx2"))) std::size_t count_chinese_avx2(
+    const std::uint8_t *data, std::size_t size, std::size_t &count) {
+  std::size_t i = 0;
+  for (; i + 35 <= size; i += 32) {
+    count += std::popcount(chinese_leads_avx2(data + i));
+  }
+  return i;
+}
+
+__attribute__((target("avx2"))) std::size_t find_chinese_avx2(
+    const std::uint8_t *data, std::size_t pos, std::size_t size) {
+  for (; pos + 35 <= size; pos += 32) {
+    // Most text is ASCII
+    auto input =
+        _mm256_loadu_si256(reinterpret_cast<const __m256i *>(data + pos));
+    if (_mm256_movemask_epi8(input) == 0) {
+      continue;
+    }
+    auto mask = chinese_leads_avx2(data + pos);
+    if (mask != 0) {
+      return pos + std::countr_zero(mask);
+    }
+  }
+  return pos;
+}
+
+// Chinese text is mostly 3 bytes sequences, so a run of it starting at pos is
+// at 0, 3, 6... of the mask. It stops before any of 4 bytes
+__attribute__((target("avx2"))) std::size_t skip_chinese_avx2(
+    const std::uint8_t *data, std::size_t pos, std::size_t size) {
+  constexpr std::uint32_t run = 0b01001001001001001001001001001001;
+  for (; pos + 33 <= size; pos += 33) {
+    auto missing = ~chinese_leads_3_avx2(data + pos) & run;
+    if (missing != 0) {
+      return pos + std::countr_zero(missing);
+    }
+  }
+  return pos;
+}
+#endif
+
+std::size_t find_chinese(const std::uint8_t *data, std::size_t pos,
+                         std::size_t size) {
+#ifdef __x86_64__
+  if (has_avx2()) {
+    pos = find_chinese_avx2(data, pos, size);
+  }
+#endif
+  for (; pos < size; ++pos) {
+    if (chinese_at(data + pos, data + size)) {
+      return pos;
+    }
+  }
+  return size;
+}
+
+// The end of the run of Chinese characters starting at pos
+std::size_t skip_chinese(const std::uint8_t *data, std::size_t pos,
+                         std::size_t size) {
+  while (pos < size) {
+#ifdef __x86_64__
+    if (has_avx2()) {
+      pos = skip_chinese_avx2(data, pos, size);
+    }
+#endif
+    if (pos >= size || !chinese_at(data + pos, data + size)) {
+      break;
+    }
+    pos += data[pos] == 0xF0 ? 4 : 3;
+  }
+  return pos;
+}
+
+bool in_char_set(const detail::CharSet &set, std::uint8_t byte) {
+  return (set.bits[byte >> 6] >> (byte & 63)) & 1;
+}
+
+#ifdef __x86_64__
+// A byte is in the set if the entry of its low nibble has the bit of its high
+// nibble, which is 0 for the bytes outside ASCII
+__attribute__((target("avx2"))) std::size_t find_first_of_avx2(
+    const std::uint8_t *data, std::size_t size, const detail::CharSet &set) {
+  const auto nibbles = _mm256_broadcastsi128_si256(_mm_loadu_si128(
+      reinterpret_cast<const __m128i *>(std::data(set.nibbles))));
+  const auto high_bits = _mm256_setr_epi8(
+      1, 2, 4, 8, 16, 32, 64, static_cast<char>(0x80), 0, 0, 0, 0, 0, 0, 0, 0,
+      1, 2, 4, 8, 16, 32, 64, static_cast<char>(0x80), 0, 0, 0, 0, 0, 0, 0, 0);
+  const auto low_mask = _mm256_set1_epi8(0x0F);
+  const auto zero = _mm256_setzero_si256();
+
+  std::size_t i = 0;
+  for (; i + 32 <= size; i += 32) {
+    auto input =
+        _mm256_loadu_si256(reinterpret_cast<const __m256i *>(data + i));
+    auto row =
+        _mm256_shuffle_epi8(nibbles, _mm256_and_si256(input, low_mask));
+    auto bit = _mm256_shuffle_epi8(
+        high_bits, _mm256_and_si256(_mm256_srli_epi16(input, 4), low_mask));
+    auto mask = ~static_cast<std::uint32_t>(_mm256_movemask_epi8(
+        _mm256_cmpeq_epi8(_mm256_and_si256(row, bit), zero)));
+    if (mask != 0) {
+      return i + std::countr_zero(mask);
+    }
+  }
+  return i;
+}
+#endif
+
+}  // namespace
+
+ChangeWorkingDir::ChangeWorkingDir(const std::string &path) {
+  if (!std::empty(path)) {
+    backup_ = std::filesystem::current_path();
+
+    if (!std::filesystem::is_directory(path)) {
+      if (!std::filesystem::create_directory(path)) {
+        throw RuntimeError("can not create directory: '{}'", path);
+      }
+    }
+
+    if (chdir(path.c_str())) {
+      throw RuntimeError("chdir error");
+    }
+  }
+}
+
+ChangeWorkingDir::~ChangeWorkingDir() {
+  if (!std::empty(backup_) && chdir(backup_.c_str())) {
+    error("chdir error");
+  }
+}
+
+namespace detail {
+
+std::size_t find_first_of(std::string_view str, const CharSet &set) {
+  auto data = reinterpret_cast<const std::uint8_t *>(std::data(str));
+  auto size = std::size(str);
+
+  std::size_t i = 0;
+#ifdef __x86_64__
+  if (set.ascii && has_avx2()) {
+    i = find_first_of_avx2(data, size, set);
+  }
+#endif
+  for (; i < size; ++i) {
+    if (in_char_set(set, data[i])) {
+      return i;
+    }
+  }
+  return std::string_view::npos;
+}
+
+}  // namespace detail
+
+std::vector<std::string> split_str(const std::string &str,
+                                   const std::string &separate) {
+  std::vector<std::string> result;
+  for (auto token :
+       split<SplitOptions{.trim = true, .skip_empty = true}>(str, separate)) {
+    result.emplace_back(token);
+  }
+
+  return result;
+}
+
+std::string read_file(const std::string &path, bool binary_mode) {
+  return read_file(path.c_str(), binary_mode);
+}
+
+std::string read_file(std::string_view path, bool binary_mode) {
+  return read_file(path.data(), binary_mode);
+}
+
+class MappedFile::MappedFileImpl {
+ public:
+  MappedFileImpl(const std::string &path, MappedFileAdvice advice) {
+    if (!std::filesystem::is_regular_file(path)) {
+      throw RuntimeError("'{}' is not a file", path);
+    }
+
+    FileDescriptor fd(path);
+    if (auto size = file_size(fd); size != 0) {
+      mapping_.emplace(fd, 0, size);
+    }
+
+    if (mapping_ && mapping_->data() != nullptr) {
+      mapping_->advise(to_madvise(advice));
+      view_ = {mapping_->data(), mapping_->size()};
+    } else {
+      pread_chunks(fd, path, 0, [&](const char *data, std::size_t size) {
+        buffer_.append(data, size);
+      });
+      view_ = buffer_;
+    }
+  }
+
+  [[nodiscard]] std::string_view view() const { return view_; }
+
+ private:
+  static std::int32_t to_madvise(MappedFileAdvice advice) {
+    switch (advice) {
+      case MappedFileAdvice::Normal:
+        return MADV_NORMAL;
+      case MappedFileAdvice::Sequential:
+        return MADV_SEQUENTIAL;
+      case MappedFileAdvice::Random:
+        return MADV_RANDOM;
+      case MappedFileAdvice::WillNeed:
+        return MADV_WILLNEED;
+      default:
+        throw RuntimeError("Unknown advice");
+    }
+  }
+
+  std::optional<Mapping> mapping_;
+  std::string buffer_;
+  std::string_view view_;
+};
+
+MappedFile::MappedFile(const std::string &path, MappedFileAdvice advice)
+    : impl_(std::make_unique<MappedFileImpl>(path, advice)) {}
+
+MappedFile::MappedFile(MappedFile &&) noexcept = default;
+
+MappedFile &MappedFile::operator=(MappedFile &&) noexcept = default;
+
+MappedFile::~MappedFile() = default;
+
+std::span<const std::byte> MappedFile::bytes() const {
+  return std::as_bytes(std::span(impl_->view()));
+}
+
+std::string_view MappedFile::view() const { return impl_->view(); }
+
+std::size_t MappedFile::size() const { return std::size(impl_->view()); }
+
+std::string read_file(const char *path, bool binary_mode) {
+  // Text and binary mode are the same on POSIX
+  (void)binary_mode;
+
+  if (!std::filesystem::is_regular_file(path)) {
+    throw RuntimeError("'{}' is not a file", path);
+  }
+
+  // Read straight into a string of the file size, mapping the file would only
+  // add a copy and fault if the file is truncated meanwhile
+  FileDescriptor fd(path);
+  std::string data;
+  data.resize(file_size(fd));
+
+  std::size_t offset = 0;
+  while (offset < std::size(data)) {
+    auto n = ::pread(fd.get(), std::data(data) + offset,
+                     std::size(data) - offset, static_cast<off_t>(offset));
+    if (n == -1) {
+      if (errno == EINTR) {
+        continue;
+      }
+      throw RuntimeError("can not read file: '{}'", path);
+    }
+    if (n == 0) {
+      break;
+    }
+    offset += static_cast<std::size_t>(n);
+  }
+  data.resize(offset);
+
+  // Files that report no size, such as those in /proc
+  if (std::empty(data)) {
+    pread_chunks(fd, path, 0, [&](const char *chunk, std::size_t size) {
+      data.append(chunk, size);
+    });
+  }
+
+  return data;
+}
+
+std::vector<std::string> read_file_line(const std::string &path) {
+  return read_file_line(path.c_str());
+}
+
+std::vector<std::string> read_file_line(std::string_view path) {
+  return read_file_line(path.data());
+}
+
+// The same as split_str(read_file(path, false), "\n"), without copying the
+// whole file first
+std::vector<std::string> read_file_line(const char *path) {
+  std::vector<std::string> result;
+  for (auto line : FileLines(path)) {
+    line = detail::trim(line);
+    if (!std::empty(line)) {
+      result.emplace_back(line);
+    }
+  }
+
+  return result;
+}
+
+// The current window is either mapped or, for files that can not be mapped,
+// read into buffer_. A line that crosses windows is gathered in carry_
+class FileLines::FileLinesImpl {
+ public:
+  explicit FileLinesImpl(const std::string &path)
+      : path_(path),
+        fd_(check_regular_file(path)),
+        size_(file_size(fd_)),
+        mappable_(size_ != 0) {}
+
+  bool next(std::string_view &line) {
+    if (carry_used_) {
+      carry_.clear();
+      carry_used_ = false;
+    }
+
+    while (true) {
+      const char *end = nullptr;
+      if (!std::empty(rest_)) {
+        end = static_cast<const char *>(
+            std::memchr(std::data(rest_), '\n', std::size(rest_)));
+      }
+      if (end != nullptr) {
+        auto size = static_cast<std::size_t>(end - std::data(rest_));
+        line = rest_.substr(0, size);
+        rest_.remove_prefix(size + 1);
+        if (!std::empty(carry_)) {
+          carry_.append(line);
+          line = carry_;
+          carry_used_ = true;
+        }
+        return true;
+      }
+
+      carry_.append(rest_);
+      rest_ = {};
+      if (!next_window()) {
+        line = carry_;
+        carry_used_ = true;
+        return !std::empty(carry_);
+      }
+    }
+  }
+
+ private:
+  static const std::string &check_regular_file(const std::string &path) {
+    if (!std::filesystem::is_regular_file(path)) {
+      throw RuntimeError("'{}' is not a file", path);
+    }
+    return path;
+  }
+
+  bool next_window() {
+    constexpr std::size_t window_size = 64 * 1024 * 1024;
+
+    mapping_.reset();
+    if (mappable_ && offset_ < size_) {
+      mapping_.emplace(fd_, offset_, std::min(window_size, size_ - offset_));
+      if (mapping_->data() != nullptr) {
+        mapping_->advise(MADV_SEQUENTIAL);
+        rest_ = {mapping_->data(), mapping_->size()};
+        offset_ += mapping_->size();
+        return true;
+      }
+      mapping_.reset();
+      mappable_ = false;
+    }
+    if (mappable_) {
+      return false;
+    }
+
+    buffer_.resize(1024 * 1024);
+    while (true) {
+      auto n = ::pread(fd_.get(), std::data(buffer_), std::size(buffer_),
+                       static_cast<off_t>(offset_));
+      if (n == -1) {
+        if (errno == EINTR) {
+          continue;
+        }
+        throw RuntimeError("can not read file: '{}'", path_);
+      }
+
+      rest_ = {std::data(buffer_), static_cast<std::size_t>(n)};
+      offset_ += static_cast<std::size_t>(n);
+      return n != 0;
+    }
+  }
+
+  std::string path_;
+  FileDescriptor fd_;
+  std::size_t size_ = 0;
+  std::size_t offset_ = 0;
+  // Files that report no size, such as those in /proc, or that fail to map
+  // are read by pread()
+  bool mappable_ = true;
+
+  std::optional<Mapping> mapping_;
+  std::vector<char> buffer_;
+  std::string_view rest_;
+
+  std::string carry_;
+  bool carry_used_ = false;
+};
+
+FileLines::Iterator &FileLines::Iterator::operator++() {
+  if (!lines_->impl_->next(line_)) {
+    lines_ = nullptr;
+  }
+  return *this;
+}
+
+FileLines::FileLines(const std::string &path)
+    : impl_(std::make_unique<FileLinesImpl>(path)) {}
+
+FileLines::FileLines(FileLines &&) noexcept = default;
+
+FileLines &FileLines::operator=(FileLines &&) noexcept = default;
+
+FileLines::~FileLines() = default;
+
+void write_file(const std::string &path, bool binary_mode,
+                const std::string &content) {
+  write_file(path.c_str(), binary_mode, content.c_str(), std::size(content));
+}
+
+void write_file(std::string_view path, bool binary_mode,
+                std::string_view content) {
+  write_file(path.data(), binary_mode, content.data(), std::size(content));
+}
+
+void write_file(const char *path, bool binary_mode, const char *content,
+                std::size_t length) {
+  std::ofstream ofs;
+  if (binary_mode) {
+    ofs.open(path, std::ofstream::binary);
+  } else {
+    ofs.open(path);
+  }
+
+  if (!ofs) {
+    throw RuntimeError("can not open file: '{}'", path);
+  }
+
+  ofs.write(content, length);
+}
+
+bool is_valid_utf8(std::string_view str) { return validate_utf8(str); }
+
+std::size_t utf8_to_utf16_size(std::string_view str) {
+  auto counts = utf8_count(str);
+  return std::size(str) - counts.continuations + counts.four_byte_leads;
+}
+
+std::size_t utf8_to_utf32_size(std::string_view str) {
+  return std::size(str) - utf8_count(str).continuations;
+}
+
+std::u16string utf8_to_utf16(const std::string &str) {
+  if (!validate_utf8(str)) {
+    throw RuntimeError("Invalid UTF-8 string");
+  }
+
+  std::u16string result(utf8_to_utf16_size(str), u'\0');
+  utf8_transcode<char16_t>(str, result, std::size(result));
+  return result;
+}
+
+std::size_t utf8_to_utf16(std::string_view str, std::span<char16_t> output) {
+  if (!validate_utf8(str)) {
+    throw RuntimeError("Invalid UTF-8 string");
+  }
+
+  return utf8_transcode(str, output, utf8_to_utf16_size(str));
+}
+
+std::u32string utf8_to_utf32(const std::string &str) {
+  if (!validate_utf8(str)) {
+    throw RuntimeError("Invalid UTF-8 string");
+  }
+
+  std::u32string result(utf8_to_utf32_size(str), U'\0');
+  utf8_transcode<char32_t>(str, result, std::size(result));
+  return result;
+}
+
+std::size_t utf8_to_utf32(std::string_view str, std::span<char32_t> output) {
+  if (!validate_utf8(str)) {
+    throw RuntimeError("Invalid UTF-8 string");
+  }
+
+  return utf8_transcode(str, output, utf8_to_utf32_size(str));
+}
+
+std::size_t utf16_to_utf8_size(std::u16string_view str) {
+  return utf8_size(str);
+}
+
+std::size_t utf32_to_utf8_size(std::u32string_view str) {
+  return utf8_size(str);
+}
+
+std::string utf16_to_utf8(const std::u16string &str) {
+  std::string result(utf8_size<char16_t>(str), '\0');
+  utf8_encode<char16_t>(str, result, std::size(result));
+  return result;
+}
+
+std::size_t utf16_to_utf8(std::u16string_view str, std::span<char> output) {
+  return utf8_encode(str, output, utf8_size(str));
+}
+
+std::string utf32_to_utf8(char32_t c) {
+  return utf32_to_utf8(std::u32string(1, c));
+}
+
+std::string utf32_to_utf8(const std::u32string &str) {
+  std::string result(utf8_size<char32_t>(str), '\0');
+  utf8_encode<char32_t>(str, result, std::size(result));
+  return result;
+}
+
+std::size_t utf32_to_utf8(std::u32string_view str, std::span<char> output) {
+  return utf8_encode(str, output, utf8_size(str));
+}
+
+bool is_ascii(std::string_view str) {
+  auto data = reinterpret_cast<const std::uint8_t *>(std::data(str));
+#ifdef __x86_64__
+  if (has_avx2()) {
+    return is_ascii_avx2(data, std::size(str));
+  }
+#endif
+  return is_ascii_scalar(data, std::size(str));
+}
+
+bool is_ascii(std::u32string_view str) {
+#ifdef __x86_64__
+  if (has_avx2()) {
+    return is_ascii_avx2(std::data(str), std::size(str));
+  }
+#endif
+  return std::all_of(std::begin(str), std::end(str),
+                     [](char32_t c) { return is_ascii(c); });
+}
+
+bool is_chinese(const std::string &c) {
+  if (std::empty(c)) {
+    return false;
+  }
+
+  // The length of the sequence is given by its lead byte
+  auto data = reinterpret_cast<const std::uint8_t *>(std::data(c));
+  auto size = std::max(std::countl_one(data[0]), 1);
+  if (std::ssize(c) != size || !validate_utf8(c)) {
+    throw RuntimeError("not a UTF-32 encoded character: '{}'", c);
+  }
+
+  char32_t code_point;
+  utf8_decode_scalar(data, data + size, &code_point);
+  return is_chinese(code_point);
+}
+
+std::size_t count_chinese(std::string_view str) {
+  auto data = reinterpret_cast<const std::uint8_t *>(std::data(str));
+  auto size = std::size(str);
+  std::size_t count = 0;
+
+  std::size_t i = 0;
+#ifdef __x86_64__
+  if (has_avx2()) {
+    i = count_chinese_avx2(data, size, count);
+  }
+#endif
+  for (; i < size; ++i) {
+    count += chinese_at(data + i, data + size);
+  }
+
+  return count;
+}
+
+std::size_t find_chinese(std::string_view str, std::size_t pos) {
+  auto size = std::size(str);
+  if (pos >= size) {
+    return std::string_view::npos;
+  }
+
+  pos = find_chinese(reinterpret_cast<const std::uint8_t *>(std::data(str)),
+                     pos, size);
+  return pos == size ? std::string_view::npos : pos;
+}
+
+std::vector<ChineseSpan> chinese_spans(std::string_view str) {
+  auto data = reinterpret_cast<const std::uint8_t *>(std::data(str));
+  auto size = std::size(str);
+
+  std::vector<ChineseSpan> result;
+  std::size_t begin = 0;
+  while (begin < size) {
+    auto chinese_begin = find_chinese(data, begin, size);
+    if (chinese_begin != begin) {
+      result.push_back({str.substr(begin, chinese_begin - begin), false});
+    }
+    if (chinese_begin == size) {
+      break;
+    }
+
+    auto chinese_end = skip_chinese(data, chinese_begin, size);
+    result.push_back(
+        {str.substr(chinese_begin, chinese_end - chinese_begin), true});
+    begin = chinese_end;
+  }
+
+  return result;
+}
+
+std::size_t base64_encode(std::string_view data, std::span<char> output,
+                          Base64Alphabet alphabet) {
+  auto size = std::size(data);
+  if (std::size(output) < base64_encoded_size(size, alphabet)) {
+    throw RuntimeError("The output is too small");
+  }
+
+  const auto &codec = base64_codec(alphabet);
+  auto bytes = reinterpret_cast<const std::uint8_t *>(std::data(data));
+  auto done = base64_encode_blocks(bytes, size, std::data(output), codec);
+
+  return done / 3 * 4 + base64_encode_tail(bytes + done, size - done,
+                                           std::data(output) + done / 3 * 4,
+                                           codec);
+}
+
+std::string base64_encode(const std::string &str, Base64Alphabet alphabet) {
+  std::string output(base64_encoded_size(std::size(str), alphabet), '\0');
+  base64_encode(str, output, alphabet);
+  return output;
+}
+
+std::size_t base64_decode(std::string_view str, std::span<char> output,
+                          Base64Alphabet alphabet) {
+  Base64Decoder decoder(alphabet);
+  auto size = decoder.update(str, output);
+  return size + decoder.finalize(output.subspan(size));
+}
+
+std::string base64_decode(const std::string &str, Base64Alphabet alphabet) {
+  std::string output(base64_decoded_size(std::size(str)), '\0');
+  output.resize(base64_decode(str, output, alphabet));
+  return output;
+}
+
+std::size_t Base64Encoder::update(std::string_view data,
+                                  std::span<char> output) {
+  auto size = std::size(data);
+  if (std::size(output) < (pending_size_ + size) / 3 * 4) {
+    throw RuntimeError("The output is too small");
+  }
+
+  const auto &codec = base64_codec(alphabet_);
+  auto bytes = reinterpret_cast<const std::uint8_t *>(std::data(data));
+  auto out = std::data(output);
+
+  std::size_t i = 0;
+  if (pending_size_ != 0) {
+    while (pending_size_ < 3 && i < size) {
+      pending_[pending_size_++] = bytes[i++];
+    }
+    if (pending_size_ < 3) {
+      return 0;
+    }
+    out += base64_encode_scalar(std::data(pending_), 3, out, codec) / 3 * 4;
+    pending_size_ = 0;
+  }
+
+  auto done = base64_encode_blocks(bytes + i, size - i, out, codec);
+  out += done / 3 * 4;
+  i += done;
+
+  std::copy(bytes + i, bytes + size, std::begin(pending_));
+  pending_size_ = size - i;
+
+  return out - std::data(output);
+}
+
+std::size_t Base64Encoder::finalize(std::span<char> output) {
+  if (std::size(output) < base64_encoded_size(pending_size_, alphabet_)) {
+    throw RuntimeError("The output is too small");
+  }
+
+  auto size = base64_encode_tail(std::data(pending_), pending_size_,
+                                 std::data(output), base64_codec(alphabet_));
+  pending_size_ = 0;
+  return size;
+}
+
+std::size_t Base64Decoder::update(std::string_view str,
+                                  std::span<char> output) {
+  // The kept characters and the new ones may end with a partial group
+  // completed by padding, 2 characters and '=' past the last whole group
+  // decode to 1 more byte
+  auto size = std::size(str);
+  auto count = pending_size_ + size;
+  if (std::size(output) < count / 4 * 3 + (count % 4 == 3 ? 1 : 0)) {
+    throw RuntimeError("The output is too small");
+  }
+
+  const auto &codec = base64_codec(alphabet_);
+  auto out = reinterpret_cast<std::uint8_t *>(std::data(output));
+
+  std::size_t i = 0;
+  while (i < size) {
+    // Whole groups go to the SIMD code, which stops at whitespace, padding or
+    // an invalid character
+    if (pending_size_ == 0 && !padded_) {
+      auto done =
+          base64_decode_blocks(std::data(str) + i, (size - i) / 4 * 4, out,
+                               codec);
+      out += done / 4 * 3;
+      i += done;
+      if (i == size) {
+        break;
+      }
+    }
+
+    auto c = str[i++];
+    if (std::isspace(static_cast<unsigned char>(c))) {
+      continue;
+    }
+
+    if (c == '=') {
+      if (!padded_) {
+        if (pending_size_ < 2) {
+          throw RuntimeError("Invalid base64 padding");
+        }
+        out += base64_decode_tail(std::data(pending_), pending_size_, out,
+                                  codec);
+        pending_size_ = 0;
+        padded_ = true;
+      }
+      continue;
+    }
+    if (padded_) {
+      throw RuntimeError("Invalid base64 data after the padding");
+    }
+    if (codec.values[static_cast<std::uint8_t>(c)] == 0xFF) {
+      throw RuntimeError("Invalid base64 character: '{}'", c);
+    }
+
+    pending_[pending_size_++] = c;
+    if (pending_size_ == 4) {
+      out += base64_decode_scalar(std::data(pending_), 4, out, codec) / 4 * 3;
+      pending_size_ = 0;
+    }
+  }
+
+  return out - reinterpret_cast<std::uint8_t *>(std::data(output));
+}
+
+std::size_t Base64Decoder::finalize(std::span<char> output) {
+  if (pending_size_ > 1 && std::size(output) < pending_size_ - 1) {
+    throw RuntimeError("The output is too small");
+  }
+
+  auto size = pending_size_;
+  pending_size_ = 0;
+  padded_ = false;
+
+  return base64_decode_tail(std::data(pending_), size,
+                            reinterpret_cast<std::uint8_t *>(std::data(output)),
+                            base64_codec(alphabet_));
+}
+
+std::size_t hex_encode(std::span<const std::uint8_t> bytes,
+                       std::span<char> hex) {
+  auto size = std::size(bytes);
+  if (std::size(hex) < 2 * size) {
+    throw RuntimeError("The output is too small");
+  }
+
+  std::size_t done = 0;
+#ifdef __x86_64__
+  if (has_avx2()) {
+    done = hex_encode_avx2(std::data(bytes), size, std::data(hex));
+  }
+  if (has_ssse3()) {
+    done += hex_encode_ssse3(std::data(bytes) + done, size - done,
+                             std::data(hex) + 2 * done);
+  }
+#endif
+  hex_encode_scalar(std::data(bytes) + done, size - done,
+                    std::data(hex) + 2 * done);
+
+  return 2 * size;
+}
+
+std::string hex_encode(std::span<const std::uint8_t> bytes) {
+  std::string hex(2 * std::size(bytes), '\0');
+  hex_encode(bytes, hex);
+  return hex;
+}
+
+std::size_t hex_decode(std::string_view hex, std::span<std::uint8_t> bytes) {
+  if (std::size(hex) % 2 != 0) {
+    throw RuntimeError("The length of the hexadecimal string is odd");
+  }
+
+  auto size = std::size(hex) / 2;
+  if (std::size(bytes) < size) {
+    throw RuntimeError("The output is too small");
+  }
+
+  std::size_t done = 0;
+#ifdef __x86_64__
+  if (has_avx2()) {
+    done = hex_decode_avx2(std::data(hex), size, std::data(bytes));
+  }
+  if (has_ssse3()) {
+    done += hex_decode_ssse3(std::data(hex) + 2 * done, size - done,
+                             std::data(bytes) + done);
+  }
+#endif
+  if (!hex_decode_scalar(std::data(hex) + 2 * done, size - done,
+                         std::data(bytes) + done)) {
+    throw RuntimeError("Not a hexadecimal string");
+  }
+
+  return size;
+}
+
+std::vector<std::uint8_t> hex_decode(std::string_view hex) {
+  std::vector<std::uint8_t> bytes(std::size(hex) / 2);
+  hex_decode(hex, bytes);
+  return bytes;
+}
+
+std::string md5(const std::string &str) {
+  return hex_encode(md5_raw(str));
+}
+
+std::vector<std::uint8_t> md5_raw(const std::string &str) {
+  return evp_digest(str, HashAlgorithm::Md5);
+}
+
+std::string md5_file(const std::string &path) {
+  return hex_encode(digest_file(path, HashAlgorithm::Md5));
+}
+
+std::string sha_256(const std::string &str) {
+  return hex_encode(sha_256_raw(str));
+}
+
+std::vector<std::uint8_t> sha_256_raw(const std::string &str) {
+  return evp_digest(str, HashAlgorithm::Sha256);
+}
+
+std::string sha_256_file(const std::string &path) {
+  return hex_encode(digest_file(path, HashAlgorithm::Sha256));
+}
+
+std::string sha3_512(const std::string &str) {
+  return hex_encode(sha3_512_raw(str));
+}
+
+std::vector<std::uint8_t> sha3_512_raw(const std::string &str) {
+  return evp_digest(str, HashAlgorithm::Sha3_512);
+}
+
+std::string sha3_512_file(const std::string &path) {
+  return hex_encode(digest_file(path, HashAlgorithm::Sha3_512));
+}
+
+void sha_256_batch(std::span<const std::string_view> inputs,
+                   std::span<Sha256Hasher::Digest> digests) {
+  if (std::size(inputs) != std::size(digests)) {
+    throw RuntimeError("The number of digests does not match the inputs");
+  }
+
+#ifdef __x86_64__
+  if (has_sha_ni()) {
+    sha_256_ni_batch(inputs, digests);
+    return;
+  }
+#endif
+
+  Sha256Hasher hasher;
+  for (std::size_t i = 0; i < std::size(inputs); ++i) {
+    digests[i] = hasher.update(inputs[i]).finalize();
+  }
+}
+
+namespace detail {
+
+bool has_avx2() {
+#ifdef __x86_64__
+  static const bool result = __builtin_cpu_supports("avx2");
+  return result;
+#else
+  return false;
+#endif
+}
+
+void for_each_file_chunk(
+    const std::string &path,
+    const std::function<void(const char *, std::size_t)> &func) {
+  klib::for_each_file_chunk(path, func);
+}
+
+}  // namespace detail
+
+// https://en.wikipedia.org/wiki/Merkle_tree
+TreeHash hash_tree(const std::string &path, HashAlgorithm algorithm,
+                   std::size_t threads) {
+  if (!std::filesystem::is_directory(path)) {
+    throw RuntimeError("'{}' is not a directory", path);
+  }
+
+  std::vector<std::filesystem::path> files;
+  std::vector<std::filesystem::path> directories = {""};
+  std::vector<std::filesystem::path> links;
+  for (const auto &item : std::filesystem::recursive_directory_iterator(path)) {
+    // relative() resolves links, so only the parent is passed to it
+    auto relative_path =
+        (std::filesystem::relative(item.path().parent_path(), path) /
+         item.path().filename())
+            .lexically_normal();
+
+    // is_directory() and is_regular_file() follow links, the iterator does not
+    if (item.is_symlink()) {
+      links.push_back(relative_path);
+    } else if (item.is_directory()) {
+      directories.push_back(relative_path);
+    } else if (item.is_regular_file()) {
+      files.push_back(relative_path);
+    }
+  }
+
+  std::vector<std::vector<std::uint8_t>> file_digests(std::size(files));
+  parallel_for(std::size(files), threads, [&](std::size_t index) {
+    file_digests[index] = digest_file(
+        (std::filesystem::path(path) / files[index]).string(), algorithm);
+  });
+
+  // The entries of each directory in the order of their names, a file is
+  // prefixed with 'f', a directory with 'd' and a link with 'l'
+  std::map<std::filesystem::path, std::map<std::string, std::string>> entries;
+  for (const auto &directory : directories) {
+    entries[directory];
+  }
+  for (std::size_t i = 0; i < std::size(files); ++i) {
+    const auto &digest = file_digests[i];
+    entries[files[i].parent_path()][files[i].filename().string()] =
+        'f' + std::string(std::begin(digest), std::end(digest));
+  }
+
+  TreeHash result;
+  for (std::size_t i = 0; i < std::size(files); ++i) {
+    result.files.emplace(files[i].generic_string(),
+                         hex_encode(file_digests[i]));
+  }
+
+  for (const auto &link : links) {
+    auto digest = evp_digest(
+        std::filesystem::read_symlink(std::filesystem::path(path) / link)
+            .string(),
+        algorithm);
+    entries[link.parent_path()][link.filename().string()] =
+        'l' + std::string(std::begin(digest), std::end(digest));
+    result.links.emplace(link.generic_string(), hex_encode(digest));
+  }
+
+  // Children are visited before their parents
+  std::sort(std::begin(directories), std::end(directories),
+            [](const auto &lhs, const auto &rhs) {
+              return std::distance(std::begin(lhs), std::end(lhs)) >
+                     std::distance(std::begin(rhs), std::end(rhs));
+            });
+
+  for (const auto &directory : directories) {
+    std::string data;
+    for (const auto &[name, digest] : entries[directory]) {
+      data.append(name).push_back('\0');
+      data.append(digest);
+    }
+
+    auto digest = evp_digest(data, algorithm);
+    result.directories.emplace(directory.generic_string(),
+                               hex_encode(digest));
+
+    if (!directory.empty()) {
+      entries[directory.parent_path()][directory.filename().string()] =
+          'd' + std::string(std::begin(digest), std::end(digest));
+    }
+  }
+
+  result.root = result.directories.at("");
+  return result;
+}
+
+// https://wiki.openssl.org/index.php/EVP_Symmetric_Encryption_and_Decryption#C.2B.2B_Programs
+class Cipher::CipherImpl {
+ public:
+  CipherImpl(CipherAlgorithm algorithm, CipherOperation operation,
+             std::span<const std::uint8_t> key,
+             std::span<const std::uint8_t> iv);
+
+  CipherImpl(const CipherImpl &) = delete;
+  CipherImpl(CipherImpl &&) = delete;
+  CipherImpl &operator=(const CipherImpl &) = delete;
+  CipherImpl &operator=(CipherImpl &&) = delete;
+
+  ~CipherImpl();
+
+  void update_aad(std::string_view aad);
+  std::size_t update(std::string_view input, std::span<char> output);
+  std::size_t finalize(std::span<char> output);
+  void reset(std::span<const std::uint8_t> iv);
+  void reset(std::span<const std::uint8_t> key,
+             std::span<const std::uint8_t> iv);
+  void clear();
+
+ private:
+  void check_key(std::span<const std::uint8_t> key) const;
+  void check_iv(std::span<const std::uint8_t> iv) const;
+  void check_usable() const;
+  void restart();
+  std::size_t cipher_update(const char *input, std::size_t size,
+                            char *output);
+
+  // Explicitly fetched, so the lookup is not repeated by every init
+  EVP_CIPHER *cipher_ = nullptr;
+  EVP_CIPHER_CTX *context_ = nullptr;
+  std::vector<std::uint8_t> iv_;
+
+  bool aead_ = false;
+  bool encrypt_ = false;
+  bool iv_used_ = false;
+  // The key schedule has been wiped by clear()
+  bool cleared_ = false;
+  // Data of the current message has been processed with iv_
+  bool iv_started_ = false;
+  // The last bytes of the ciphertext seen so far, which may be the tag
+  std::array<char, tag_size> tail_ = {};
+  std::size_t tail_size_ = 0;
+};
+
+Cipher::CipherImpl::CipherImpl(CipherAlgorithm algorithm,
+                               CipherOperation operation,
+                               std::span<const std::uint8_t> key,
+                               std::span<const std::uint8_t> iv) {
+  const char *name = nullptr;
+  switch (algorithm) {
+    case CipherAlgorithm::Aes256Cbc:
+      name = "AES-256-CBC";
+      break;
+    case CipherAlgorithm::Aes256Gcm:
+      name = "AES-256-GCM";
+      aead_ = true;
+      break;
+    case CipherAlgorithm::ChaCha20Poly1305:
+      name = "ChaCha20-Poly1305";
+      aead_ = true;
+      break;
+  }
+  encrypt_ = operation == CipherOperation::Encrypt;
+
+  cipher_ = EVP_CIPHER_fetch(nullptr, name, nullptr);
+  if (!cipher_) {
+    throw RuntimeError(ERR_error_string(ERR_get_error(), nullptr));
+  }
+
+  try {
+    check_key(key);
+    check_iv(iv);
+
+    context_ = EVP_CIPHER_CTX_new();
+    if (!context_) {
+      throw RuntimeError(ERR_error_string(ERR_get_error(), nullptr));
+    }
+
+    iv_.assign(std::begin(iv), std::end(iv));
+    check_openssl(EVP_CipherInit_ex2(context_, cipher_, std::data(key),
+                                     std::data(iv_), encrypt_ ? 1 : 0,
+                                     nullptr));
+  } catch (...) {
+    EVP_CIPHER_CTX_free(context_);
+    EVP_CIPHER_free(cipher_);
+    throw;
+  }
+}
+
+Cipher::CipherImpl::~CipherImpl() {
+  EVP_CIPHER_CTX_free(context_);
+  EVP_CIPHER_free(cipher_);
+}
+
+void Cipher::CipherImpl::update_aad(std::string_view aad) {
+  if (!aead_) {
+    throw RuntimeError("Additional authenticated data needs an AEAD cipher");
+  }
+  check_usable();
+  iv_started_ = true;
+
+  cipher_update(std::data(aad), std::size(aad), nullptr);
+}
+
+std::size_t Cipher::CipherImpl::update(std::string_view input,
+                                       std::span<char> output) {
+  if (std::size(output) < std::size(input) + block_size) {
+    throw RuntimeError("The output is too small");
+  }
+  check_usable();
+  iv_started_ = true;
+
+  if (!aead_ || encrypt_) {
+    return cipher_update(std::data(input), std::size(input),
+                         std::data(output));
+  }
+
+  // Only the bytes that are followed by at least tag_size others can not be
+  // part of the tag
+  auto size = std::size(input);
+  if (tail_size_ + size <= tag_size) {
+    std::copy_n(std::data(input), size, std::data(tail_) + tail_size_);
+    tail_size_ += size;
+    return 0;
+  }
+
+  auto release = tail_size_ + size - tag_size;
+  auto from_tail = std::min(tail_size_, release);
+  auto from_input = release - from_tail;
+
+  auto written = cipher_update(std::data(tail_), from_tail, std::data(output));
+  written += cipher_update(std::data(input), from_input,
+                           std::data(output) + written);
+
+  std::copy(std::data(tail_) + from_tail, std::data(tail_) + tail_size_,
+            std::data(tail_));
+  tail_size_ -= from_tail;
+  std::copy(std::data(input) + from_input, std::data(input) + size,
+            std::data(tail_) + tail_size_);
+  tail_size_ += size - from_input;
+
+  return written;
+}
+
+std::size_t Cipher::CipherImpl::finalize(std::span<char> output) {
+  if (std::size(output) < block_size) {
+    throw RuntimeError("The output is too small");
+  }
+  check_usable();
+
+  auto out = reinterpret_cast<std::uint8_t *>(std::data(output));
+  if (aead_ && !encrypt_) {
+    if (tail_size_ != tag_size) {
+      restart();
+      throw RuntimeError("The ciphertext is too short");
+    }
+    check_openssl(EVP_CIPHER_CTX_ctrl(context_, EVP_CTRL_AEAD_SET_TAG,
+                                      tag_size, std::data(tail_)));
+  }
+
+  std::int32_t length = 0;
+  auto rc = EVP_CipherFinal_ex(context_, out, &length);
+  if (rc == 1 && aead_ && encrypt_) {
+    rc = EVP_CIPHER_CTX_ctrl(context_, EVP_CTRL_AEAD_GET_TAG, tag_size,
+                             out + length);
+    length += tag_size;
+  }
+
+  restart();
+  if (rc != 1 && aead_ && !encrypt_) {
+    throw RuntimeError("The authentication tag does not match");
+  }
+  check_openssl(rc);
+
+  iv_used_ = aead_ && encrypt_;
+  return length;
+}
+
+void Cipher::CipherImpl::reset(std::span<const std::uint8_t> iv) {
+  if (cleared_) {
+    throw RuntimeError("The key of the cipher has been cleared");
+  }
+  check_iv(iv);
+  // Encrypting again with an iv that has been used would reuse the key stream
+  if (aead_ && encrypt_ && (iv_used_ || iv_started_) &&
+      std::ranges::equal(iv, iv_)) {
+    throw RuntimeError("The iv of an AEAD cipher must not be reused");
+  }
+  iv_.assign(std::begin(iv), std::end(iv));
+
+  restart();
+}
+
+void Cipher::CipherImpl::reset(std::span<const std::uint8_t> key,
+                               std::span<const std::uint8_t> iv) {
+  check_key(key);
+  check_iv(iv);
+  iv_.assign(std::begin(iv), std::end(iv));
+
+  // Only the key schedule is redone, the context and the fetched cipher are
+  // kept. A cleared context needs the cipher again
+  check_openssl(EVP_CipherInit_ex2(context_, cleared_ ? cipher_ : nullptr,
+                                   std::data(key), std::data(iv_),
+                                   encrypt_ ? 1 : 0, nullptr));
+  cleared_ = false;
+  iv_used_ = false;
+  iv_started_ = false;
+  tail_size_ = 0;
+}
+
+void Cipher::CipherImpl::check_key(std::span<const std::uint8_t> key) const {
+  auto key_length = EVP_CIPHER_get_key_length(cipher_);
+  if (std::size(key) != static_cast<std::size_t>(key_length)) {
+    throw RuntimeError("The key is not {} bit", key_length * 8);
+  }
+}
+
+void Cipher::CipherImpl::clear() {
+  // Frees and wipes the key schedule, the context itself is kept
+  check_openssl(EVP_CIPHER_CTX_reset(context_));
+  cleared_ = true;
+  iv_started_ = false;
+  tail_size_ = 0;
+}
+
+void Cipher::CipherImpl::check_usable() const {
+  if (cleared_) {
+    throw RuntimeError("The key of the cipher has been cleared");
+  }
+  if (iv_used_) {
+    throw RuntimeError("The iv of an AEAD cipher must not be reused");
+  }
+}
+
+void Cipher::CipherImpl::restart() {
+  // The key schedule is kept, only the iv is set again
+  check_openssl(EVP_CipherInit_ex2(context_, nullptr, nullptr, std::data(iv_),
+                                   -1, nullptr));
+  iv_used_ = false;
+  iv_started_ = false;
+  tail_size_ = 0;
+}
+
+std::size_t Cipher::CipherImpl::cipher_update(const char *input,
+                                              std::size_t size, char *output) {
+  // The length is an int for OpenSSL
+  constexpr std::size_t max_chunk = 1 << 30;
+
+  auto in = reinterpret_cast<const std::uint8_t *>(input);
+  auto out = reinterpret_cast<std::uint8_t *>(output);
+  std::size_t written = 0;
+  for (std::size_t i = 0; i < size; i += max_chunk) {
+    auto chunk = static_cast<std::int32_t>(std::min(max_chunk, size - i));
+    std::int32_t length = 0;
+    check_openssl(EVP_CipherUpdate(context_, out ? out + written : nullptr,
+                                   &length, in + i, chunk));
+    written += length;
+  }
+
+  return written;
+}
+
+void Cipher::CipherImpl::check_iv(std::span<const std::uint8_t> iv) const {
+  auto iv_length = EVP_CIPHER_get_iv_length(cipher_);
+  if (std::size(iv) != static_cast<std::size_t>(iv_length)) {
+    throw RuntimeError("The iv is not {} bit", iv_length * 8);
+  }
+}
+
+Cipher::Cipher(CipherAlgorithm algorithm, CipherOperation operation,
+               std::span<const std::uint8_t> key,
+               std::span<const std::uint8_t> iv)
+    : impl_(std::make_unique<CipherImpl>(algorithm, operation, key, iv)) {}
+
+Cipher::Cipher(Cipher &&) noexcept = default;
+
+Cipher &Cipher::operator=(Cipher &&) noexcept = default;
+
+Cipher::~Cipher() = default;
+
+std::size_t Cipher::update(std::string_view input, std::span<char> output) {
+  return impl_->update(input, output);
+}
+
+std::size_t Cipher::finalize(std::span<char> output) {
+  return impl_->finalize(output);
+}
+
+void Cipher::update_aad(std::string_view aad) { impl_->update_aad(aad); }
+
+void Cipher::reset(std::span<const std::uint8_t> iv) { impl_->reset(iv); }
+
+void Cipher::reset(std::span<const std::uint8_t> key,
+                   std::span<const std::uint8_t> iv) {
+  impl_->reset(key, iv);
+}
+
+void Cipher::clear() { impl_->clear(); }
+
+namespace {
+
+// One cipher per algorithm, operation and thread, only the key and the iv are
+// set again for each message
+Cipher &cached_cipher(CipherAlgorithm algorithm, CipherOperation operation,
+                      std::span<const std::uint8_t> key,
+                      std::span<const std::uint8_t> iv) {
+  thread_local std::array<std::unique_ptr<Cipher>, 6> ciphers;
+
+  auto &cipher = ciphers[static_cast<std::size_t>(algorithm) * 2 +
+                         static_cast<std::size_t>(operation)];
+  if (!cipher) {
+    cipher = std::make_unique<Cipher>(algorithm, operation, key, iv);
+  } else {
+    cipher->reset(key, iv);
+  }
+  return *cipher;
+}
+
+std::string cipher_string(const std::string &str,
+                          const std::vector<std::uint8_t> &key,
+                          const std::vector<std::uint8_t> &iv,
+                          CipherAlgorithm algorithm, CipherOperation operation,
+                          std::string_view aad = {}) {
+  // The context is kept for the next call, but not the key schedule
+  auto &cipher = cached_cipher(algorithm, operation, key, iv);
+
+  std::string result;
+  try {
+    if (!std::empty(aad)) {
+      cipher.update_aad(aad);
+    }
+
+    result.resize(std::size(str) + 2 * Cipher::block_size);
+    auto size = cipher.update(str, result);
+    size += cipher.finalize(std::span<char>(result).subspan(size));
+    result.resize(size);
+  } catch (...) {
+    cipher.clear();
+    throw;
+  }
+  cipher.clear();
+
+  return result;
+}
+
+// Opening the output truncates it, which would destroy the input if both are
+// the same file
+void check_distinct_files(const std::string &in_path,
+                          const std::string &out_path) {
+  std::error_code error;
+  if (std::filesystem::equivalent(in_path, out_path, error)) {
+    throw RuntimeError("'{}' and '{}' are the same file", in_path, out_path);
+  }
+}
+
+void cipher_file(const std::string &in_path, const std::string &out_path,
+                 const std::vector<std::uint8_t> &key,
+                 const std::vector<std::uint8_t> &iv,
+                 CipherOperation operation) {
+  check_distinct_files(in_path, out_path);
+  Cipher cipher(CipherAlgorithm::Aes256Cbc, operation, key, iv);
+
+  std::ofstream ofs(out_path, std::ofstream::binary);
+  if (!ofs) {
+    throw RuntimeError("can not open file: '{}'", out_path);
+  }
+
+  constexpr std::size_t chunk_size = 1024 * 1024;
+  std::vector<char> buffer(chunk_size + Cipher::block_size);
+
+  try {
+    for_each_file_chunk(in_path, [&](const char *data, std::size_t size) {
+      for (std::size_t i = 0; i < size; i += chunk_size) {
+        auto length = cipher.update(
+            std::string_view(data + i, std::min(chunk_size, size - i)), buffer);
+        ofs.write(std::data(buffer), static_cast<std::streamsize>(length));
+      }
+    });
+
+    auto length = cipher.finalize(buffer);
+    ofs.write(std::data(buffer), static_cast<std::streamsize>(length));
+    ofs.close();
+    if (!ofs) {
+      throw RuntimeError("can not write file: '{}'", out_path);
+    }
+  } catch (...) {
+    ofs.close();
+    std::filesystem::remove(out_path);
+    throw;
+  }
+}
+
+}  // namespace
+
+std::string aes_256_cbc_encrypt(const std::string &str,
+                                const std::vector<std::uint8_t> &key,
+                                const std::vector<std::uint8_t> &iv) {
+  return cipher_string(str, key, iv, CipherAlgorithm::Aes256Cbc,
+                       CipherOperation::Encrypt);
+}
+
+std::string aes_256_cbc_decrypt(const std::string &str,
+                                const std::vector<std::uint8_t> &key,
+                                const std::vector<std::uint8_t> &iv) {
+  return cipher_string(str, key, iv, CipherAlgorithm::Aes256Cbc,
+                       CipherOperation::Decrypt);
+}
+
+std::string aes_256_gcm_encrypt(const std::string &str,
+                                const std::vector<std::uint8_t> &key,
+                                const std::vector<std::uint8_t> &iv,
+                                std::string_view aad) {
+  return cipher_string(str, key, iv, CipherAlgorithm::Aes256Gcm,
+                       CipherOperation::Encrypt, aad);
+}
+
+std::string aes_256_gcm_decrypt(const std::string &str,
+                                const std::vector<std::uint8_t> &key,
+                                const std::vector<std::uint8_t> &iv,
+                                std::string_view aad) {
+  return cipher_string(str, key, iv, CipherAlgorithm::Aes256Gcm,
+                       CipherOperation::Decrypt, aad);
+}
+
+std::string chacha20_poly1305_encrypt(const std::string &str,
+                                      const std::vector<std::uint8_t> &key,
+                                      const std::vector<std::uint8_t> &iv,
+                                      std::string_view aad) {
+  return cipher_string(str, key, iv, CipherAlgorithm::ChaCha20Poly1305,
+                       CipherOperation::Encrypt, aad);
+}
+
+std::string chacha20_poly1305_decrypt(const std::string &str,
+                                      const std::vector<std::uint8_t> &key,
+                                      const std::vector<std::uint8_t> &iv,
+                                      std::string_view aad) {
+  return cipher_string(str, key, iv, CipherAlgorithm::ChaCha20Poly1305,
+                       CipherOperation::Decrypt, aad);
+}
+
+void aes_256_cbc_encrypt_file(const std::string &in_path,
+                              const std::string &out_path,
+                              const std::vector<std::uint8_t> &key,
+                              const std::vector<std::uint8_t> &iv) {
+  cipher_file(in_path, out_path, key, iv, CipherOperation::Encrypt);
+}
+
+void aes_256_cbc_decrypt_file(const std::string &in_path,
+                              const std::string &out_path,
+                              const std::vector<std::uint8_t> &key,
+                              const std::vector<std::uint8_t> &iv) {
+  cipher_file(in_path, out_path, key, iv, CipherOperation::Decrypt);
+}
+
+namespace {
+
+constexpr char chunked_magic[8] = {'K', 'L', 'I', 'B', 'A', 'E', 'A', 'D'};
+constexpr std::uint8_t chunked_version = 1;
+constexpr std::size_t chunked_iv_size = 12;
+constexpr std::size_t chunked_max_chunk_size = 1 << 30;
+
+// Little-endian: magic[8] version[1] algorithm[1] reserved[2] chunk_size[4]
+// plaintext_size[8] base_iv[12]
+class ChunkedHeader {
+ public:
+  static constexpr std::size_t size = 36;
+
+  ChunkedHeader(CipherAlgorithm algorithm, std::size_t chunk_size,
+                std::size_t plaintext_size)
+      : algorithm_(algorithm),
+        chunk_size_(chunk_size),
+        plaintext_size_(plaintext_size) {
+    if (algorithm == CipherAlgorithm::Aes256Cbc) {
+      throw RuntimeError("The chunked format needs an AEAD cipher");
+    }
+    if (chunk_size == 0 || chunk_size > chunked_max_chunk_size) {
+      throw RuntimeError("Invalid chunk size: {}", chunk_size);
+    }
+
+    compute_file_size();
+    check_openssl(RAND_bytes(std::data(base_iv_), chunked_iv_size));
+    encode();
+  }
+
+  explicit ChunkedHeader(const std::array<char, size> &bytes) : bytes_(bytes) {
+    auto data = reinterpret_cast<const std::uint8_t *>(std::data(bytes));
+    if (!std::equal(std::begin(chunked_magic), std::end(chunked_magic),
+                    std::data(bytes)) ||
+        data[8] != chunked_version) {
+      throw RuntimeError("Not a chunked encrypted file");
+    }
+
+    switch (data[9]) {
+      case 1:
+        algorithm_ = CipherAlgorithm::Aes256Gcm;
+        break;
+      case 2:
+        algorithm_ = CipherAlgorithm::ChaCha20Poly1305;
+        break;
+      default:
+        throw RuntimeError("Unknown cipher algorithm: {}", data[9]);
+    }
+
+    chunk_size_ = read_le32(data + 12);
+    plaintext_size_ = read_le64(data + 16);
+    std::copy_n(data + 24, chunked_iv_size, std::data(base_iv_));
+    if (chunk_size_ == 0 || chunk_size_ > chunked_max_chunk_size) {
+      throw RuntimeError("Invalid chunk size: {}", chunk_size_);
+    }
+    compute_file_size();
+  }
+
+  [[nodiscard]] CipherAlgorithm algorithm() const { return algorithm_; }
+  [[nodiscard]] std::size_t chunk_size() const { return chunk_size_; }
+  [[nodiscard]] std::size_t plaintext_size() const { return plaintext_size_; }
+  [[nodiscard]] std::string_view bytes() const {
+    return {std::data(bytes_), size};
+  }
+
+  // An empty file still has one chunk, whose tag authenticates the header
+  [[nodiscard]] std::size_t chunk_count() const {
+    return std::max<std::size_t>(
+        plaintext_size_ / chunk_size_ + (plaintext_size_ % chunk_size_ != 0),
+        1);
+  }
+
+  [[nodiscard]] std::size_t plaintext_chunk_size(std::size_t index) const {
+    return std::min(chunk_size_, plaintext_size_ - index * chunk_size_);
+  }
+
+  // Can not overflow for index < chunk_count(), as the offset is below
+  // file_size()
+  [[nodiscard]] std::size_t chunk_offset(std::size_t index) const {
+    return size + index * (chunk_size_ + Cipher::tag_size);
+  }
+
+  [[nodiscard]] std::size_t file_size() const { return file_size_; }
+
+  // The chunk index is xored into the last 8 bytes, as the sequence number
+  // of a TLS 1.3 record
+  // https://datatracker.ietf.org/doc/html/rfc8446#section-5.3
+  [[nodiscard]] std::array<std::uint8_t, chunked_iv_size> iv(
+      std::size_t index) const {
+    auto iv = base_iv_;
+    for (std::size_t i = 0; i < 8; ++i) {
+      iv[chunked_iv_size - 1 - i] ^=
+          static_cast<std::uint8_t>(index >> (8 * i));
+    }
+    return iv;
+  }
+
+ private:
+  // Checked, since the sizes of a file being decrypted are read before
+  // anything is authenticated
+  void compute_file_size() {
+    std::size_t tags = 0;
+    if (__builtin_mul_overflow(chunk_count(), Cipher::tag_size, &tags) ||
+        __builtin_add_overflow(plaintext_size_, tags, &file_size_) ||
+        __builtin_add_overflow(file_size_, size, &file_size_) ||
+        file_size_ > static_cast<std::size_t>(
+                         std::numeric_limits<off_t>::max())) {
+      throw RuntimeError("Invalid plaintext size: {}", plaintext_size_);
+    }
+  }
+
+  void encode() {
+    auto data = reinterpret_cast<std::uint8_t *>(std::data(bytes_));
+    std::copy(std::begin(chunked_magic), std::end(chunked_magic),
+              std::data(bytes_));
+    data[8] = chunked_version;
+    data[9] = algorithm_ == CipherAlgorithm::Aes256Gcm ? 1 : 2;
+    for (std::size_t i = 0; i < 4; ++i) {
+      data[12 + i] = static_cast<std::uint8_t>(chunk_size_ >> (8 * i));
+    }
+    for (std::size_t i = 0; i < 8; ++i) {
+      data[16 + i] = static_cast<std::uint8_t>(plaintext_size_ >> (8 * i));
+    }
+    std::copy_n(std::data(base_iv_), chunked_iv_size, data + 24);
+  }
+
+  CipherAlgorithm algorithm_ = CipherAlgorithm::Aes256Gcm;
+  std::size_t chunk_size_ = 0;
+  std::size_t plaintext_size_ = 0;
+  std::size_t file_size_ = 0;
+  std::array<std::uint8_t, chunked_iv_size> base_iv_ = {};
+  std::array<char, size> bytes_ = {};
+};
+
+void pread_exact(const FileDescriptor &fd, char *data, std::size_t size,
+                 std::size_t offset) {
+  while (size > 0) {
+    auto n = ::pread(fd.get(), data, size, static_cast<off_t>(offset));
+    if (n == -1 && errno == EINTR) {
+      continue;
+    }
+    if (n <= 0) {
+      throw RuntimeError("can not read file: {}",
+                         n == 0 ? "unexpected end of file"
+                                : std::strerror(errno));
+    }
+    data += n;
+    size -= static_cast<std::size_t>(n);
+    offset += static_cast<std::size_t>(n);
+  }
+}
+
+void pwrite_exact(const FileDescriptor &fd, const char *data, std::size_t size,
+                  std::size_t offset) {
+  while (size > 0) {
+    auto n = ::pwrite(fd.get(), data, size, static_cast<off_t>(offset));
+    if (n == -1 && errno == EINTR) {
+      continue;
+    }
+    if (n == -1) {
+      throw RuntimeError("can not write file: {}", std::strerror(errno));
+    }
+    data += n;
+    size -= static_cast<std::size_t>(n);
+    offset += static_cast<std::size_t>(n);
+  }
+}
+
+ChunkedHeader read_chunked_header(const FileDescriptor &fd) {
+  std::array<char, ChunkedHeader::size> bytes;
+  if (file_size(fd) < ChunkedHeader::size) {
+    throw RuntimeError("Not a chunked encrypted file");
+  }
+  pread_exact(fd, std::data(bytes), std::size(bytes), 0);
+
+  ChunkedHeader header(bytes);
+  if (file_size(fd) != header.file_size()) {
+    throw RuntimeError("The chunked encrypted file is truncated");
+  }
+  return header;
+}
+
+// The cipher context and buffers that are reused for every chunk. The buffers
+// grow to the largest chunk seen rather than to the chunk size, which is not
+// authenticated until a chunk is opened
+class ChunkWorker {
+ public:
+  ChunkWorker(const ChunkedHeader &header, const std::vector<std::uint8_t> &key,
+              CipherOperation operation)
+      : header_(header),
+        cipher_(header.algorithm(), operation, key, header.iv(0)) {}
+
+  // Start sealing or opening chunk index
+  void begin(std::size_t index) {
+    auto size = header_.plaintext_chunk_size(index) + Cipher::tag_size;
+    if (std::size(input_) < size) {
+      input_.resize(size);
+      output_.resize(size + Cipher::tag_size);
+    }
+
+    cipher_.reset(header_.iv(index));
+    cipher_.update_aad(header_.bytes());
+  }
+
+  [[nodiscard]] Cipher &cipher() { return cipher_; }
+  [[nodiscard]] std::vector<char> &input() { return input_; }
+  [[nodiscard]] std::vector<char> &output() { return output_; }
+
+ private:
+  const ChunkedHeader &header_;
+  Cipher cipher_;
+  std::vector<char> input_;
+  std::vector<char> output_;
+};
+
+// Seal or open the chunks of a file on a pool of threads, each thread has a
+// worker of its own. func(worker, index) processes one chunk
+template <typename Func>
+void for_each_chunk(const ChunkedHeader &header,
+                    const std::vector<std::uint8_t> &key,
+                    CipherOperation operation, std::size_t threads, Func func) {
+  parallel_for(
+      header.chunk_count(), threads,
+      [&] { return ChunkWorker(header, key, operation); },
+      [&](ChunkWorker &worker, std::size_t index) {
+        worker.begin(index);
+        func(worker, index);
+      });
+}
+
+std::size_t open_chunk(ChunkWorker &worker, const FileDescriptor &fd,
+                       const ChunkedHeader &header, std::size_t index) {
+  auto size = header.plaintext_chunk_size(index) + Cipher::tag_size;
+  auto &input = worker.input();
+  auto &output = worker.output();
+  pread_exact(fd, std::data(input), size, header.chunk_offset(index));
+
+  auto length =
+      worker.cipher().update(std::string_view(std::data(input), size), output);
+  return length +
+         worker.cipher().finalize(std::span<char>(output).subspan(length));
+}
+
+}  // namespace
+
+void encrypt_file_chunked(const std::string &in_path,
+                          const std::string &out_path,
+                          const std::vector<std::uint8_t> &key,
+                          CipherAlgorithm algorithm, std::size_t chunk_size,
+                          std::size_t threads) {
+  if (!std::filesystem::is_regular_file(in_path)) {
+    throw RuntimeError("'{}' is not a file", in_path);
+  }
+
+  FileDescriptor in(in_path);
+  ChunkedHeader header(algorithm, chunk_size, file_size(in));
+
+  check_distinct_files(in_path, out_path);
+  FileDescriptor out(out_path, O_WRONLY | O_CREAT | O_TRUNC);
+  try {
+    pwrite_exact(out, std::data(header.bytes()), ChunkedHeader::size, 0);
+
+    for_each_chunk(
+        header, key, CipherOperation::Encrypt, threads,
+        [&](ChunkWorker &worker, std::size_t index) {
+          auto size = header.plaintext_chunk_size(index);
+          auto &input = worker.input();
+          auto &output = worker.output();
+          pread_exact(in, std::data(input), size, index * chunk_size);
+
+          auto length = worker.cipher().update(
+              std::string_view(std::data(input), size), output);
+          length +=
+              worker.cipher().finalize(std::span<char>(output).subspan(length));
+          pwrite_exact(out, std::data(output), length,
+                       header.chunk_offset(index));
+        });
+  } catch (...) {
+    std::filesystem::remove(out_path);
+    throw;
+  }
+}
+
+void decrypt_file_chunked(const std::string &in_path,
+                          const std::string &out_path,
+                          const std::vector<std::uint8_t> &key,
+                          std::size_t threads) {
+  if (!std::filesystem::is_regular_file(in_path)) {
+    throw RuntimeError("'{}' is not a file", in_path);
+  }
+
+  FileDescriptor in(in_path);
+  auto header = read_chunked_header(in);
+
+  check_distinct_files(in_path, out_path);
+  FileDescriptor out(out_path, O_WRONLY | O_CREAT | O_TRUNC);
+  try {
+    for_each_chunk(
+        header, key, CipherOperation::Decrypt, threads,
+        [&](ChunkWorker &worker, std::size_t index) {
+          auto length = open_chunk(worker, in, header, index);
+          pwrite_exact(out, std::data(worker.output()), length,
+                       index * header.chunk_size());
+        });
+  } catch (...) {
+    std::filesystem::remove(out_path);
+    throw;
+  }
+}
+
+std::string decrypt_file_chunked_range(const std::string &path,
+                                       const std::vector<std::uint8_t> &key,
+                                       std::size_t offset, std::size_t size) {
+  if (!std::filesystem::is_regular_file(path)) {
+    throw RuntimeError("'{}' is not a file", path);
+  }
+
+  FileDescriptor fd(path);
+  auto header = read_chunked_header(fd);
+  if (offset >= header.plaintext_size() || size == 0) {
+    return {};
+  }
+  size = std::min(size, header.plaintext_size() - offset);
+
+  ChunkWorker worker(header, key, CipherOperation::Decrypt);
+
+  std::string result;
+  result.reserve(size);
+  auto first = offset / header.chunk_size();
+  auto last = (offset + size - 1) / header.chunk_size();
+  for (auto index = first; index <= last; ++index) {
+    worker.begin(index);
+    auto length = open_chunk(worker, fd, header, index);
+
+    auto begin = index * header.chunk_size();
+    auto from = offset > begin ? offset - begin : 0;
+    auto to = std::min(length, offset + size - begin);
+    result.append(std::data(worker.output()) + from, to - from);
+  }
 
-  result.resize(len + len2);
   return result;
 }
 
@@ -0,0 +1,40 @@
+#include <cstddef>
+#include <cstdint>
+#include <filesystem>
+#include <string>
+
+#include <catch2/catch.hpp>
+
+#include "klib/util.h"
+
+TEST_CASE("blake3", "[util]") {
+  // https://github.com/BLAKE3-team/BLAKE3/blob/master/test_vectors/test_vectors.json
+  auto input = [](std::size_t size) {
+    std::string data;
+    for (std::size_t i = 0; i < size; ++i) {
+      data.push_back(static_cast<char>(i % 251));
+    }
+    return data;
+  };
+
+  REQUIRE(klib::blake3("") ==
+          "af1349b9f5f9a1a6a0404dea36dcc9499bcb25c9adc112b7cc9a93cae41f3262");
+  REQUIRE(klib::blake3("abc") ==
+          "6437b3ac38465133ffb63b75273a8db548c558465d79db03fd359c6cd5bd9d85");
+  REQUIRE(klib::blake3(input(1024)) ==
+          "42214739f095a406f3fc83deb889744ac00df831c10daa55189b5d121c855af7");
+  REQUIRE(klib::blake3(input(102400)) ==
+          "bc3e3d41a1146b069abffad3c0d44860cf664390afce4d9661f7902e7943e085");
+  REQUIRE(std::size(klib::blake3_raw("abc")) == 32);
+
+  // The tree mode gives the same result whatever the number of threads
+  auto data = input(3 * 1024 * 1024 + 1);
+  auto expect = klib::blake3(data);
+  REQUIRE(klib::blake3(data, 4) == expect);
+  REQUIRE(klib::blake3(data, 0) == expect);
+
+  klib::write_file("blake3.bin", true, data);
+  REQUIRE(klib::blake3_file("blake3.bin") == expect);
+  REQUIRE(klib::blake3_file("blake3.bin", 4) == expect);
+  REQUIRE(std::filesystem::remove("blake3.bin"));
+}
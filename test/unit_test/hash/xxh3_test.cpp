@@ -0,0 +1,40 @@
+#include <cstddef>
+#include <cstdint>
+#include <filesystem>
+#include <string>
+#include <vector>
+
+#include <catch2/catch.hpp>
+
+#include "klib/util.h"
+
+TEST_CASE("xxh3", "[util]") {
+  auto input = [](std::size_t size) {
+    std::string data;
+    for (std::size_t i = 0; i < size; ++i) {
+      data.push_back(static_cast<char>(i % 251));
+    }
+    return data;
+  };
+
+  REQUIRE(klib::xxh3_64("") == "2d06800538d394c2");
+  REQUIRE(klib::xxh3_64("abc") == "78af5f94892f3950");
+  REQUIRE(klib::xxh3_64(input(1000)) == "33ef703fb2b20ed1");
+  REQUIRE(klib::xxh3_64(input(102400)) == "1428e17f1cac2837");
+  REQUIRE(klib::xxh3_64_raw("abc") ==
+          std::vector<std::uint8_t>{0x78, 0xaf, 0x5f, 0x94, 0x89, 0x2f, 0x39,
+                                    0x50});
+
+  REQUIRE(klib::xxh3_128("") == "99aa06d3014798d86001c324468d497f");
+  REQUIRE(klib::xxh3_128("abc") == "06b05ab6733a618578af5f94892f3950");
+  REQUIRE(klib::xxh3_128(input(102400)) ==
+          "ecd387d36185351b1428e17f1cac2837");
+  REQUIRE(std::size(klib::xxh3_128_raw("abc")) == 16);
+
+  for (std::size_t size : {0, 100, 240, 241, 1024, 1025, 102400}) {
+    klib::write_file("xxh3.bin", true, input(size));
+    REQUIRE(klib::xxh3_64_file("xxh3.bin") == klib::xxh3_64(input(size)));
+    REQUIRE(klib::xxh3_128_file("xxh3.bin") == klib::xxh3_128(input(size)));
+  }
+  REQUIRE(std::filesystem::remove("xxh3.bin"));
+}
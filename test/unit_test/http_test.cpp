@@ -1,9 +1,23 @@
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
 #include <filesystem>
+#include <memory>
+#include <span>
 #include <string>
+#include <thread>
+#include <vector>
 
+#include <boost/algorithm/string.hpp>
 #include <boost/json.hpp>
 #include <catch2/catch.hpp>
 
+#include "klib/exception.h"
 #include "klib/http.h"
 #include "klib/util.h"
 
@@ -147,3 +161,405 @@ TEST_CASE("POST json", "[http]") {
 
   REQUIRE(jv.at("data").as_string() == boost::json::serialize(obj));
 }
+
+TEST_CASE("POST binary", "[http]") {
+  klib::Request request;
+
+#ifndef NDEBUG
+  request.verbose(true);
+#endif
+
+  using namespace std::string_literals;
+  const auto data = "aaa\0bbb"s;
+  REQUIRE(std::size(data) == 7);
+
+  auto response =
+      request.post(httpbin_url + "/post", std::as_bytes(std::span(data)),
+                   {{"Content-Type", "application/octet-stream"}});
+  REQUIRE(response.status_code() == klib::Response::StatusCode::Ok);
+
+  auto jv = boost::json::parse(response.text());
+  REQUIRE(jv.at("data").as_string() == data);
+}
+
+TEST_CASE("POST callback", "[http]") {
+  klib::Request request;
+
+#ifndef NDEBUG
+  request.verbose(true);
+#endif
+
+  const std::string data(100000, 'a');
+  std::size_t offset = 0;
+  auto callback = [&](char *buffer, std::size_t size) {
+    auto count = std::min(size, std::size(data) - offset);
+    std::copy_n(std::data(data) + offset, count, buffer);
+    offset += count;
+    return count;
+  };
+
+  auto response =
+      request.post(httpbin_url + "/post", callback, std::size(data));
+  REQUIRE(response.status_code() == klib::Response::StatusCode::Ok);
+  REQUIRE(boost::json::parse(response.text()).at("data").as_string() == data);
+
+  offset = 0;
+  response = request.post(httpbin_url + "/post", callback, -1);
+  REQUIRE(response.status_code() == klib::Response::StatusCode::Ok);
+  REQUIRE(boost::json::parse(response.text()).at("data").as_string() == data);
+}
+
+TEST_CASE("PUT", "[http]") {
+  klib::Request request;
+
+#ifndef NDEBUG
+  request.verbose(true);
+#endif
+
+  const std::string file = "put.txt";
+  const std::string content = "put content";
+  klib::write_file(file, false, content);
+
+  auto fd = open(file.c_str(), O_RDONLY);
+  REQUIRE(fd != -1);
+  auto response = request.put(httpbin_url + "/put", fd);
+  close(fd);
+  REQUIRE(response.status_code() == klib::Response::StatusCode::Ok);
+  REQUIRE(boost::json::parse(response.text()).at("data").as_string() ==
+          content);
+
+  response = request.put(httpbin_url + "/put", content);
+  REQUIRE(response.status_code() == klib::Response::StatusCode::Ok);
+  REQUIRE(boost::json::parse(response.text()).at("data").as_string() ==
+          content);
+
+  REQUIRE(std::filesystem::remove(file));
+}
+
+TEST_CASE("PATCH & DELETE", "[http]") {
+  klib::Request request;
+
+#ifndef NDEBUG
+  request.verbose(true);
+#endif
+
+  const std::string data = "patch content";
+  auto response = request.patch(httpbin_url + "/patch", data);
+  REQUIRE(response.status_code() == klib::Response::StatusCode::Ok);
+  REQUIRE(boost::json::parse(response.text()).at("data").as_string() == data);
+
+  const std::string file = "patch.txt";
+  klib::write_file(file, false, data);
+  auto fd = open(file.c_str(), O_RDONLY);
+  REQUIRE(fd != -1);
+  response = request.patch(httpbin_url + "/patch", fd);
+  close(fd);
+  REQUIRE(response.status_code() == klib::Response::StatusCode::Ok);
+  REQUIRE(boost::json::parse(response.text()).at("data").as_string() == data);
+  REQUIRE(std::filesystem::remove(file));
+
+  response = request.del(httpbin_url + "/delete", {{"a", "111"}});
+  REQUIRE(response.status_code() == klib::Response::StatusCode::Ok);
+  REQUIRE(boost::json::parse(response.text()).at("args").at("a").as_string() ==
+          "111");
+
+  response = request.get(httpbin_url + "/get");
+  REQUIRE(response.status_code() == klib::Response::StatusCode::Ok);
+}
+
+TEST_CASE("cookie jar", "[http]") {
+  auto cookie_jar = std::make_shared<klib::CookieJar>();
+
+  klib::Request request;
+  request.set_cookie_jar(cookie_jar);
+
+#ifndef NDEBUG
+  request.verbose(true);
+#endif
+
+  auto response = request.get(httpbin_url + "/cookies/set", {{"a", "111"}});
+  REQUIRE(response.status_code() == klib::Response::StatusCode::Ok);
+  REQUIRE(std::size(cookie_jar->cookies()) == 1);
+
+  klib::Request other;
+  other.set_cookie_jar(cookie_jar);
+  response = other.get(httpbin_url + "/cookies");
+  REQUIRE(response.status_code() == klib::Response::StatusCode::Ok);
+  auto cookies = boost::json::parse(response.text()).at("cookies");
+  REQUIRE(cookies.at("a").as_string() == "111");
+
+  const std::string path = "cookies.txt";
+  REQUIRE_NOTHROW(cookie_jar->save(path));
+  cookie_jar->clear();
+  REQUIRE(std::empty(cookie_jar->cookies()));
+  REQUIRE_NOTHROW(cookie_jar->load(path));
+  REQUIRE(std::size(cookie_jar->cookies()) == 1);
+
+  // A failed save throws and keeps the previous file
+  auto saved = klib::read_file(path, true);
+  REQUIRE(std::filesystem::create_directory(path + ".tmp"));
+  REQUIRE_THROWS_AS(cookie_jar->save(path), klib::RuntimeError);
+  REQUIRE(klib::read_file(path, true) == saved);
+  REQUIRE(std::filesystem::remove(path + ".tmp"));
+
+  // Only the cookies of the file given are added
+  const std::string other_path = "other-cookies.txt";
+  std::string_view content =
+      "# Netscape HTTP Cookie File\n\n"
+      "example.com\tFALSE\t/\tFALSE\t0\tb\t222\n";
+  klib::write_file(other_path, false, content);
+  cookie_jar->clear();
+  REQUIRE_NOTHROW(cookie_jar->load(other_path));
+  auto loaded = cookie_jar->cookies();
+  REQUIRE(std::size(loaded) == 1);
+  REQUIRE(loaded.front().ends_with("\tb\t222"));
+  REQUIRE(std::filesystem::remove(other_path));
+
+  // Catch2 assertions are not thread-safe
+  std::atomic<std::size_t> failures = 0;
+  std::vector<std::thread> threads;
+  for (std::size_t i = 0; i < 4; ++i) {
+    threads.emplace_back([&, i] {
+      auto thread_path = "cookies-" + std::to_string(i) + ".txt";
+      for (std::size_t j = 0; j < 50; ++j) {
+        cookie_jar->save(thread_path);
+        failures += std::size(cookie_jar->cookies()) != 1;
+      }
+      std::filesystem::remove(thread_path);
+    });
+  }
+  for (auto &thread : threads) {
+    thread.join();
+  }
+  REQUIRE(failures == 0);
+  REQUIRE(std::filesystem::remove(path));
+
+  other.use_cookies(false);
+  response = other.get(httpbin_url + "/cookies");
+  REQUIRE(response.status_code() == klib::Response::StatusCode::Ok);
+  cookies = boost::json::parse(response.text()).at("cookies");
+  REQUIRE_FALSE(cookies.as_object().contains("a"));
+}
+
+TEST_CASE("retry", "[http]") {
+  klib::Request request;
+
+#ifndef NDEBUG
+  request.verbose(true);
+#endif
+
+  klib::RetryPolicy policy;
+  policy.max_retries = 2;
+  policy.initial_backoff = std::chrono::milliseconds(10);
+  request.set_retry_policy(policy);
+
+  auto response = request.get(httpbin_url + "/status/503");
+  REQUIRE(static_cast<std::int64_t>(response.status_code()) == 503);
+  auto stats = request.stats();
+  REQUIRE(stats.requests == 1);
+  REQUIRE(stats.retries == 2);
+  REQUIRE(stats.transfers == 3);
+
+  // POST is not idempotent
+  response = request.post(httpbin_url + "/status/503", "data");
+  REQUIRE(static_cast<std::int64_t>(response.status_code()) == 503);
+  REQUIRE(request.stats().retries == 2);
+
+  response = request.get(httpbin_url + "/status/404", {}, {}, true);
+  REQUIRE(response.status_code() == klib::Response::StatusCode::NotFound);
+  REQUIRE(request.stats().retries == 2);
+}
+
+TEST_CASE("hedge", "[http]") {
+  klib::Request request;
+
+#ifndef NDEBUG
+  request.verbose(true);
+#endif
+
+  klib::HedgePolicy policy;
+  policy.max_hedges = 1;
+  policy.delay = std::chrono::milliseconds(200);
+  request.set_hedge_policy(policy);
+
+  auto response = request.get(httpbin_url + "/delay/1");
+  REQUIRE(response.status_code() == klib::Response::StatusCode::Ok);
+  REQUIRE(response.headers_map().contains("Content-Type"));
+
+  auto stats = request.stats();
+  REQUIRE(stats.hedges == 1);
+  REQUIRE(stats.transfers == 2);
+  REQUIRE(stats.latency_p95 > std::chrono::microseconds(0));
+}
+
+TEST_CASE("cache", "[http]") {
+  const std::string directory = "http_cache";
+  auto cache = std::make_shared<klib::HttpCache>(1024 * 1024, directory);
+
+  klib::Request request;
+  request.set_cache(cache);
+
+#ifndef NDEBUG
+  request.verbose(true);
+#endif
+
+  auto response = request.get(httpbin_url + "/cache/60");
+  REQUIRE(response.status_code() == klib::Response::StatusCode::Ok);
+  auto text = response.text();
+
+  response = request.get(httpbin_url + "/cache/60");
+  REQUIRE(response.status_code() == klib::Response::StatusCode::Ok);
+  REQUIRE(response.text() == text);
+  REQUIRE(cache->hits() == 1);
+  REQUIRE(request.stats().requests == 1);
+
+  response = request.get(httpbin_url + "/cache");
+  REQUIRE(response.status_code() == klib::Response::StatusCode::Ok);
+  text = response.text();
+
+  response = request.get(httpbin_url + "/cache");
+  REQUIRE(response.status_code() == klib::Response::StatusCode::Ok);
+  REQUIRE(response.text() == text);
+  REQUIRE(cache->revalidations() == 1);
+  REQUIRE(request.stats().requests == 3);
+
+  auto disk_cache = std::make_shared<klib::HttpCache>(1024 * 1024, directory);
+  klib::Request other;
+  other.set_cache(disk_cache);
+  response = other.get(httpbin_url + "/cache/60");
+  REQUIRE(response.status_code() == klib::Response::StatusCode::Ok);
+  REQUIRE(disk_cache->hits() == 1);
+  REQUIRE(other.stats().requests == 0);
+
+  // A fresh entry is revalidated if the request asks for it
+  response = request.get(httpbin_url + "/cache/60", {},
+                         {{"cache-control", "no-cache"}});
+  REQUIRE(response.status_code() == klib::Response::StatusCode::Ok);
+  REQUIRE(cache->hits() == 1);
+  REQUIRE(request.stats().requests == 4);
+
+  // Stored apart for each value of the request headers listed by Vary
+  const std::unordered_map<std::string, std::string> vary_params = {
+      {"Cache-Control", "max-age=60"}, {"Vary", "Accept"}};
+  for (std::size_t i = 0; i < 2; ++i) {
+    for (const auto *accept : {"text/plain", "application/json"}) {
+      response = request.get(httpbin_url + "/response-headers", vary_params,
+                             {{"Accept", accept}});
+      REQUIRE(response.status_code() == klib::Response::StatusCode::Ok);
+    }
+  }
+  REQUIRE(cache->hits() == 3);
+  REQUIRE(request.stats().requests == 6);
+
+  // Responses to requests with credentials are only stored if public
+  for (const auto *cache_control : {"max-age=60", "public, max-age=60"}) {
+    for (std::size_t i = 0; i < 2; ++i) {
+      response = request.get(httpbin_url + "/response-headers",
+                             {{"Cache-Control", cache_control}},
+                             {{"authorization", "Bearer token"}});
+      REQUIRE(response.status_code() == klib::Response::StatusCode::Ok);
+    }
+  }
+  REQUIRE(cache->hits() == 4);
+  REQUIRE(request.stats().requests == 9);
+
+  // Never stored if no-store is anywhere in the directives
+  cache->clear();
+  for (const auto *cache_control : {"no-cache, no-store", "no-store, no-cache",
+                                    "max-age=bogus, no-store"}) {
+    response = request.get(
+        httpbin_url + "/response-headers",
+        {{"Cache-Control", cache_control}, {"ETag", "\"abc\""}});
+    REQUIRE(response.status_code() == klib::Response::StatusCode::Ok);
+    REQUIRE(cache->memory_size() == 0);
+    REQUIRE(std::filesystem::is_empty(directory));
+  }
+
+  cache->clear();
+  REQUIRE(cache->memory_size() == 0);
+  REQUIRE(std::filesystem::is_empty(directory));
+  REQUIRE(std::filesystem::remove(directory));
+}
+
+TEST_CASE("warm up", "[http]") {
+  klib::Request request;
+  request.set_dns_cache_timeout(-1);
+
+#ifndef NDEBUG
+  request.verbose(true);
+#endif
+
+  auto port = std::stoi(httpbin_url.substr(httpbin_url.rfind(':') + 1));
+  request.add_resolve("httpbin.klib", port, "127.0.0.1");
+  auto url =
+      boost::replace_first_copy(httpbin_url, "localhost", "httpbin.klib");
+
+  REQUIRE(request.warm_up({url + "/get", httpbin_url + "/get"}) == 2);
+  REQUIRE(request.warm_up({url + "/get", "http://localhost:1"}, true) == 1);
+
+  auto response = request.get(url + "/get", {{"a", "111"}});
+  REQUIRE(response.status_code() == klib::Response::StatusCode::Ok);
+  REQUIRE(boost::json::parse(response.text()).at("args").at("a").as_string() ==
+          "111");
+
+  response = request.get(url + "/get", {}, {}, true);
+  REQUIRE(response.status_code() == klib::Response::StatusCode::Ok);
+
+  // The pinned host is in the DNS cache of the shared cookie jar
+  auto cookie_jar = std::make_shared<klib::CookieJar>();
+  request.set_cookie_jar(cookie_jar);
+  request.use_cookies(false);
+  REQUIRE(request.warm_up({url + "/get"}) == 1);
+
+  klib::Request other;
+  other.set_cookie_jar(cookie_jar);
+  response = other.get(url + "/get");
+  REQUIRE(response.status_code() == klib::Response::StatusCode::Ok);
+
+  // Each connection waits for a permit
+  auto rate_limiter = std::make_shared<klib::RateLimiter>(10, 1, 1);
+  request.set_rate_limiter(rate_limiter);
+  auto start = std::chrono::steady_clock::now();
+  REQUIRE(request.warm_up({httpbin_url + "/get", httpbin_url + "/get",
+                           httpbin_url + "/get"},
+                          true) == 3);
+  REQUIRE(std::chrono::steady_clock::now() - start >=
+          std::chrono::milliseconds(150));
+  REQUIRE(rate_limiter->stats().acquired == 3);
+}
+
+TEST_CASE("rate limiter", "[http]") {
+  auto rate_limiter = std::make_shared<klib::RateLimiter>(20, 1, 2);
+  std::atomic<std::int32_t> ok = 0;
+
+  auto start = std::chrono::steady_clock::now();
+  std::vector<std::thread> threads;
+  for (std::int32_t i = 0; i < 4; ++i) {
+    threads.emplace_back([&] {
+      klib::Request request;
+      request.set_rate_limiter(rate_limiter);
+
+      for (std::int32_t j = 0; j < 2; ++j) {
+        auto response = request.get(httpbin_url + "/delay/0.2");
+        if (response.status_code() == klib::Response::StatusCode::Ok) {
+          ++ok;
+        }
+      }
+    });
+  }
+  for (auto &thread : threads) {
+    thread.join();
+  }
+  auto elapsed = std::chrono::steady_clock::now() - start;
+
+  REQUIRE(ok == 8);
+  // At most 2 concurrent transfers of 0.2 seconds
+  REQUIRE(elapsed >= std::chrono::milliseconds(750));
+
+  auto stats = rate_limiter->stats();
+  REQUIRE(stats.acquired == 8);
+  REQUIRE(stats.queue_depth == 0);
+  REQUIRE(stats.max_queue_depth >= 2);
+  REQUIRE(stats.total_wait > std::chrono::microseconds(0));
+  REQUIRE(stats.max_wait <= stats.total_wait);
+}
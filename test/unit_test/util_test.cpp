@@ -1,11 +1,17 @@
+#include <array>
 #include <cstdint>
 #include <filesystem>
+#include <fstream>
+#include <ranges>
+#include <span>
 #include <string>
 #include <string_view>
+#include <utility>
 #include <vector>
 
 #include <catch2/catch.hpp>
 
+#include "klib/exception.h"
 #include "klib/util.h"
 
 TEST_CASE("ChangeWorkingDir", "[util]") {
@@ -37,6 +43,69 @@ TEST_CASE("split_str", "[util]") {
 
   result = klib::split_str("|||123?123|123!", "|?!");
   REQUIRE(result == std_vec);
+
+  result = klib::split_str(" 123 ,\t123\n,, ,123", ",");
+  REQUIRE(result == std_vec);
+  REQUIRE(std::empty(klib::split_str("", ",")));
+}
+
+TEST_CASE("split", "[util]") {
+  static_assert(std::ranges::forward_range<klib::SplitView<>>);
+  static_assert(std::ranges::common_range<klib::SplitView<>>);
+  static_assert(std::ranges::view<klib::SplitView<>>);
+  static_assert(std::ranges::borrowed_range<klib::SplitView<>>);
+
+  auto tokens = [](auto view) {
+    return std::vector<std::string>(std::begin(view), std::end(view));
+  };
+
+  REQUIRE(tokens(klib::split("a,,b,", ",")) ==
+          std::vector<std::string>{"a", "", "b", ""});
+  REQUIRE(tokens(klib::split("", ",")) == std::vector<std::string>{""});
+  REQUIRE(tokens(klib::split("a,b", "")) == std::vector<std::string>{"a,b"});
+  REQUIRE(tokens(klib::split<klib::SplitOptions{.skip_empty = true}>(
+              "", ",")) == std::vector<std::string>{});
+
+  constexpr klib::SplitOptions char_options{
+      .separator = klib::SplitSeparator::Char};
+  REQUIRE(tokens(klib::split<char_options>("a b", " ")) ==
+          std::vector<std::string>{"a", "b"});
+
+  constexpr klib::SplitOptions string_options{
+      .separator = klib::SplitSeparator::String,
+      .trim = true,
+      .skip_empty = true};
+  REQUIRE(tokens(klib::split<string_options>(
+              "HTTP/1.1 200 OK\r\n\r\nA: b \r\nC: d\r\n", "\r\n")) ==
+          std::vector<std::string>{"HTTP/1.1 200 OK", "A: b", "C: d"});
+
+  constexpr klib::SplitOptions trim_options{.trim = true};
+  REQUIRE(tokens(klib::split<trim_options>(" a ;\tb\n; ", ";")) ==
+          std::vector<std::string>{"a", "b", ""});
+
+  // Long enough for the SIMD search, with separators outside ASCII too
+  std::string str;
+  std::vector<std::string> expected;
+  for (std::size_t i = 0; i < 50; ++i) {
+    expected.push_back(std::string(i, 'x') + "水");
+    str += expected.back();
+    str += i % 3 == 0 ? "|" : (i % 3 == 1 ? "?" : "!");
+  }
+  expected.emplace_back();
+  REQUIRE(tokens(klib::split(str, "|?!")) == expected);
+  REQUIRE(tokens(klib::split(str, "|?!\xFF")) == expected);
+
+  auto view = klib::split(str, "|?!");
+  REQUIRE(std::ranges::distance(view) == 51);
+  REQUIRE(view.front() == "水");
+
+  // The iterators outlive the view they come from
+  auto iter = klib::split(str, "|?!").begin();
+  REQUIRE(*++iter == "x水");
+  auto found = std::ranges::find(klib::split<string_options>("a, b, c", ", "),
+                                 "b");
+  REQUIRE(*found == "b");
+  REQUIRE(*++found == "c");
 }
 
 TEST_CASE("read_file & write_file", "[util]") {
@@ -49,8 +118,45 @@ TEST_CASE("read_file & write_file", "[util]") {
 
   REQUIRE(std::filesystem::exists("write-file.zip"));
   REQUIRE(std::filesystem::file_size("write-file.zip") == 644596);
+  REQUIRE(klib::read_file("write-file.zip", true) == data);
 
   REQUIRE(std::filesystem::remove("write-file.zip"));
+
+  // Files in /proc report no size
+  REQUIRE(klib::read_file("/proc/self/status", false).starts_with("Name:"));
+
+  klib::write_file("write-file.txt", false, std::string());
+  REQUIRE(std::empty(klib::read_file("write-file.txt", false)));
+  REQUIRE(std::filesystem::remove("write-file.txt"));
+  REQUIRE_THROWS_AS(klib::read_file("folder1", true), klib::RuntimeError);
+}
+
+TEST_CASE("MappedFile", "[util]") {
+  const std::string data = klib::read_file("zlib-v1.2.11.tar.gz", true);
+
+  klib::MappedFile file("zlib-v1.2.11.tar.gz");
+  REQUIRE(file.size() == std::size(data));
+  REQUIRE(file.view() == data);
+  REQUIRE(std::size(file.bytes()) == std::size(data));
+  REQUIRE(static_cast<char>(file.bytes()[100]) == data[100]);
+
+  auto moved = std::move(file);
+  REQUIRE(moved.view() == data);
+
+  klib::write_file("mapped-file-empty.txt", true, std::string());
+  klib::MappedFile empty("mapped-file-empty.txt",
+                         klib::MappedFileAdvice::Random);
+  REQUIRE(empty.size() == 0);
+  REQUIRE(std::empty(empty.view()));
+  REQUIRE(std::filesystem::remove("mapped-file-empty.txt"));
+
+  // Reports a size of 0, so it is read instead
+  klib::MappedFile status("/proc/self/status");
+  REQUIRE(status.view().starts_with("Name:"));
+
+  REQUIRE_THROWS_AS(klib::MappedFile("."), klib::RuntimeError);
+  REQUIRE_THROWS_AS(klib::MappedFile("mapped-file-missing"),
+                    klib::RuntimeError);
 }
 
 TEST_CASE("read_file_line", "[util]") {
@@ -64,9 +170,45 @@ ccc
   REQUIRE(klib::read_file_line("write-file.txt") ==
           std::vector<std::string>{"aaa", "bbb", "ccc", "dd"});
 
+  content = "\r\n  aa a \r\n\n\t\nb\n";
+  REQUIRE_NOTHROW(klib::write_file("write-file.txt", true, content));
+  REQUIRE(klib::read_file_line("write-file.txt") ==
+          std::vector<std::string>{"aa a", "b"});
+
   REQUIRE(std::filesystem::remove("write-file.txt"));
 }
 
+TEST_CASE("FileLines", "[util]") {
+  static_assert(std::ranges::input_range<klib::FileLines>);
+
+  std::string_view content = "aaa\n\n b \r\nccc";
+  REQUIRE_NOTHROW(klib::write_file("file-lines.txt", true, content));
+  std::vector<std::string> lines;
+  for (auto line : klib::FileLines("file-lines.txt")) {
+    lines.emplace_back(line);
+  }
+  REQUIRE(lines == std::vector<std::string>{"aaa", "", " b \r", "ccc"});
+
+  content = "\n\n";
+  REQUIRE_NOTHROW(klib::write_file("file-lines.txt", true, content));
+  lines.clear();
+  for (auto line : klib::FileLines("file-lines.txt")) {
+    lines.emplace_back(line);
+  }
+  REQUIRE(lines == std::vector<std::string>{"", ""});
+
+  REQUIRE_NOTHROW(klib::write_file("file-lines.txt", true, std::string()));
+  klib::FileLines empty("file-lines.txt");
+  REQUIRE(empty.begin() == empty.end());
+  REQUIRE(std::filesystem::remove("file-lines.txt"));
+
+  // Reports a size of 0, so it is read instead
+  klib::FileLines status("/proc/self/status");
+  REQUIRE((*status.begin()).starts_with("Name:"));
+
+  REQUIRE_THROWS_AS(klib::FileLines("file-lines-missing"), klib::RuntimeError);
+}
+
 TEST_CASE("utf8_to_utf16", "[util]") {
   auto utf16 = klib::utf8_to_utf16("zß水🍌");
 
@@ -88,6 +230,57 @@ TEST_CASE("utf8_to_utf32", "[util]") {
   REQUIRE(utf32[3] == 0x0001F34C);
 }
 
+TEST_CASE("is_valid_utf8", "[util]") {
+  REQUIRE(klib::is_valid_utf8(""));
+  REQUIRE(klib::is_valid_utf8("zß水🍌"));
+  REQUIRE(klib::is_valid_utf8("\xF4\x8F\xBF\xBF"));
+
+  // Overlong, surrogate, too large, truncated and stray continuation
+  for (const auto &str : {"\xC0\x80", "\xE0\x9F\xBF", "\xED\xA0\x80",
+                          "\xF4\x90\x80\x80", "\xF5\x80\x80\x80", "\xE6\xB0",
+                          "\x80", "\xFF"}) {
+    REQUIRE_FALSE(klib::is_valid_utf8(str));
+    REQUIRE_THROWS_AS(klib::utf8_to_utf32(str), klib::RuntimeError);
+  }
+
+  // Long enough for the SIMD code, with errors at every position
+  std::string text;
+  for (std::size_t i = 0; i < 20; ++i) {
+    text += "abc水。ß🍌 ";
+  }
+  REQUIRE(klib::is_valid_utf8(text));
+  for (std::size_t i = 0; i < std::size(text); ++i) {
+    auto invalid = text;
+    invalid[i] = '\xFF';
+    REQUIRE_FALSE(klib::is_valid_utf8(invalid));
+  }
+  REQUIRE_FALSE(klib::is_valid_utf8(text.substr(0, std::size(text) - 2)));
+}
+
+TEST_CASE("utf8 transcoding into a caller buffer", "[util]") {
+  std::string text;
+  std::u32string expect;
+  for (std::size_t i = 0; i < 50; ++i) {
+    text += "水。水。水。水。水。水。水。水。 a🍌";
+    expect += U"水。水。水。水。水。水。水。水。 a🍌";
+  }
+
+  REQUIRE(klib::utf8_to_utf32_size(text) == std::size(expect));
+  REQUIRE(klib::utf8_to_utf16_size(text) == std::size(expect) + 50);
+
+  std::u32string utf32(std::size(expect), U'\0');
+  REQUIRE(klib::utf8_to_utf32(text, utf32) == std::size(expect));
+  REQUIRE(utf32 == expect);
+  REQUIRE(klib::utf8_to_utf32(text) == expect);
+
+  std::u16string utf16(klib::utf8_to_utf16_size(text), u'\0');
+  REQUIRE(klib::utf8_to_utf16(text, utf16) == std::size(utf16));
+  REQUIRE(utf16.substr(0, 20) == u"水。水。水。水。水。水。水。水。 a🍌");
+
+  std::u32string small(10, U'\0');
+  REQUIRE_THROWS_AS(klib::utf8_to_utf32(text, small), klib::RuntimeError);
+}
+
 TEST_CASE("utf32_to_utf8", "[util]") {
   auto utf32 = klib::utf8_to_utf32("书客");
   auto utf8 = klib::utf32_to_utf8(utf32);
@@ -101,6 +294,53 @@ TEST_CASE("utf32_to_utf8", "[util]") {
   REQUIRE(static_cast<std::uint8_t>(utf8[5]) == 0xA2);
 }
 
+TEST_CASE("utf16_to_utf8 & utf32_to_utf8 bulk", "[util]") {
+  REQUIRE(klib::utf32_to_utf8(U'🍌') == "🍌");
+  REQUIRE(klib::utf32_to_utf8(U"") == "");
+
+  std::string expect;
+  std::u16string utf16;
+  std::u32string utf32;
+  for (std::size_t i = 0; i < 50; ++i) {
+    expect += "abcdefgh水。水。水。水。ßéßéßéßé a🍌";
+    utf16 += u"abcdefgh水。水。水。水。ßéßéßéßé a🍌";
+    utf32 += U"abcdefgh水。水。水。水。ßéßéßéßé a🍌";
+  }
+
+  REQUIRE(klib::utf16_to_utf8_size(utf16) == std::size(expect));
+  REQUIRE(klib::utf32_to_utf8_size(utf32) == std::size(expect));
+  REQUIRE(klib::utf16_to_utf8(utf16) == expect);
+  REQUIRE(klib::utf32_to_utf8(utf32) == expect);
+
+  std::string output(std::size(expect), '\0');
+  REQUIRE(klib::utf16_to_utf8(utf16, output) == std::size(expect));
+  REQUIRE(output == expect);
+  std::fill(std::begin(output), std::end(output), '\0');
+  REQUIRE(klib::utf32_to_utf8(utf32, output) == std::size(expect));
+  REQUIRE(output == expect);
+
+  std::string small(10, '\0');
+  REQUIRE_THROWS_AS(klib::utf32_to_utf8(utf32, small), klib::RuntimeError);
+
+  // Surrogates and code points above U+10FFFF
+  for (auto c : {U'\xD800', U'\xDFFF', U'\x110000'}) {
+    auto invalid = utf32;
+    invalid[100] = c;
+    REQUIRE_THROWS_AS(klib::utf32_to_utf8(invalid), klib::RuntimeError);
+  }
+
+  // Unpaired surrogates
+  for (auto i : {std::size_t{0}, std::size_t{40}, std::size(utf16) - 1}) {
+    auto invalid = utf16;
+    invalid[i] = u'\xD800';
+    REQUIRE_THROWS_AS(klib::utf16_to_utf8(invalid), klib::RuntimeError);
+    if (i != std::size(utf16) - 1) {
+      invalid[i] = u'\xDC00';
+      REQUIRE_THROWS_AS(klib::utf16_to_utf8(invalid), klib::RuntimeError);
+    }
+  }
+}
+
 TEST_CASE("is_ascii", "[util]") {
   REQUIRE(klib::is_ascii('A'));
   REQUIRE_FALSE(klib::is_ascii(static_cast<char>(190)));
@@ -110,12 +350,105 @@ TEST_CASE("is_ascii", "[util]") {
 
   REQUIRE(klib::is_ascii(klib::utf8_to_utf32("AAA")));
   REQUIRE_FALSE(klib::is_ascii(klib::utf8_to_utf32("你")));
+
+  std::string str(1000, 'a');
+  REQUIRE(klib::is_ascii(str));
+  REQUIRE(klib::is_ascii(klib::utf8_to_utf32(str)));
+  for (auto i : {std::size_t{0}, std::size_t{500}, std::size_t{999}}) {
+    auto copy = str;
+    copy[i] = static_cast<char>(0x80);
+    REQUIRE_FALSE(klib::is_ascii(copy));
+    auto utf32 = klib::utf8_to_utf32(str);
+    utf32[i] = U'\x80';
+    REQUIRE_FALSE(klib::is_ascii(utf32));
+  }
 }
 
 TEST_CASE("is_chinese", "[util]") {
   REQUIRE(klib::is_chinese("你"));
   REQUIRE_FALSE(klib::is_chinese("a"));
   REQUIRE_FALSE(klib::is_chinese("🍌"));
+  REQUIRE(klib::is_chinese("𠀀"));
+  REQUIRE_THROWS_AS(klib::is_chinese("你好"), klib::RuntimeError);
+}
+
+TEST_CASE("script_of", "[util]") {
+  REQUIRE(klib::script_of(U'a') == klib::Script::Latin);
+  REQUIRE(klib::is_script<klib::Script::Han>(U'水'));
+  REQUIRE(klib::script_of(U'0') == klib::Script::Common);
+  REQUIRE(klib::script_of(U'Z') == klib::Script::Latin);
+  REQUIRE(klib::script_of(U'α') == klib::Script::Greek);
+  REQUIRE(klib::script_of(U'ж') == klib::Script::Cyrillic);
+  REQUIRE(klib::script_of(U'א') == klib::Script::Hebrew);
+  REQUIRE(klib::script_of(U'ب') == klib::Script::Arabic);
+  REQUIRE(klib::script_of(U'क') == klib::Script::Devanagari);
+  REQUIRE(klib::script_of(U'ก') == klib::Script::Thai);
+  REQUIRE(klib::script_of(U'한') == klib::Script::Hangul);
+  REQUIRE(klib::script_of(U'ㄱ') == klib::Script::Hangul);
+  REQUIRE(klib::script_of(U'の') == klib::Script::Hiragana);
+  REQUIRE(klib::script_of(U'カ') == klib::Script::Katakana);
+  REQUIRE(klib::script_of(U'ㄅ') == klib::Script::Bopomofo);
+  REQUIRE(klib::script_of(U'〇') == klib::Script::Han);
+  REQUIRE(klib::script_of(U'𠀀') == klib::Script::Han);
+  REQUIRE(klib::script_of(U'。') == klib::Script::Common);
+  REQUIRE(klib::script_of(U'\u0301') == klib::Script::Inherited);
+  REQUIRE(klib::script_of(U'🍌') == klib::Script::Common);
+  // Runic, unassigned and not a code point
+  REQUIRE(klib::script_of(U'ᚠ') == klib::Script::Unknown);
+  REQUIRE(klib::script_of(U'\U0010FFFF') == klib::Script::Unknown);
+  REQUIRE(klib::script_of(static_cast<char32_t>(0x110000)) ==
+          klib::Script::Unknown);
+
+  using klib::Script;
+  REQUIRE(klib::is_script<Script::Han, Script::Hiragana, Script::Katakana>(
+      U'の'));
+  REQUIRE_FALSE(
+      klib::is_script<Script::Han, Script::Hiragana, Script::Katakana>(U'a'));
+  REQUIRE_FALSE(klib::is_script<>(U'a'));
+
+  std::size_t count = 0;
+  for (char32_t c = 0x4E00; c <= 0x9FFF; ++c) {
+    count += klib::is_script<Script::Han>(c);
+  }
+  REQUIRE(count == 0x9FFF - 0x4E00 + 1);
+}
+
+TEST_CASE("count_chinese & chinese_spans", "[util]") {
+  REQUIRE(klib::count_chinese("") == 0);
+  REQUIRE(klib::find_chinese("abc") == std::string_view::npos);
+  REQUIRE(klib::chinese_spans("").empty());
+
+  // Around the edges of the blocks, U+4DC0 is a Yijing hexagram
+  REQUIRE(klib::count_chinese("㐀䶿䷀一鿿ꀀ豈﫿𠀀𯨟a") == 8);
+
+  std::string str;
+  for (std::size_t i = 0; i < 20; ++i) {
+    str += "Hello, 你好世界𠀀！abcdefghijklmnopqrstuvwxyz";
+  }
+  REQUIRE(klib::count_chinese(str) == 20 * 5);
+  REQUIRE(klib::find_chinese(str) == 7);
+  REQUIRE(klib::find_chinese(str, 8) == 10);
+  REQUIRE(klib::find_chinese(str, std::size(str)) == std::string_view::npos);
+
+  auto spans = klib::chinese_spans(str);
+  REQUIRE(std::size(spans) == 41);
+  REQUIRE(spans[0].text == "Hello, ");
+  REQUIRE_FALSE(spans[0].chinese);
+  REQUIRE(spans[1].text == "你好世界𠀀");
+  REQUIRE(spans[1].chinese);
+  REQUIRE(spans[2].text == "！abcdefghijklmnopqrstuvwxyzHello, ");
+  REQUIRE_FALSE(spans[2].chinese);
+  REQUIRE(spans.back().text == "！abcdefghijklmnopqrstuvwxyz");
+
+  std::string long_run;
+  for (std::size_t i = 0; i < 100; ++i) {
+    long_run += "你好";
+  }
+  const std::string text = long_run + "a";
+  spans = klib::chinese_spans(text);
+  REQUIRE(std::size(spans) == 2);
+  REQUIRE(spans[0].text == long_run);
+  REQUIRE(spans[1].text == "a");
 }
 
 TEST_CASE("base64_encode", "[util]") {
@@ -135,6 +468,160 @@ TEST_CASE("base64_decode", "[util]") {
         "How to resolve the \"EVP_DecryptFInal_ex: bad decrypt\"");
 }
 
+TEST_CASE("base64 alphabets", "[util]") {
+  // https://datatracker.ietf.org/doc/html/rfc4648#section-10
+  CHECK(klib::base64_encode("") == "");
+  CHECK(klib::base64_encode("f") == "Zg==");
+  CHECK(klib::base64_encode("fo") == "Zm8=");
+  CHECK(klib::base64_encode("foo") == "Zm9v");
+  CHECK(klib::base64_encode("foob") == "Zm9vYg==");
+  CHECK(klib::base64_encode("fooba") == "Zm9vYmE=");
+  CHECK(klib::base64_encode("foobar") == "Zm9vYmFy");
+
+  const std::string bytes = "\xfb\xff\xbf";
+  CHECK(klib::base64_encode(bytes) == "+/+/");
+  CHECK(klib::base64_encode(bytes, klib::Base64Alphabet::UrlSafe) == "-_-_");
+  CHECK(klib::base64_encode("fo", klib::Base64Alphabet::UrlSafe) == "Zm8");
+  CHECK(klib::base64_decode("Zm8") == "fo");
+  CHECK(klib::base64_decode("Zm8=", klib::Base64Alphabet::UrlSafe) == "fo");
+  CHECK(klib::base64_decode("-_-_", klib::Base64Alphabet::UrlSafe) == bytes);
+
+  CHECK(klib::base64_decode("Zm9v\nYmFy\r\n") == "foobar");
+  CHECK(klib::base64_decode(" Zm 9v Yg = = ") == "foob");
+  CHECK_THROWS_AS(klib::base64_decode("-_-_"), klib::RuntimeError);
+  CHECK_THROWS_AS(klib::base64_decode("+/+/", klib::Base64Alphabet::UrlSafe),
+                  klib::RuntimeError);
+  CHECK_THROWS_AS(klib::base64_decode("Zm9vY"), klib::RuntimeError);
+  CHECK_THROWS_AS(klib::base64_decode("Zm8=Zm8="), klib::RuntimeError);
+  CHECK_THROWS_AS(klib::base64_decode("Zm9v="), klib::RuntimeError);
+
+  std::array<char, 3> small;
+  CHECK_THROWS_AS(klib::base64_encode("foo", small), klib::RuntimeError);
+}
+
+TEST_CASE("base64 large & streaming", "[util]") {
+  std::string data;
+  for (std::size_t i = 0; i < 1000; ++i) {
+    data.push_back(static_cast<char>(i * 31 + i / 256));
+  }
+
+  for (auto alphabet :
+       {klib::Base64Alphabet::Standard, klib::Base64Alphabet::UrlSafe}) {
+    for (std::size_t size = 0; size <= std::size(data); size += 7) {
+      auto input = data.substr(0, size);
+      auto encoded = klib::base64_encode(input, alphabet);
+      REQUIRE(std::size(encoded) ==
+              klib::base64_encoded_size(size, alphabet));
+      REQUIRE(klib::base64_decode(encoded, alphabet) == input);
+    }
+
+    auto expect = klib::base64_encode(data, alphabet);
+
+    // Small chunks are handled byte by byte, large ones with SIMD
+    for (std::size_t chunk : {1, 2, 5, 64, 1000}) {
+      klib::Base64Encoder encoder(alphabet);
+      std::string encoded(klib::base64_encoded_size(std::size(data)) + 4, '\0');
+      std::size_t size = 0;
+      for (std::size_t i = 0; i < std::size(data); i += chunk) {
+        size += encoder.update(std::string_view(data).substr(i, chunk),
+                               std::span<char>(encoded).subspan(size));
+      }
+      size += encoder.finalize(std::span<char>(encoded).subspan(size));
+      encoded.resize(size);
+      REQUIRE(encoded == expect);
+
+      klib::Base64Decoder decoder(alphabet);
+      std::string decoded(klib::base64_decoded_size(std::size(encoded)),
+                          '\0');
+      size = 0;
+      for (std::size_t i = 0; i < std::size(encoded); i += chunk) {
+        size += decoder.update(std::string_view(encoded).substr(i, chunk),
+                               std::span<char>(decoded).subspan(size));
+      }
+      size += decoder.finalize(std::span<char>(decoded).subspan(size));
+      decoded.resize(size);
+      REQUIRE(decoded == data);
+
+      // Each chunk gets an output of just the documented size
+      decoder = klib::Base64Decoder(alphabet);
+      decoded.clear();
+      for (std::size_t i = 0; i < std::size(encoded); i += chunk) {
+        auto str = std::string_view(encoded).substr(i, chunk);
+        std::vector<char> output(
+            klib::base64_decoded_size(std::size(str) + (i == 0 ? 0 : 3)));
+        size = decoder.update(str, output);
+        decoded.append(std::data(output), size);
+      }
+      std::vector<char> output(2);
+      decoded.append(std::data(output), decoder.finalize(output));
+      REQUIRE(decoded == data);
+    }
+  }
+
+  // The padding completes the group started by the previous call
+  klib::Base64Decoder decoder;
+  std::vector<char> output(klib::base64_decoded_size(3));
+  REQUIRE(decoder.update("AAA", output) == 0);
+  output.resize(klib::base64_decoded_size(20));
+  REQUIRE_THROWS_AS(decoder.update("AXK1fivShAJdOZ2TWAQ=", output),
+                    klib::RuntimeError);
+  output.resize(klib::base64_decoded_size(20 + 3));
+  REQUIRE(decoder.update("AXK1fivShAJdOZ2TWAQ=", output) == 16);
+  REQUIRE(decoder.finalize(output) == 0);
+  REQUIRE(std::string_view(std::data(output), 16) ==
+          klib::base64_decode("AAAAXK1fivShAJdOZ2TWAQ=="));
+
+  auto encoded = klib::base64_encode(data);
+  for (std::size_t i = 0; i < std::size(encoded); i += 97) {
+    auto invalid = encoded;
+    invalid[i] = '*';
+    REQUIRE_THROWS_AS(klib::base64_decode(invalid), klib::RuntimeError);
+  }
+}
+
+TEST_CASE("hex_encode & hex_decode", "[util]") {
+  std::vector<std::uint8_t> bytes;
+  for (std::size_t i = 0; i < 256 * 3; ++i) {
+    bytes.push_back(static_cast<std::uint8_t>(i * 7));
+  }
+
+  std::string expect;
+  for (auto byte : bytes) {
+    expect.push_back("0123456789abcdef"[byte >> 4]);
+    expect.push_back("0123456789abcdef"[byte & 0xF]);
+  }
+
+  // Every size, so the SIMD blocks and the scalar tail are both covered
+  for (std::size_t size = 0; size <= 100; ++size) {
+    auto data = std::span(bytes).first(size);
+    REQUIRE(klib::hex_encode(data) == expect.substr(0, 2 * size));
+    REQUIRE(klib::hex_decode(expect.substr(0, 2 * size)) ==
+            std::vector<std::uint8_t>(std::begin(data), std::end(data)));
+  }
+  REQUIRE(klib::hex_encode(bytes) == expect);
+  REQUIRE(klib::hex_decode(expect) == bytes);
+  REQUIRE(klib::hex_decode("00FFaBcD") ==
+          std::vector<std::uint8_t>{0x00, 0xFF, 0xAB, 0xCD});
+
+  std::array<std::uint8_t, 4> digest = {0xDE, 0xAD, 0xBE, 0xEF};
+  auto hex = klib::hex_encode(digest);
+  REQUIRE(std::string_view(std::data(hex), std::size(hex)) == "deadbeef");
+
+  std::array<std::uint8_t, 2> output;
+  REQUIRE(klib::hex_decode("1234", output) == 2);
+  REQUIRE(output == std::array<std::uint8_t, 2>{0x12, 0x34});
+  REQUIRE_THROWS_AS(klib::hex_decode("123456", output), klib::RuntimeError);
+
+  REQUIRE_THROWS_AS(klib::hex_decode("123"), klib::RuntimeError);
+  for (auto position : {0, 31, 32, 63, 100}) {
+    for (auto c : {'g', 'G', '/', ':', '@', '`', ' '}) {
+      auto invalid = expect.substr(0, 128);
+      invalid[position] = c;
+      REQUIRE_THROWS_AS(klib::hex_decode(invalid), klib::RuntimeError);
+    }
+  }
+}
+
 TEST_CASE("md5", "[util]") {
   REQUIRE(klib::md5("MD5 online hash function") ==
           "71f6cb39c6d09c6fae36b69ee0b2b9cd");
@@ -147,6 +634,12 @@ TEST_CASE("sha_256_file", "[util]") {
 
   REQUIRE(klib::sha_256_file("zlib-v1.2.11.tar.gz") ==
           "143df9ab483578ce7a1019b96aaa10f6e1ebc64b1a3d97fa14f4b4e4e7ec95e7");
+
+  // The size is reported as 0, so the file is read instead of mapped
+  std::ifstream ifs("/proc/version");
+  std::string version;
+  REQUIRE(std::getline(ifs, version));
+  REQUIRE(klib::sha_256_file("/proc/version") == klib::sha_256(version + "\n"));
 }
 
 TEST_CASE("sha3_512_file", "[util]") {
@@ -157,6 +650,109 @@ TEST_CASE("sha3_512_file", "[util]") {
           "2a2b8784f20bb2307211a2a776241797857b133056f4b33de1d363db7bb2");
 }
 
+TEST_CASE("sha_256_batch", "[util]") {
+  // Cover the padding of one and two blocks, and inputs of different lengths
+  // hashed side by side
+  std::vector<std::string> data;
+  for (std::size_t size = 0; size <= 200; ++size) {
+    data.emplace_back(size, static_cast<char>('a' + size % 26));
+  }
+  data.emplace_back(100000, 'x');
+
+  std::vector<std::string_view> inputs(std::begin(data), std::end(data));
+  std::vector<klib::Sha256Hasher::Digest> digests(std::size(inputs));
+  klib::sha_256_batch(inputs, digests);
+
+  for (std::size_t i = 0; i < std::size(data); ++i) {
+    REQUIRE(std::vector<std::uint8_t>(std::begin(digests[i]),
+                                      std::end(digests[i])) ==
+            klib::sha_256_raw(data[i]));
+  }
+
+  REQUIRE_THROWS_AS(
+      klib::sha_256_batch(inputs, std::span(digests).first(1)),
+      klib::RuntimeError);
+}
+
+TEST_CASE("Hasher", "[util]") {
+  auto to_vector = [](const auto &digest) {
+    return std::vector<std::uint8_t>(std::begin(digest), std::end(digest));
+  };
+
+  const std::string data = "MD5 online hash function";
+
+  klib::Md5Hasher md5;
+  md5.update(data.substr(0, 5)).update(data.substr(5));
+  REQUIRE(to_vector(md5.finalize()) == klib::md5_raw(data));
+
+  // Reset after finalize
+  md5.update(std::as_bytes(std::span(data)));
+  REQUIRE(to_vector(md5.finalize()) == klib::md5_raw(data));
+
+  klib::Sha256Hasher sha_256;
+  sha_256.update("discarded");
+  sha_256.reset();
+  for (auto c : data) {
+    sha_256.update(std::string_view(&c, 1));
+  }
+  REQUIRE(to_vector(sha_256.finalize()) == klib::sha_256_raw(data));
+  REQUIRE(to_vector(sha_256.finalize()) == klib::sha_256_raw(""));
+
+  klib::Sha3_512Hasher sha3_512;
+  auto moved = std::move(sha3_512);
+  moved.update(data);
+  REQUIRE(std::size(moved.finalize()) == 64);
+  REQUIRE(to_vector(moved.update(data).finalize()) ==
+          klib::sha3_512_raw(data));
+}
+
+TEST_CASE("hash_tree", "[util]") {
+  REQUIRE(std::filesystem::exists("folder1"));
+  REQUIRE(std::filesystem::exists("folder2"));
+
+  auto tree = klib::hash_tree("folder1", klib::HashAlgorithm::Sha256, 4);
+  REQUIRE(std::size(tree.files) == 3);
+  REQUIRE(std::size(tree.directories) == 3);
+  REQUIRE(tree.files.at("a/b/a.txt") ==
+          klib::sha_256_file("folder1/a/b/a.txt"));
+  REQUIRE(tree.root == tree.directories.at(""));
+
+  REQUIRE(klib::hash_tree("folder2", klib::HashAlgorithm::Sha256, 1).root ==
+          tree.root);
+  REQUIRE(klib::hash_tree("folder1", klib::HashAlgorithm::Md5).root !=
+          tree.root);
+
+  std::filesystem::copy("folder1", "hash-tree",
+                        std::filesystem::copy_options::recursive);
+  klib::write_file("hash-tree/a/b/a.txt", true, std::string("changed"));
+  auto changed = klib::hash_tree("hash-tree", klib::HashAlgorithm::Sha256);
+  REQUIRE(std::filesystem::remove_all("hash-tree") != 0);
+
+  REQUIRE(changed.root != tree.root);
+  REQUIRE(changed.directories.at("a/b") != tree.directories.at("a/b"));
+  REQUIRE(changed.files.at("a/a.txt") == tree.files.at("a/a.txt"));
+  REQUIRE(changed.files.at("b.txt") == tree.files.at("b.txt"));
+
+  // Links are hashed by their target, not followed
+  std::filesystem::copy("folder1", "hash-tree",
+                        std::filesystem::copy_options::recursive);
+  std::filesystem::create_directory_symlink("a", "hash-tree/link-a");
+  std::filesystem::create_symlink("b.txt", "hash-tree/link-b.txt");
+  auto linked = klib::hash_tree("hash-tree", klib::HashAlgorithm::Sha256);
+  std::filesystem::remove("hash-tree/link-a");
+  std::filesystem::create_directory_symlink("a/b", "hash-tree/link-a");
+  auto relinked = klib::hash_tree("hash-tree", klib::HashAlgorithm::Sha256);
+  REQUIRE(std::filesystem::remove_all("hash-tree") != 0);
+
+  REQUIRE(linked.files == tree.files);
+  REQUIRE(std::size(linked.directories) == 3);
+  REQUIRE(linked.links.at("link-a") == klib::sha_256("a"));
+  REQUIRE(linked.links.at("link-b.txt") == klib::sha_256("b.txt"));
+  REQUIRE(linked.root != tree.root);
+  REQUIRE(relinked.root != linked.root);
+  REQUIRE(relinked.directories.at("a") == linked.directories.at("a"));
+}
+
 TEST_CASE("aes_256_cbc_encrypt", "[util]") {
   std::vector<std::uint8_t> iv;
   iv.resize(16, 0);
@@ -735,6 +1331,376 @@ TEST_CASE("aes_256_cbc_decrypt", "[util]") {
       base64, klib::sha_256_raw("913d8e1ebca5ef2193b4fea1fdbe0394"), iv));
 }
 
+TEST_CASE("Cipher", "[util]") {
+  auto key = klib::sha_256_raw("key");
+  std::vector<std::uint8_t> iv(16, 1);
+
+  std::string plaintext;
+  for (std::size_t i = 0; i < 100000; ++i) {
+    plaintext.push_back(static_cast<char>(i * 13));
+  }
+  auto expect = klib::aes_256_cbc_encrypt(plaintext, key, iv);
+  REQUIRE(std::size(expect) == 100000 / 16 * 16 + 16);
+
+  klib::Cipher encryptor(klib::CipherAlgorithm::Aes256Cbc,
+                         klib::CipherOperation::Encrypt, key, iv);
+  klib::Cipher decryptor(klib::CipherAlgorithm::Aes256Cbc,
+                         klib::CipherOperation::Decrypt, key, iv);
+
+  // The context is reused for the next message
+  for (std::size_t chunk : {1, 15, 16, 4096, 100000}) {
+    std::string ciphertext(std::size(plaintext) + 2 * 16, '\0');
+    std::size_t size = 0;
+    for (std::size_t i = 0; i < std::size(plaintext); i += chunk) {
+      size += encryptor.update(std::string_view(plaintext).substr(i, chunk),
+                               std::span<char>(ciphertext).subspan(size));
+    }
+    size += encryptor.finalize(std::span<char>(ciphertext).subspan(size));
+    ciphertext.resize(size);
+    REQUIRE(ciphertext == expect);
+
+    std::string decrypted(std::size(ciphertext) + 2 * 16, '\0');
+    size = 0;
+    for (std::size_t i = 0; i < std::size(ciphertext); i += chunk) {
+      size += decryptor.update(std::string_view(ciphertext).substr(i, chunk),
+                               std::span<char>(decrypted).subspan(size));
+    }
+    size += decryptor.finalize(std::span<char>(decrypted).subspan(size));
+    decrypted.resize(size);
+    REQUIRE(decrypted == plaintext);
+  }
+
+  std::vector<std::uint8_t> other_iv(16, 2);
+  encryptor.reset(other_iv);
+  std::string ciphertext(64, '\0');
+  auto size = encryptor.update("hello", ciphertext);
+  size += encryptor.finalize(std::span<char>(ciphertext).subspan(size));
+  ciphertext.resize(size);
+  REQUIRE(ciphertext == klib::aes_256_cbc_encrypt("hello", key, other_iv));
+
+  auto other_key = klib::sha_256_raw("other key");
+  encryptor.reset(other_key, iv);
+  ciphertext.resize(64);
+  size = encryptor.update("hello", ciphertext);
+  size += encryptor.finalize(std::span<char>(ciphertext).subspan(size));
+  ciphertext.resize(size);
+  REQUIRE(ciphertext == klib::aes_256_cbc_encrypt("hello", other_key, iv));
+  REQUIRE(klib::aes_256_cbc_decrypt(ciphertext, other_key, iv) == "hello");
+  REQUIRE(klib::aes_256_cbc_encrypt("hello", key, iv) ==
+          klib::aes_256_cbc_encrypt("hello", key, iv));
+  REQUIRE_THROWS_AS(encryptor.reset(iv, iv), klib::RuntimeError);
+
+  // A cleared cipher needs the key again before the next message
+  encryptor.clear();
+  ciphertext.resize(64);
+  REQUIRE_THROWS_AS(encryptor.update("hello", ciphertext), klib::RuntimeError);
+  REQUIRE_THROWS_AS(encryptor.reset(iv), klib::RuntimeError);
+  encryptor.reset(key, iv);
+  size = encryptor.update("hello", ciphertext);
+  size += encryptor.finalize(std::span<char>(ciphertext).subspan(size));
+  ciphertext.resize(size);
+  REQUIRE(ciphertext == klib::aes_256_cbc_encrypt("hello", key, iv));
+
+  auto corrupted = expect;
+  corrupted.back() ^= 1;
+  REQUIRE_THROWS_AS(klib::aes_256_cbc_decrypt(corrupted, key, iv),
+                    klib::RuntimeError);
+  REQUIRE(klib::aes_256_cbc_decrypt(expect, key, iv) == plaintext);
+
+  REQUIRE_THROWS_AS(klib::Cipher(klib::CipherAlgorithm::Aes256Cbc,
+                                 klib::CipherOperation::Encrypt, iv, iv),
+                    klib::RuntimeError);
+  REQUIRE_THROWS_AS(klib::Cipher(klib::CipherAlgorithm::Aes256Cbc,
+                                 klib::CipherOperation::Encrypt, key, key),
+                    klib::RuntimeError);
+}
+
+TEST_CASE("aes_256_gcm", "[util]") {
+  // Test cases 13 and 14 of the GCM specification
+  std::vector<std::uint8_t> key(32, 0);
+  std::vector<std::uint8_t> iv(12, 0);
+
+  auto to_hex = [](const std::string &str) {
+    return klib::hex_encode(std::span<const std::uint8_t>(
+        reinterpret_cast<const std::uint8_t *>(std::data(str)),
+        std::size(str)));
+  };
+  REQUIRE(to_hex(klib::aes_256_gcm_encrypt("", key, iv)) ==
+          "530f8afbc74536b9a963b4f1c4cb738b");
+  REQUIRE(to_hex(klib::aes_256_gcm_encrypt(std::string(16, '\0'), key, iv)) ==
+          "cea7403d4d606b6e074ec5d3baf39d18d0d1c8a799996bf0265b98b5d48ab919");
+
+  auto ciphertext = klib::aes_256_gcm_encrypt("hello", key, iv, "header");
+  REQUIRE(std::size(ciphertext) == 5 + klib::Cipher::tag_size);
+  REQUIRE(klib::aes_256_gcm_decrypt(ciphertext, key, iv, "header") == "hello");
+  REQUIRE_THROWS_AS(klib::aes_256_gcm_decrypt(ciphertext, key, iv),
+                    klib::RuntimeError);
+  REQUIRE_THROWS_AS(klib::aes_256_gcm_decrypt("short", key, iv),
+                    klib::RuntimeError);
+  for (std::size_t i = 0; i < std::size(ciphertext); ++i) {
+    auto tampered = ciphertext;
+    tampered[i] ^= 0x80;
+    REQUIRE_THROWS_AS(klib::aes_256_gcm_decrypt(tampered, key, iv, "header"),
+                      klib::RuntimeError);
+  }
+}
+
+TEST_CASE("chacha20_poly1305", "[util]") {
+  // https://datatracker.ietf.org/doc/html/rfc8439#section-2.8.2
+  std::vector<std::uint8_t> key;
+  for (std::uint8_t i = 0x80; i <= 0x9f; ++i) {
+    key.push_back(i);
+  }
+  auto iv = klib::hex_decode("070000004041424344454647");
+  auto aad = klib::hex_decode("50515253c0c1c2c3c4c5c6c7");
+  const std::string plaintext =
+      "Ladies and Gentlemen of the class of '99: If I could offer you only one "
+      "tip for the future, sunscreen would be it.";
+
+  auto ciphertext = klib::chacha20_poly1305_encrypt(
+      plaintext, key, iv,
+      std::string_view(reinterpret_cast<const char *>(std::data(aad)),
+                       std::size(aad)));
+  REQUIRE(klib::hex_encode(std::span<const std::uint8_t>(
+              reinterpret_cast<const std::uint8_t *>(std::data(ciphertext)),
+              std::size(ciphertext))) ==
+          "d31a8d34648e60db7b86afbc53ef7ec2a4aded51296e08fea9e2b5a736ee62d63dbe"
+          "a45e8ca9671282fafb69da92728b1a71de0a9e060b2905d6a5b67ecd3b3692ddbd7f"
+          "2d778b8c9803aee328091b58fab324e4fad675945585808b4831d7bc3ff4def08e4b"
+          "7a9de576d26586cec64b6116"
+          "1ae10b594f09e26a7e902ecbd0600691");
+
+  REQUIRE(klib::chacha20_poly1305_decrypt(
+              ciphertext, key, iv,
+              std::string_view(reinterpret_cast<const char *>(std::data(aad)),
+                               std::size(aad))) == plaintext);
+  REQUIRE_THROWS_AS(klib::chacha20_poly1305_decrypt(ciphertext, key, iv),
+                    klib::RuntimeError);
+}
+
+TEST_CASE("AEAD Cipher", "[util]") {
+  auto key = klib::sha_256_raw("key");
+  std::vector<std::uint8_t> iv(12, 1);
+
+  std::string plaintext;
+  for (std::size_t i = 0; i < 10000; ++i) {
+    plaintext.push_back(static_cast<char>(i * 13));
+  }
+
+  for (auto algorithm : {klib::CipherAlgorithm::Aes256Gcm,
+                         klib::CipherAlgorithm::ChaCha20Poly1305}) {
+    auto expect = algorithm == klib::CipherAlgorithm::Aes256Gcm
+                      ? klib::aes_256_gcm_encrypt(plaintext, key, iv, "aad")
+                      : klib::chacha20_poly1305_encrypt(plaintext, key, iv,
+                                                        "aad");
+    REQUIRE(std::size(expect) == std::size(plaintext) + 16);
+
+    klib::Cipher decryptor(algorithm, klib::CipherOperation::Decrypt, key, iv);
+
+    // The tag may be split across the last chunks
+    for (std::size_t chunk : {1, 7, 16, 17, 4096, 10016}) {
+      klib::Cipher encryptor(algorithm, klib::CipherOperation::Encrypt, key,
+                             iv);
+      encryptor.update_aad("aad");
+      std::string ciphertext(std::size(plaintext) + 2 * 16, '\0');
+      std::size_t size = 0;
+      for (std::size_t i = 0; i < std::size(plaintext); i += chunk) {
+        size += encryptor.update(std::string_view(plaintext).substr(i, chunk),
+                                 std::span<char>(ciphertext).subspan(size));
+      }
+      size += encryptor.finalize(std::span<char>(ciphertext).subspan(size));
+      ciphertext.resize(size);
+      REQUIRE(ciphertext == expect);
+
+      decryptor.update_aad("aad");
+      std::string decrypted(std::size(ciphertext) + 16, '\0');
+      size = 0;
+      for (std::size_t i = 0; i < std::size(ciphertext); i += chunk) {
+        size += decryptor.update(std::string_view(ciphertext).substr(i, chunk),
+                                 std::span<char>(decrypted).subspan(size));
+      }
+      size += decryptor.finalize(std::span<char>(decrypted).subspan(size));
+      decrypted.resize(size);
+      REQUIRE(decrypted == plaintext);
+    }
+
+    // Encrypting a second message with the same iv is refused, whether it
+    // follows the last one or restarts a message that has begun
+    klib::Cipher encryptor(algorithm, klib::CipherOperation::Encrypt, key, iv);
+    std::string output(64, '\0');
+    REQUIRE_NOTHROW(encryptor.finalize(output));
+    REQUIRE_THROWS_AS(encryptor.update("hello", output), klib::RuntimeError);
+    REQUIRE_THROWS_AS(encryptor.reset(iv), klib::RuntimeError);
+
+    std::vector<std::uint8_t> other_iv(12, 2);
+    encryptor.reset(other_iv);
+    REQUIRE(encryptor.update("hello", output) == 5);
+    REQUIRE_THROWS_AS(encryptor.reset(other_iv), klib::RuntimeError);
+
+    auto tampered = expect;
+    tampered[100] ^= 1;
+    REQUIRE_NOTHROW(decryptor.update_aad("aad"));
+    std::string decrypted(std::size(tampered) + 16, '\0');
+    auto size = decryptor.update(tampered, decrypted);
+    REQUIRE_THROWS_AS(
+        decryptor.finalize(std::span<char>(decrypted).subspan(size)),
+        klib::RuntimeError);
+  }
+
+  klib::Cipher cbc(klib::CipherAlgorithm::Aes256Cbc,
+                   klib::CipherOperation::Encrypt, key,
+                   std::vector<std::uint8_t>(16, 0));
+  REQUIRE_THROWS_AS(cbc.update_aad("aad"), klib::RuntimeError);
+  REQUIRE_THROWS_AS(klib::aes_256_gcm_encrypt("hello", key,
+                                              std::vector<std::uint8_t>(16, 0)),
+                    klib::RuntimeError);
+}
+
+TEST_CASE("aes_256_cbc file", "[util]") {
+  auto key = klib::sha_256_raw("key");
+  std::vector<std::uint8_t> iv(16, 1);
+
+  std::string plaintext;
+  for (std::size_t i = 0; i < 3 * 1024 * 1024 + 5; ++i) {
+    plaintext.push_back(static_cast<char>(i * 7 + i / 1024));
+  }
+  klib::write_file("aes-plain.bin", true, plaintext);
+
+  klib::aes_256_cbc_encrypt_file("aes-plain.bin", "aes-cipher.bin", key, iv);
+  REQUIRE(klib::read_file("aes-cipher.bin", true) ==
+          klib::aes_256_cbc_encrypt(plaintext, key, iv));
+
+  klib::aes_256_cbc_decrypt_file("aes-cipher.bin", "aes-decrypted.bin", key,
+                                 iv);
+  REQUIRE(klib::read_file("aes-decrypted.bin", true) == plaintext);
+
+  // A wrong key fails on the padding, and no partial output is left behind
+  REQUIRE_THROWS_AS(
+      klib::aes_256_cbc_decrypt_file("aes-cipher.bin", "aes-wrong.bin",
+                                     klib::sha_256_raw("other"), iv),
+      klib::RuntimeError);
+  REQUIRE_FALSE(std::filesystem::exists("aes-wrong.bin"));
+
+  // The output is never the input
+  REQUIRE_THROWS_AS(
+      klib::aes_256_cbc_encrypt_file("aes-plain.bin", "./aes-plain.bin", key,
+                                     iv),
+      klib::RuntimeError);
+  REQUIRE(klib::read_file("aes-plain.bin", true) == plaintext);
+
+  klib::write_file("aes-empty.bin", true, std::string());
+  klib::aes_256_cbc_encrypt_file("aes-empty.bin", "aes-cipher.bin", key, iv);
+  REQUIRE(std::filesystem::file_size("aes-cipher.bin") == 16);
+  klib::aes_256_cbc_decrypt_file("aes-cipher.bin", "aes-decrypted.bin", key,
+                                 iv);
+  REQUIRE(std::filesystem::file_size("aes-decrypted.bin") == 0);
+
+  for (const auto &path : {"aes-plain.bin", "aes-cipher.bin",
+                           "aes-decrypted.bin", "aes-empty.bin"}) {
+    std::filesystem::remove(path);
+  }
+}
+
+TEST_CASE("encrypt_file_chunked", "[util]") {
+  auto key = klib::sha_256_raw("key");
+
+  std::string plaintext;
+  for (std::size_t i = 0; i < 1000000; ++i) {
+    plaintext.push_back(static_cast<char>(i * 7 + i / 1024));
+  }
+  klib::write_file("chunked-plain.bin", true, plaintext);
+
+  for (auto algorithm : {klib::CipherAlgorithm::Aes256Gcm,
+                         klib::CipherAlgorithm::ChaCha20Poly1305}) {
+    for (std::size_t threads : {1, 4}) {
+      klib::encrypt_file_chunked("chunked-plain.bin", "chunked-cipher.bin",
+                                 key, algorithm, 4096, threads);
+      REQUIRE(std::filesystem::file_size("chunked-cipher.bin") ==
+              36 + std::size(plaintext) + (1000000 / 4096 + 1) * 16);
+
+      klib::decrypt_file_chunked("chunked-cipher.bin", "chunked-decrypted.bin",
+                                 key, threads);
+      REQUIRE(klib::read_file("chunked-decrypted.bin", true) == plaintext);
+    }
+  }
+
+  // Any chunk can be decrypted on its own
+  REQUIRE(klib::decrypt_file_chunked_range("chunked-cipher.bin", key, 0, 10) ==
+          plaintext.substr(0, 10));
+  REQUIRE(klib::decrypt_file_chunked_range("chunked-cipher.bin", key, 4090,
+                                           10000) ==
+          plaintext.substr(4090, 10000));
+  REQUIRE(klib::decrypt_file_chunked_range("chunked-cipher.bin", key, 999990,
+                                           100) == plaintext.substr(999990));
+  REQUIRE(std::empty(klib::decrypt_file_chunked_range(
+      "chunked-cipher.bin", key, 1000000, 100)));
+
+  REQUIRE_THROWS_AS(
+      klib::decrypt_file_chunked("chunked-cipher.bin", "chunked-wrong.bin",
+                                 klib::sha_256_raw("other")),
+      klib::RuntimeError);
+  REQUIRE_FALSE(std::filesystem::exists("chunked-wrong.bin"));
+
+  // The output is never the input, even through another path
+  REQUIRE_THROWS_AS(
+      klib::encrypt_file_chunked("chunked-plain.bin", "./chunked-plain.bin",
+                                 key),
+      klib::RuntimeError);
+  REQUIRE(klib::read_file("chunked-plain.bin", true) == plaintext);
+  REQUIRE_THROWS_AS(
+      klib::decrypt_file_chunked("chunked-cipher.bin", "chunked-cipher.bin",
+                                 key),
+      klib::RuntimeError);
+  REQUIRE(klib::decrypt_file_chunked_range("chunked-cipher.bin", key, 0, 10) ==
+          plaintext.substr(0, 10));
+
+  // Tampering with the header, a chunk or the length is detected
+  auto ciphertext = klib::read_file("chunked-cipher.bin", true);
+  for (std::size_t offset :
+       {std::size_t{16}, std::size_t{40}, std::size_t{500000},
+        std::size(ciphertext) - 1}) {
+    auto tampered = ciphertext;
+    tampered[offset] ^= 1;
+    klib::write_file("chunked-tampered.bin", true, tampered);
+    REQUIRE_THROWS_AS(klib::decrypt_file_chunked("chunked-tampered.bin",
+                                                 "chunked-wrong.bin", key),
+                      klib::RuntimeError);
+  }
+  klib::write_file("chunked-tampered.bin", true,
+                   ciphertext.substr(0, std::size(ciphertext) - 4112));
+  REQUIRE_THROWS_AS(klib::decrypt_file_chunked("chunked-tampered.bin",
+                                               "chunked-wrong.bin", key),
+                    klib::RuntimeError);
+
+  // A plaintext size whose file size overflows is refused before any chunk
+  auto overflow = ciphertext;
+  std::fill_n(std::begin(overflow) + 16, 8, '\xFF');
+  klib::write_file("chunked-tampered.bin", true, overflow);
+  REQUIRE_THROWS_AS(klib::decrypt_file_chunked("chunked-tampered.bin",
+                                               "chunked-wrong.bin", key),
+                    klib::RuntimeError);
+  REQUIRE_THROWS_AS(klib::decrypt_file_chunked_range("chunked-tampered.bin",
+                                                     key, 0, 10),
+                    klib::RuntimeError);
+
+  klib::write_file("chunked-plain.bin", true, std::string());
+  klib::encrypt_file_chunked("chunked-plain.bin", "chunked-cipher.bin", key);
+  REQUIRE(std::filesystem::file_size("chunked-cipher.bin") == 36 + 16);
+  klib::decrypt_file_chunked("chunked-cipher.bin", "chunked-decrypted.bin",
+                             key);
+  REQUIRE(std::filesystem::file_size("chunked-decrypted.bin") == 0);
+
+  REQUIRE_THROWS_AS(
+      klib::encrypt_file_chunked("chunked-plain.bin", "chunked-cipher.bin", key,
+                                 klib::CipherAlgorithm::Aes256Cbc),
+      klib::RuntimeError);
+
+  for (const auto &path : {"chunked-plain.bin", "chunked-cipher.bin",
+                           "chunked-decrypted.bin", "chunked-tampered.bin"}) {
+    std::filesystem::remove(path);
+  }
+}
+
 TEST_CASE("folder_size", "[util]") {
   REQUIRE(std::filesystem::exists("folder1"));
   REQUIRE(klib::folder_size("folder1") == 38);